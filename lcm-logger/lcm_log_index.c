@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#ifdef WIN32
+#define __STDC_FORMAT_MACROS            // Enable integer types
+#endif
+#include <inttypes.h>
+
+#include <lcm/lcm.h>
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "usage: %s [options] FILE [FILE ...]\n"
+            "\n"
+            "Builds the index of each LCM log file FILE, and writes it to\n"
+            "FILE.idx.  An existing index is replaced.  lcm-logger writes the\n"
+            "index as it logs, so this is only needed for log files written\n"
+            "without one.\n"
+            "\n"
+            "Options:\n"
+            "  -q, --quiet    Only report errors.\n"
+            "  -h, --help     Shows this help text and exits\n"
+            "\n", progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    int quiet = 0;
+
+    char *optstring = "qh";
+    int c;
+    struct option long_opts[] = {
+        { "quiet", no_argument, 0, 'q' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    while ((c = getopt_long(argc, argv, optstring, long_opts, 0)) >= 0) {
+        switch (c) {
+            case 'q':
+                quiet = 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        int64_t count = lcm_eventlog_index_build(argv[i]);
+        if (count < 0) {
+            fprintf(stderr, "Unable to index %s\n", argv[i]);
+            status = 1;
+        } else if (!quiet) {
+            printf("%s: %"PRId64" events\n", argv[i], count);
+        }
+    }
+    return status;
+}
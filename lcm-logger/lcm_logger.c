@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // for sync_file_range
+#endif
+
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -22,6 +26,7 @@
 #include <lcm/windows/WinPorting.h>
 #else
 #include <unistd.h> /* fdatasync */
+#include <fcntl.h> /* sync_file_range */
 #endif
 
 #include <inttypes.h>
@@ -34,6 +39,17 @@
 
 #define DEFAULT_MAX_WRITE_QUEUE_SIZE_MB 100
 
+// The shard of a sharded log that the channels of no other shard go to
+#define DEFAULT_SHARD_NAME "default"
+
+// Most events written at once by the write thread
+#define WRITE_BATCH_SIZE 256
+
+// Most write latencies kept per status message, see publish_status()
+#define LATENCY_SAMPLES 1024
+
+#define STATUS_INTERVAL_MS 1000
+
 #define SECONDS_PER_HOUR 3600
 
 GMainLoop *_mainloop;
@@ -53,16 +69,80 @@ static inline int64_t timestamp_now(void)
 }
 
 typedef struct logger logger_t;
-struct logger
+
+// Writes the messages on some of the channels to a log file, on its own
+// thread.  There's a single writer for all channels unless the log is
+// sharded, and then one per shard.
+typedef struct writer writer_t;
+struct writer
 {
+    logger_t *logger;
+    char    *name;          // name of the shard, NULL if not sharded
+    GRegex  *regex;         // channels of the shard, NULL for the rest
+    char    *dir;           // where to put the shard, NULL for next to FILE
+
     lcm_eventlog_t *log;
+    char    fname[PATH_MAX];
+
+    GThread *write_thread;
+    GMutex * mutex;
+    GCond * write_cond;
+
+    // received messages waiting to be written.  See message_handler().
+    uint8_t *ring;
 
+    // these members controlled by mutex
+    uint64_t ring_head;             // bytes added to the ring so far
+    uint64_t ring_tail;             // bytes released by the write thread
+    int write_thread_waiting;
+    int write_thread_exit_flag;
+
+    // these members controlled by write thread
+    int64_t nevents;
+    int64_t logsize;
+    int64_t events_since_last_report;
+    int64_t last_report_time;
+    int64_t last_report_logsize;
+    int64_t last_fflush_time;
+    int64_t last_spew_utime;
+
+    // statistics for the status channel, controlled by mutex
+    int64_t stat_events;
+    int64_t stat_bytes;
+    int64_t stat_max_latency;
+    int stat_num_latencies;
+    int64_t stat_latencies[LATENCY_SAMPLES];    // a sample of the latencies
+
+    // Syncs the log file to disk in the background.  See request_sync().
+    GThread *sync_thread;
+    GMutex * sync_mutex;
+    GCond * sync_cond;
+
+    // these members controlled by sync_mutex
+    int sync_fd;
+    int sync_index_fd;
+    int sync_requested;
+    int sync_busy;
+    int sync_thread_exit_flag;
+    int64_t stat_syncs;
+    int64_t stat_max_sync_time;
+
+    // these members controlled by the LCM thread
+    int64_t dropped_packets_count;
+    int64_t last_drop_report_utime;
+    int64_t last_drop_report_count;
+    int64_t last_status_drop_count;
+    uint64_t peak_ring_used;
+};
+
+struct logger
+{
     char    input_fname[PATH_MAX];
     char    fname[PATH_MAX];
     char    fname_prefix[PATH_MAX];
     lcm_t    *lcm;
 
-    int64_t max_write_queue_size;
+    int64_t max_write_queue_size;     // size of each writer's ring
     int auto_increment;
     int next_increment_num;
     double auto_split_mb;
@@ -72,33 +152,42 @@ struct logger
     int rotate;
     int quiet;
     int append;
+    int write_index;
+    int compress;
+    int direct_io;
 
-    GThread *write_thread;
-    GAsyncQueue *write_queue;
-    GMutex * mutex;
+    // The shards, followed by the writer for all other channels.  Only the
+    // latter if the log isn't sharded.
+    writer_t *writers;
+    int num_writers;
+    int sharded;
+    GHashTable *channel_writers;    // cache of which channel goes where
 
     // variables for inverted matching (e.g., logging all but some channels)
     int invert_channels;
     GRegex * regex;
 
-    // these members controlled by mutex
-    int64_t write_queue_size;
-    int write_thread_exit_flag;
+    char *status_channel;
 
-    // these members controlled by write thread
-    int64_t nevents;
-    int64_t logsize;
-    int64_t events_since_last_report;
-    int64_t last_report_time;
-    int64_t last_report_logsize;
     int64_t time0;
-    int64_t last_fflush_time;
-
-    int64_t dropped_packets_count;
-    int64_t last_drop_report_utime;
-    int64_t last_drop_report_count;
 };
 
+// Renames a log file along with its index, if it has one.
+static int
+rename_logfile(const char* from, const char* to)
+{
+    gchar* from_index = g_strdup_printf("%s.idx", from);
+    gchar* to_index = g_strdup_printf("%s.idx", to);
+    if(g_file_test(from_index, G_FILE_TEST_EXISTS)) {
+        g_rename(from_index, to_index);
+    } else {
+        g_unlink(to_index);
+    }
+    g_free(from_index);
+    g_free(to_index);
+    return g_rename(from, to);
+}
+
 static void
 rotate_logfiles(logger_t* logger)
 {
@@ -114,13 +203,17 @@ rotate_logfiles(logger_t* logger)
         }
     }
     g_free(tomove);
+    tomove = g_strdup_printf("%s.%d.idx", logger->fname_prefix,
+            logger->rotate-1);
+    g_unlink(tomove);
+    g_free(tomove);
 
     // Rotate away any existing log files
     for(int file_num = logger->rotate-1; file_num>=0; file_num--) {
         gchar* newname = g_strdup_printf("%s.%d", logger->fname_prefix, file_num);
         tomove = g_strdup_printf("%s.%d", logger->fname_prefix, file_num-1);
         if(g_file_test(tomove, G_FILE_TEST_EXISTS)) {
-            if(0 != g_rename(tomove, newname)) {
+            if(0 != rename_logfile(tomove, newname)) {
                 fprintf(stderr, "ERROR!  Unable to rotate [%s]\n", tomove);
             }
         }
@@ -129,6 +222,140 @@ rotate_logfiles(logger_t* logger)
     }
 }
 
+// create directories if needed
+static void
+make_parent_dirs(const char* fname)
+{
+    char *dirpart = g_path_get_dirname (fname);
+    if (! g_file_test (dirpart, G_FILE_TEST_IS_DIR)) {
+        mkdir_with_parents (dirpart, 0755);
+    }
+    g_free (dirpart);
+}
+
+static int
+open_writer_log(writer_t* w)
+{
+    logger_t *logger = w->logger;
+
+    make_parent_dirs(w->fname);
+
+    if(!logger->quiet) {
+        printf("Opening log file \"%s\"\n", w->fname);
+    }
+
+    // open output file in append mode if we're rotating log files or appending
+    // use write mode if not.
+    const char* logmode = (logger->rotate > 0 || logger->append) ? "a" : "w";
+    if (logger->compress)
+        w->log = lcm_eventlog_create_compressed(w->fname, logmode);
+    else if (logger->write_index)
+        w->log = lcm_eventlog_create_with_index(w->fname, logmode);
+    else
+        w->log = lcm_eventlog_create(w->fname, logmode);
+    if (w->log == NULL) {
+        perror ("Error: fopen failed");
+        return 1;
+    }
+    if (logger->direct_io && 0 != lcm_eventlog_enable_direct_io(w->log)) {
+        fprintf(stderr, "Direct I/O isn't supported for %s, writing it through "
+                "the page cache\n", w->fname);
+    }
+    return 0;
+}
+
+// Returns whether FILE is already the manifest of the shards in entries, as
+// lcm_eventlog_write_manifest() writes it.
+static int
+is_same_manifest(const char *fname, gchar **entries)
+{
+    gchar *contents = NULL;
+    if(!g_file_get_contents(fname, &contents, NULL, NULL))
+        return 0;
+    GString *expected = g_string_new("LCM log manifest 1\n");
+    for(int i = 0; entries[i]; i++)
+        g_string_append_printf(expected, "%s\n", entries[i]);
+    int same = !strcmp(contents, expected->str);
+    g_string_free(expected, TRUE);
+    g_free(contents);
+    return same;
+}
+
+// Opens the shards of a sharded log, named after FILE, and writes the manifest
+// that lists them to FILE.
+static int
+open_shards(logger_t* logger)
+{
+    gchar *basename = g_path_get_basename(logger->fname);
+    gchar **entries = g_new0(gchar*, logger->num_writers + 1);
+    int status = 0;
+
+    for(int i = 0; i < logger->num_writers && status == 0; i++) {
+        writer_t *w = &logger->writers[i];
+        int len;
+        if(w->dir) {
+            // shards elsewhere are listed by absolute path
+            gchar *shard_name = g_strdup_printf("%s.%s", basename, w->name);
+            gchar *path = g_build_filename(w->dir, shard_name, NULL);
+            if(g_path_is_absolute(path)) {
+                entries[i] = g_strdup(path);
+            } else {
+                gchar *cwd = g_get_current_dir();
+                entries[i] = g_build_filename(cwd, path, NULL);
+                g_free(cwd);
+            }
+            len = snprintf(w->fname, sizeof(w->fname), "%s", path);
+            g_free(path);
+            g_free(shard_name);
+        } else {
+            len = snprintf(w->fname, sizeof(w->fname), "%s.%s", logger->fname,
+                    w->name);
+            entries[i] = g_strdup_printf("%s.%s", basename, w->name);
+        }
+
+        if(len < 0 || len >= (int) sizeof(w->fname)) {
+            fprintf (stderr, "Error: file name of shard \"%s\" is too long\n",
+                    w->name);
+            status = 1;
+        }
+    }
+
+    // Appending only adds to the shards.  FILE itself is replaced by the
+    // manifest, so it must already be that manifest.
+    if(status == 0 && logger->append &&
+            g_file_test(logger->fname, G_FILE_TEST_EXISTS) &&
+            !is_same_manifest(logger->fname, entries)) {
+        fprintf (stderr, "Refusing to append to \"%s\", which is not the "
+                "manifest of the same shards.\n"
+                "Use -f instead of -a to overwrite it.\n", logger->fname);
+        status = 1;
+    }
+
+    if(status == 0)
+        make_parent_dirs(logger->fname);
+
+    for(int i = 0; i < logger->num_writers && status == 0; i++) {
+        writer_t *w = &logger->writers[i];
+        if(!(logger->force_overwrite || logger->append) &&
+                g_file_test(w->fname, G_FILE_TEST_EXISTS)) {
+            fprintf (stderr, "Refusing to overwrite existing file \"%s\"\n",
+                    w->fname);
+            status = 1;
+        } else {
+            status = open_writer_log(w);
+        }
+    }
+
+    if(status == 0 && 0 != lcm_eventlog_write_manifest(logger->fname,
+                (const char **) entries, logger->num_writers)) {
+        perror ("Error: can't write manifest");
+        status = 1;
+    }
+    g_strfreev(entries);
+    g_free(basename);
+    return status;
+}
+
 static int
 open_logfile(logger_t* logger)
 {
@@ -170,124 +397,288 @@ open_logfile(logger_t* logger)
         }
     }
 
-    // create directories if needed
-    char *dirpart = g_path_get_dirname (logger->fname);
-    if (! g_file_test (dirpart, G_FILE_TEST_IS_DIR)) {
-        mkdir_with_parents (dirpart, 0755);
-    }
-    g_free (dirpart);
+    if(logger->sharded)
+        return open_shards(logger);
 
-    if(!logger->quiet) {
-        printf("Opening log file \"%s\"\n", logger->fname);
+    writer_t *w = &logger->writers[0];
+    strcpy(w->fname, logger->fname);
+    return open_writer_log(w);
+}
+
+// Received messages are queued for the write thread in a ring buffer of
+// max_write_queue_size bytes, which is allocated up front.  Each message is
+// copied into the ring once, as a ring_record_t followed by the channel,
+// NUL-terminated, and the payload, padded to RING_ALIGN bytes.  The write
+// thread writes them to the log from there.
+//
+// Records don't wrap around the end of the ring.  If a record doesn't fit
+// before the end, the rest of the ring is skipped, and marked with a record
+// with a negative channel length if there is room for one.
+typedef struct {
+    int64_t timestamp;
+    int32_t channellen;
+    int32_t datalen;
+} ring_record_t;
+
+#define RING_ALIGN 8
+
+static inline uint64_t
+ring_record_size(int32_t channellen, int32_t datalen)
+{
+    return (sizeof(ring_record_t) + channellen + 1 + datalen + RING_ALIGN - 1) &
+        ~(uint64_t) (RING_ALIGN - 1);
+}
+
+// Waits for the log file and its index to be synced whenever they are
+// flushed.  fdatasync() can take long, so it's done here rather than by the
+// write thread.
+static void*
+sync_thread(void *user_data)
+{
+    writer_t *w = (writer_t*) user_data;
+
+    g_mutex_lock(w->sync_mutex);
+    while(1) {
+        while(!w->sync_requested && !w->sync_thread_exit_flag)
+            g_cond_wait(w->sync_cond, w->sync_mutex);
+        if(!w->sync_requested)
+            break;
+        int fd = w->sync_fd;
+        int index_fd = w->sync_index_fd;
+        w->sync_requested = 0;
+        w->sync_busy = 1;
+        g_mutex_unlock(w->sync_mutex);
+
+        int64_t start = timestamp_now();
+#ifndef WIN32
+        fdatasync(fd);
+        // after the log, so that the index never points past its data
+        if(index_fd >= 0)
+            fdatasync(index_fd);
+#endif
+        int64_t elapsed = timestamp_now() - start;
+
+        g_mutex_lock(w->sync_mutex);
+        w->sync_busy = 0;
+        w->stat_syncs++;
+        if(elapsed > w->stat_max_sync_time)
+            w->stat_max_sync_time = elapsed;
+        g_cond_broadcast(w->sync_cond);
     }
+    g_mutex_unlock(w->sync_mutex);
+    return NULL;
+}
 
-    // open output file in append mode if we're rotating log files or appending
-    // use write mode if not.
-    const char* logmode = (logger->rotate > 0 || logger->append) ? "a" : "w";
-    logger->log = lcm_eventlog_create(logger->fname, logmode);
-    if (logger->log == NULL) {
-        perror ("Error: fopen failed");
-        return 1;
+// Starts writing the flushed log file back to disk, and has the sync thread
+// wait for it.  Requests made while the sync thread is busy are coalesced.
+static void
+request_sync(writer_t *w)
+{
+    int fd = fileno(w->log->f);
+#ifdef SYNC_FILE_RANGE_WRITE
+    // only initiates the writeback, so the next sync has less to wait for
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+    g_mutex_lock(w->sync_mutex);
+    w->sync_fd = fd;
+    w->sync_index_fd = lcm_eventlog_index_fileno(w->log);
+    w->sync_requested = 1;
+    g_cond_signal(w->sync_cond);
+    g_mutex_unlock(w->sync_mutex);
+}
+
+// Waits until the sync thread is done with the log file, before it's closed.
+static void
+wait_for_sync(writer_t *w)
+{
+    g_mutex_lock(w->sync_mutex);
+    w->sync_requested = 0;
+    while(w->sync_busy)
+        g_cond_wait(w->sync_cond, w->sync_mutex);
+    g_mutex_unlock(w->sync_mutex);
+}
+
+static void
+write_events(writer_t *w, lcm_eventlog_event_t **events, int num_events)
+{
+    int done = 0;
+    while(done < num_events) {
+        int written = lcm_eventlog_write_events(w->log, events + done,
+                num_events - done);
+        for(int i = done; i < done + written; i++) {
+            lcm_eventlog_event_t *le = events[i];
+            w->nevents++;
+            w->events_since_last_report ++;
+            w->logsize += 4 + 8 + 8 + 4 + le->channellen + 4 + le->datalen;
+        }
+        done += written;
+        if(done == num_events)
+            break;
+
+        // Skip the event that couldn't be written.  Whatever part of it made
+        // it into the file has been cut off again, so the next event follows
+        // the last complete one.
+        char *reason = strdup(strerror(errno));
+        int64_t now = timestamp_now();
+        if(now - w->last_spew_utime > 500000) {
+            fprintf(stderr, "lcm_eventlog_write_events: %s\n", reason);
+            w->last_spew_utime = now;
+        }
+        free(reason);
+        if(errno == ENOSPC)
+            exit(1);
+        done++;
     }
-    return 0;
 }
 
 static void*
 write_thread(void *user_data)
 {
-    logger_t *logger = (logger_t*) user_data;
+    writer_t *w = (writer_t*) user_data;
+    logger_t *logger = w->logger;
 
     GTimeVal start_time;
     g_get_current_time(&start_time);
     int num_splits = 0;
+    lcm_eventlog_event_t events[WRITE_BATCH_SIZE];
+    lcm_eventlog_event_t *batch[WRITE_BATCH_SIZE];
+    for(int i = 0; i < WRITE_BATCH_SIZE; i++)
+        batch[i] = &events[i];
+    uint64_t ring_size = logger->max_write_queue_size;
+    uint64_t tail = 0;
 
     while(1) {
-        void *msg = g_async_queue_pop(logger->write_queue);
+        // Wait for messages.  Exit once they have all been written.
+        g_mutex_lock(w->mutex);
+        while(w->ring_head == tail && !w->write_thread_exit_flag) {
+            w->write_thread_waiting = 1;
+            g_cond_wait(w->write_cond, w->mutex);
+            w->write_thread_waiting = 0;
+        }
+        uint64_t head = w->ring_head;
+        g_mutex_unlock(w->mutex);
+        if(head == tail)
+            return NULL;
+
+        // Write the messages from where they are in the ring.
+        int num_events = 0;
+        while(tail < head && num_events < WRITE_BATCH_SIZE) {
+            uint64_t offset = tail % ring_size;
+            ring_record_t *rec = (ring_record_t*) (w->ring + offset);
+            if(ring_size - offset < sizeof(ring_record_t) || rec->channellen < 0) {
+                tail += ring_size - offset;
+                continue;
+            }
+            lcm_eventlog_event_t *le = &events[num_events++];
+            le->timestamp = rec->timestamp;
+            le->channellen = rec->channellen;
+            le->datalen = rec->datalen;
+            le->channel = (char*) (rec + 1);
+            le->data = le->channel + rec->channellen + 1;
+            tail += ring_record_size(rec->channellen, rec->datalen);
+        }
 
         // Is it time to start a new logfile?
         int split_log = 0;
         if(logger->auto_split_mb) {
-          double logsize_mb = (double)logger->logsize / (1 << 20);
+          double logsize_mb = (double)w->logsize / (1 << 20);
           split_log = (logsize_mb > logger->auto_split_mb);
         }
-        if(_reset_logfile) {
+        // a sharded log is only opened once
+        if(_reset_logfile && !logger->sharded) {
             split_log = 1;
             _reset_logfile = 0;
         }
 
         if(split_log) {
             // Yes.  open up a new log file
-            lcm_eventlog_destroy(logger->log);
+            wait_for_sync(w);
+            lcm_eventlog_destroy(w->log);
             if(logger->rotate > 0)
                 rotate_logfiles(logger);
             if(0 != open_logfile(logger))
               exit(1);
             num_splits++;
-            logger->logsize = 0;
-            logger->last_report_logsize = 0;
+            w->logsize = 0;
+            w->last_report_logsize = 0;
         }
 
-        // Should the write thread exit?
-        g_mutex_lock(logger->mutex);
-        if(msg == &logger->write_thread_exit_flag) {
-            g_mutex_unlock(logger->mutex);
-            return NULL;
-        }
-        // nope.  write the event to disk
-        lcm_eventlog_event_t *le = (lcm_eventlog_event_t*) msg;
-        int64_t sz = sizeof(lcm_eventlog_event_t) + le->channellen + 1 + le->datalen;
-        logger->write_queue_size -= sz;
-        g_mutex_unlock(logger->mutex);
-
-        if(0 != lcm_eventlog_write_event(logger->log, le)) {
-            static int64_t last_spew_utime = 0;
-            char *reason = strdup(strerror(errno));
-            int64_t now = timestamp_now();
-            if(now - last_spew_utime > 500000) {
-                fprintf(stderr, "lcm_eventlog_write_event: %s\n", reason);
-                last_spew_utime = now;
+        // write the events to disk
+        int64_t nevents = w->nevents;
+        int64_t logsize = w->logsize;
+        int64_t write_start = timestamp_now();
+        write_events(w, batch, num_events);
+        int64_t write_latency = timestamp_now() - write_start;
+
+        if(num_events > 0) {
+            int64_t timestamp = batch[num_events - 1]->timestamp;
+            if (logger->fflush_interval_ms >= 0 &&
+                (timestamp - w->last_fflush_time) > logger->fflush_interval_ms*1000) {
+                lcm_eventlog_flush(w->log);
+                request_sync(w);
+                w->last_fflush_time = timestamp;
             }
-            free(reason);
-            free(le);
-            if(errno == ENOSPC) {
-                exit(1);
-            } else {
-                continue;
+
+            // bookkeeping
+            int64_t offset_utime = timestamp - logger->time0;
+            if (!logger->quiet && (offset_utime - w->last_report_time > 1000000)) {
+                double dt = (offset_utime - w->last_report_time)/1000000.0;
+
+                double tps =  w->events_since_last_report / dt;
+                double kbps = (w->logsize - w->last_report_logsize) / dt / 1024.0;
+                printf("Summary: %s ti:%4"PRIi64"sec Events: %-9"PRIi64" ( %4"PRIi64" MB )      TPS: %8.2f       KB/s: %8.2f\n",
+                        w->fname,
+                        timestamp_seconds(offset_utime),
+                        w->nevents, w->logsize/1048576,
+                        tps, kbps);
+                w->last_report_time = offset_utime;
+                w->events_since_last_report = 0;
+                w->last_report_logsize = w->logsize;
             }
         }
-        if (logger->fflush_interval_ms >= 0 &&
-            (le->timestamp - logger->last_fflush_time) > logger->fflush_interval_ms*1000) {
-            fflush(logger->log->f);
-            // Perform a full fsync operation after flush
-#ifndef WIN32
-            fdatasync(fileno(logger->log->f));
-#endif
-            logger->last_fflush_time = le->timestamp;
+
+        // make room for more messages
+        g_mutex_lock(w->mutex);
+        w->ring_tail = tail;
+        if(num_events > 0) {
+            w->stat_events += w->nevents - nevents;
+            w->stat_bytes += w->logsize - logsize;
+            if(write_latency > w->stat_max_latency)
+                w->stat_max_latency = write_latency;
+            // reservoir sampling, so that each latency is equally likely
+            // to be kept
+            int i = w->stat_num_latencies++;
+            if(i >= LATENCY_SAMPLES)
+                i = g_random_int_range(0, i + 1);
+            if(i < LATENCY_SAMPLES)
+                w->stat_latencies[i] = write_latency;
         }
+        g_mutex_unlock(w->mutex);
+    }
+}
 
-        // bookkeeping, cleanup
-        int64_t offset_utime = le->timestamp - logger->time0;
-        logger->nevents++;
-        logger->events_since_last_report ++;
-        logger->logsize += 4 + 8 + 8 + 4 + le->channellen + 4 + le->datalen;
-
-        free(le);
-
-        if (!logger->quiet && (offset_utime - logger->last_report_time > 1000000)) {
-            double dt = (offset_utime - logger->last_report_time)/1000000.0;
-
-            double tps =  logger->events_since_last_report / dt;
-            double kbps = (logger->logsize - logger->last_report_logsize) / dt / 1024.0;
-            printf("Summary: %s ti:%4"PRIi64"sec Events: %-9"PRIi64" ( %4"PRIi64" MB )      TPS: %8.2f       KB/s: %8.2f\n",
-                    logger->fname,
-                    timestamp_seconds(offset_utime),
-                    logger->nevents, logger->logsize/1048576,
-                    tps, kbps);
-            logger->last_report_time = offset_utime;
-            logger->events_since_last_report = 0;
-            logger->last_report_logsize = logger->logsize;
+// Returns the writer for the messages on a channel: the first shard whose
+// regex matches it, or the last writer.
+static writer_t *
+channel_writer(logger_t *logger, const char *channel)
+{
+    if(logger->num_writers == 1)
+        return &logger->writers[0];
+
+    writer_t *w = (writer_t*) g_hash_table_lookup(logger->channel_writers,
+            channel);
+    if(w)
+        return w;
+    w = &logger->writers[logger->num_writers - 1];
+    for(int i = 0; i < logger->num_writers - 1; i++) {
+        if(g_regex_match(logger->writers[i].regex, channel,
+                    (GRegexMatchFlags) 0, NULL)) {
+            w = &logger->writers[i];
+            break;
         }
     }
+    g_hash_table_insert(logger->channel_writers, g_strdup(channel), w);
+    return w;
 }
 
 static void
@@ -300,52 +691,140 @@ message_handler (const lcm_recv_buf_t *rbuf, const char *channel, void *u)
             return;
     }
 
+    writer_t *w = channel_writer(logger, channel);
     int channellen = strlen(channel);
+    uint64_t size = ring_record_size(channellen, rbuf->data_size);
+    uint64_t ring_size = logger->max_write_queue_size;
 
-    // check if the backlog of unwritten messages is too big.  If so, then
-    // ignore this event
-    int64_t mem_sz = sizeof(lcm_eventlog_event_t) + channellen + 1 + rbuf->data_size;
-    g_mutex_lock(logger->mutex);
-    int64_t mem_required = mem_sz + logger->write_queue_size;
+    // Find room for the message in the ring.  Only this thread adds to it, so
+    // the room stays available while the message is copied.
+    g_mutex_lock(w->mutex);
+    uint64_t head = w->ring_head;
+    uint64_t used = head - w->ring_tail;
+    g_mutex_unlock(w->mutex);
 
-    if(mem_required > logger->max_write_queue_size) {
+    uint64_t offset = head % ring_size;
+    uint64_t skip = offset + size > ring_size ? ring_size - offset : 0;
+
+    if(used + skip + size > ring_size) {
         // can't write to logfile fast enough.  drop packet.
-        g_mutex_unlock(logger->mutex);
 
         // maybe print an informational message to stdout
         int64_t now = timestamp_now();
-        logger->dropped_packets_count ++;
-        int rc = logger->dropped_packets_count - logger->last_drop_report_count;
-
-        if(now - logger->last_drop_report_utime > 1000000 && rc > 0) {
-            if(!logger->quiet)
+        w->dropped_packets_count ++;
+        int rc = w->dropped_packets_count - w->last_drop_report_count;
+
+        if(now - w->last_drop_report_utime > 1000000 && rc > 0) {
+            if(!logger->quiet && w->name)
+                printf("Can't write to log shard %s fast enough.  Dropped %d "
+                        "packet%s\n", w->name, rc, rc==1?"":"s");
+            else if(!logger->quiet)
                 printf("Can't write to log fast enough.  Dropped %d packet%s\n",
                         rc, rc==1?"":"s");
-            logger->last_drop_report_utime = now;
-            logger->last_drop_report_count = logger->dropped_packets_count;
+            w->last_drop_report_utime = now;
+            w->last_drop_report_count = w->dropped_packets_count;
         }
         return;
-    } else {
-        logger->write_queue_size = mem_required;
-        g_mutex_unlock(logger->mutex);
     }
 
+    if(used + skip + size > w->peak_ring_used)
+        w->peak_ring_used = used + skip + size;
+
+    if(skip >= sizeof(ring_record_t))
+        ((ring_record_t*) (w->ring + offset))->channellen = -1;
+    if(skip)
+        offset = 0;
+
+    // serialize the message into the ring.  log_write_event will handle the
+    // event number.
+    ring_record_t *rec = (ring_record_t*) (w->ring + offset);
+    rec->timestamp = rbuf->recv_utime;
+    rec->channellen = channellen;
+    rec->datalen = rbuf->data_size;
+    char *dst = (char*) (rec + 1);
+    memcpy(dst, channel, channellen + 1);
+    memcpy(dst + channellen + 1, rbuf->data, rbuf->data_size);
+
     // queue up the message for writing to disk by the write thread
-    lcm_eventlog_event_t *le = (lcm_eventlog_event_t*) malloc(mem_sz);
-    memset(le, 0, mem_sz);
+    g_mutex_lock(w->mutex);
+    w->ring_head = head + skip + size;
+    if(w->write_thread_waiting)
+        g_cond_signal(w->write_cond);
+    g_mutex_unlock(w->mutex);
+}
 
-    le->timestamp = rbuf->recv_utime;
-    le->channellen = channellen;
-    le->datalen = rbuf->data_size;
-    // log_write_event will handle le.eventnum.
+static int
+compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return x < y ? -1 : x > y;
+}
 
-    le->channel = ((char*)le) + sizeof(lcm_eventlog_event_t);
-    strcpy(le->channel, channel);
-    le->data = le->channel + channellen + 1;
-    assert((char*)le->data + rbuf->data_size == (char*)le + mem_sz);
-    memcpy(le->data, rbuf->data, rbuf->data_size);
+// Publishes the I/O statistics of each writer since the last status message,
+// as JSON.
+static gboolean
+publish_status(gpointer user_data)
+{
+    logger_t *logger = (logger_t*) user_data;
+    static int64_t latencies[LATENCY_SAMPLES];
+
+    GString *msg = g_string_new(NULL);
+    g_string_append_printf(msg, "{\"utime\":%"PRIi64",\"writers\":[",
+            timestamp_now());
+    for(int i = 0; i < logger->num_writers; i++) {
+        writer_t *w = &logger->writers[i];
+
+        g_mutex_lock(w->mutex);
+        uint64_t used = w->ring_head - w->ring_tail;
+        int64_t events = w->stat_events;
+        int64_t bytes = w->stat_bytes;
+        int64_t max_latency = w->stat_max_latency;
+        int num_latencies = MIN(w->stat_num_latencies, LATENCY_SAMPLES);
+        memcpy(latencies, w->stat_latencies, num_latencies * sizeof(int64_t));
+        w->stat_events = 0;
+        w->stat_bytes = 0;
+        w->stat_max_latency = 0;
+        w->stat_num_latencies = 0;
+        g_mutex_unlock(w->mutex);
+
+        g_mutex_lock(w->sync_mutex);
+        int64_t syncs = w->stat_syncs;
+        int64_t max_sync_time = w->stat_max_sync_time;
+        w->stat_syncs = 0;
+        w->stat_max_sync_time = 0;
+        g_mutex_unlock(w->sync_mutex);
+
+        int64_t dropped = w->dropped_packets_count - w->last_status_drop_count;
+        w->last_status_drop_count = w->dropped_packets_count;
+        uint64_t peak_used = MAX(w->peak_ring_used, used);
+        w->peak_ring_used = used;
+
+        qsort(latencies, num_latencies, sizeof(int64_t), compare_int64);
+        int64_t p50 = 0, p90 = 0, p99 = 0;
+        if(num_latencies > 0) {
+            p50 = latencies[(num_latencies - 1) * 50 / 100];
+            p90 = latencies[(num_latencies - 1) * 90 / 100];
+            p99 = latencies[(num_latencies - 1) * 99 / 100];
+        }
 
-    g_async_queue_push(logger->write_queue, le);
+        g_string_append_printf(msg, "%s{\"shard\":\"%s\",\"events\":%"PRIi64
+                ",\"bytes\":%"PRIi64",\"write_latency_us\":{\"p50\":%"PRIi64
+                ",\"p90\":%"PRIi64",\"p99\":%"PRIi64",\"max\":%"PRIi64"},"
+                "\"queue_bytes\":%"PRIu64",\"queue_peak_bytes\":%"PRIu64
+                ",\"queue_capacity\":%"PRIi64",\"dropped\":%"PRIi64
+                ",\"dropped_total\":%"PRIi64",\"syncs\":%"PRIi64
+                ",\"max_sync_us\":%"PRIi64"}",
+                i ? "," : "", w->name ? w->name : "",
+                events, bytes, p50, p90, p99, max_latency,
+                used, peak_used, logger->max_write_queue_size,
+                dropped, w->dropped_packets_count, syncs, max_sync_time);
+    }
+    g_string_append(msg, "]}");
+
+    lcm_publish(logger->lcm, logger->status_channel, msg->str, msg->len);
+    g_string_free(msg, TRUE);
+    return TRUE;
 }
 
 #ifdef USE_SIGHUP
@@ -355,6 +834,89 @@ static void sighup_handler (int signum)
 }
 #endif
 
+static writer_t *
+find_writer(logger_t *logger, const char *name)
+{
+    for(int i = 0; i < logger->num_writers; i++) {
+        writer_t *w = &logger->writers[i];
+        if(w->name && !strcmp(w->name, name))
+            return w;
+    }
+    return NULL;
+}
+
+// Sets up a writer for each --shard=NAME=REGEX, followed by one for all other
+// channels, and places them according to --shard-dir=NAME=DIR.
+static int
+create_writers(logger_t *logger, GPtrArray *shards, GPtrArray *shard_dirs)
+{
+    int num_shards = shards->len;
+    logger->sharded = num_shards > 0;
+    logger->num_writers = num_shards + 1;
+    logger->writers = (writer_t*) calloc(logger->num_writers, sizeof(writer_t));
+    for(int i = 0; i < logger->num_writers; i++)
+        logger->writers[i].logger = logger;
+    if(!logger->sharded) {
+        if(shard_dirs->len > 0) {
+            fprintf(stderr, "ERROR.  --shard-dir requires --shard\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    for(int i = 0; i < num_shards; i++) {
+        writer_t *w = &logger->writers[i];
+        const char *arg = (const char*) g_ptr_array_index(shards, i);
+        const char *regex = strchr(arg, '=');
+        // names are used in file names
+        if(!regex || regex == arg ||
+                strspn(arg, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                    "0123456789_-") != (size_t) (regex - arg)) {
+            fprintf(stderr, "ERROR.  Invalid shard \"%s\", expected "
+                    "NAME=REGEX\n", arg);
+            return 1;
+        }
+        w->name = g_strndup(arg, regex - arg);
+        if(!strcmp(w->name, DEFAULT_SHARD_NAME) ||
+                find_writer(logger, w->name) != w) {
+            fprintf(stderr, "ERROR.  Shard name \"%s\" is already used\n",
+                    w->name);
+            return 1;
+        }
+
+        char *regexbuf = g_strdup_printf("^%s$", regex + 1);
+        GError *rerr = NULL;
+        w->regex = g_regex_new(regexbuf, (GRegexCompileFlags) 0,
+                (GRegexMatchFlags) 0, &rerr);
+        g_free(regexbuf);
+        if(rerr) {
+            fprintf(stderr, "%s\n", rerr->message);
+            g_error_free(rerr);
+            return 1;
+        }
+    }
+    logger->writers[num_shards].name = g_strdup(DEFAULT_SHARD_NAME);
+
+    for(unsigned int i = 0; i < shard_dirs->len; i++) {
+        const char *arg = (const char*) g_ptr_array_index(shard_dirs, i);
+        const char *dir = strchr(arg, '=');
+        gchar *name = dir ? g_strndup(arg, dir - arg) : NULL;
+        writer_t *w = name ? find_writer(logger, name) : NULL;
+        g_free(name);
+        if(!w || !dir[1]) {
+            fprintf(stderr, "ERROR.  Invalid shard directory \"%s\", expected "
+                    "NAME=DIR for one of the shards\n", arg);
+            return 1;
+        }
+        g_free(w->dir);
+        w->dir = g_strdup(dir + 1);
+    }
+
+    logger->channel_writers = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, NULL);
+    return 0;
+}
+
 static void usage ()
 {
     fprintf (stderr, "usage: lcm-logger [options] [FILE]\n"
@@ -369,6 +931,7 @@ static void usage ()
             "  -c, --channel=CHAN         Channel string to pass to lcm_subscribe.\n"
             "                             (default: \".*\")\n"
             "      --flush-interval=MS    Flush the log file to disk every MS milliseconds.\n"
+            "                             Syncing it happens in the background.\n"
             "                             (default: 100)\n"
             "  -f, --force                Overwrite existing files\n"
             "  -h, --help                 Shows this help text and exits\n"
@@ -379,7 +942,9 @@ static void usage ()
             "  -l, --lcm-url=URL          Log messages on the specified LCM URL\n"
             "  -m, --max-unwritten-mb=SZ  Maximum size of received but unwritten\n"
             "                             messages to store in memory before dropping\n"
-            "                             messages.  (default: 100 MB)\n"
+            "                             messages.  The buffer is allocated at\n"
+            "                             startup, once for each shard.\n"
+            "                             (default: 100 MB)\n"
             "      --rotate=NUM           When creating a new log file, rename existing files\n"
             "                             out of the way and always write to FILE.0.  If\n"
             "                             FILE.0 already exists, it is renamed to FILE.1.  If\n"
@@ -395,6 +960,22 @@ static void usage ()
             "  -s, --strftime             Format FILE with strftime.\n"
             "  -v, --invert-channels      Invert channels.  Log everything that CHAN\n"
             "                             does not match.\n"
+            "      --no-index             Don't write an index (FILE.idx) next to the\n"
+            "                             log file.\n"
+            "      --direct-io            Write the log file with O_DIRECT, bypassing the\n"
+            "                             page cache.  Not supported with --compress.\n"
+            "  -z, --compress             Write a compressed log file.  Compressed log\n"
+            "                             files have a built-in block index instead of\n"
+            "                             FILE.idx, and --split-mb applies to their\n"
+            "                             uncompressed size.\n"
+            "      --shard=NAME=REGEX     Write the messages on channels matching REGEX\n"
+            "                             to a separate log file, FILE.NAME, on a thread\n"
+            "                             of its own.  See below.\n"
+            "      --shard-dir=NAME=DIR   Put the log file of shard NAME in DIR instead\n"
+            "                             of next to FILE.\n"
+            "      --status-channel=CHAN  Publish write latencies, buffer usage and\n"
+            "                             dropped messages on CHAN every second, as\n"
+            "                             JSON.\n"
             "\n"
             "Rotating / splitting log files\n"
             "==============================\n"
@@ -407,6 +988,21 @@ static void usage ()
             "\n"
             "    Moving to a new file happens either when the current log file size exceeds\n"
             "    the limit specified by --split-mb, or when lcm-logger receives a SIGHUP.\n"
+            "\n"
+            "Sharded logs\n"
+            "============\n"
+            "    With --shard, each shard is written by its own thread, from its own\n"
+            "    buffer of --max-unwritten-mb, so that a slow disk or a burst of large\n"
+            "    messages on some channels doesn't hold up the others.  A channel\n"
+            "    belongs to the first shard whose REGEX matches it, and all other\n"
+            "    channels are written to FILE."DEFAULT_SHARD_NAME".  FILE is a manifest that\n"
+            "    lists the shards, and that can be played back like any other log\n"
+            "    file.  For example:\n"
+            "\n"
+            "        # Write camera images to another disk\n"
+            "        lcm-logger --shard=cam=CAMERA.* --shard-dir=cam=/mnt/disk2 logfile\n"
+            "\n"
+            "    Sharded logs can't be rotated or split.\n"
             "\n");
 }
 
@@ -433,9 +1029,12 @@ int main(int argc, char *argv[])
     logger.rotate = -1;
     logger.quiet = 0;
     logger.append = 0;
+    logger.write_index = 1;
 
     char *lcmurl = NULL;
-    char *optstring = "fic:shm:vu:qa";
+    GPtrArray *shards = g_ptr_array_new();
+    GPtrArray *shard_dirs = g_ptr_array_new();
+    char *optstring = "fic:shm:vu:qaz";
     int c;
     struct option long_opts[] = {
         { "split-mb", required_argument, 0, 'b' },
@@ -450,6 +1049,12 @@ int main(int argc, char *argv[])
         { "append", no_argument, 0, 'a' },
         { "invert-channels", no_argument, 0, 'v' },
         { "flush-interval", required_argument, 0,'u'},
+        { "no-index", no_argument, 0, 'n' },
+        { "compress", no_argument, 0, 'z' },
+        { "direct-io", no_argument, 0, 'd' },
+        { "shard", required_argument, 0, 'S' },
+        { "shard-dir", required_argument, 0, 'D' },
+        { "status-channel", required_argument, 0, 'T' },
         { 0, 0, 0, 0 }
     };
 
@@ -513,6 +1118,25 @@ int main(int argc, char *argv[])
             case 'a':
               logger.append = 1;
               break;
+            case 'n':
+              logger.write_index = 0;
+              break;
+            case 'z':
+              logger.compress = 1;
+              break;
+            case 'd':
+              logger.direct_io = 1;
+              break;
+            case 'S':
+              g_ptr_array_add(shards, optarg);
+              break;
+            case 'D':
+              g_ptr_array_add(shard_dirs, optarg);
+              break;
+            case 'T':
+              free(logger.status_channel);
+              logger.status_channel = strdup(optarg);
+              break;
             case 'h':
             default:
                 usage();
@@ -543,19 +1167,46 @@ int main(int argc, char *argv[])
     if (logger.force_overwrite && logger.append) {
         fprintf(stderr, "ERROR.  --force_overwrite and --append can't both be used\n");
     }
+    if(shards->len > 0 && (logger.auto_split_mb > 0 || logger.rotate > 0)) {
+        fprintf(stderr, "ERROR.  --shard can't be used with --split-mb or --rotate\n");
+        return 1;
+    }
+    if(0 != create_writers(&logger, shards, shard_dirs))
+        return 1;
+    g_ptr_array_free(shards, TRUE);
+    g_ptr_array_free(shard_dirs, TRUE);
 
     logger.time0 = timestamp_now();
-    logger.max_write_queue_size = (int64_t)(max_write_queue_size_mb * (1 << 20));
+    logger.max_write_queue_size = (int64_t)(max_write_queue_size_mb * (1 << 20)) &
+        ~(int64_t) (RING_ALIGN - 1);
+    for(int i = 0; i < logger.num_writers; i++) {
+        writer_t *w = &logger.writers[i];
+        w->ring = (uint8_t*) malloc(logger.max_write_queue_size);
+        if(logger.max_write_queue_size <= 0 || !w->ring) {
+            fprintf(stderr, "Couldn't allocate %.1f MB for unwritten messages\n",
+                    max_write_queue_size_mb);
+            return 1;
+        }
+    }
 
     if(0 != open_logfile(&logger))
         return 1;
 
-    // create write thread
-    logger.write_thread_exit_flag = 0;
-    logger.mutex = g_mutex_new();
-    logger.write_queue_size = 0;
-    logger.write_queue = g_async_queue_new();
-    logger.write_thread = g_thread_create(write_thread, &logger, TRUE, NULL);
+    // create write threads
+    for(int i = 0; i < logger.num_writers; i++) {
+        writer_t *w = &logger.writers[i];
+        w->write_thread_exit_flag = 0;
+        w->mutex = g_mutex_new();
+        w->write_cond = g_cond_new();
+        w->ring_head = 0;
+        w->ring_tail = 0;
+        w->write_thread_waiting = 0;
+        w->write_thread = g_thread_create(write_thread, w, TRUE, NULL);
+
+        w->sync_mutex = g_mutex_new();
+        w->sync_cond = g_cond_new();
+        w->sync_thread = g_thread_create(sync_thread, w, TRUE, NULL);
+    }
 
     // begin logging
     logger.lcm = lcm_create (lcmurl);
@@ -588,6 +1239,8 @@ int main(int argc, char *argv[])
     _mainloop = g_main_loop_new (NULL, FALSE);
     signal_pipe_glib_quit_on_kill ();
     glib_mainloop_attach_lcm (logger.lcm);
+    if(logger.status_channel)
+        g_timeout_add(STATUS_INTERVAL_MS, publish_status, &logger);
 
 #ifdef USE_SIGHUP
     signal(SIGHUP, sighup_handler);
@@ -598,27 +1251,46 @@ int main(int argc, char *argv[])
 
     fprintf(stderr, "Logger exiting\n");
 
-    // stop the write thread
-    g_mutex_lock(logger.mutex);
-    logger.write_thread_exit_flag = 1;
-    g_mutex_unlock(logger.mutex);
-    g_async_queue_push(logger.write_queue, &logger.write_thread_exit_flag);
-    g_thread_join(logger.write_thread);
-    g_mutex_free(logger.mutex);
+    // stop the write threads
+    for(int i = 0; i < logger.num_writers; i++) {
+        writer_t *w = &logger.writers[i];
+        g_mutex_lock(w->mutex);
+        w->write_thread_exit_flag = 1;
+        g_cond_signal(w->write_cond);
+        g_mutex_unlock(w->mutex);
+    }
+    for(int i = 0; i < logger.num_writers; i++) {
+        writer_t *w = &logger.writers[i];
+        g_thread_join(w->write_thread);
+        g_cond_free(w->write_cond);
+        g_mutex_free(w->mutex);
+
+        g_mutex_lock(w->sync_mutex);
+        w->sync_thread_exit_flag = 1;
+        g_cond_signal(w->sync_cond);
+        g_mutex_unlock(w->sync_mutex);
+        g_thread_join(w->sync_thread);
+        g_cond_free(w->sync_cond);
+        g_mutex_free(w->sync_mutex);
+    }
 
     // cleanup.  This isn't strictly necessary, do it to be pedantic and so that
     // leak checkers don't complain
     glib_mainloop_detach_lcm (logger.lcm);
     lcm_destroy (logger.lcm);
-    lcm_eventlog_destroy (logger.log);
-
-    for(void *msg = g_async_queue_try_pop(logger.write_queue); msg;
-            msg=g_async_queue_try_pop(logger.write_queue)) {
-        if(msg == &logger.write_thread_exit_flag)
-            continue;
-        free(msg);
+    for(int i = 0; i < logger.num_writers; i++) {
+        writer_t *w = &logger.writers[i];
+        lcm_eventlog_destroy (w->log);
+        free(w->ring);
+        g_free(w->name);
+        g_free(w->dir);
+        if(w->regex)
+            g_regex_unref(w->regex);
     }
-    g_async_queue_unref(logger.write_queue);
+    free(logger.writers);
+    free(logger.status_channel);
+    if(logger.channel_writers)
+        g_hash_table_destroy(logger.channel_writers);
 
     if(logger.invert_channels) {
         g_regex_unref(logger.regex);
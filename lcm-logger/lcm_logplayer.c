@@ -3,6 +3,11 @@
 #include <getopt.h>
 
 #include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
 
 #include <lcm/lcm.h>
 
@@ -27,6 +32,18 @@ handler (const lcm_recv_buf_t *rbuf, const char *channel, void *u)
     lcm_publish (l->lcm_out, channel, rbuf->data, rbuf->data_size);
 }
 
+static double
+wall_time (void)
+{
+#ifdef WIN32
+    return GetTickCount64 () / 1000.0;
+#else
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
 static void
 usage (char * cmd)
 {
@@ -39,6 +56,8 @@ Options:\n\
   -s, --speed=NUM     Playback speed multiplier.  Default is 1.0.\n\
   -e, --regexp=EXPR   GLib regular expression of channels to play.\n\
   -l, --lcm-url=URL   Play logged messages on the specified LCM URL.\n\
+  -S, --stats         When done, print the number of events played and the\n\
+                      playback throughput to stderr.\n\
   -h, --help          Shows some help text and exits.\n\
   \n", cmd);
 }
@@ -50,18 +69,20 @@ main(int argc, char ** argv)
     double speed = 1.0;
     int c;
     char * expression = NULL;
+    int print_stats = 0;
     struct option long_opts[] = {
         { "help", no_argument, 0, 'h' },
         { "speed", required_argument, 0, 's' },
         { "lcm-url", required_argument, 0, 'l' },
         { "verbose", no_argument, 0, 'v' },
         { "regexp", required_argument, 0, 'e' },
+        { "stats", no_argument, 0, 'S' },
         { 0, 0, 0, 0 }
     };
 
     char *lcmurl = NULL;
     memset (&l, 0, sizeof (logplayer_t));
-    while ((c = getopt_long (argc, argv, "hp:s:ve:l:", long_opts, 0)) >= 0)
+    while ((c = getopt_long (argc, argv, "hp:s:ve:l:S", long_opts, 0)) >= 0)
     {
         switch (c) {
             case 's':
@@ -77,6 +98,9 @@ main(int argc, char ** argv)
             case 'e':
                 expression = strdup (optarg);
                 break;
+            case 'S':
+                print_stats = 1;
+                break;
             case 'h':
             default:
                 usage (argv[0]);
@@ -98,7 +122,8 @@ main(int argc, char ** argv)
 #else
     char url_in[2048];
 #endif
-    sprintf (url_in, "file://%s?speed=%f", argv[optind], speed);
+    sprintf (url_in, "file://%s?speed=%f&skip_unsubscribed=true",
+            argv[optind], speed);
     l.lcm_in = lcm_create (url_in);
     if (!l.lcm_in) {
         fprintf (stderr, "Error: Failed to open %s\n", file);
@@ -116,7 +141,20 @@ main(int argc, char ** argv)
 
     lcm_subscribe (l.lcm_in, expression, handler, &l);
 
-    while (!lcm_handle (l.lcm_in));
+    double start_time = wall_time ();
+    while (lcm_handle_batch (l.lcm_in, 256, -1) > 0);
+    double elapsed = wall_time () - start_time;
+
+    lcm_stats_t stats;
+    stats.size = sizeof (stats);
+    if (print_stats && 0 == lcm_get_stats (l.lcm_in, &stats) &&
+            elapsed > 0) {
+        double mb = stats.bytes_received / 1048576.0;
+        fprintf (stderr, "Played %llu events (%.1f MB) in %.2f s: "
+                "%.0f events/s, %.1f MB/s\n",
+                (unsigned long long) stats.packets_received,
+                mb, elapsed, stats.packets_received / elapsed, mb / elapsed);
+    }
 
     lcm_destroy (l.lcm_in);
     lcm_destroy (l.lcm_out);
@@ -15,6 +15,9 @@ sources = [ \
     os.path.join("..", "lcm", "lcm_memq.c"),
     os.path.join("..", "lcm", "lcm_mpudpm.c"),
     os.path.join("..", "lcm", "lcm_tcpq.c"),
+    os.path.join("..", "lcm", "lcmtypes", "channel_port_load_t.c"),
+    os.path.join("..", "lcm", "lcmtypes", "channel_port_loads_t.c"),
+    os.path.join("..", "lcm", "lcmtypes", "channel_port_map_delta_t.c"),
     os.path.join("..", "lcm", "lcmtypes", "channel_port_map_update_t.c"),
     os.path.join("..", "lcm", "lcmtypes", "channel_to_port_t.c"),
     os.path.join("..", "lcm", "lcm_udpm.c"),
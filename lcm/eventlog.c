@@ -1,8 +1,14 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // for O_DIRECT
+#endif
+
 #include <stdio.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <errno.h>
 #ifdef WIN32
 #define __STDC_FORMAT_MACROS			// Enable integer types
 #endif
@@ -13,13 +19,127 @@
 
 #ifdef WIN32
 #include "./windows/WinPorting.h"
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(O_DIRECT) && !defined(WIN32)
+#define HAVE_O_DIRECT
+#endif
+
+#include <glib.h>
+#ifdef LCM_HAVE_ZLIB
+#include <zlib.h>
 #endif
 
 #define MAGIC ((int32_t) 0xEDA1DA01L)
 
+// magic, event number, timestamp, channel length, data length
+#define EVENT_HEADER_SIZE 28
+
+static inline int32_t decode32(const uint8_t *p)
+{
+    return (int32_t) (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+                      ((uint32_t) p[2] << 8) | (uint32_t) p[3]);
+}
+
+static inline int64_t decode64(const uint8_t *p)
+{
+    return (int64_t) (((uint64_t) (uint32_t) decode32(p) << 32) |
+                      (uint64_t) (uint32_t) decode32(p + 4));
+}
+
+static inline void encode32(uint8_t *p, int32_t v)
+{
+    p[0] = (uint32_t) v >> 24;
+    p[1] = (uint32_t) v >> 16;
+    p[2] = (uint32_t) v >> 8;
+    p[3] = (uint32_t) v;
+}
+
+static inline void encode64(uint8_t *p, int64_t v)
+{
+    encode32(p, (int32_t) ((uint64_t) v >> 32));
+    encode32(p + 4, (int32_t) (v & 0xffffffff));
+}
+
+typedef struct _lcm_eventlog_index_writer_t index_writer_t;
+
+// Appends entries to an index as its log is written.  See the index format
+// below.
+struct _lcm_eventlog_index_writer_t
+{
+    FILE *f;
+    int64_t offset;             // log offset of the next event, or -1
+    int64_t count;
+    int32_t flags;
+    int64_t last_eventnum;
+    int64_t last_timestamp;
+};
+
+
+static index_writer_t *index_writer_create(const char *path, int64_t offset);
+static int index_writer_add(index_writer_t *w, int64_t offset,
+        int64_t eventnum, int64_t timestamp, const char *channel,
+        int32_t channellen);
+static int index_writer_destroy(index_writer_t *w);
+static int64_t index_end(const lcm_eventlog_index_t *idx);
+static void index_remove(const char *path);
+
+typedef struct _lcm_eventlog_blocks_t blocks_t;
+
+static int is_compressed(const char *path);
+static int blocks_open_read(lcm_eventlog_t *l);
+static int blocks_open_write(lcm_eventlog_t *l, int append);
+static void blocks_close(lcm_eventlog_t *l);
+static lcm_eventlog_event_t *blocks_read_next_event(lcm_eventlog_t *l,
+        lcm_eventlog_filter_t filter, void *user);
+static int blocks_write_event(lcm_eventlog_t *l, lcm_eventlog_event_t *le);
+static int blocks_flush(lcm_eventlog_t *l);
+static int blocks_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp);
+static int blocks_seek_to_eventnum(lcm_eventlog_t *l, int64_t eventnum);
+static int blocks_seek_to_channel(lcm_eventlog_t *l, const char *channel);
+
+typedef struct _lcm_eventlog_direct_t direct_t;
+
+static int direct_append(lcm_eventlog_t *l, const void *data, size_t len);
+static int64_t direct_offset(const lcm_eventlog_t *l);
+static void direct_discard(lcm_eventlog_t *l, int64_t offset);
+static int direct_flush(lcm_eventlog_t *l);
+static void direct_close(lcm_eventlog_t *l);
+
+typedef struct _lcm_eventlog_shards_t shards_t;
+
+static int is_manifest(const char *path);
+static int shards_open(lcm_eventlog_t *l, const char *path);
+static void shards_close(lcm_eventlog_t *l);
+static lcm_eventlog_event_t *shards_read_next_event(lcm_eventlog_t *l,
+        lcm_eventlog_filter_t filter, void *user);
+static int shards_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp);
+static int shards_seek_to_channel(lcm_eventlog_t *l, const char *channel);
+
+// Limits of a single writev() by lcm_eventlog_write_events().  The number of
+// buffers stays within the IOV_MAX of 1024 on Linux and macOS.
+#define WRITEV_EVENTS 1024
+#define WRITEV_IOVECS 512
+#define WRITEV_BUFFER_SIZE (256 << 10)
+// larger payloads are written in place rather than copied
+#define WRITEV_COPY_MAX 2048
+
 lcm_eventlog_t *lcm_eventlog_create(const char *path, const char *mode)
 {
     assert(!strcmp(mode, "r") || !strcmp(mode, "w") || !strcmp(mode, "a"));
+    if (*mode == 'a' && is_compressed(path))
+        return lcm_eventlog_create_compressed(path, mode);
+    // events can't be appended to a sharded log file
+    if (*mode == 'a' && is_manifest(path))
+        return NULL;
+
     if(*mode == 'w')
         mode = "wb";
     else if(*mode == 'r')
@@ -39,18 +159,99 @@ lcm_eventlog_t *lcm_eventlog_create(const char *path, const char *mode)
 
     l->eventcount = 0;
 
+    if (*mode == 'r' && is_compressed(path)) {
+        if (0 != blocks_open_read(l)) {
+            lcm_eventlog_destroy(l);
+            return NULL;
+        }
+        return l;
+    }
+    if (*mode == 'r' && is_manifest(path)) {
+        if (0 != shards_open(l, path)) {
+            lcm_eventlog_destroy(l);
+            return NULL;
+        }
+        return l;
+    }
+
+    // Use the index if there is one.  When overwriting a log file, remove its
+    // index, which no longer matches it.
+    if (*mode == 'r')
+        l->index = lcm_eventlog_index_open(path);
+    else if (*mode == 'w')
+        index_remove(path);
+
+    return l;
+}
+
+lcm_eventlog_t *lcm_eventlog_create_with_index(const char *path,
+        const char *mode)
+{
+    lcm_eventlog_t *l = lcm_eventlog_create(path, mode);
+    if (!l || *mode == 'r' || l->blocks)
+        return l;
+
+    fseeko(l->f, 0, SEEK_END);
+    l->index_writer = index_writer_create(path, ftello(l->f));
+    if (!l->index_writer) {
+        lcm_eventlog_destroy(l);
+        return NULL;
+    }
+    return l;
+}
+
+lcm_eventlog_t *lcm_eventlog_create_compressed(const char *path,
+        const char *mode)
+{
+    assert(!strcmp(mode, "w") || !strcmp(mode, "a"));
+
+    lcm_eventlog_t *l = (lcm_eventlog_t*) calloc(1, sizeof(lcm_eventlog_t));
+
+    // Appending reads the block index, and then overwrites it.
+    if (*mode == 'a') {
+        l->f = fopen(path, "r+b");
+        if (l->f == NULL && errno == ENOENT)
+            l->f = fopen(path, "wb");
+    } else {
+        l->f = fopen(path, "wb");
+        index_remove(path);
+    }
+    if (l->f == NULL) {
+        free(l);
+        return NULL;
+    }
+
+    if (0 != blocks_open_write(l, *mode == 'a')) {
+        lcm_eventlog_destroy(l);
+        return NULL;
+    }
     return l;
 }
 
 void lcm_eventlog_destroy(lcm_eventlog_t *l)
 {
+    if (l->blocks)
+        blocks_close(l);
+    if (l->direct)
+        direct_close(l);
+    if (l->shards)
+        shards_close(l);
     fflush(l->f);
     fclose(l->f);
+    if (l->index)
+        lcm_eventlog_index_close(l->index);
+    if (l->index_writer)
+        index_writer_destroy(l->index_writer);
     free(l);
 }
 
 lcm_eventlog_event_t *lcm_eventlog_read_next_event(lcm_eventlog_t *l)
 {
+    if (l->blocks)
+        return blocks_read_next_event(l, NULL, NULL);
+    if (l->shards)
+        return shards_read_next_event(l, NULL, NULL);
+
     lcm_eventlog_event_t *le =
         (lcm_eventlog_event_t*) calloc(1, sizeof(lcm_eventlog_event_t));
 
@@ -117,27 +318,243 @@ lcm_eventlog_event_t *lcm_eventlog_read_next_event(lcm_eventlog_t *l)
     return le;
 }
 
-int lcm_eventlog_write_event(lcm_eventlog_t *l, lcm_eventlog_event_t *le)
+static void encode_event_header(uint8_t *hdr, const lcm_eventlog_event_t *le)
 {
-    if (0 != fwrite32(l->f, MAGIC)) return -1;
+    encode32(hdr, MAGIC);
+    encode64(hdr + 4, le->eventnum);
+    encode64(hdr + 12, le->timestamp);
+    encode32(hdr + 20, le->channellen);
+    encode32(hdr + 24, le->datalen);
+}
 
-    le->eventnum = l->eventcount;
+static int write_event(lcm_eventlog_t *l, lcm_eventlog_event_t *le)
+{
+    uint8_t hdr[EVENT_HEADER_SIZE];
 
-    if (0 != fwrite64(l->f, le->eventnum)) return -1;
-    if (0 != fwrite64(l->f, le->timestamp)) return -1;
-    if (0 != fwrite32(l->f, le->channellen)) return -1;
-    if (0 != fwrite32(l->f, le->datalen)) return -1;
+    le->eventnum = l->eventcount;
+    encode_event_header(hdr, le);
 
-    if (le->channellen != fwrite(le->channel, 1, le->channellen, l->f)) 
-        return -1;
-    if (le->datalen != fwrite(le->data, 1, le->datalen, l->f))
-        return -1;
+    if (l->direct) {
+        int64_t offset = direct_offset(l);
+        if (0 != direct_append(l, hdr, EVENT_HEADER_SIZE) ||
+                0 != direct_append(l, le->channel, le->channellen) ||
+                0 != direct_append(l, le->data, le->datalen)) {
+            direct_discard(l, offset);
+            return -1;
+        }
+    } else {
+        if (fwrite(hdr, EVENT_HEADER_SIZE, 1, l->f) != 1)
+            return -1;
+        if (le->channellen != fwrite(le->channel, 1, le->channellen, l->f))
+            return -1;
+        if (le->datalen != fwrite(le->data, 1, le->datalen, l->f))
+            return -1;
+    }
 
     l->eventcount++;
 
     return 0;
 }
 
+// Returns the offset at which the next event will be written.
+static int64_t write_offset(lcm_eventlog_t *l)
+{
+    if (l->direct)
+        return direct_offset(l);
+    return ftello(l->f);
+}
+
+// Adds an event that was just written to the index.
+static void index_add_event(lcm_eventlog_t *l, const lcm_eventlog_event_t *le)
+{
+    index_writer_t *w = l->index_writer;
+    if (w->offset >= 0 && 0 == index_writer_add(w, w->offset, le->eventnum,
+                le->timestamp, le->channel, le->channellen)) {
+        w->offset += EVENT_HEADER_SIZE + le->channellen + le->datalen;
+        return;
+    }
+
+    // The event made it into the log, so don't fail.  The index written so
+    // far is still valid for the part of the log that it covers.
+    fprintf(stderr, "Error writing log index, no longer indexing: %s\n",
+            strerror(errno));
+    index_writer_destroy(w);
+    l->index_writer = NULL;
+}
+
+int lcm_eventlog_write_event(lcm_eventlog_t *l, lcm_eventlog_event_t *le)
+{
+    if (l->blocks)
+        return blocks_write_event(l, le);
+
+    index_writer_t *w = l->index_writer;
+    if (!w)
+        return write_event(l, le);
+
+    // The offset of the next event is tracked, rather than asking the stream
+    // for it each time, except after a failed write.
+    if (w->offset < 0)
+        w->offset = write_offset(l);
+    if (0 != write_event(l, le)) {
+        w->offset = -1;
+        return -1;
+    }
+    index_add_event(l, le);
+    return 0;
+}
+
+#ifndef WIN32
+// Writes events with as few system calls as possible, directly to the file
+// descriptor.  Headers, channels and small payloads are serialized into a
+// buffer, and large payloads are written from where they are.  Returns the
+// number of events written.
+static int writev_events(lcm_eventlog_t *l, lcm_eventlog_event_t **events,
+        int num_events)
+{
+    struct iovec iov[WRITEV_IOVECS];
+    size_t ends[WRITEV_EVENTS];     // where each event ends in the output
+    int fd = fileno(l->f);
+    int written = 0;
+
+    // anything written through the stream has to go first
+    if (0 != fflush(l->f))
+        return 0;
+
+    uint8_t *buf = (uint8_t *) malloc(WRITEV_BUFFER_SIZE);
+    while (written < num_events) {
+        int n = 0;
+        int niov = 0;
+        size_t used = 0;
+        size_t total = 0;
+        while (written + n < num_events && n < WRITEV_EVENTS &&
+                niov + 2 <= WRITEV_IOVECS) {
+            lcm_eventlog_event_t *le = events[written + n];
+            int in_place = le->datalen > WRITEV_COPY_MAX;
+            size_t copied = EVENT_HEADER_SIZE + le->channellen +
+                (in_place ? 0 : le->datalen);
+            if (used + copied > WRITEV_BUFFER_SIZE)
+                break;
+
+            uint8_t *p = buf + used;
+            le->eventnum = l->eventcount + n;
+            encode_event_header(p, le);
+            memcpy(p + EVENT_HEADER_SIZE, le->channel, le->channellen);
+            if (!in_place)
+                memcpy(p + EVENT_HEADER_SIZE + le->channellen, le->data,
+                        le->datalen);
+            if (niov > 0 && (uint8_t *) iov[niov - 1].iov_base +
+                    iov[niov - 1].iov_len == p) {
+                iov[niov - 1].iov_len += copied;
+            } else {
+                iov[niov].iov_base = p;
+                iov[niov++].iov_len = copied;
+            }
+            used += copied;
+            if (in_place) {
+                iov[niov].iov_base = le->data;
+                iov[niov++].iov_len = le->datalen;
+            }
+            total += EVENT_HEADER_SIZE + le->channellen + le->datalen;
+            ends[n++] = total;
+        }
+
+        // Write everything, and count the events that were completely
+        // written if that fails part way.
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        struct iovec *v = iov;
+        size_t done_bytes = 0;
+        while (niov > 0) {
+            ssize_t status = writev(fd, v, niov);
+            if (status < 0 && errno == EINTR)
+                continue;
+            if (status <= 0)
+                break;
+            done_bytes += status;
+            while (niov > 0 && (size_t) status >= v->iov_len) {
+                status -= v->iov_len;
+                v++;
+                niov--;
+            }
+            if (niov > 0) {
+                v->iov_base = (char *) v->iov_base + status;
+                v->iov_len -= status;
+            }
+        }
+
+        int done = 0;
+        while (done < n && ends[done] <= done_bytes)
+            done++;
+        l->eventcount += done;
+        written += done;
+        if (done < n) {
+            // Cut off a partially written event, so that whatever is
+            // written next does not follow a torn record.
+            size_t keep = done ? ends[done - 1] : 0;
+            if (done_bytes > keep && start >= 0) {
+                int saved_errno = errno;
+                if (0 == ftruncate(fd, start + keep))
+                    lseek(fd, start + keep, SEEK_SET);
+                errno = saved_errno;
+            }
+            break;
+        }
+    }
+    free(buf);
+
+    // Let the stream know where the descriptor is now.
+    int saved_errno = errno;
+    fseeko(l->f, lseek(fd, 0, SEEK_CUR), SEEK_SET);
+    errno = saved_errno;
+    return written;
+}
+#endif
+
+int lcm_eventlog_write_events(lcm_eventlog_t *l,
+        lcm_eventlog_event_t **events, int num_events)
+{
+    int written = 0;
+
+#ifndef WIN32
+    if (!l->blocks && !l->direct) {
+        index_writer_t *w = l->index_writer;
+        if (w && w->offset < 0)
+            w->offset = write_offset(l);
+        written = writev_events(l, events, num_events);
+        for (int i = 0; i < written && l->index_writer; i++)
+            index_add_event(l, events[i]);
+        if (written < num_events && l->index_writer)
+            l->index_writer->offset = -1;
+        return written;
+    }
+#endif
+
+    // Compressed logs and direct I/O copy each event into a buffer anyway.
+    while (written < num_events &&
+            0 == lcm_eventlog_write_event(l, events[written]))
+        written++;
+    return written;
+}
+
+int lcm_eventlog_flush(lcm_eventlog_t *l)
+{
+    int status;
+    if (l->blocks)
+        status = blocks_flush(l);
+    else if (l->direct)
+        status = direct_flush(l);
+    else
+        status = fflush(l->f) == 0 ? 0 : -1;
+    // after the log data, so that the index never points past it
+    if (status == 0 && l->index_writer && fflush(l->index_writer->f) != 0)
+        status = -1;
+    return status;
+}
+
+int lcm_eventlog_index_fileno(lcm_eventlog_t *l)
+{
+    return l->index_writer ? fileno(l->index_writer->f) : -1;
+}
+
 void lcm_eventlog_free_event(lcm_eventlog_event_t *le)
 {
     if (le->data) free(le->data);
@@ -176,6 +593,18 @@ eof:
 
 int lcm_eventlog_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp)
 {
+    if (l->blocks)
+        return blocks_seek_to_timestamp(l, timestamp);
+    if (l->shards)
+        return shards_seek_to_timestamp(l, timestamp);
+
+    if (l->index) {
+        int64_t offset = lcm_eventlog_index_find_timestamp(l->index,
+                timestamp);
+        if (offset >= 0)
+            return fseeko(l->f, offset, SEEK_SET);
+    }
+
     fseeko (l->f, 0, SEEK_END);
     off_t file_len = ftello(l->f);
 
@@ -215,3 +644,2107 @@ int lcm_eventlog_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp)
 
     return 0;
 }
+
+
+// Reads the header of the next event at or after the current position into
+// le, leaving the file positioned at the event's channel.  Returns the offset
+// of the event, or -1 if there is none.
+static int64_t read_event_header(FILE *f, lcm_eventlog_event_t *le)
+{
+    int64_t offset = ftello(f);
+    uint32_t magic = 0;
+    int r;
+
+    if (offset < 0)
+        return -1;
+    do {
+        r = fgetc(f);
+        if (r < 0)
+            return -1;
+        magic = (magic << 8) | (uint32_t) r;
+        offset++;
+    } while( magic != MAGIC );
+    offset -= 4;
+
+    if (0 != fread64(f, &le->eventnum) ||
+        0 != fread64(f, &le->timestamp) ||
+        0 != fread32(f, &le->channellen) ||
+        0 != fread32(f, &le->datalen))
+        return -1;
+    if (le->channellen <= 0 || le->channellen >= 1000 || le->datalen < 0)
+        return -1;
+    return offset;
+}
+
+int lcm_eventlog_seek_to_eventnum(lcm_eventlog_t *l, int64_t eventnum)
+{
+    if (l->blocks)
+        return blocks_seek_to_eventnum(l, eventnum);
+    // event numbers are only unique within each shard
+    if (l->shards)
+        return -1;
+
+    int64_t pos = ftello(l->f);
+    int64_t start = 0;
+    if (l->index) {
+        int64_t offset = lcm_eventlog_index_find_eventnum(l->index, eventnum);
+        if (offset >= 0)
+            return fseeko(l->f, offset, SEEK_SET);
+        // only the part of the log that isn't indexed is left to search
+        start = index_end(l->index);
+    }
+
+    lcm_eventlog_event_t le;
+    int64_t offset;
+    fseeko(l->f, start, SEEK_SET);
+    while ((offset = read_event_header(l->f, &le)) >= 0) {
+        if (le.eventnum == eventnum)
+            return fseeko(l->f, offset, SEEK_SET);
+        fseeko(l->f, le.channellen + le.datalen, SEEK_CUR);
+    }
+    fseeko(l->f, pos, SEEK_SET);
+    return -1;
+}
+
+// Returns whether the event at offset is on the given channel.  The index
+// only records a hash of the channel name, which two channels may share.
+static int event_on_channel(FILE *f, int64_t offset, const char *channel,
+        int32_t channellen)
+{
+    char buf[1000];
+    lcm_eventlog_event_t le;
+    return 0 == fseeko(f, offset, SEEK_SET) &&
+        read_event_header(f, &le) == offset &&
+        le.channellen == channellen &&
+        fread(buf, 1, channellen, f) == (size_t) channellen &&
+        !memcmp(buf, channel, channellen);
+}
+
+int lcm_eventlog_seek_to_channel(lcm_eventlog_t *l, const char *channel)
+{
+    if (l->blocks)
+        return blocks_seek_to_channel(l, channel);
+    if (l->shards)
+        return shards_seek_to_channel(l, channel);
+
+    int64_t pos = ftello(l->f);
+    int64_t start = pos;
+    if (start < 0)
+        return -1;
+
+    int32_t channellen = strlen(channel);
+    if (l->index) {
+        int64_t count;
+        const int64_t *offsets = lcm_eventlog_index_channel_offsets(l->index,
+                channel, &count);
+        int64_t lo = 0, hi = count;
+        while (lo < hi) {
+            int64_t mid = lo + (hi - lo) / 2;
+            if (offsets[mid] < start)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < count; lo++) {
+            if (event_on_channel(l->f, offsets[lo], channel, channellen))
+                return fseeko(l->f, offsets[lo], SEEK_SET);
+        }
+        // only the part of the log that isn't indexed is left to search
+        if (start < index_end(l->index))
+            start = index_end(l->index);
+    }
+
+    char buf[1000];
+    lcm_eventlog_event_t le;
+    int64_t offset;
+    fseeko(l->f, start, SEEK_SET);
+    while ((offset = read_event_header(l->f, &le)) >= 0) {
+        if (le.channellen == channellen) {
+            if (fread(buf, 1, channellen, l->f) != (size_t) channellen)
+                break;
+            if (!memcmp(buf, channel, channellen))
+                return fseeko(l->f, offset, SEEK_SET);
+            fseeko(l->f, le.datalen, SEEK_CUR);
+        } else {
+            fseeko(l->f, le.channellen + le.datalen, SEEK_CUR);
+        }
+    }
+    fseeko(l->f, pos, SEEK_SET);
+    return -1;
+}
+
+
+/*** Memory mapped reader ***/
+
+struct _lcm_eventlog_reader_t
+{
+    const uint8_t *base;
+    size_t size;
+    size_t pos;             // offset of the next event
+    lcm_eventlog_index_t *index;
+    int sequential;         // whether the kernel is told to read ahead
+};
+
+// Finds the next magic number at or after offset.  Returns its offset, or -1
+// if there is none.
+static int64_t find_magic(const lcm_eventlog_reader_t *r, size_t offset)
+{
+    const uint8_t first = ((uint32_t) MAGIC) >> 24;
+    while (offset + 4 <= r->size) {
+        const uint8_t *p = (const uint8_t *) memchr(r->base + offset, first,
+                r->size - offset - 3);
+        if (!p)
+            return -1;
+        offset = p - r->base;
+        if (decode32(p) == MAGIC)
+            return offset;
+        offset++;
+    }
+    return -1;
+}
+
+lcm_eventlog_reader_t *lcm_eventlog_reader_create(const char *path)
+{
+#ifdef WIN32
+    return NULL;
+#else
+    // events in compressed or sharded log files can't be read in place
+    if (is_compressed(path) || is_manifest(path))
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0 ||
+            (uint64_t) st.st_size > (size_t) -1) {
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping is private and writable, so that subscribers can modify the
+    // payloads they are handed, as they can with any other provider.  Pages
+    // are only copied if they do.
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+#ifdef MADV_SEQUENTIAL
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    lcm_eventlog_reader_t *r =
+        (lcm_eventlog_reader_t *) calloc(1, sizeof(lcm_eventlog_reader_t));
+    r->base = (const uint8_t *) base;
+    r->size = st.st_size;
+    r->pos = 0;
+    r->index = lcm_eventlog_index_open(path);
+    r->sequential = 1;
+    return r;
+#endif
+}
+
+void lcm_eventlog_reader_destroy(lcm_eventlog_reader_t *r)
+{
+#ifndef WIN32
+    munmap((void *) r->base, r->size);
+#endif
+    if (r->index)
+        lcm_eventlog_index_close(r->index);
+    free(r);
+}
+
+int lcm_eventlog_reader_next(lcm_eventlog_reader_t *r,
+        lcm_eventlog_view_t *ev)
+{
+    int64_t start = find_magic(r, r->pos);
+    if (start < 0 || start + EVENT_HEADER_SIZE > r->size) {
+        r->pos = r->size;
+        return -1;
+    }
+
+    const uint8_t *hdr = r->base + start;
+    ev->eventnum = decode64(hdr + 4);
+    ev->timestamp = decode64(hdr + 12);
+    ev->channellen = decode32(hdr + 20);
+    ev->datalen = decode32(hdr + 24);
+
+    // Sanity check the channel length and data length
+    if (ev->channellen <= 0 || ev->channellen >= 1000) {
+        fprintf(stderr, "Log event has invalid channel length: %d\n",
+                ev->channellen);
+        return -1;
+    }
+    if (ev->datalen < 0) {
+        fprintf(stderr, "Log event has invalid data length: %d\n",
+                ev->datalen);
+        return -1;
+    }
+
+    size_t end = start + EVENT_HEADER_SIZE + ev->channellen + ev->datalen;
+    if (end > r->size)
+        return -1;
+
+    // Check that there's a valid event or the EOF after this event.
+    if (end + 4 <= r->size && decode32(r->base + end) != MAGIC) {
+        fprintf(stderr, "Invalid header after log data\n");
+        return -1;
+    }
+
+    ev->channel = (const char *) hdr + EVENT_HEADER_SIZE;
+    ev->data = ev->channel + ev->channellen;
+    r->pos = end;
+    return 0;
+}
+
+// Returns the timestamp of the first event at or after offset, and sets *pos
+// to the event's offset.  Returns -1 if there is no such event.
+static int64_t get_view_time(const lcm_eventlog_reader_t *r, size_t offset,
+        size_t *pos)
+{
+    int64_t start = find_magic(r, offset);
+    if (start < 0 || start + 20 > r->size)
+        return -1;
+    *pos = start;
+    return decode64(r->base + start + 12);
+}
+
+int lcm_eventlog_reader_seek_to_timestamp(lcm_eventlog_reader_t *r,
+        int64_t timestamp)
+{
+    if (r->index) {
+        int64_t offset = lcm_eventlog_index_find_timestamp(r->index,
+                timestamp);
+        if (offset >= 0 && (uint64_t) offset < r->size) {
+            r->pos = offset;
+            return 0;
+        }
+    }
+
+    int64_t cur_time;
+    double frac1 = 0;               // left bracket
+    double frac2 = 1;               // right bracket
+    double prev_frac = -1;
+    double frac;                    // current position
+
+    while (1) {
+        frac = 0.5*(frac1+frac2);
+        size_t pos;
+        cur_time = get_view_time(r, (size_t)(frac*r->size), &pos);
+        if (cur_time < 0)
+            return -1;
+        r->pos = pos;
+
+        if ((frac > frac2) || (frac < frac1) || (frac1>=frac2))
+            break;
+
+        double df = frac-prev_frac;
+        if (df < 0)
+            df = -df;
+        if (df < 1e-12)
+            break;
+
+        if (cur_time == timestamp)
+            break;
+
+        if (cur_time < timestamp)
+            frac1 = frac;
+        else
+            frac2 = frac;
+
+        prev_frac = frac;
+    }
+
+    return 0;
+}
+
+
+/*** Index ***/
+
+// An index file starts with a header:
+//
+//   magic, version, flags, reserved (4 bytes each)
+//
+// followed by one entry for each event, in the order of the log file:
+//
+//   file offset, event number, timestamp, channel hash (8 bytes each)
+//
+// All numbers are big-endian, like in the log file.  Entries have a fixed size
+// and never change once written, so the index can be appended to as the log
+// is written, and searched in place.  The flags record whether the event
+// numbers and timestamps are in increasing order.  Channels are identified by
+// a 64-bit FNV-1a hash of their name, which keeps the index append-only.
+#define INDEX_MAGIC ((int32_t) 0x4C434958L)     // "LCIX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 16
+#define INDEX_ENTRY_SIZE 32
+
+#define INDEX_TIMESTAMPS_UNSORTED 1
+#define INDEX_EVENTNUMS_UNSORTED 2
+
+// field offsets within an entry
+#define ENTRY_OFFSET 0
+#define ENTRY_EVENTNUM 8
+#define ENTRY_TIMESTAMP 16
+#define ENTRY_CHANNEL 24
+
+typedef struct _index_channel_t index_channel_t;
+struct _index_channel_t {
+    uint64_t hash;
+    int64_t count;
+    int64_t *offsets;
+    index_channel_t *next;
+};
+
+struct _lcm_eventlog_index_t
+{
+    const uint8_t *base;        // mapping of the index file
+    size_t size;
+    int32_t flags;
+    int64_t n;                  // number of entries for events in the log
+    int64_t end;                // log offset just past the last of them
+
+    // entry numbers ordered by timestamp or event number, built on demand
+    // when the entries are not in that order already.
+    int64_t *by_timestamp;
+    int64_t *by_eventnum;
+
+    index_channel_t *channels;  // per-channel offsets, built on demand
+
+    // names of the channels seen by filtered reads, by hash.  An open
+    // addressing table, with NULL names marking free slots.
+    uint64_t *name_hashes;
+    char **names;
+    size_t names_capacity;
+    size_t names_count;
+};
+
+static uint64_t channel_hash(const char *channel, int32_t channellen)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (int32_t i = 0; i < channellen; i++) {
+        h ^= (uint8_t) channel[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static char *index_path(const char *path)
+{
+    char *ipath = (char *) malloc(strlen(path) + 5);
+    strcpy(ipath, path);
+    strcat(ipath, ".idx");
+    return ipath;
+}
+
+static void index_remove(const char *path)
+{
+    char *ipath = index_path(path);
+    remove(ipath);
+    free(ipath);
+}
+
+static inline int64_t entry_field(const lcm_eventlog_index_t *idx, int64_t i,
+        int field)
+{
+    return decode64(idx->base + INDEX_HEADER_SIZE + i * INDEX_ENTRY_SIZE +
+            field);
+}
+
+// Checks that entry i describes an event in the log file, and sets *end to
+// the offset just past the event.
+static int check_entry(const lcm_eventlog_index_t *idx, int64_t i, FILE *f,
+        int64_t log_size, int64_t *end)
+{
+    int64_t offset = entry_field(idx, i, ENTRY_OFFSET);
+    uint8_t hdr[EVENT_HEADER_SIZE];
+    char channel[1000];
+
+    if (offset < 0 || offset + EVENT_HEADER_SIZE > log_size ||
+            0 != fseeko(f, offset, SEEK_SET) ||
+            fread(hdr, EVENT_HEADER_SIZE, 1, f) != 1)
+        return -1;
+
+    int32_t channellen = decode32(hdr + 20);
+    int32_t datalen = decode32(hdr + 24);
+    if (decode32(hdr) != MAGIC ||
+            decode64(hdr + 4) != entry_field(idx, i, ENTRY_EVENTNUM) ||
+            decode64(hdr + 12) != entry_field(idx, i, ENTRY_TIMESTAMP) ||
+            channellen <= 0 || channellen >= 1000 || datalen < 0 ||
+            fread(channel, 1, channellen, f) != (size_t) channellen ||
+            channel_hash(channel, channellen) !=
+                (uint64_t) entry_field(idx, i, ENTRY_CHANNEL))
+        return -1;
+
+    *end = offset + EVENT_HEADER_SIZE + channellen + datalen;
+    return *end <= log_size ? 0 : -1;
+}
+
+// Finds the entries that refer to events in the log file.  Entries past its
+// end are ignored, since the log may not have been flushed as far as its
+// index.  Fails if the first and last of the remaining entries don't match
+// the log, which then isn't the one that was indexed.
+static int index_check_log(lcm_eventlog_index_t *idx, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    fseeko(f, 0, SEEK_END);
+    int64_t log_size = ftello(f);
+
+    int64_t lo = 0;
+    int64_t hi = (idx->size - INDEX_HEADER_SIZE) / INDEX_ENTRY_SIZE;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (entry_field(idx, mid, ENTRY_OFFSET) + EVENT_HEADER_SIZE <= log_size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    idx->n = lo;
+
+    // the last event may have been cut short
+    int64_t first_end;
+    if (idx->n > 0 && 0 != check_entry(idx, idx->n - 1, f, log_size, &idx->end))
+        idx->n--;
+    int status = -1;
+    if (idx->n > 0 &&
+            0 == check_entry(idx, idx->n - 1, f, log_size, &idx->end) &&
+            0 == check_entry(idx, 0, f, log_size, &first_end))
+        status = 0;
+    fclose(f);
+    return status;
+}
+
+lcm_eventlog_index_t *lcm_eventlog_index_open(const char *path)
+{
+#ifdef WIN32
+    return NULL;
+#else
+    char *ipath = index_path(path);
+    int fd = open(ipath, O_RDONLY);
+    free(ipath);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < INDEX_HEADER_SIZE ||
+            (uint64_t) st.st_size > (size_t) -1) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    lcm_eventlog_index_t *idx =
+        (lcm_eventlog_index_t *) calloc(1, sizeof(lcm_eventlog_index_t));
+    idx->base = (const uint8_t *) base;
+    idx->size = st.st_size;
+    idx->flags = decode32(idx->base + 8);
+    if (decode32(idx->base) != INDEX_MAGIC ||
+            decode32(idx->base + 4) != INDEX_VERSION ||
+            0 != index_check_log(idx, path)) {
+        lcm_eventlog_index_close(idx);
+        return NULL;
+    }
+    return idx;
+#endif
+}
+
+void lcm_eventlog_index_close(lcm_eventlog_index_t *idx)
+{
+#ifndef WIN32
+    munmap((void *) idx->base, idx->size);
+#endif
+    free(idx->by_timestamp);
+    free(idx->by_eventnum);
+    while (idx->channels) {
+        index_channel_t *next = idx->channels->next;
+        free(idx->channels->offsets);
+        free(idx->channels);
+        idx->channels = next;
+    }
+    for (size_t i = 0; i < idx->names_capacity; i++)
+        free(idx->names[i]);
+    free(idx->name_hashes);
+    free(idx->names);
+    free(idx);
+}
+
+int64_t lcm_eventlog_index_size(const lcm_eventlog_index_t *idx)
+{
+    return idx->n;
+}
+
+static int64_t index_end(const lcm_eventlog_index_t *idx)
+{
+    return idx->end;
+}
+
+typedef struct {
+    int64_t key;
+    int64_t entry;
+} sort_key_t;
+
+static int compare_sort_keys(const void *a, const void *b)
+{
+    const sort_key_t *ka = (const sort_key_t *) a;
+    const sort_key_t *kb = (const sort_key_t *) b;
+    if (ka->key != kb->key)
+        return ka->key < kb->key ? -1 : 1;
+    return ka->entry < kb->entry ? -1 : (ka->entry > kb->entry);
+}
+
+// Returns the entry numbers ordered by a field, and by position for equal
+// values.
+static int64_t *sort_entries(const lcm_eventlog_index_t *idx, int field)
+{
+    sort_key_t *keys = (sort_key_t *) malloc(idx->n * sizeof(sort_key_t));
+    int64_t *order = (int64_t *) malloc(idx->n * sizeof(int64_t));
+    if (!keys || !order) {
+        free(keys);
+        free(order);
+        return NULL;
+    }
+    for (int64_t i = 0; i < idx->n; i++) {
+        keys[i].key = entry_field(idx, i, field);
+        keys[i].entry = i;
+    }
+    qsort(keys, idx->n, sizeof(sort_key_t), compare_sort_keys);
+    for (int64_t i = 0; i < idx->n; i++)
+        order[i] = keys[i].entry;
+    free(keys);
+    return order;
+}
+
+// Returns the first entry, in the given order or in file order if order is
+// NULL, whose field is not less than value, or -1 if there is none.
+static int64_t lower_bound(const lcm_eventlog_index_t *idx,
+        const int64_t *order, int field, int64_t value)
+{
+    int64_t lo = 0, hi = idx->n;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (entry_field(idx, order ? order[mid] : mid, field) < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == idx->n)
+        return -1;
+    return order ? order[lo] : lo;
+}
+
+int64_t lcm_eventlog_index_find_timestamp(lcm_eventlog_index_t *idx,
+        int64_t ts)
+{
+    if ((idx->flags & INDEX_TIMESTAMPS_UNSORTED) && !idx->by_timestamp) {
+        idx->by_timestamp = sort_entries(idx, ENTRY_TIMESTAMP);
+        if (!idx->by_timestamp)
+            return -1;
+    }
+    int64_t i = lower_bound(idx, idx->by_timestamp, ENTRY_TIMESTAMP, ts);
+    return i < 0 ? -1 : entry_field(idx, i, ENTRY_OFFSET);
+}
+
+int64_t lcm_eventlog_index_find_eventnum(lcm_eventlog_index_t *idx,
+        int64_t eventnum)
+{
+    if ((idx->flags & INDEX_EVENTNUMS_UNSORTED) && !idx->by_eventnum) {
+        idx->by_eventnum = sort_entries(idx, ENTRY_EVENTNUM);
+        if (!idx->by_eventnum)
+            return -1;
+    }
+    int64_t i = lower_bound(idx, idx->by_eventnum, ENTRY_EVENTNUM, eventnum);
+    if (i < 0 || entry_field(idx, i, ENTRY_EVENTNUM) != eventnum)
+        return -1;
+    return entry_field(idx, i, ENTRY_OFFSET);
+}
+
+const int64_t *lcm_eventlog_index_channel_offsets(lcm_eventlog_index_t *idx,
+        const char *channel, int64_t *count)
+{
+    uint64_t hash = channel_hash(channel, strlen(channel));
+    index_channel_t *chan;
+    for (chan = idx->channels; chan; chan = chan->next) {
+        if (chan->hash == hash)
+            break;
+    }
+
+    if (!chan) {
+        chan = (index_channel_t *) calloc(1, sizeof(index_channel_t));
+        chan->hash = hash;
+        for (int64_t i = 0; i < idx->n; i++) {
+            if ((uint64_t) entry_field(idx, i, ENTRY_CHANNEL) == hash)
+                chan->count++;
+        }
+        if (chan->count) {
+            chan->offsets = (int64_t *) malloc(chan->count * sizeof(int64_t));
+            int64_t j = 0;
+            for (int64_t i = 0; i < idx->n; i++) {
+                if ((uint64_t) entry_field(idx, i, ENTRY_CHANNEL) == hash)
+                    chan->offsets[j++] = entry_field(idx, i, ENTRY_OFFSET);
+            }
+        }
+        chan->next = idx->channels;
+        idx->channels = chan;
+    }
+
+    *count = chan->count;
+    return chan->offsets;
+}
+
+static index_writer_t *index_writer_open(const char *ipath, int append)
+{
+    FILE *f = fopen(ipath, append ? "r+b" : "w+b");
+    if (!f)
+        return NULL;
+
+    index_writer_t *w = (index_writer_t *) calloc(1, sizeof(index_writer_t));
+    w->f = f;
+    if (!append) {
+        if (0 != fwrite32(f, INDEX_MAGIC) || 0 != fwrite32(f, INDEX_VERSION) ||
+                0 != fwrite32(f, 0) || 0 != fwrite32(f, 0))
+            goto fail;
+        return w;
+    }
+
+    int32_t magic, version, reserved;
+    if (0 != fread32(f, &magic) || 0 != fread32(f, &version) ||
+            0 != fread32(f, &w->flags) || 0 != fread32(f, &reserved) ||
+            magic != INDEX_MAGIC || version != INDEX_VERSION)
+        goto fail;
+
+    fseeko(f, 0, SEEK_END);
+    w->count = (ftello(f) - INDEX_HEADER_SIZE) / INDEX_ENTRY_SIZE;
+    if (w->count > 0) {
+        fseeko(f, INDEX_HEADER_SIZE + (w->count - 1) * INDEX_ENTRY_SIZE +
+                ENTRY_EVENTNUM, SEEK_SET);
+        if (0 != fread64(f, &w->last_eventnum) ||
+                0 != fread64(f, &w->last_timestamp))
+            goto fail;
+    }
+    fseeko(f, INDEX_HEADER_SIZE + w->count * INDEX_ENTRY_SIZE, SEEK_SET);
+    return w;
+
+fail:
+    fclose(f);
+    free(w);
+    return NULL;
+}
+
+static index_writer_t *index_writer_create(const char *path, int64_t offset)
+{
+    if (offset < 0)
+        return NULL;
+
+    // When appending, rebuild the index unless it covers exactly the events
+    // already in the log.
+    int append = offset > 0;
+    if (append) {
+        lcm_eventlog_index_t *idx = lcm_eventlog_index_open(path);
+        int up_to_date = idx && idx->end == offset &&
+            (int64_t) idx->size == INDEX_HEADER_SIZE + idx->n * INDEX_ENTRY_SIZE;
+        if (idx)
+            lcm_eventlog_index_close(idx);
+        if (!up_to_date && lcm_eventlog_index_build(path) < 0)
+            return NULL;
+    }
+
+    char *ipath = index_path(path);
+    index_writer_t *w = index_writer_open(ipath, append);
+    free(ipath);
+    if (w)
+        w->offset = offset;
+    return w;
+}
+
+static int index_writer_add(index_writer_t *w, int64_t offset,
+        int64_t eventnum, int64_t timestamp, const char *channel,
+        int32_t channellen)
+{
+    int32_t flags = w->flags;
+    if (w->count > 0 && timestamp < w->last_timestamp)
+        flags |= INDEX_TIMESTAMPS_UNSORTED;
+    if (w->count > 0 && eventnum < w->last_eventnum)
+        flags |= INDEX_EVENTNUMS_UNSORTED;
+    if (flags != w->flags) {
+        if (0 != fseeko(w->f, 8, SEEK_SET) || 0 != fwrite32(w->f, flags) ||
+                0 != fseeko(w->f, 0, SEEK_END))
+            return -1;
+        w->flags = flags;
+    }
+
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    encode64(entry + ENTRY_OFFSET, offset);
+    encode64(entry + ENTRY_EVENTNUM, eventnum);
+    encode64(entry + ENTRY_TIMESTAMP, timestamp);
+    encode64(entry + ENTRY_CHANNEL, channel_hash(channel, channellen));
+    if (fwrite(entry, INDEX_ENTRY_SIZE, 1, w->f) != 1)
+        return -1;
+
+    w->count++;
+    w->last_eventnum = eventnum;
+    w->last_timestamp = timestamp;
+    return 0;
+}
+
+static int index_writer_destroy(index_writer_t *w)
+{
+    int status = fclose(w->f);
+    free(w);
+    return status;
+}
+
+int64_t lcm_eventlog_index_build(const char *path)
+{
+    if (is_compressed(path)) {
+        fprintf(stderr, "%s is compressed, and has a block index instead\n",
+                path);
+        return -1;
+    }
+    if (is_manifest(path)) {
+        fprintf(stderr, "%s is a manifest of a sharded log, index its shards "
+                "instead\n", path);
+        return -1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    fseeko(f, 0, SEEK_END);
+    int64_t log_size = ftello(f);
+    fseeko(f, 0, SEEK_SET);
+
+    // Write to a temporary file, so that readers never see a partial index.
+    char *ipath = index_path(path);
+    char *tmp_path = (char *) malloc(strlen(ipath) + 5);
+    strcpy(tmp_path, ipath);
+    strcat(tmp_path, ".tmp");
+
+    int64_t count = -1;
+    index_writer_t *w = index_writer_open(tmp_path, 0);
+    if (w) {
+        lcm_eventlog_event_t le;
+        char channel[1000];
+        int64_t offset;
+        int status = 0;
+        while ((offset = read_event_header(f, &le)) >= 0) {
+            // Stop where readers would, at an event that is cut short or not
+            // followed by another one.
+            int64_t end = offset + EVENT_HEADER_SIZE + le.channellen +
+                le.datalen;
+            int32_t next_magic;
+            if (end > log_size ||
+                    fread(channel, 1, le.channellen, f) !=
+                        (size_t) le.channellen ||
+                    0 != fseeko(f, end, SEEK_SET) ||
+                    (0 == fread32(f, &next_magic) && next_magic != MAGIC))
+                break;
+            fseeko(f, end, SEEK_SET);
+
+            status = index_writer_add(w, offset, le.eventnum, le.timestamp,
+                    channel, le.channellen);
+            if (status != 0)
+                break;
+        }
+        count = w->count;
+        if (0 != index_writer_destroy(w) || status != 0)
+            count = -1;
+    }
+    fclose(f);
+
+#ifdef WIN32
+    if (count >= 0)
+        remove(ipath);
+#endif
+    if (count >= 0 && 0 != rename(tmp_path, ipath))
+        count = -1;
+    if (count < 0)
+        remove(tmp_path);
+    free(tmp_path);
+    free(ipath);
+    return count;
+}
+
+
+/*** Filtered reading ***/
+
+// Returns the name of the channel with the given hash, if it was seen before.
+static const char *index_channel_name(const lcm_eventlog_index_t *idx,
+        uint64_t hash)
+{
+    if (!idx->names_capacity)
+        return NULL;
+    size_t mask = idx->names_capacity - 1;
+    for (size_t i = hash & mask; idx->names[i]; i = (i + 1) & mask) {
+        if (idx->name_hashes[i] == hash)
+            return idx->names[i];
+    }
+    return NULL;
+}
+
+static const char *index_add_channel_name(lcm_eventlog_index_t *idx,
+        uint64_t hash, const char *channel, int32_t channellen)
+{
+    // keep the table at most half full
+    if (2 * (idx->names_count + 1) > idx->names_capacity) {
+        size_t old_capacity = idx->names_capacity;
+        uint64_t *old_hashes = idx->name_hashes;
+        char **old_names = idx->names;
+
+        idx->names_capacity = old_capacity ? 2 * old_capacity : 64;
+        idx->name_hashes =
+            (uint64_t *) calloc(idx->names_capacity, sizeof(uint64_t));
+        idx->names = (char **) calloc(idx->names_capacity, sizeof(char *));
+        size_t mask = idx->names_capacity - 1;
+        for (size_t j = 0; j < old_capacity; j++) {
+            if (!old_names[j])
+                continue;
+            size_t i = old_hashes[j] & mask;
+            while (idx->names[i])
+                i = (i + 1) & mask;
+            idx->name_hashes[i] = old_hashes[j];
+            idx->names[i] = old_names[j];
+        }
+        free(old_hashes);
+        free(old_names);
+    }
+
+    size_t mask = idx->names_capacity - 1;
+    size_t i = hash & mask;
+    while (idx->names[i])
+        i = (i + 1) & mask;
+    idx->name_hashes[i] = hash;
+    idx->names[i] = (char *) malloc(channellen + 1);
+    memcpy(idx->names[i], channel, channellen);
+    idx->names[i][channellen] = 0;
+    idx->names_count++;
+    return idx->names[i];
+}
+
+// Returns the first entry for an event at or after offset.
+static int64_t index_entry_at(const lcm_eventlog_index_t *idx, int64_t offset)
+{
+    int64_t i = lower_bound(idx, NULL, ENTRY_OFFSET, offset);
+    return i < 0 ? idx->n : i;
+}
+
+lcm_eventlog_event_t *lcm_eventlog_read_next_event_filtered(
+        lcm_eventlog_t *l, lcm_eventlog_filter_t filter, void *user)
+{
+    if (l->blocks)
+        return blocks_read_next_event(l, filter, user);
+    if (l->shards)
+        return shards_read_next_event(l, filter, user);
+
+    char channel[1000];
+    int64_t pos = ftello(l->f);
+    if (pos < 0)
+        return NULL;
+
+    // Find the next event in the index, and only read the channel names of
+    // those that weren't seen before.
+    if (l->index && pos < index_end(l->index)) {
+        lcm_eventlog_index_t *idx = l->index;
+        for (int64_t i = index_entry_at(idx, pos); i < idx->n; i++) {
+            uint64_t hash = entry_field(idx, i, ENTRY_CHANNEL);
+            int64_t offset = entry_field(idx, i, ENTRY_OFFSET);
+            const char *name = index_channel_name(idx, hash);
+            if (!name) {
+                int32_t channellen;
+                if (0 != fseeko(l->f, offset + EVENT_HEADER_SIZE - 8,
+                            SEEK_SET) ||
+                        0 != fread32(l->f, &channellen) ||
+                        channellen <= 0 || channellen >= 1000 ||
+                        0 != fseeko(l->f, 4, SEEK_CUR) ||
+                        fread(channel, 1, channellen, l->f) !=
+                            (size_t) channellen)
+                    return NULL;
+                name = index_add_channel_name(idx, hash, channel, channellen);
+            }
+            if (filter(name, user)) {
+                fseeko(l->f, offset, SEEK_SET);
+                return lcm_eventlog_read_next_event(l);
+            }
+        }
+        fseeko(l->f, index_end(idx), SEEK_SET);
+    }
+
+    // Otherwise, read each event's header and channel, and seek past the
+    // data of those that are filtered out.
+    lcm_eventlog_event_t le;
+    int64_t offset;
+    while ((offset = read_event_header(l->f, &le)) >= 0) {
+        if (fread(channel, 1, le.channellen, l->f) != (size_t) le.channellen)
+            return NULL;
+        channel[le.channellen] = 0;
+        if (filter(channel, user)) {
+            fseeko(l->f, offset, SEEK_SET);
+            return lcm_eventlog_read_next_event(l);
+        }
+        fseeko(l->f, le.datalen, SEEK_CUR);
+    }
+    return NULL;
+}
+
+#ifndef WIN32
+// Tells the kernel that an event is about to be read.
+static void reader_will_need(const lcm_eventlog_reader_t *r,
+        const lcm_eventlog_view_t *ev)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) ev->channel & ~(uintptr_t) (page_size - 1);
+    uintptr_t end = (uintptr_t) ev->data + ev->datalen;
+    madvise((void *) start, end - start, MADV_WILLNEED);
+}
+#endif
+
+int lcm_eventlog_reader_next_filtered(lcm_eventlog_reader_t *r,
+        lcm_eventlog_view_t *ev, lcm_eventlog_filter_t filter, void *user)
+{
+#ifndef WIN32
+    // Reading ahead would mostly read data that is skipped.  With an index,
+    // only the events that are read are touched, so don't read around them
+    // either, but ask for each of them instead.
+    if (r->sequential) {
+        madvise((void *) r->base, r->size, r->index ? MADV_RANDOM :
+                MADV_NORMAL);
+        r->sequential = 0;
+    }
+#endif
+
+    char channel[1000];
+    lcm_eventlog_index_t *idx = r->index;
+    if (idx && r->pos < (uint64_t) index_end(idx)) {
+        int64_t i;
+        for (i = index_entry_at(idx, r->pos); i < idx->n; i++) {
+            uint64_t hash = entry_field(idx, i, ENTRY_CHANNEL);
+            int64_t offset = entry_field(idx, i, ENTRY_OFFSET);
+            const char *name = index_channel_name(idx, hash);
+            if (!name) {
+                // the index was checked against the log when it was opened,
+                // but the log may have changed since.
+                if ((uint64_t) offset + EVENT_HEADER_SIZE > r->size)
+                    break;
+                int32_t channellen = decode32(r->base + offset + 20);
+                if (channellen <= 0 || channellen >= 1000 ||
+                        offset + EVENT_HEADER_SIZE + channellen > r->size)
+                    break;
+                name = index_add_channel_name(idx, hash, (const char *)
+                        r->base + offset + EVENT_HEADER_SIZE, channellen);
+            }
+            if (filter(name, user)) {
+                r->pos = offset;
+                break;
+            }
+        }
+        if (i == idx->n)
+            r->pos = index_end(idx);
+    }
+
+    while (1) {
+        if (0 != lcm_eventlog_reader_next(r, ev))
+            return -1;
+        memcpy(channel, ev->channel, ev->channellen);
+        channel[ev->channellen] = 0;
+        if (filter(channel, user))
+            break;
+    }
+#ifndef WIN32
+    reader_will_need(r, ev);
+#endif
+    return 0;
+}
+
+
+/*** Compressed log files ***/
+
+// A compressed log file starts with a header:
+//
+//   magic, version, codec, block size (4 bytes each)
+//
+// followed by blocks of events.  A block holds a run of consecutive events in
+// the format of an uncompressed log file, which are compressed as a whole.
+// Each block starts with a header:
+//
+//   magic, compressed size, uncompressed size, number of events (4 bytes
+//   each), event number and timestamp of the first event (8 bytes each)
+//
+// Blocks are compressed independently of each other, so that reading can
+// start at any of them.  When the file is closed, a block index is written
+// after the last block, with an entry for each block:
+//
+//   file offset, event number and timestamp of the first event (8 bytes each)
+//
+// followed by a trailer:
+//
+//   index offset, number of blocks (8 bytes each), magic (4 bytes)
+//
+// Files that were not closed, or are still being written, have no block
+// index.  Their blocks are found by reading the block headers instead.  All
+// numbers are big-endian, like in the log file.
+#define BLOCKS_MAGIC ((int32_t) 0x4C434D5AL)           // "LCMZ"
+#define BLOCKS_VERSION 1
+#define BLOCKS_HEADER_SIZE 16
+#define BLOCK_MAGIC ((int32_t) 0x4C435A42L)            // "LCZB"
+#define BLOCK_HEADER_SIZE 32
+#define BLOCK_ENTRY_SIZE 24
+#define BLOCKS_TRAILER_MAGIC ((int32_t) 0x4C435A54L)   // "LCZT"
+#define BLOCKS_TRAILER_SIZE 20
+
+// compression formats
+#define CODEC_DEFLATE 1
+
+// Events are collected into blocks of about this size
+#define BLOCK_SIZE (1 << 20)
+
+// Blocks that are waiting to be compressed and written.  Writing an event
+// waits once there are this many, which bounds the memory used when the disk
+// can't keep up.
+#define MAX_PENDING_BLOCKS 8
+
+typedef struct _block_entry_t block_entry_t;
+struct _block_entry_t {
+    int64_t offset;
+    int64_t eventnum;           // of the first event in the block
+    int64_t timestamp;          // of the first event in the block
+};
+
+typedef struct _pending_block_t pending_block_t;
+struct _pending_block_t {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    int32_t count;
+    int64_t eventnum;
+    int64_t timestamp;
+};
+
+struct _lcm_eventlog_blocks_t
+{
+    int32_t codec;
+    block_entry_t *entries;
+    int64_t n;
+    int64_t capacity;
+    int64_t end;                // file offset just past the last block
+    int indexed;                // whether the blocks were read from an index
+
+    // Reading.  The uncompressed contents of the current block.
+    int64_t block;              // -1 before the first block is read
+    uint8_t *buf;
+    size_t buf_capacity;
+    size_t len;
+    size_t pos;                 // offset of the next event in buf
+    uint8_t *zbuf;              // compressed data, also used by the writer
+    size_t zbuf_capacity;
+
+    // Writing.  Full blocks are queued for a thread that compresses and
+    // writes them.
+    pending_block_t *cur;
+    GThread *thread;
+    GMutex *mutex;
+    GCond *cond;
+    GQueue *pending;
+    int exit;
+    int error;                  // errno of a failed write, or 0
+};
+
+static int codec_supported(int32_t codec)
+{
+#ifdef LCM_HAVE_ZLIB
+    if (codec == CODEC_DEFLATE)
+        return 1;
+#endif
+    return 0;
+}
+
+// Returns the largest compressed size of len bytes of data.
+static size_t compress_bound(int32_t codec, size_t len)
+{
+#ifdef LCM_HAVE_ZLIB
+    if (codec == CODEC_DEFLATE)
+        return compressBound(len);
+#endif
+    return len;
+}
+
+// Compresses len bytes of src into dst, which has room for capacity bytes.
+// Returns the compressed size, or -1 on failure.
+static int64_t block_compress(int32_t codec, uint8_t *dst, size_t capacity,
+        const uint8_t *src, size_t len)
+{
+#ifdef LCM_HAVE_ZLIB
+    if (codec == CODEC_DEFLATE) {
+        // Favor speed, so that compression keeps up with fast loggers.
+        uLongf dst_len = capacity;
+        if (compress2(dst, &dst_len, src, len, Z_BEST_SPEED) != Z_OK)
+            return -1;
+        return dst_len;
+    }
+#endif
+    return -1;
+}
+
+// Uncompresses src into exactly len bytes of dst.
+static int block_uncompress(int32_t codec, uint8_t *dst, size_t len,
+        const uint8_t *src, size_t src_len)
+{
+#ifdef LCM_HAVE_ZLIB
+    if (codec == CODEC_DEFLATE) {
+        uLongf dst_len = len;
+        if (uncompress(dst, &dst_len, src, src_len) != Z_OK ||
+                dst_len != len)
+            return -1;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+// Grows a buffer to hold at least size bytes.
+static int reserve(uint8_t **buf, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+        return 0;
+    size_t new_capacity = *capacity ? *capacity : BLOCK_SIZE;
+    while (new_capacity < size)
+        new_capacity *= 2;
+    uint8_t *new_buf = (uint8_t *) realloc(*buf, new_capacity);
+    if (!new_buf)
+        return -1;
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int truncate_file(FILE *f, int64_t size)
+{
+    fflush(f);
+#ifdef WIN32
+    return _chsize_s(_fileno(f), size) == 0 ? 0 : -1;
+#else
+    return ftruncate(fileno(f), size);
+#endif
+}
+
+static int is_compressed(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    uint8_t magic[4];
+    int compressed = fread(magic, 4, 1, f) == 1 &&
+        decode32(magic) == BLOCKS_MAGIC;
+    fclose(f);
+    return compressed;
+}
+
+static void blocks_add_entry(blocks_t *b, int64_t offset, int64_t eventnum,
+        int64_t timestamp)
+{
+    if (b->n == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 64;
+        b->entries = (block_entry_t *) realloc(b->entries,
+                b->capacity * sizeof(block_entry_t));
+    }
+    block_entry_t *e = &b->entries[b->n++];
+    e->offset = offset;
+    e->eventnum = eventnum;
+    e->timestamp = timestamp;
+}
+
+static int blocks_read_header(lcm_eventlog_t *l)
+{
+    uint8_t hdr[BLOCKS_HEADER_SIZE];
+    if (0 != fseeko(l->f, 0, SEEK_SET) ||
+            fread(hdr, BLOCKS_HEADER_SIZE, 1, l->f) != 1 ||
+            decode32(hdr) != BLOCKS_MAGIC) {
+        fprintf(stderr, "Not a compressed log file\n");
+        return -1;
+    }
+    if (decode32(hdr + 4) != BLOCKS_VERSION) {
+        fprintf(stderr, "Unsupported compressed log file version: %d\n",
+                decode32(hdr + 4));
+        return -1;
+    }
+    l->blocks->codec = decode32(hdr + 8);
+    if (!codec_supported(l->blocks->codec)) {
+        fprintf(stderr, "Compressed log file uses a compression format "
+                "that this build of LCM doesn't support: %d\n",
+                l->blocks->codec);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the block index.  Fails if the file doesn't end with one.
+static int blocks_read_index(lcm_eventlog_t *l)
+{
+    blocks_t *b = l->blocks;
+    uint8_t trailer[BLOCKS_TRAILER_SIZE];
+    fseeko(l->f, 0, SEEK_END);
+    int64_t size = ftello(l->f);
+    if (size < BLOCKS_HEADER_SIZE + BLOCKS_TRAILER_SIZE ||
+            0 != fseeko(l->f, size - BLOCKS_TRAILER_SIZE, SEEK_SET) ||
+            fread(trailer, BLOCKS_TRAILER_SIZE, 1, l->f) != 1 ||
+            decode32(trailer + 16) != BLOCKS_TRAILER_MAGIC)
+        return -1;
+
+    int64_t index_offset = decode64(trailer);
+    int64_t n = decode64(trailer + 8);
+    if (index_offset < BLOCKS_HEADER_SIZE || n < 0 ||
+            n > (size - index_offset) / BLOCK_ENTRY_SIZE ||
+            index_offset + n * BLOCK_ENTRY_SIZE + BLOCKS_TRAILER_SIZE != size)
+        return -1;
+
+    uint8_t *entries = (uint8_t *) malloc(n * BLOCK_ENTRY_SIZE + 1);
+    int status = 0;
+    if (0 != fseeko(l->f, index_offset, SEEK_SET) ||
+            fread(entries, BLOCK_ENTRY_SIZE, n, l->f) != (size_t) n)
+        status = -1;
+    b->n = 0;
+    for (int64_t i = 0; i < n && status == 0; i++) {
+        const uint8_t *e = entries + i * BLOCK_ENTRY_SIZE;
+        int64_t offset = decode64(e);
+        int64_t prev_end = i ? b->entries[i - 1].offset + BLOCK_HEADER_SIZE :
+            BLOCKS_HEADER_SIZE;
+        if (offset < prev_end || offset + BLOCK_HEADER_SIZE > index_offset)
+            status = -1;
+        else
+            blocks_add_entry(b, offset, decode64(e + 8), decode64(e + 16));
+    }
+    free(entries);
+    if (status != 0) {
+        b->n = 0;
+        return -1;
+    }
+    b->end = index_offset;
+    b->indexed = 1;
+    return 0;
+}
+
+// Adds the blocks after the last known one, by reading their headers.  Stops
+// at the end of the file, or at a block that hasn't been completely written.
+static void blocks_scan(lcm_eventlog_t *l)
+{
+    blocks_t *b = l->blocks;
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    fseeko(l->f, 0, SEEK_END);
+    int64_t size = ftello(l->f);
+    while (b->end + BLOCK_HEADER_SIZE <= size) {
+        if (0 != fseeko(l->f, b->end, SEEK_SET) ||
+                fread(hdr, BLOCK_HEADER_SIZE, 1, l->f) != 1)
+            break;
+        int32_t csize = decode32(hdr + 4);
+        int32_t usize = decode32(hdr + 8);
+        int32_t count = decode32(hdr + 12);
+        if (decode32(hdr) != BLOCK_MAGIC || csize < 0 || usize < 0 ||
+                count <= 0 || b->end + BLOCK_HEADER_SIZE + csize > size)
+            break;
+        blocks_add_entry(b, b->end, decode64(hdr + 16), decode64(hdr + 24));
+        b->end += BLOCK_HEADER_SIZE + csize;
+    }
+}
+
+static int blocks_open_read(lcm_eventlog_t *l)
+{
+    blocks_t *b = (blocks_t *) calloc(1, sizeof(blocks_t));
+    b->block = -1;
+    l->blocks = b;
+    if (0 != blocks_read_header(l))
+        return -1;
+    if (0 != blocks_read_index(l)) {
+        b->end = BLOCKS_HEADER_SIZE;
+        blocks_scan(l);
+    }
+    return 0;
+}
+
+// Reads and uncompresses block i.
+static int blocks_load(lcm_eventlog_t *l, int64_t i)
+{
+    blocks_t *b = l->blocks;
+    // look for blocks that were written since the file was opened
+    if (i >= b->n && !b->indexed)
+        blocks_scan(l);
+    if (i < 0 || i >= b->n)
+        return -1;
+
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    if (0 != fseeko(l->f, b->entries[i].offset, SEEK_SET) ||
+            fread(hdr, BLOCK_HEADER_SIZE, 1, l->f) != 1 ||
+            decode32(hdr) != BLOCK_MAGIC)
+        return -1;
+    int32_t csize = decode32(hdr + 4);
+    int32_t usize = decode32(hdr + 8);
+    if (csize < 0 || usize < 0 ||
+            0 != reserve(&b->zbuf, &b->zbuf_capacity, csize) ||
+            0 != reserve(&b->buf, &b->buf_capacity, usize) ||
+            fread(b->zbuf, 1, csize, l->f) != (size_t) csize)
+        return -1;
+    if (0 != block_uncompress(b->codec, b->buf, usize, b->zbuf, csize)) {
+        fprintf(stderr, "Invalid compressed block in log file\n");
+        return -1;
+    }
+    b->block = i;
+    b->len = usize;
+    b->pos = 0;
+    return 0;
+}
+
+static void blocks_set_position(lcm_eventlog_t *l, int64_t block, size_t pos)
+{
+    blocks_t *b = l->blocks;
+    if (block < 0) {
+        b->block = -1;
+        b->len = b->pos = 0;
+    } else if (block == b->block || 0 == blocks_load(l, block)) {
+        b->pos = pos;
+    }
+}
+
+// Decodes the header of the next event into le, reading the next block if
+// the current one has been read.  The event is at b->pos on success.
+static int blocks_next_header(lcm_eventlog_t *l, lcm_eventlog_event_t *le)
+{
+    blocks_t *b = l->blocks;
+    while (b->pos >= b->len) {
+        if (0 != blocks_load(l, b->block + 1))
+            return -1;
+    }
+
+    const uint8_t *hdr = b->buf + b->pos;
+    if (b->pos + EVENT_HEADER_SIZE > b->len || decode32(hdr) != MAGIC) {
+        fprintf(stderr, "Invalid event in compressed log block\n");
+        return -1;
+    }
+    le->eventnum = decode64(hdr + 4);
+    le->timestamp = decode64(hdr + 12);
+    le->channellen = decode32(hdr + 20);
+    le->datalen = decode32(hdr + 24);
+
+    // Sanity check the channel length and data length
+    if (le->channellen <= 0 || le->channellen >= 1000) {
+        fprintf(stderr, "Log event has invalid channel length: %d\n",
+                le->channellen);
+        return -1;
+    }
+    if (le->datalen < 0 || b->len - b->pos - EVENT_HEADER_SIZE <
+            (uint64_t) le->channellen + le->datalen) {
+        fprintf(stderr, "Log event has invalid data length: %d\n",
+                le->datalen);
+        return -1;
+    }
+    return 0;
+}
+
+static lcm_eventlog_event_t *blocks_read_next_event(lcm_eventlog_t *l,
+        lcm_eventlog_filter_t filter, void *user)
+{
+    blocks_t *b = l->blocks;
+    lcm_eventlog_event_t hdr;
+    char channel[1000];
+
+    while (0 == blocks_next_header(l, &hdr)) {
+        const uint8_t *p = b->buf + b->pos + EVENT_HEADER_SIZE;
+        b->pos += EVENT_HEADER_SIZE + hdr.channellen + hdr.datalen;
+        memcpy(channel, p, hdr.channellen);
+        channel[hdr.channellen] = 0;
+        if (filter && !filter(channel, user))
+            continue;
+
+        lcm_eventlog_event_t *le =
+            (lcm_eventlog_event_t*) calloc(1, sizeof(lcm_eventlog_event_t));
+        *le = hdr;
+        le->channel = (char *) calloc(1, hdr.channellen + 1);
+        memcpy(le->channel, channel, hdr.channellen);
+        le->data = calloc(1, hdr.datalen + 1);
+        memcpy(le->data, p + hdr.channellen, hdr.datalen);
+        return le;
+    }
+    return NULL;
+}
+
+// Returns the first block whose first event has a field not less than value,
+// or greater than value if upper is set, assuming that the blocks are in
+// order of that field.
+static int64_t blocks_bound(const blocks_t *b, size_t field, int64_t value,
+        int upper)
+{
+    int64_t lo = 0, hi = b->n;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        const int64_t *v = (const int64_t *) ((const char *) &b->entries[mid] +
+                field);
+        if (*v < value || (upper && *v == value))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int blocks_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp)
+{
+    blocks_t *b = l->blocks;
+    if (!b->indexed)
+        blocks_scan(l);
+
+    // Start at the last block that begins before the timestamp, which
+    // may end after it.
+    int64_t i = blocks_bound(b, offsetof(block_entry_t, timestamp),
+            timestamp, 0);
+    if (b->n == 0 || 0 != blocks_load(l, i > 0 ? i - 1 : 0))
+        return -1;
+
+    lcm_eventlog_event_t le;
+    while (0 == blocks_next_header(l, &le) && le.timestamp < timestamp)
+        b->pos += EVENT_HEADER_SIZE + le.channellen + le.datalen;
+    return 0;
+}
+
+static int blocks_seek_to_eventnum(lcm_eventlog_t *l, int64_t eventnum)
+{
+    blocks_t *b = l->blocks;
+    int64_t block = b->block;
+    size_t pos = b->pos;
+    if (!b->indexed)
+        blocks_scan(l);
+
+    // Only the last block that begins at or before the event can hold it.
+    int64_t i = blocks_bound(b, offsetof(block_entry_t, eventnum),
+            eventnum, 1) - 1;
+    if (i >= 0 && 0 == blocks_load(l, i)) {
+        lcm_eventlog_event_t le;
+        while (0 == blocks_next_header(l, &le) && b->block == i) {
+            if (le.eventnum == eventnum)
+                return 0;
+            b->pos += EVENT_HEADER_SIZE + le.channellen + le.datalen;
+        }
+    }
+    blocks_set_position(l, block, pos);
+    return -1;
+}
+
+static int blocks_seek_to_channel(lcm_eventlog_t *l, const char *channel)
+{
+    blocks_t *b = l->blocks;
+    int64_t block = b->block;
+    size_t pos = b->pos;
+    int32_t channellen = strlen(channel);
+
+    lcm_eventlog_event_t le;
+    while (0 == blocks_next_header(l, &le)) {
+        if (le.channellen == channellen && !memcmp(b->buf + b->pos +
+                    EVENT_HEADER_SIZE, channel, channellen))
+            return 0;
+        b->pos += EVENT_HEADER_SIZE + le.channellen + le.datalen;
+    }
+    blocks_set_position(l, block, pos);
+    return -1;
+}
+
+static void pending_block_free(pending_block_t *p)
+{
+    if (p) {
+        free(p->data);
+        free(p);
+    }
+}
+
+// Compresses and writes the queued blocks, in order.
+static gpointer blocks_writer_thread(gpointer user)
+{
+    lcm_eventlog_t *l = (lcm_eventlog_t *) user;
+    blocks_t *b = l->blocks;
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+
+    while (1) {
+        // The block stays queued while it is written, so that it counts
+        // towards MAX_PENDING_BLOCKS.
+        g_mutex_lock(b->mutex);
+        while (g_queue_is_empty(b->pending) && !b->exit)
+            g_cond_wait(b->cond, b->mutex);
+        pending_block_t *p = (pending_block_t *) g_queue_peek_head(b->pending);
+        int error = b->error;
+        g_mutex_unlock(b->mutex);
+        if (!p)
+            break;
+
+        // Once a write has failed, the file ends in a partial block, and any
+        // blocks after it are dropped.
+        if (!error) {
+            int64_t csize = -1;
+            errno = 0;
+            if (0 == reserve(&b->zbuf, &b->zbuf_capacity,
+                        compress_bound(b->codec, p->len)))
+                csize = block_compress(b->codec, b->zbuf, b->zbuf_capacity,
+                        p->data, p->len);
+            encode32(hdr, BLOCK_MAGIC);
+            encode32(hdr + 4, (int32_t) csize);
+            encode32(hdr + 8, (int32_t) p->len);
+            encode32(hdr + 12, p->count);
+            encode64(hdr + 16, p->eventnum);
+            encode64(hdr + 24, p->timestamp);
+            if (csize < 0 || csize > INT32_MAX || p->len > INT32_MAX ||
+                    fwrite(hdr, BLOCK_HEADER_SIZE, 1, l->f) != 1 ||
+                    fwrite(b->zbuf, 1, csize, l->f) != (size_t) csize) {
+                error = errno ? errno : EIO;
+            } else {
+                blocks_add_entry(b, b->end, p->eventnum, p->timestamp);
+                b->end += BLOCK_HEADER_SIZE + csize;
+            }
+        }
+
+        g_mutex_lock(b->mutex);
+        g_queue_pop_head(b->pending);
+        b->error = error;
+        g_cond_broadcast(b->cond);
+        g_mutex_unlock(b->mutex);
+        pending_block_free(p);
+    }
+    return NULL;
+}
+
+// Queues the current block for the writer thread.
+static int blocks_submit(lcm_eventlog_t *l)
+{
+    blocks_t *b = l->blocks;
+    g_mutex_lock(b->mutex);
+    while (g_queue_get_length(b->pending) >= MAX_PENDING_BLOCKS && !b->error)
+        g_cond_wait(b->cond, b->mutex);
+    int error = b->error;
+    if (!error) {
+        g_queue_push_tail(b->pending, b->cur);
+        g_cond_broadcast(b->cond);
+    }
+    g_mutex_unlock(b->mutex);
+
+    if (error) {
+        pending_block_free(b->cur);
+        errno = error;
+    }
+    b->cur = NULL;
+    return error ? -1 : 0;
+}
+
+static int blocks_write_event(lcm_eventlog_t *l, lcm_eventlog_event_t *le)
+{
+    blocks_t *b = l->blocks;
+    size_t size = EVENT_HEADER_SIZE + le->channellen + le->datalen;
+
+    // Start a new block if the event doesn't fit.  Events larger than a
+    // block get a block of their own.
+    if (b->cur && b->cur->len + size > BLOCK_SIZE && 0 != blocks_submit(l))
+        return -1;
+    if (!b->cur)
+        b->cur = (pending_block_t *) calloc(1, sizeof(pending_block_t));
+    pending_block_t *p = b->cur;
+    if (0 != reserve(&p->data, &p->capacity, p->len + size)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    le->eventnum = l->eventcount;
+    if (p->count == 0) {
+        p->eventnum = le->eventnum;
+        p->timestamp = le->timestamp;
+    }
+
+    uint8_t *dst = p->data + p->len;
+    encode_event_header(dst, le);
+    memcpy(dst + EVENT_HEADER_SIZE, le->channel, le->channellen);
+    memcpy(dst + EVENT_HEADER_SIZE + le->channellen, le->data, le->datalen);
+    p->len += size;
+    p->count++;
+    l->eventcount++;
+
+    if (p->len >= BLOCK_SIZE)
+        return blocks_submit(l);
+    return 0;
+}
+
+// Writes out the current, partial block and waits until the writer thread
+// has written every queued block.
+static int blocks_flush(lcm_eventlog_t *l)
+{
+    blocks_t *b = l->blocks;
+    if (b->thread && b->cur && b->cur->count > 0 && 0 != blocks_submit(l))
+        return -1;
+
+    if (b->thread) {
+        g_mutex_lock(b->mutex);
+        while (!g_queue_is_empty(b->pending) && !b->error)
+            g_cond_wait(b->cond, b->mutex);
+        int error = b->error;
+        g_mutex_unlock(b->mutex);
+        if (error) {
+            errno = error;
+            return -1;
+        }
+    }
+    return fflush(l->f) == 0 ? 0 : -1;
+}
+
+static int blocks_open_write(lcm_eventlog_t *l, int append)
+{
+    blocks_t *b = (blocks_t *) calloc(1, sizeof(blocks_t));
+    b->block = -1;
+    l->blocks = b;
+
+    fseeko(l->f, 0, SEEK_END);
+    if (append && ftello(l->f) > 0) {
+        if (0 != blocks_read_header(l))
+            return -1;
+
+        // Drop the block index, or a partial block if the file wasn't
+        // closed, and carry on numbering events after the last block.
+        if (0 != blocks_read_index(l)) {
+            b->end = BLOCKS_HEADER_SIZE;
+            blocks_scan(l);
+        }
+        b->indexed = 0;
+        if (b->n > 0) {
+            uint8_t hdr[BLOCK_HEADER_SIZE];
+            if (0 != fseeko(l->f, b->entries[b->n - 1].offset, SEEK_SET) ||
+                    fread(hdr, BLOCK_HEADER_SIZE, 1, l->f) != 1)
+                return -1;
+            l->eventcount = b->entries[b->n - 1].eventnum + decode32(hdr + 12);
+        }
+        if (0 != truncate_file(l->f, b->end) ||
+                0 != fseeko(l->f, b->end, SEEK_SET)) {
+            perror("Error truncating compressed log file");
+            return -1;
+        }
+    } else {
+        uint8_t hdr[BLOCKS_HEADER_SIZE];
+        b->codec = CODEC_DEFLATE;
+        if (!codec_supported(b->codec)) {
+            fprintf(stderr, "This build of LCM doesn't support compressed "
+                    "log files\n");
+            return -1;
+        }
+        encode32(hdr, BLOCKS_MAGIC);
+        encode32(hdr + 4, BLOCKS_VERSION);
+        encode32(hdr + 8, b->codec);
+        encode32(hdr + 12, BLOCK_SIZE);
+        if (fwrite(hdr, BLOCKS_HEADER_SIZE, 1, l->f) != 1)
+            return -1;
+        b->end = BLOCKS_HEADER_SIZE;
+    }
+
+    b->mutex = g_mutex_new();
+    b->cond = g_cond_new();
+    b->pending = g_queue_new();
+    b->thread = g_thread_create(blocks_writer_thread, l, TRUE, NULL);
+    if (!b->thread)
+        return -1;
+    return 0;
+}
+
+static void blocks_close(lcm_eventlog_t *l)
+{
+    blocks_t *b = l->blocks;
+    if (b->thread) {
+        if (b->cur && b->cur->count > 0 && 0 != blocks_submit(l))
+            perror("Error writing compressed log file");
+
+        g_mutex_lock(b->mutex);
+        b->exit = 1;
+        g_cond_broadcast(b->cond);
+        g_mutex_unlock(b->mutex);
+        g_thread_join(b->thread);
+
+        // Write the block index, unless the file ends in a partial block.
+        if (b->error) {
+            errno = b->error;
+            perror("Error writing compressed log file");
+        } else {
+            uint8_t *index = (uint8_t *) malloc(b->n * BLOCK_ENTRY_SIZE +
+                    BLOCKS_TRAILER_SIZE);
+            for (int64_t i = 0; i < b->n; i++) {
+                uint8_t *e = index + i * BLOCK_ENTRY_SIZE;
+                encode64(e, b->entries[i].offset);
+                encode64(e + 8, b->entries[i].eventnum);
+                encode64(e + 16, b->entries[i].timestamp);
+            }
+            uint8_t *trailer = index + b->n * BLOCK_ENTRY_SIZE;
+            encode64(trailer, b->end);
+            encode64(trailer + 8, b->n);
+            encode32(trailer + 16, BLOCKS_TRAILER_MAGIC);
+            if (fwrite(index, b->n * BLOCK_ENTRY_SIZE + BLOCKS_TRAILER_SIZE, 1,
+                        l->f) != 1)
+                perror("Error writing compressed log file index");
+            free(index);
+        }
+
+        g_queue_free(b->pending);
+        g_cond_free(b->cond);
+        g_mutex_free(b->mutex);
+    }
+    pending_block_free(b->cur);
+    free(b->entries);
+    free(b->buf);
+    free(b->zbuf);
+    free(b);
+    l->blocks = NULL;
+}
+
+
+/*** Direct I/O ***/
+
+// With direct I/O, events are copied into a buffer that is aligned in memory
+// and with the file.  Full buffers are written as they fill up, and a partial
+// buffer is written padded to the alignment when the log is flushed, and the
+// file truncated again.  The buffer then keeps the partial block at its end,
+// which is rewritten along with the events that follow it.
+//
+// When appending to a file whose size isn't aligned, events are written
+// without O_DIRECT up to the next aligned offset.
+#define DIRECT_ALIGNMENT 4096
+#define DIRECT_BUFFER_SIZE (4 << 20)
+
+struct _lcm_eventlog_direct_t
+{
+    int fd;
+    int flags;                  // file status flags, with O_DIRECT
+    uint8_t *buf;
+    size_t len;
+    size_t limit;               // DIRECT_BUFFER_SIZE once aligned
+    int64_t offset;             // file offset of the buffer
+};
+
+#ifdef HAVE_O_DIRECT
+// Writes len bytes from the start of the buffer.
+static int direct_write(direct_t *d, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t status = pwrite(d->fd, d->buf + done, len - done,
+                d->offset + done);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            return -1;
+        done += status;
+    }
+    return 0;
+}
+
+// Moves the buffer past len bytes that were written.
+static void direct_advance(direct_t *d, size_t len)
+{
+    memmove(d->buf, d->buf + len, d->len - len);
+    d->offset += len;
+    d->len -= len;
+    if (d->limit == DIRECT_BUFFER_SIZE)
+        return;
+
+    d->limit -= len;
+    if (d->limit == 0) {
+        // aligned from now on
+        fcntl(d->fd, F_SETFL, d->flags);
+        d->limit = DIRECT_BUFFER_SIZE;
+    }
+}
+#endif
+
+int lcm_eventlog_enable_direct_io(lcm_eventlog_t *l)
+{
+#ifdef HAVE_O_DIRECT
+    if (l->blocks || l->direct)
+        return -1;
+
+    int fd = fileno(l->f);
+    int flags = fcntl(fd, F_GETFL);
+    struct stat st;
+    if (flags < 0 || (flags & O_ACCMODE) == O_RDONLY ||
+            0 != fflush(l->f) || 0 != fstat(fd, &st))
+        return -1;
+
+    // Write at explicit offsets, which appending would ignore.  Setting
+    // O_DIRECT fails if the file system doesn't support it.
+    flags = (flags & ~O_APPEND) | O_DIRECT;
+    if (0 != fcntl(fd, F_SETFL, flags))
+        return -1;
+
+    direct_t *d = (direct_t *) calloc(1, sizeof(direct_t));
+    d->fd = fd;
+    d->flags = flags;
+    d->offset = st.st_size;
+    d->limit = DIRECT_ALIGNMENT - st.st_size % DIRECT_ALIGNMENT;
+    if (d->limit == DIRECT_ALIGNMENT)
+        d->limit = DIRECT_BUFFER_SIZE;
+    else
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    if (0 != posix_memalign((void **) &d->buf, DIRECT_ALIGNMENT,
+                DIRECT_BUFFER_SIZE)) {
+        free(d);
+        return -1;
+    }
+
+    if (l->index_writer)
+        l->index_writer->offset = st.st_size;
+    l->direct = d;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int direct_append(lcm_eventlog_t *l, const void *data, size_t len)
+{
+#ifdef HAVE_O_DIRECT
+    direct_t *d = l->direct;
+    const uint8_t *p = (const uint8_t *) data;
+    while (len > 0) {
+        size_t n = d->limit - d->len;
+        if (n > len)
+            n = len;
+        memcpy(d->buf + d->len, p, n);
+        d->len += n;
+        p += n;
+        len -= n;
+        if (d->len == d->limit) {
+            // the buffer stays full on failure, to be retried
+            if (0 != direct_write(d, d->len))
+                return -1;
+            direct_advance(d, d->len);
+        }
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int64_t direct_offset(const lcm_eventlog_t *l)
+{
+    return l->direct->offset + l->direct->len;
+}
+
+// Drops the data appended after offset, if it is all still buffered.
+static void direct_discard(lcm_eventlog_t *l, int64_t offset)
+{
+    direct_t *d = l->direct;
+    if (offset >= d->offset)
+        d->len = offset - d->offset;
+}
+
+static int direct_flush(lcm_eventlog_t *l)
+{
+#ifdef HAVE_O_DIRECT
+    direct_t *d = l->direct;
+    if (d->len == 0)
+        return 0;
+
+    // not aligned yet, so written without O_DIRECT
+    if (d->limit != DIRECT_BUFFER_SIZE) {
+        if (0 != direct_write(d, d->len))
+            return -1;
+        direct_advance(d, d->len);
+        return 0;
+    }
+
+    size_t full = d->len & ~(size_t) (DIRECT_ALIGNMENT - 1);
+    size_t padded = (d->len + DIRECT_ALIGNMENT - 1) &
+        ~(size_t) (DIRECT_ALIGNMENT - 1);
+    memset(d->buf + d->len, 0, padded - d->len);
+    if (0 != direct_write(d, padded) ||
+            0 != ftruncate(d->fd, d->offset + d->len))
+        return -1;
+
+    // keep only the partial block
+    direct_advance(d, full);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void direct_close(lcm_eventlog_t *l)
+{
+    if (0 != direct_flush(l))
+        perror("Error writing log file");
+    free(l->direct->buf);
+    free(l->direct);
+    l->direct = NULL;
+}
+
+
+/*** Sharded log files ***/
+
+// A manifest is a text file that starts with MANIFEST_HEADER, followed by
+// the paths of the shards, one per line.  Relative paths are relative to the
+// directory of the manifest.
+#define MANIFEST_HEADER "LCM log manifest 1\n"
+
+struct _lcm_eventlog_shards_t
+{
+    int num_shards;
+    lcm_eventlog_t **logs;
+    lcm_eventlog_event_t **next;    // the next event of each shard, if read
+};
+
+static int is_manifest(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    char header[sizeof(MANIFEST_HEADER) - 1];
+    int manifest = fread(header, sizeof(header), 1, f) == 1 &&
+        !memcmp(header, MANIFEST_HEADER, sizeof(header));
+    fclose(f);
+    return manifest;
+}
+
+int lcm_eventlog_write_manifest(const char *path, const char **shards,
+        int num_shards)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return -1;
+    fputs(MANIFEST_HEADER, f);
+    for (int i = 0; i < num_shards; i++)
+        fprintf(f, "%s\n", shards[i]);
+    int status = ferror(f) ? -1 : 0;
+    if (0 != fclose(f))
+        status = -1;
+    return status;
+}
+
+static int shards_open(lcm_eventlog_t *l, const char *path)
+{
+    gchar *contents;
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return -1;
+
+    shards_t *s = (shards_t *) calloc(1, sizeof(shards_t));
+    l->shards = s;
+
+    gchar *dir = g_path_get_dirname(path);
+    gchar **lines = g_strsplit(contents + strlen(MANIFEST_HEADER), "\n", -1);
+    int status = 0;
+    for (int i = 0; lines[i] && status == 0; i++) {
+        char *name = lines[i];
+        size_t len = strlen(name);
+        if (len > 0 && name[len - 1] == '\r')
+            name[--len] = 0;
+        if (len == 0)
+            continue;
+
+        gchar *shard = g_path_is_absolute(name) ? g_strdup(name) :
+            g_build_filename(dir, name, NULL);
+        // shards can't be manifests themselves
+        lcm_eventlog_t *log = is_manifest(shard) ? NULL :
+            lcm_eventlog_create(shard, "r");
+        if (log) {
+            s->logs = (lcm_eventlog_t **) realloc(s->logs,
+                    (s->num_shards + 1) * sizeof(lcm_eventlog_t *));
+            s->logs[s->num_shards++] = log;
+        } else {
+            fprintf(stderr, "Can't read log file %s listed in %s\n", shard,
+                    path);
+            status = -1;
+        }
+        g_free(shard);
+    }
+    g_strfreev(lines);
+    g_free(dir);
+    g_free(contents);
+
+    s->next = (lcm_eventlog_event_t **) calloc(s->num_shards + 1,
+            sizeof(lcm_eventlog_event_t *));
+    return status;
+}
+
+static void shards_drop_next(shards_t *s)
+{
+    for (int i = 0; i < s->num_shards; i++) {
+        if (s->next[i])
+            lcm_eventlog_free_event(s->next[i]);
+        s->next[i] = NULL;
+    }
+}
+
+static void shards_close(lcm_eventlog_t *l)
+{
+    shards_t *s = l->shards;
+    shards_drop_next(s);
+    for (int i = 0; i < s->num_shards; i++)
+        lcm_eventlog_destroy(s->logs[i]);
+    free(s->logs);
+    free(s->next);
+    free(s);
+    l->shards = NULL;
+}
+
+// Reads ahead one event in each shard, and returns the shard whose event is
+// the oldest, or -1 if all of them are at their end.
+static int shards_peek(lcm_eventlog_t *l, lcm_eventlog_filter_t filter,
+        void *user)
+{
+    shards_t *s = l->shards;
+    int oldest = -1;
+    for (int i = 0; i < s->num_shards; i++) {
+        lcm_eventlog_event_t *le = s->next[i];
+        // the event may have been read ahead with a different filter
+        if (le && filter && !filter(le->channel, user)) {
+            lcm_eventlog_free_event(le);
+            le = NULL;
+        }
+        if (!le)
+            le = filter ?
+                lcm_eventlog_read_next_event_filtered(s->logs[i], filter,
+                        user) :
+                lcm_eventlog_read_next_event(s->logs[i]);
+        s->next[i] = le;
+        if (le && (oldest < 0 || le->timestamp < s->next[oldest]->timestamp))
+            oldest = i;
+    }
+    return oldest;
+}
+
+static lcm_eventlog_event_t *shards_read_next_event(lcm_eventlog_t *l,
+        lcm_eventlog_filter_t filter, void *user)
+{
+    int i = shards_peek(l, filter, user);
+    if (i < 0)
+        return NULL;
+    lcm_eventlog_event_t *le = l->shards->next[i];
+    l->shards->next[i] = NULL;
+    return le;
+}
+
+static int shards_seek_to_timestamp(lcm_eventlog_t *l, int64_t timestamp)
+{
+    shards_t *s = l->shards;
+    int status = -1;
+    shards_drop_next(s);
+    for (int i = 0; i < s->num_shards; i++) {
+        if (0 == lcm_eventlog_seek_to_timestamp(s->logs[i], timestamp))
+            status = 0;
+    }
+    return status;
+}
+
+// Events on a channel may be in any shard, so this reads through the events
+// of all of them in order.
+static int shards_seek_to_channel(lcm_eventlog_t *l, const char *channel)
+{
+    shards_t *s = l->shards;
+    int i;
+    while ((i = shards_peek(l, NULL, NULL)) >= 0) {
+        if (!strcmp(s->next[i]->channel, channel))
+            return 0;
+        lcm_eventlog_free_event(s->next[i]);
+        s->next[i] = NULL;
+    }
+    return -1;
+}
@@ -28,6 +28,12 @@ extern "C" {
  * @{
  */
 
+/**
+ * @brief An index of a log file, stored next to it.  See
+ * lcm_eventlog_index_open().
+ */
+typedef struct _lcm_eventlog_index_t lcm_eventlog_index_t;
+
 typedef struct _lcm_eventlog_t lcm_eventlog_t;
 struct _lcm_eventlog_t
 {
@@ -40,6 +46,35 @@ struct _lcm_eventlog_t
      * Internal counter, keeps track of how many events have been written.
      */
     int64_t eventcount;
+
+    /**
+     * Internal.  The index of the log file in read mode, if it has one.
+     */
+    lcm_eventlog_index_t *index;
+
+    /**
+     * Internal.  Writes the index of the log file, if enabled with
+     * lcm_eventlog_create_with_index().
+     */
+    struct _lcm_eventlog_index_writer_t *index_writer;
+
+    /**
+     * Internal.  The state of a compressed log file.  See
+     * lcm_eventlog_create_compressed().
+     */
+    struct _lcm_eventlog_blocks_t *blocks;
+
+    /**
+     * Internal.  The write buffer, if direct I/O is enabled with
+     * lcm_eventlog_enable_direct_io().
+     */
+    struct _lcm_eventlog_direct_t *direct;
+
+    /**
+     * Internal.  The shards of a sharded log file in read mode.  See
+     * lcm_eventlog_write_manifest().
+     */
+    struct _lcm_eventlog_shards_t *shards;
 };
 
 /**
@@ -79,6 +114,10 @@ struct _lcm_eventlog_event_t {
 /**
  * Open a log file for reading or writing.
  *
+ * In read mode, @p path can also be the manifest of a sharded log file, which
+ * is read as a single log file with the events of all its shards merged by
+ * timestamp.  See lcm_eventlog_write_manifest().
+ *
  * @param path Log file to open
  * @param mode "r" (read mode), "w" (write mode), or "a" (append mode)
  *
@@ -87,6 +126,57 @@ struct _lcm_eventlog_event_t {
 LCM_EXPORT
 lcm_eventlog_t *lcm_eventlog_create(const char *path, const char *mode);
 
+/**
+ * Open a log file like lcm_eventlog_create(), and in write or append mode,
+ * also write an index of it as it is written.  Compressed log files have a
+ * block index instead, so this is the same as lcm_eventlog_create() for them.
+ *
+ * The index is kept in a file named after the log file with ".idx" appended.
+ * In append mode, an index that doesn't cover the existing part of the log
+ * file is rebuilt first.  See lcm_eventlog_index_open().
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path Log file to open
+ * @param mode "r" (read mode), "w" (write mode), or "a" (append mode)
+ *
+ * @return a newly allocated lcm_eventlog_t, or NULL on failure.
+ */
+LCM_EXPORT
+lcm_eventlog_t *lcm_eventlog_create_with_index(const char *path,
+        const char *mode);
+
+/**
+ * Open a compressed log file for writing or appending.
+ *
+ * Events are collected into blocks of about 1 MiB, which are compressed
+ * independently of each other on a separate thread, so writing an event
+ * rarely has to wait for compression or for the disk.  A block index is
+ * written when the file is closed, which makes seeking in the file fast
+ * without a separate index file.  Events still waiting to be compressed are
+ * written when the file is closed, and are lost if the process ends before
+ * that.
+ *
+ * Compressed log files are read with lcm_eventlog_create() like any other
+ * log file, and lcm_eventlog_create() in append mode keeps appending
+ * compressed events to them.  They can't be read with
+ * lcm_eventlog_reader_create().
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path Log file to open
+ * @param mode "w" (write mode), or "a" (append mode).  A log file can only be
+ * appended to if it is empty or already compressed.  Appending to a file
+ * whose writer didn't close it drops the events that were not completely
+ * written.
+ *
+ * @return a newly allocated lcm_eventlog_t, or NULL on failure, or if LCM
+ * was built without support for compressed log files.
+ */
+LCM_EXPORT
+lcm_eventlog_t *lcm_eventlog_create_compressed(const char *path,
+        const char *mode);
+
 /**
  * Read the next event in the log file.  Valid in read mode only.  Free the
  * returned structure with lcm_eventlog_free_event() after use.
@@ -99,6 +189,38 @@ lcm_eventlog_t *lcm_eventlog_create(const char *path, const char *mode);
 LCM_EXPORT
 lcm_eventlog_event_t *lcm_eventlog_read_next_event(lcm_eventlog_t *eventlog);
 
+/**
+ * Decides whether an event is read by lcm_eventlog_read_next_event_filtered()
+ * or lcm_eventlog_reader_next_filtered().
+ *
+ * @param channel The event's channel
+ * @param user The user parameter passed to the read function
+ *
+ * @return nonzero to read the event, or 0 to skip it.
+ */
+typedef int (*lcm_eventlog_filter_t)(const char *channel, void *user);
+
+/**
+ * Read the next event in the log file whose channel passes a filter.  Valid
+ * in read mode only.
+ *
+ * Events that are filtered out are skipped without reading their data.  If
+ * the log file has an index, they are not read at all, so that reading the
+ * events on a few channels of a large log file is fast.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ * @param filter Decides which events to read
+ * @param user Passed to @p filter
+ *
+ * @return the next event that passes the filter, like
+ * lcm_eventlog_read_next_event().
+ */
+LCM_EXPORT
+lcm_eventlog_event_t *lcm_eventlog_read_next_event_filtered(
+        lcm_eventlog_t *eventlog, lcm_eventlog_filter_t filter, void *user);
+
 /**
  * Free a structure returned by lcm_eventlog_read_next_event().
  *
@@ -108,7 +230,11 @@ LCM_EXPORT
 void lcm_eventlog_free_event(lcm_eventlog_event_t *event);
 
 /**
- * Seek (approximately) to a particular timestamp.
+ * Seek to a particular timestamp.
+ *
+ * If the log file has an index, this seeks exactly to the event with the
+ * smallest timestamp not less than @p ts.  Otherwise, or if all indexed events
+ * are older, it bisects the file and the position is approximate.
  *
  * @param eventlog The log file object
  * @param ts Timestamp of the target event in the log file.
@@ -118,6 +244,40 @@ void lcm_eventlog_free_event(lcm_eventlog_event_t *event);
 LCM_EXPORT
 int lcm_eventlog_seek_to_timestamp(lcm_eventlog_t *eventlog, int64_t ts);
 
+/**
+ * Seek to the first event with a particular event number.  Uses the index of
+ * the log file if it has one, and reads through the file otherwise.  Fails
+ * for sharded log files, whose shards number their events independently.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ * @param eventnum Event number of the target event.
+ *
+ * @return 0 on success, -1 if there is no such event, in which
+ * case the position is unchanged.
+ */
+LCM_EXPORT
+int lcm_eventlog_seek_to_eventnum(lcm_eventlog_t *eventlog, int64_t eventnum);
+
+/**
+ * Seek to the next event on a channel, starting from the current position.
+ * Uses the index of the log file if it has one, and reads through the file
+ * otherwise.  Sharded log files are read through, and are left at their end
+ * if there is no such event.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ * @param channel Channel of the target event.
+ *
+ * @return 0 on success, -1 if there is no such event, in which
+ * case the position is unchanged.
+ */
+LCM_EXPORT
+int lcm_eventlog_seek_to_channel(lcm_eventlog_t *eventlog,
+        const char *channel);
+
 /**
  * Write an event into a log file.  Valid in write mode only.
  *
@@ -131,6 +291,107 @@ LCM_EXPORT
 int lcm_eventlog_write_event(lcm_eventlog_t *eventlog,
         lcm_eventlog_event_t *event);
 
+/**
+ * Write several events into a log file.  Valid in write mode only.
+ *
+ * This is faster than writing the events one at a time with
+ * lcm_eventlog_write_event().  The events are written straight to the
+ * underlying file descriptor, with a single system call for many events, and
+ * without copying their payloads.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ * @param events The events to write.  On return, the eventnum fields of the
+ * events that were written will be filled in for you.
+ * @param num_events Number of events in @p events
+ *
+ * @return the number of events written, which is less than @p num_events if
+ * an error occurred, with errno set to the cause.
+ */
+LCM_EXPORT
+int lcm_eventlog_write_events(lcm_eventlog_t *eventlog,
+        lcm_eventlog_event_t **events, int num_events);
+
+/**
+ * Write buffered events to the log file.  Valid in write mode only.
+ *
+ * This is the same as calling fflush() on the log file's stream, except
+ * with direct I/O, and for compressed logs, whose partial block is
+ * compressed and written out first.  The index written by
+ * lcm_eventlog_create_with_index() is flushed after the log.  Neither waits
+ * for the data to reach the disk.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ *
+ * @return 0 on success, -1 on failure.
+ */
+LCM_EXPORT
+int lcm_eventlog_flush(lcm_eventlog_t *eventlog);
+
+/**
+ * Get the file descriptor of the index being written, for example to sync
+ * it to disk after the log file itself, once both were flushed with
+ * lcm_eventlog_flush().
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ *
+ * @return the file descriptor, or -1 if no index is being written.
+ */
+LCM_EXPORT
+int lcm_eventlog_index_fileno(lcm_eventlog_t *eventlog);
+
+/**
+ * Bypass the operating system's page cache when writing a log file, with
+ * O_DIRECT.  Valid in write or append mode only, and not for compressed log
+ * files.
+ *
+ * Events are then collected in a 4 MiB buffer that is aligned as O_DIRECT
+ * requires, and written when it fills up, or when the log file is flushed
+ * with lcm_eventlog_flush() or closed.  This saves copying the data into the
+ * page cache and evicting it again, which can be the bottleneck of logging
+ * to fast disks.  The log file must not be written through its stream after
+ * this.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param eventlog The log file object
+ *
+ * @return 0 on success, or -1 if direct I/O isn't supported by the platform
+ * or the file system, in which case the log file is written as before.
+ */
+LCM_EXPORT
+int lcm_eventlog_enable_direct_io(lcm_eventlog_t *eventlog);
+
+/**
+ * Write the manifest of a sharded log file.
+ *
+ * A sharded log file is made of several log files, typically written in
+ * parallel, each with the events on some of the channels.  The manifest
+ * lists them, so that lcm_eventlog_create() in read mode, and so the log
+ * player, can read them back as a single log file, merged by timestamp.  The
+ * event numbers of the merged events are those of their shards.
+ *
+ * The manifest is a text file that starts with the line "LCM log manifest 1",
+ * followed by the paths of the shards, one per line.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path The manifest file to write
+ * @param shards Paths of the shards.  Relative paths are relative to the
+ * directory of the manifest.
+ * @param num_shards Number of shards
+ *
+ * @return 0 on success, -1 on failure.
+ */
+LCM_EXPORT
+int lcm_eventlog_write_manifest(const char *path, const char **shards,
+        int num_shards);
+
 /**
  * Close a log file and release allocated resources.
  *
@@ -139,6 +400,214 @@ int lcm_eventlog_write_event(lcm_eventlog_t *eventlog,
 LCM_EXPORT
 void lcm_eventlog_destroy(lcm_eventlog_t *eventlog);
 
+/**
+ * @brief Reads log files through a memory mapping, without copying or
+ * allocating memory for each event.  See lcm_eventlog_reader_create().
+ */
+typedef struct _lcm_eventlog_reader_t lcm_eventlog_reader_t;
+
+/**
+ * An event (message) in a log file that is read with a
+ * lcm_eventlog_reader_t.  Refers to the event's channel and payload in place,
+ * in the reader's memory mapping of the file.
+ */
+typedef struct _lcm_eventlog_view_t lcm_eventlog_view_t;
+struct _lcm_eventlog_view_t {
+    /**
+     * A monotonically increasing number assigned to the message to identify it
+     * in the log file.
+     */
+    int64_t eventnum;
+    /**
+     * Time that the message was received, in microseconds since the UNIX
+     * epoch
+     */
+    int64_t timestamp;
+    /**
+     * Length of @c channel, in bytes
+     */
+    int32_t channellen;
+    /**
+     * Length of @c data, in bytes
+     */
+    int32_t datalen;
+    /**
+     * Channel that the message was received on.  @b Not NUL-terminated.
+     */
+    const char *channel;
+    /**
+     * Raw byte buffer containing the message payload.
+     */
+    const void *data;
+};
+
+/**
+ * Open a log file for reading through a memory mapping.
+ *
+ * Events are returned as views into the mapping, so this is considerably
+ * faster than lcm_eventlog_read_next_event() for large log files.  Only the
+ * part of the file that exists when it is opened is read.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path Log file to open
+ *
+ * @return a newly allocated lcm_eventlog_reader_t, or NULL if the file can't
+ * be opened or mapped, or is compressed or sharded.  Memory mapping is not
+ * supported on Windows.
+ */
+LCM_EXPORT
+lcm_eventlog_reader_t *lcm_eventlog_reader_create(const char *path);
+
+/**
+ * Read the next event in the log file.
+ *
+ * @param reader The log file reader
+ * @param event Filled in with the event.  Its pointers stay valid until the
+ * reader is destroyed.
+ *
+ * @return 0 on success, or -1 when the end of the file has been reached or
+ * when invalid data is read.
+ */
+LCM_EXPORT
+int lcm_eventlog_reader_next(lcm_eventlog_reader_t *reader,
+        lcm_eventlog_view_t *event);
+
+/**
+ * Read the next event in the log file whose channel passes a filter.  Like
+ * lcm_eventlog_read_next_event_filtered(), this doesn't touch the data of
+ * events that are filtered out, and uses the index of the log file to skip
+ * them if it has one.  Once this is used, the kernel is no longer asked to
+ * read ahead in the file, which would mostly read data that is skipped.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param reader The log file reader
+ * @param event Filled in with the event
+ * @param filter Decides which events to read
+ * @param user Passed to @p filter
+ *
+ * @return 0 on success, or -1 when the end of the file has been reached or
+ * when invalid data is read.
+ */
+LCM_EXPORT
+int lcm_eventlog_reader_next_filtered(lcm_eventlog_reader_t *reader,
+        lcm_eventlog_view_t *event, lcm_eventlog_filter_t filter, void *user);
+
+/**
+ * Seek to a particular timestamp.  Exact if the log file has an index, like
+ * lcm_eventlog_seek_to_timestamp().
+ *
+ * @param reader The log file reader
+ * @param ts Timestamp of the target event in the log file.
+ *
+ * @return 0 on success, -1 on failure
+ */
+LCM_EXPORT
+int lcm_eventlog_reader_seek_to_timestamp(lcm_eventlog_reader_t *reader,
+        int64_t ts);
+
+/**
+ * Unmap and close a log file.  Invalidates all events read from it.
+ *
+ * @param reader The log file reader
+ */
+LCM_EXPORT
+void lcm_eventlog_reader_destroy(lcm_eventlog_reader_t *reader);
+
+/**
+ * Open the index of a log file.
+ *
+ * An index lists the file offset, event number, timestamp and channel of
+ * every event in a log file, so that events can be found without reading the
+ * log.  It is stored in a file named after the log file with ".idx" appended,
+ * and written by lcm_eventlog_create_with_index() or
+ * lcm_eventlog_index_build().  Log files opened for reading use their index
+ * automatically, so this is only needed to query it directly.
+ *
+ * Events that were appended to the log file after they were indexed are not
+ * covered by the index.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path The log file (not the index file)
+ *
+ * @return a newly allocated lcm_eventlog_index_t, or NULL if the log file has
+ * no index, or an index that doesn't match it.  Not supported on Windows.
+ */
+LCM_EXPORT
+lcm_eventlog_index_t *lcm_eventlog_index_open(const char *path);
+
+/**
+ * Close an index and release allocated resources.
+ *
+ * @param index The index
+ */
+LCM_EXPORT
+void lcm_eventlog_index_close(lcm_eventlog_index_t *index);
+
+/**
+ * @param index The index
+ *
+ * @return the number of indexed events.
+ */
+LCM_EXPORT
+int64_t lcm_eventlog_index_size(const lcm_eventlog_index_t *index);
+
+/**
+ * Find the indexed event with the smallest timestamp not less than @p ts.
+ * Ties are broken by the order of the events in the log file.
+ *
+ * @param index The index
+ * @param ts Timestamp to find
+ *
+ * @return the file offset of the event, or -1 if there is none.
+ */
+LCM_EXPORT
+int64_t lcm_eventlog_index_find_timestamp(lcm_eventlog_index_t *index,
+        int64_t ts);
+
+/**
+ * Find the first indexed event with a particular event number.
+ *
+ * @param index The index
+ * @param eventnum Event number to find
+ *
+ * @return the file offset of the event, or -1 if there is none.
+ */
+LCM_EXPORT
+int64_t lcm_eventlog_index_find_eventnum(lcm_eventlog_index_t *index,
+        int64_t eventnum);
+
+/**
+ * Lists the file offsets of all indexed events on a channel, in increasing
+ * order.
+ *
+ * @param index The index
+ * @param channel The channel
+ * @param count Set to the number of offsets
+ *
+ * @return the offsets, which are owned by the index and stay valid until it
+ * is closed.  NULL if there are no events on the channel.
+ */
+LCM_EXPORT
+const int64_t *lcm_eventlog_index_channel_offsets(lcm_eventlog_index_t *index,
+        const char *channel, int64_t *count);
+
+/**
+ * (Re)builds the index of an existing log file, replacing any index it has.
+ * Compressed log files have a block index instead, and can't be indexed.
+ * Neither can the manifests of sharded log files, only their shards.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param path The log file
+ *
+ * @return the number of indexed events, or -1 on failure.
+ */
+LCM_EXPORT
+int64_t lcm_eventlog_index_build(const char *path);
+
 /**
  * @}
  */
@@ -18,6 +18,12 @@ Subscription::getQueueSize() const
     return lcm_subscription_get_queue_size(c_subs);
 }
 
+int
+Subscription::getStats(lcm_subscription_stats_t* stats) const
+{
+    return lcm_subscription_get_stats(c_subs, stats);
+}
+
 template <class MessageType, class ContextClass>
 class LCMTypedSubscription : public Subscription {
     friend class LCM;
@@ -216,6 +222,26 @@ LCM::handleTimeout(int timeout_millis) {
     return lcm_handle_timeout(this->lcm, timeout_millis);
 }
 
+inline int
+LCM::handleBatch(int max_msgs, int timeout_millis) {
+    if(!this->lcm) {
+        fprintf(stderr,
+            "LCM instance not initialized.  Ignoring call to handleBatch()\n");
+        return -1;
+    }
+    return lcm_handle_batch(this->lcm, max_msgs, timeout_millis);
+}
+
+inline int
+LCM::getStats(lcm_stats_t* stats) {
+    if(!this->lcm) {
+        fprintf(stderr,
+            "LCM instance not initialized.  Ignoring call to getStats()\n");
+        return -1;
+    }
+    return lcm_get_stats(this->lcm, stats);
+}
+
 template <class MessageType, class MessageHandlerClass>
 Subscription*
 LCM::subscribe(const std::string& channel,
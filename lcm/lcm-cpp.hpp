@@ -130,6 +130,29 @@ class LCM {
          */
         inline int handleTimeout(int timeout_millis);
 
+        /**
+         * @brief Waits for and dispatches a batch of messages, with a
+         * timeout.
+         *
+         * New in LCM 1.4.0.
+         *
+         * @return the number of messages handled, 0 if the function timed
+         * out, and <0 if an error occured.
+         * @sa lcm_handle_batch()
+         */
+        inline int handleBatch(int max_msgs, int timeout_millis);
+
+        /**
+         * @brief Retrieves receive statistics.  @c stats->size must be set
+         * to sizeof(lcm_stats_t) first.
+         *
+         * New in LCM 1.4.0.
+         *
+         * @return 0 on success, -1 on failure.
+         * @sa lcm_get_stats()
+         */
+        inline int getStats(lcm_stats_t* stats);
+
         /**
          * @brief Subscribes a callback method of an object to a channel, with
          * automatic message decoding.
@@ -449,6 +472,17 @@ class Subscription {
          */
         inline int getQueueSize() const;
 
+        /**
+         * @brief Retrieves receive statistics of this subscription.
+         * @c stats->size must be set to sizeof(lcm_subscription_stats_t)
+         * first.
+         *
+         * New in LCM 1.4.0.
+         *
+         * @sa lcm_subscription_get_stats()
+         */
+        inline int getStats(lcm_subscription_stats_t* stats) const;
+
     friend class LCM;
     protected:
         Subscription() {};
@@ -1,8 +1,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
+#include <errno.h>
 #include <assert.h>
 
 #include <glib.h>
@@ -15,10 +17,16 @@
 #include "windows/WinPorting.h"
 #include <winsock2.h>
 #else
+#include <fcntl.h>
 #include <sys/select.h>
 typedef int SOCKET;
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#define HAVE_EVENTFD
+#endif
+
 #define LCM_DEFAULT_URL "udpm://239.255.76.67:7667?ttl=0"
 
 struct _lcm_t {
@@ -26,27 +34,56 @@ struct _lcm_t {
     GStaticRecMutex handle_mutex;  // only one thread allowed in lcm_handle at a time
 
     GPtrArray   *handlers_all;  // list containing *all* handlers
-    GHashTable  *handlers_map;  // map of channel name (string) to GPtrArray 
-                                // of matching handlers (lcm_subscription_t*)
+    GHashTable  *handlers_map;  // map of channel name (string) to the
+                                // interned lcm_channel_t for that channel
 
     lcm_provider_vtable_t * vtable;
     lcm_provider_t * provider;
 
     int default_max_num_queued_messages;
     int in_handle;
+
+    // receive statistics, guarded by mutex
+    uint64_t messages_dropped;
+    uint64_t messages_dispatched;
+    uint64_t latency_usec[LCM_STATS_LATENCY_BUCKETS];
+};
+
+// A channel name that has been seen, and the subscriptions that match it.
+// Channels are only freed by lcm_destroy(), so providers can hold on to them.
+struct _lcm_channel_t {
+    char        *name;
+    GPtrArray   *handlers;      // matching handlers (lcm_subscription_t*)
 };
 
+// How a subscription's channel pattern is matched against channel names.
+// Patterns without any regular expression syntax, and patterns that are such
+// a string followed by ".*", are compared directly instead of with a GRegex.
+typedef enum {
+    LCM_MATCH_LITERAL,
+    LCM_MATCH_PREFIX,
+    LCM_MATCH_REGEX
+} lcm_match_type_t;
+
 struct _lcm_subscription_t {
     char             *channel;
     lcm_msg_handler_t  handler;
     void             *userdata;
     lcm_t* lcm;
-    GRegex * regex;
+    lcm_match_type_t match_type;
+    size_t prefix_len;          // length of the literal part of a prefix match
+    GRegex * regex;             // NULL unless match_type is LCM_MATCH_REGEX
     int callback_scheduled;
     int marked_for_deletion;
 
     int max_num_queued_messages;
     int num_queued_messages;
+
+    // receive statistics, guarded by lcm->mutex
+    int max_num_queued_messages_seen;
+    uint64_t num_handled_messages;
+    uint64_t num_dropped_messages;
+    uint64_t latency_usec[LCM_STATS_LATENCY_BUCKETS];
 };
 
 extern void lcm_udpm_provider_init (GPtrArray * providers);
@@ -153,21 +190,23 @@ fail:
     return NULL;
 }
 
-// free the array that we associate for each channel, and the key. Don't free
-// the lcm_subscription_t*s.
+// free the channel record, which also owns the key.  Don't free the
+// lcm_subscription_t*s.
 static void 
 map_free_handlers_callback(gpointer _key, gpointer _value, gpointer _data)
 {
-    GPtrArray *handlers = (GPtrArray*) _value;
-    g_ptr_array_free(handlers, TRUE);
-    free(_key);
+    lcm_channel_t *chan = (lcm_channel_t*) _value;
+    g_ptr_array_free(chan->handlers, TRUE);
+    free(chan->name);
+    free(chan);
 }
 
 static void
 lcm_handler_free (lcm_subscription_t *h) 
 {
     assert (!h->callback_scheduled);
-    g_regex_unref(h->regex);
+    if (h->regex)
+        g_regex_unref(h->regex);
     free (h->channel);
     memset (h, 0, sizeof (lcm_subscription_t));
     free (h);
@@ -220,23 +259,32 @@ lcm_handle (lcm_t * lcm)
         return -1;
 }
 
-int
-lcm_handle_timeout (lcm_t *lcm, int timeout_milis)
+// waits up to timeout_millis for fd to become readable, or indefinitely if
+// timeout_millis is negative.  Returns >0 if readable, 0 on timeout and <0 on
+// error.
+static int
+wait_for_readable (SOCKET fd, int timeout_millis)
 {
-  fd_set fds;
-  FD_ZERO(&fds);
-  SOCKET lcm_fd = lcm_get_fileno(lcm);
-  FD_SET(lcm_fd, &fds);
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = timeout_millis / 1000;
+    timeout.tv_usec = (timeout_millis % 1000) * 1000;
 
-  struct timeval timeout;
-  timeout.tv_sec = timeout_milis / 1000;
-  timeout.tv_usec = (timeout_milis % 1000) * 1000;
+    return select(fd + 1, &fds, NULL, NULL,
+            timeout_millis < 0 ? NULL : &timeout);
+}
 
+int
+lcm_handle_timeout (lcm_t *lcm, int timeout_milis)
+{
   if (timeout_milis < 0) {
       return -1;
   }
 
-  int select_result = select(lcm_fd + 1, &fds, NULL, NULL, &timeout);
+  int select_result = wait_for_readable(lcm_get_fileno(lcm), timeout_milis);
   if (select_result > 0) {
       int lcm_handle_result = lcm_handle(lcm);
       return lcm_handle_result == 0 ? 1 : lcm_handle_result;
@@ -247,6 +295,66 @@ lcm_handle_timeout (lcm_t *lcm, int timeout_milis)
   }
 }
 
+int
+lcm_handle_batch (lcm_t *lcm, int max_msgs, int timeout_millis)
+{
+    if (!lcm->provider || !lcm->vtable->handle || max_msgs <= 0)
+        return -1;
+
+    SOCKET lcm_fd = lcm_get_fileno(lcm);
+    int select_result = wait_for_readable(lcm_fd, timeout_millis);
+    if (select_result <= 0)
+        return select_result;
+
+    int nhandled = 0;
+    g_static_rec_mutex_lock (&lcm->handle_mutex);
+    assert(!lcm->in_handle); // recursive calls to lcm_handle are not allowed
+    lcm->in_handle = 1;
+    if (lcm->vtable->handle_batch) {
+        nhandled = lcm->vtable->handle_batch (lcm->provider, max_msgs);
+    } else {
+        // the provider can only dispatch one message at a time.  Keep going
+        // for as long as more messages are immediately available.
+        while (nhandled < max_msgs) {
+            if (0 != lcm->vtable->handle (lcm->provider)) {
+                if (!nhandled)
+                    nhandled = -1;
+                break;
+            }
+            nhandled++;
+            if (wait_for_readable(lcm_fd, 0) <= 0)
+                break;
+        }
+    }
+    lcm->in_handle = 0;
+    g_static_rec_mutex_unlock (&lcm->handle_mutex);
+    return nhandled;
+}
+
+int
+lcm_get_stats (lcm_t * lcm, lcm_stats_t * stats)
+{
+    // the caller may have been compiled against an older, smaller struct
+    uint32_t size = stats->size;
+    if (size < offsetof (lcm_stats_t, packets_received))
+        return -1;
+    lcm_stats_t all;
+    memset (&all, 0, sizeof (lcm_stats_t));
+    if (lcm->provider && lcm->vtable->get_stats &&
+            0 != lcm->vtable->get_stats (lcm->provider, &all))
+        return -1;
+
+    g_static_rec_mutex_lock (&lcm->mutex);
+    all.messages_dropped = lcm->messages_dropped;
+    all.messages_dispatched = lcm->messages_dispatched;
+    memcpy (all.latency_usec, lcm->latency_usec, sizeof (all.latency_usec));
+    g_static_rec_mutex_unlock (&lcm->mutex);
+
+    memcpy (stats, &all, MIN (size, sizeof (lcm_stats_t)));
+    stats->size = size;
+    return 0;
+}
+
 int
 lcm_get_fileno (lcm_t * lcm)
 {
@@ -269,7 +377,30 @@ lcm_publish (lcm_t *lcm, const char *channel, const void *data,
 static int 
 is_handler_subscriber(lcm_subscription_t *h, const char *channel_name)
 {
-    return g_regex_match(h->regex, channel_name, (GRegexMatchFlags) 0, NULL);
+    switch (h->match_type) {
+        case LCM_MATCH_LITERAL:
+            return !strcmp(h->channel, channel_name);
+        case LCM_MATCH_PREFIX:
+            return !strncmp(h->channel, channel_name, h->prefix_len);
+        default:
+            return g_regex_match(h->regex, channel_name,
+                    (GRegexMatchFlags) 0, NULL);
+    }
+}
+
+// Decides how to match a subscription's channel pattern.  Returns the length
+// of the pattern's literal part through prefix_len.
+static lcm_match_type_t
+classify_channel_pattern(const char *channel, size_t *prefix_len)
+{
+    // everything that means something to a regular expression
+    size_t len = strcspn(channel, "\\^$.|?*+()[]{}");
+    *prefix_len = len;
+    if (!channel[len])
+        return LCM_MATCH_LITERAL;
+    if (!strcmp(channel + len, ".*"))
+        return LCM_MATCH_PREFIX;
+    return LCM_MATCH_REGEX;
 }
 
 // add the handler to any channel's handler list if its subscription matches
@@ -277,13 +408,12 @@ static void
 map_add_handler_callback(gpointer _key, gpointer _value, gpointer _data)
 {
     lcm_subscription_t *h = (lcm_subscription_t*) _data;
-    char *channel_name = (char*) _key;
-    GPtrArray *handlers = (GPtrArray*) _value;
+    lcm_channel_t *chan = (lcm_channel_t*) _value;
 
-    if (!is_handler_subscriber(h, channel_name))
+    if (!is_handler_subscriber(h, chan->name))
         return;
     
-    g_ptr_array_add(handlers, h);
+    g_ptr_array_add(chan->handlers, h);
 }
 
 // remove from a channel's handler list
@@ -292,8 +422,8 @@ map_remove_handler_callback(gpointer _key, gpointer _value,
         gpointer _data)
 {
     lcm_subscription_t *h = (lcm_subscription_t*) _data;
-    GPtrArray *handlers = (GPtrArray*) _value;
-    g_ptr_array_remove_fast(handlers, h);
+    lcm_channel_t *chan = (lcm_channel_t*) _value;
+    g_ptr_array_remove_fast(chan->handlers, h);
 }
 
 lcm_subscription_t
@@ -319,16 +449,20 @@ lcm_subscription_t
     h->num_queued_messages = 0;
     h->lcm = lcm;
 
-    char *regexbuf = g_strdup_printf("^%s$", channel);
-    GError *rerr = NULL;
-    h->regex = g_regex_new(regexbuf, (GRegexCompileFlags) 0, (GRegexMatchFlags) 0, &rerr);
-    g_free(regexbuf);
-    if(rerr) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, rerr->message);
-        dbg(DBG_LCM, "%s: %s\n", __FUNCTION__, rerr->message);
-        g_error_free(rerr);
-        free(h);
-        return NULL;
+    h->match_type = classify_channel_pattern(channel, &h->prefix_len);
+    if (h->match_type == LCM_MATCH_REGEX) {
+        char *regexbuf = g_strdup_printf("^%s$", channel);
+        GError *rerr = NULL;
+        h->regex = g_regex_new(regexbuf, (GRegexCompileFlags) 0, (GRegexMatchFlags) 0, &rerr);
+        g_free(regexbuf);
+        if(rerr) {
+            fprintf(stderr, "%s: %s\n", __FUNCTION__, rerr->message);
+            dbg(DBG_LCM, "%s: %s\n", __FUNCTION__, rerr->message);
+            g_error_free(rerr);
+            free(h->channel);
+            free(h);
+            return NULL;
+        }
     }
     g_static_rec_mutex_lock (&lcm->mutex);
     g_ptr_array_add(lcm->handlers_all, h);
@@ -366,68 +500,118 @@ lcm_unsubscribe (lcm_t *lcm, lcm_subscription_t *h)
 
 /* ==== Internal API for Providers ==== */
 
-GPtrArray *
-lcm_get_handlers (lcm_t * lcm, const char * channel)
+lcm_channel_t *
+lcm_get_channel (lcm_t * lcm, const char * channel)
 {
     g_static_rec_mutex_lock (&lcm->mutex);
-    GPtrArray * handlers = (GPtrArray *) g_hash_table_lookup (lcm->handlers_map, channel);
-    if (handlers)
+    lcm_channel_t * chan = (lcm_channel_t *) g_hash_table_lookup (lcm->handlers_map, channel);
+    if (chan)
         goto finished;
 
     // if we haven't seen this channel name before, create a new list
     // of subscribed handlers.
-    handlers = g_ptr_array_new ();
-    // alloc channel name
-    g_hash_table_insert (lcm->handlers_map, strdup(channel), handlers);
+    chan = (lcm_channel_t *) malloc (sizeof (lcm_channel_t));
+    chan->name = strdup (channel);
+    chan->handlers = g_ptr_array_new ();
+    g_hash_table_insert (lcm->handlers_map, chan->name, chan);
 
     // find all the matching handlers
     for (unsigned int i = 0; i < lcm->handlers_all->len; i++) {
         lcm_subscription_t *h = (lcm_subscription_t *) g_ptr_array_index (lcm->handlers_all, i);
         if (is_handler_subscriber (h, channel))
-            g_ptr_array_add(handlers, h);
+            g_ptr_array_add(chan->handlers, h);
     }
 
 finished:
     g_static_rec_mutex_unlock (&lcm->mutex);
-    return handlers;
+    return chan;
+}
+
+const char *
+lcm_channel_name (const lcm_channel_t * chan)
+{
+    return chan->name;
 }
 
 int
-lcm_try_enqueue_message(lcm_t* lcm, const char* channel)
+lcm_try_enqueue_channel_message (lcm_t * lcm, lcm_channel_t * chan)
 {
     g_static_rec_mutex_lock (&lcm->mutex);
-    GPtrArray * handlers = lcm_get_handlers (lcm, channel);
+    GPtrArray * handlers = chan->handlers;
     int num_keepers = 0;
     for(unsigned int i=0; i<handlers->len; i++) {
         lcm_subscription_t* h = (lcm_subscription_t*) g_ptr_array_index(handlers, i);
         if(h->num_queued_messages < h->max_num_queued_messages ||
                 h->max_num_queued_messages <= 0) {
             h->num_queued_messages++;
+            if (h->num_queued_messages > h->max_num_queued_messages_seen)
+                h->max_num_queued_messages_seen = h->num_queued_messages;
             num_keepers++;
+        } else {
+            h->num_dropped_messages++;
         }
     }
+    if (!num_keepers && handlers->len)
+        lcm->messages_dropped++;
     g_static_rec_mutex_unlock (&lcm->mutex);
     return num_keepers > 0;
 }
 
 int
-lcm_has_handlers (lcm_t * lcm, const char * channel)
+lcm_try_enqueue_message(lcm_t* lcm, const char* channel)
+{
+    return lcm_try_enqueue_channel_message (lcm, lcm_get_channel (lcm, channel));
+}
+
+int
+lcm_channel_has_handlers (lcm_t * lcm, lcm_channel_t * chan)
 {
-    int has_handlers = 1;
     g_static_rec_mutex_lock (&lcm->mutex);
-    GPtrArray * handlers = lcm_get_handlers (lcm, channel);
-    if (!handlers || !handlers->len)
-        has_handlers = 0;
+    int has_handlers = chan->handlers->len > 0;
     g_static_rec_mutex_unlock (&lcm->mutex);
     return has_handlers;
 }
 
+int
+lcm_has_handlers (lcm_t * lcm, const char * channel)
+{
+    return lcm_channel_has_handlers (lcm, lcm_get_channel (lcm, channel));
+}
+
 int
 lcm_dispatch_handlers (lcm_t * lcm, lcm_recv_buf_t * buf, const char *channel)
+{
+    return lcm_dispatch_channel_handlers (lcm, buf,
+            lcm_get_channel (lcm, channel));
+}
+
+// Index of the latency histogram bucket for a latency in microseconds.
+static int
+latency_bucket (int64_t usec)
+{
+    int bucket = 0;
+    while (usec > 0 && bucket < LCM_STATS_LATENCY_BUCKETS - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+int
+lcm_dispatch_channel_handlers (lcm_t * lcm, lcm_recv_buf_t * buf,
+        lcm_channel_t * chan)
 {
     g_static_rec_mutex_lock (&lcm->mutex);
 
-    GPtrArray * handlers = lcm_get_handlers (lcm, channel);
+    GPtrArray * handlers = chan->handlers;
+    const char * channel = chan->name;
+
+    GTimeVal now;
+    g_get_current_time (&now);
+    int latency = latency_bucket ((int64_t) now.tv_sec * 1000000 +
+            now.tv_usec - buf->recv_utime);
+    lcm->messages_dispatched++;
+    lcm->latency_usec[latency]++;
 
     // ref the handlers to prevent them from being destroyed by an
     // lcm_unsubscribe.  This guarantees that handlers 0-(nhandlers-1) will not
@@ -445,6 +629,8 @@ lcm_dispatch_handlers (lcm_t * lcm, lcm_recv_buf_t * buf, const char *channel)
         lcm_subscription_t *h = (lcm_subscription_t *) g_ptr_array_index(handlers, i);
         if (!h->marked_for_deletion && h->num_queued_messages > 0) {
             h->num_queued_messages--;
+            h->num_handled_messages++;
+            h->latency_usec[latency]++;
             int depth = g_static_rec_mutex_unlock_full (&lcm->mutex);
             h->handler (buf, channel, h->userdata);
             g_static_rec_mutex_lock_full (&lcm->mutex, depth);
@@ -472,6 +658,98 @@ lcm_dispatch_handlers (lcm_t * lcm, lcm_recv_buf_t * buf, const char *channel)
     return 0;
 }
 
+int
+lcm_notify_init (lcm_notify_t * notify)
+{
+    notify->signaled = 0;
+#ifdef HAVE_EVENTFD
+    notify->fds[0] = notify->fds[1] = eventfd (0, EFD_NONBLOCK);
+    return notify->fds[0] < 0 ? -1 : 0;
+#else
+    if (0 != lcm_internal_pipe_create (notify->fds)) {
+        notify->fds[0] = notify->fds[1] = -1;
+        return -1;
+    }
+#ifndef WIN32
+    // never more than one byte in the pipe, but don't ever block on it
+    fcntl (notify->fds[0], F_SETFL, O_NONBLOCK);
+    fcntl (notify->fds[1], F_SETFL, O_NONBLOCK);
+#endif
+    return 0;
+#endif
+}
+
+void
+lcm_notify_destroy (lcm_notify_t * notify)
+{
+    if (notify->fds[1] >= 0 && notify->fds[1] != notify->fds[0])
+        lcm_internal_pipe_close (notify->fds[1]);
+    if (notify->fds[0] >= 0)
+        lcm_internal_pipe_close (notify->fds[0]);
+    notify->fds[0] = notify->fds[1] = -1;
+}
+
+int
+lcm_notify_fileno (const lcm_notify_t * notify)
+{
+    return notify->fds[0];
+}
+
+int
+lcm_notify_signal (lcm_notify_t * notify)
+{
+    if (g_atomic_int_get (&notify->signaled))
+        return 0;
+    // Set the flag first, so that lcm_notify_wait() never sees a readable
+    // descriptor without the flag and spins until it is set.
+    g_atomic_int_set (&notify->signaled, 1);
+#ifdef HAVE_EVENTFD
+    uint64_t one = 1;
+    if (write (notify->fds[1], &one, sizeof (one)) < 0) {
+#else
+    if (lcm_internal_pipe_write (notify->fds[1], "+", 1) < 0) {
+#endif
+        perror ("lcm_notify_signal");
+        g_atomic_int_set (&notify->signaled, 0);
+        return -1;
+    }
+    return 0;
+}
+
+int
+lcm_notify_clear (lcm_notify_t * notify)
+{
+    if (!g_atomic_int_get (&notify->signaled))
+        return 0;
+#ifdef HAVE_EVENTFD
+    uint64_t count;
+    if (read (notify->fds[0], &count, sizeof (count)) < 0) {
+#else
+    char ch;
+    if (lcm_internal_pipe_read (notify->fds[0], &ch, 1) < 0) {
+#endif
+        perror ("lcm_notify_clear");
+        return -1;
+    }
+    g_atomic_int_set (&notify->signaled, 0);
+    return 0;
+}
+
+int
+lcm_notify_wait (lcm_notify_t * notify)
+{
+    // The flag is authoritative.  The descriptor only tells us when to look
+    // at it again.
+    while (!g_atomic_int_get (&notify->signaled)) {
+        fd_set fds;
+        FD_ZERO (&fds);
+        FD_SET (notify->fds[0], &fds);
+        if (select (notify->fds[0] + 1, &fds, NULL, NULL, NULL) < 0)
+            return -1;
+    }
+    return 0;
+}
+
 int
 lcm_parse_url (const char * url, char ** provider, char ** network,
         GHashTable * args)
@@ -535,3 +813,28 @@ int lcm_subscription_get_queue_size(lcm_subscription_t* subs)
     g_static_rec_mutex_unlock(&subs->lcm->mutex);
     return result;
 }
+
+int
+lcm_subscription_get_stats(lcm_subscription_t* subs,
+        lcm_subscription_stats_t* stats)
+{
+    // the caller may have been compiled against an older, smaller struct
+    uint32_t size = stats->size;
+    if (size < offsetof(lcm_subscription_stats_t, messages_handled))
+        return -1;
+    lcm_subscription_stats_t all;
+    memset(&all, 0, sizeof(all));
+
+    g_static_rec_mutex_lock(&subs->lcm->mutex);
+    all.messages_handled = subs->num_handled_messages;
+    all.messages_dropped = subs->num_dropped_messages;
+    all.queue_size = subs->num_queued_messages;
+    all.queue_size_high_water = subs->max_num_queued_messages_seen;
+    all.queue_capacity = MAX(subs->max_num_queued_messages, 0);
+    memcpy(all.latency_usec, subs->latency_usec, sizeof(all.latency_usec));
+    g_static_rec_mutex_unlock(&subs->lcm->mutex);
+
+    memcpy(stats, &all, MIN(size, sizeof(all)));
+    stats->size = size;
+    return 0;
+}
@@ -121,6 +121,36 @@ typedef void (*lcm_msg_handler_t) (const lcm_recv_buf_t *rbuf,
          ttl = N
              time to live of transmitted packets.  Default 0
 
+         recv_batch = N
+             maximum number of datagrams to drain from the socket with a
+             single system call (Linux recvmmsg).  Values greater than 1
+             reduce per-packet overhead under high packet rates.  Default 1.
+             Ignored on platforms without recvmmsg.
+
+         zero_copy_frags = true | false
+             receive the fragments of large messages directly into the
+             buffer that the message is reassembled in, instead of copying
+             them there.  Saves copying each large message once, at the cost
+             of one extra system call per received packet.  Can't be combined
+             with recv_batch.  Linux only.  Default false.
+
+         interleave_frags = true | false
+             let threads that publish large messages at the same time
+             transmit their fragments concurrently, instead of one message
+             after another.  Receivers in older LCM releases and in the Java
+             implementation can only reassemble one message per sender at a
+             time, and drop the others, so enable this only if all receivers
+             use this library.  Default false.
+
+         channel_filter = true | false
+             attach a socket filter that drops messages on channels that
+             nobody subscribed to in the kernel, before they are copied to
+             the receive thread.  The filter is rebuilt on every subscribe
+             and unsubscribe.  It matches literal channel names and
+             "prefix.*" patterns; while any other regular expression is
+             subscribed, all messages are received.  Linux only.  Default
+             false.
+
      examples:
          "udpm://239.255.76.67:7667"
              Default initialization string
@@ -146,7 +176,11 @@ typedef void (*lcm_msg_handler_t) (const lcm_recv_buf_t *rbuf,
              Defaults to 1.  If less than or equal to zero, then the events
              in the log file are played back as fast as possible.  Events are
              never skipped in read mode, so actual playback speed may be slower
-             than requested, depending on the handlers.
+             than requested, depending on the handlers.  When playing back as
+             fast as possible, no timer is used, and lcm_handle_batch
+             dispatches up to its max_msgs events per call.  In read mode,
+             lcm_get_stats reports the events and bytes read from the log
+             file as packets_received and bytes_received.
 
          mode = r | w
              Specifies the log file mode.  Defaults to 'r'
@@ -158,6 +192,23 @@ typedef void (*lcm_msg_handler_t) (const lcm_recv_buf_t *rbuf,
              log file.  If it is after the last event, calls to lcm_handle will
              return -1.
 
+         skip_unsubscribed = [true|false]
+             In read mode, skip events on channels that have no subscribers
+             without reading their data, using the index of the log file if
+             it has one.  Reading a few channels out of a large log file is
+             then much faster.  Subscriptions are checked when the event
+             before is handled (or read ahead, see readahead_mb), and each
+             call to lcm_handle handles an event that has subscribers.
+             Defaults to false.
+
+         readahead_mb = N
+             In read mode, read up to N MB of events ahead of playback in a
+             background thread, so that playback timing isn't disturbed by
+             slow reads.  Events that were read ahead are handed over in
+             batches, so up to 2N MB may be buffered.  Reading ahead starts
+             with the first call to lcm_handle.  Defaults to 0, which reads
+             each event when the one before it has been handled.
+
      examples:
          "file:///home/albert/path/to/logfile"
              Loads the file "/home/albert/path/to/logfile" as an LCM event
@@ -325,6 +376,30 @@ int lcm_handle (lcm_t *lcm);
 LCM_EXPORT
 int lcm_handle_timeout (lcm_t *lcm, int timeout_millis);
 
+/**
+ * @brief Wait for and dispatch a batch of incoming messages.
+ *
+ * Waits up to @p timeout_millis milliseconds for a message to arrive, and then
+ * dispatches it along with any other messages that are already queued, up to
+ * a total of @p max_msgs.  Providers that queue received messages internally
+ * dequeue the whole batch at once, which makes this considerably cheaper than
+ * calling lcm_handle() once per message for high-rate subscribers.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param lcm the %LCM object
+ * @param max_msgs the maximum number of messages to dispatch.  Must be
+ *        greater than 0.
+ * @param timeout_millis the maximum amount of time to wait for the first
+ *        message, in milliseconds.  If 0, then only dispatches messages that
+ *        are already available.  If less than 0, then waits indefinitely.
+ *
+ * @return the number of messages dispatched, 0 if the function timed out, and
+ * <0 if an error occured.
+ */
+LCM_EXPORT
+int lcm_handle_batch (lcm_t *lcm, int max_msgs, int timeout_millis);
+
 /**
  * @brief Adjusts the maximum number of received messages that can be queued up
  * for a subscription.
@@ -352,6 +427,154 @@ int lcm_subscription_set_queue_capacity(lcm_subscription_t* handler, int num_mes
 LCM_EXPORT
 int lcm_subscription_get_queue_size(lcm_subscription_t* handler);
 
+/**
+ * Number of buckets in the latency histograms of lcm_stats_t and
+ * lcm_subscription_stats_t.
+ */
+#define LCM_STATS_LATENCY_BUCKETS 32
+
+/**
+ * @brief Receive statistics of an %LCM instance.  See lcm_get_stats().
+ *
+ * Counters that a provider doesn't keep are left at 0.  Fields may be added
+ * at the end in later releases, so callers must set @c size.
+ */
+typedef struct _lcm_stats_t lcm_stats_t;
+struct _lcm_stats_t
+{
+    /**
+     * set by the caller to sizeof(lcm_stats_t).  Only the fields that fit
+     * in @c size bytes are filled in.
+     */
+    uint32_t size;
+    /**
+     * packets received by the provider
+     */
+    uint64_t packets_received;
+    /**
+     * bytes of message data in the packets received by the provider
+     */
+    uint64_t bytes_received;
+    /**
+     * packets discarded because they were malformed, or couldn't be received
+     */
+    uint64_t packets_bad;
+    /**
+     * fragments of large messages discarded because their message wasn't
+     * being reassembled, e.g., because its first fragment was lost, or
+     * nobody subscribed to it
+     */
+    uint64_t fragments_dropped;
+    /**
+     * partially received messages discarded to make room for newer ones
+     */
+    uint64_t reassembly_evictions;
+    /**
+     * partially received messages discarded because the rest of the message
+     * didn't arrive in time
+     */
+    uint64_t reassembly_expirations;
+    /**
+     * messages discarded because the queues of all their subscriptions were
+     * full.  See lcm_subscription_set_queue_capacity().
+     */
+    uint64_t messages_dropped;
+    /**
+     * messages dispatched to subscriptions
+     */
+    uint64_t messages_dispatched;
+    /**
+     * most bytes of the receive buffer that were ever in use at once
+     */
+    uint64_t recv_buf_high_water;
+    /**
+     * current size of the receive buffer, in bytes
+     */
+    uint64_t recv_buf_capacity;
+    /**
+     * time between the receipt and the dispatch of messages.  Bucket 0
+     * counts messages dispatched in less than 1 microsecond, and bucket i
+     * those dispatched in 2^(i-1) to 2^i - 1 microseconds.  The last bucket
+     * also counts everything slower.
+     */
+    uint64_t latency_usec[LCM_STATS_LATENCY_BUCKETS];
+};
+
+/**
+ * @brief Receive statistics of a subscription.  See
+ * lcm_subscription_get_stats().
+ *
+ * Fields may be added at the end in later releases, so callers must set
+ * @c size.
+ */
+typedef struct _lcm_subscription_stats_t lcm_subscription_stats_t;
+struct _lcm_subscription_stats_t
+{
+    /**
+     * set by the caller to sizeof(lcm_subscription_stats_t).  Only the
+     * fields that fit in @c size bytes are filled in.
+     */
+    uint32_t size;
+    /**
+     * messages passed to the subscription's handler
+     */
+    uint64_t messages_handled;
+    /**
+     * messages not queued for the subscription because its queue was full
+     */
+    uint64_t messages_dropped;
+    /**
+     * number of messages currently queued
+     */
+    int queue_size;
+    /**
+     * largest number of messages that were ever queued at once
+     */
+    int queue_size_high_water;
+    /**
+     * maximum number of messages that can be queued.  0 means no limit.
+     */
+    int queue_capacity;
+    /**
+     * time between the receipt of messages and the call of the handler, in
+     * the same buckets as lcm_stats_t::latency_usec.
+     */
+    uint64_t latency_usec[LCM_STATS_LATENCY_BUCKETS];
+};
+
+/**
+ * @brief Retrieve receive statistics of an %LCM instance.
+ *
+ * All counters are cumulative since the instance was created.  Latencies are
+ * measured from the message's @c recv_utime, so they are meaningless for the
+ * log file provider.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param lcm the %LCM object
+ * @param stats filled in with the statistics.  @c stats->size must be set
+ *        first.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+LCM_EXPORT
+int lcm_get_stats(lcm_t *lcm, lcm_stats_t *stats);
+
+/**
+ * @brief Retrieve receive statistics of a subscription.
+ *
+ * New in LCM 1.4.0.
+ *
+ * @param handler the subscription object
+ * @param stats filled in with the statistics.  @c stats->size must be set
+ *        first.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+LCM_EXPORT
+int lcm_subscription_get_stats(lcm_subscription_t *handler,
+        lcm_subscription_stats_t *stats);
+
 /**
  * @}
  */
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 #ifndef WIN32
@@ -20,6 +21,13 @@ typedef enum {
   LCM_LOGPROV_APPEND_MODE=2,
 } lcm_log_provider_mode_t;
 
+// An event read ahead of playback
+typedef struct _prefetched_event_t prefetched_event_t;
+struct _prefetched_event_t {
+    lcm_eventlog_view_t event;
+    lcm_eventlog_event_t * stdio_event;     // owns event's memory, if set
+};
+
 typedef struct _lcm_provider_t lcm_logprov_t;
 struct _lcm_provider_t {
     lcm_t * lcm;
@@ -30,7 +38,33 @@ struct _lcm_provider_t {
     lcm_log_provider_mode_t log_mode;
 
     lcm_eventlog_t * log;
-    lcm_eventlog_event_t * event;
+    // in read mode, the log is memory mapped where possible, and read with
+    // stdio otherwise.  event holds the event read last in either case.
+    lcm_eventlog_reader_t * reader;
+    lcm_eventlog_event_t * stdio_event;
+    lcm_eventlog_view_t event;
+    int have_event;
+    char channel[1000];     // NUL-terminated channel name of event
+
+    // skip events on channels that have no subscribers while reading
+    int skip_unsubscribed;
+
+    // In read mode, events can be read ahead of playback by a prefetch
+    // thread, so that I/O doesn't delay playback.  The prefetch thread
+    // queues up to readahead bytes of events.
+    int64_t readahead;
+    GThread *prefetch_thread;
+    GMutex *prefetch_mutex;
+    GCond *prefetch_cond;       // broadcast whenever the queue changes
+    GQueue *prefetch_queue;
+    GQueue *ready_queue;        // events handed over to lcm_handle()
+    int64_t prefetch_bytes;
+    int prefetch_done;          // set by the prefetch thread at end of file
+    volatile int prefetch_exit; // tells the prefetch thread to exit
+
+    // events handed to lcm_try_enqueue_channel_message(), and their size
+    int64_t events_read;
+    int64_t bytes_read;
 
     double speed;
     int64_t next_clock_time;
@@ -38,7 +72,7 @@ struct _lcm_provider_t {
 
     int thread_created;
     GThread *timer_thread;
-    int notify_pipe[2];
+    lcm_notify_t notify;    // signaled while the current event is due
     int timer_pipe[2];
 };
 
@@ -56,13 +90,38 @@ lcm_logprov_destroy (lcm_logprov_t *lr)
         g_thread_join (lr->timer_thread);
     }
 
-    if(lr->notify_pipe[0] >= 0) lcm_internal_pipe_close(lr->notify_pipe[0]);
-    if(lr->notify_pipe[1] >= 0) lcm_internal_pipe_close(lr->notify_pipe[1]);
+    if (lr->prefetch_thread) {
+        g_mutex_lock (lr->prefetch_mutex);
+        lr->prefetch_exit = 1;
+        g_cond_broadcast (lr->prefetch_cond);
+        g_mutex_unlock (lr->prefetch_mutex);
+        g_thread_join (lr->prefetch_thread);
+    }
+    GQueue *queues[] = { lr->prefetch_queue, lr->ready_queue };
+    for (int i = 0; i < 2; i++) {
+        if (!queues[i])
+            continue;
+        prefetched_event_t *pe;
+        while ((pe = (prefetched_event_t *) g_queue_pop_head (queues[i]))) {
+            if (pe->stdio_event)
+                lcm_eventlog_free_event (pe->stdio_event);
+            free (pe);
+        }
+        g_queue_free (queues[i]);
+    }
+    if (lr->prefetch_cond)
+        g_cond_free (lr->prefetch_cond);
+    if (lr->prefetch_mutex)
+        g_mutex_free (lr->prefetch_mutex);
+
+    lcm_notify_destroy(&lr->notify);
     if(lr->timer_pipe[0] >= 0)  lcm_internal_pipe_close(lr->timer_pipe[0]);
     if(lr->timer_pipe[1] >= 0)  lcm_internal_pipe_close(lr->timer_pipe[1]);
 
-    if (lr->event)
-        lcm_eventlog_free_event (lr->event);
+    if (lr->stdio_event)
+        lcm_eventlog_free_event (lr->stdio_event);
+    if (lr->reader)
+        lcm_eventlog_reader_destroy (lr->reader);
     if (lr->log)
         lcm_eventlog_destroy (lr->log);
 
@@ -105,14 +164,10 @@ timer_thread (void * user)
 
             if (0 == status) {
                 // select timed out
-                if(lcm_internal_pipe_write(lr->notify_pipe[1], "+", 1) < 0) {
-                    perror(__FILE__ " - write (timer select)");
-                }
+                lcm_notify_signal(&lr->notify);
             }
         } else {
-            if(lcm_internal_pipe_write(lr->notify_pipe[1], "+", 1) < 0) {
-                perror(__FILE__ " - write (timer)");
-            }
+            lcm_notify_signal(&lr->notify);
        }
     }
     perror ("timer_thread read failed");
@@ -133,6 +188,21 @@ new_argument (gpointer key, gpointer value, gpointer user)
         lr->start_timestamp = strtoll ((char *) value, &endptr, 10);
         if (endptr == value)
             fprintf (stderr, "Warning: Invalid value for start_timestamp\n");
+    } else if (!strcmp ((char *) key, "skip_unsubscribed")) {
+        if (!strcmp ((char *) value, "true") || !strcmp ((char *) value, "1"))
+            lr->skip_unsubscribed = 1;
+        else if (!strcmp ((char *) value, "false") ||
+                !strcmp ((char *) value, "0"))
+            lr->skip_unsubscribed = 0;
+        else
+            fprintf (stderr, "Warning: Invalid value for skip_unsubscribed\n");
+    } else if (!strcmp ((char *) key, "readahead_mb")) {
+        char *endptr = NULL;
+        double readahead_mb = strtod ((char *) value, &endptr);
+        if (endptr == value || readahead_mb < 0)
+            fprintf (stderr, "Warning: Invalid value for readahead_mb\n");
+        else
+            lr->readahead = (int64_t) (readahead_mb * (1 << 20));
     } else if (!strcmp ((char *) key, "mode")) {
         const char *mode = (char *) value;
         if (!strcmp(mode, "r")) {
@@ -151,15 +221,167 @@ new_argument (gpointer key, gpointer value, gpointer user)
 }
 
 static int
-load_next_event (lcm_logprov_t * lr)
+has_subscribers (const char *channel, void *user)
 {
-    if (lr->event)
-        lcm_eventlog_free_event (lr->event);
+    lcm_logprov_t * lr = (lcm_logprov_t *) user;
+    // lcm_destroy() unsubscribes everything before destroying the provider.
+    // Don't let the prefetch thread skip through the rest of the log then.
+    if (lr->prefetch_exit)
+        return 1;
+    return lcm_channel_has_handlers (lr->lcm,
+            lcm_get_channel (lr->lcm, channel));
+}
 
-    lr->event = lcm_eventlog_read_next_event (lr->log);
-    if (!lr->event)
+// Reads the next event from the log file.  If it is read with stdio,
+// *stdio_event is set to the allocated event.
+static int
+read_event (lcm_logprov_t * lr, lcm_eventlog_view_t * event,
+        lcm_eventlog_event_t ** stdio_event)
+{
+    *stdio_event = NULL;
+    if (lr->reader) {
+        return lr->skip_unsubscribed ?
+            lcm_eventlog_reader_next_filtered (lr->reader, event,
+                    has_subscribers, lr) :
+            lcm_eventlog_reader_next (lr->reader, event);
+    }
+
+    lcm_eventlog_event_t * le = lr->skip_unsubscribed ?
+        lcm_eventlog_read_next_event_filtered (lr->log, has_subscribers, lr) :
+        lcm_eventlog_read_next_event (lr->log);
+    if (!le)
         return -1;
+    event->eventnum = le->eventnum;
+    event->timestamp = le->timestamp;
+    event->channellen = le->channellen;
+    event->datalen = le->datalen;
+    event->channel = le->channel;
+    event->data = le->data;
+    *stdio_event = le;
+    return 0;
+}
+
+static int64_t
+event_size (const lcm_eventlog_view_t * event)
+{
+    return sizeof (prefetched_event_t) + event->channellen + event->datalen;
+}
+
+// Events are read ahead in batches of up to this many, to lock the queue less
+// often.
+#define PREFETCH_BATCH 64
+
+static void *
+prefetch_thread (void * user)
+{
+    lcm_logprov_t * lr = (lcm_logprov_t *) user;
+    GQueue batch;
+    g_queue_init (&batch);
+
+    while (1) {
+        g_mutex_lock (lr->prefetch_mutex);
+        while (!lr->prefetch_exit && lr->prefetch_bytes >= lr->readahead)
+            g_cond_wait (lr->prefetch_cond, lr->prefetch_mutex);
+        int exit = lr->prefetch_exit;
+        int64_t budget = lr->readahead - lr->prefetch_bytes;
+        g_mutex_unlock (lr->prefetch_mutex);
+        if (exit)
+            return NULL;
+
+        int64_t batch_bytes = 0;
+        int status = 0;
+        while (batch_bytes < budget && batch.length < PREFETCH_BATCH) {
+            prefetched_event_t * pe =
+                (prefetched_event_t *) calloc (1, sizeof (prefetched_event_t));
+            status = read_event (lr, &pe->event, &pe->stdio_event);
+            if (status != 0) {
+                free (pe);
+                break;
+            }
 
+            // A mapped event is only read from disk once it's accessed, so
+            // access it here rather than in the handlers.
+            if (lr->reader) {
+                const volatile char * p =
+                    (const volatile char *) pe->event.channel;
+                const volatile char * end =
+                    (const volatile char *) pe->event.data + pe->event.datalen;
+                for (; p < end; p += 4096)
+                    (void) *p;
+            }
+
+            g_queue_push_tail (&batch, pe);
+            batch_bytes += event_size (&pe->event);
+        }
+
+        g_mutex_lock (lr->prefetch_mutex);
+        GList * link;
+        while ((link = g_queue_pop_head_link (&batch)))
+            g_queue_push_tail_link (lr->prefetch_queue, link);
+        lr->prefetch_bytes += batch_bytes;
+        if (status != 0)
+            lr->prefetch_done = 1;
+        g_cond_broadcast (lr->prefetch_cond);
+        g_mutex_unlock (lr->prefetch_mutex);
+        if (status != 0)
+            return NULL;
+    }
+}
+
+static int
+start_prefetch_thread (lcm_logprov_t * lr)
+{
+    lr->prefetch_mutex = g_mutex_new ();
+    lr->prefetch_cond = g_cond_new ();
+    lr->prefetch_queue = g_queue_new ();
+    lr->ready_queue = g_queue_new ();
+    lr->prefetch_thread = g_thread_create (prefetch_thread, lr, TRUE, NULL);
+    if (!lr->prefetch_thread) {
+        fprintf (stderr, "Error: LCM failed to start prefetch thread\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+load_next_event (lcm_logprov_t * lr)
+{
+    lr->have_event = 0;
+    if (lr->stdio_event) {
+        lcm_eventlog_free_event (lr->stdio_event);
+        lr->stdio_event = NULL;
+    }
+
+    if (!lr->prefetch_thread) {
+        if (0 != read_event (lr, &lr->event, &lr->stdio_event))
+            return -1;
+        lr->have_event = 1;
+        return 0;
+    }
+
+    // Take all the events read ahead at once, rather than locking the queue
+    // for each of them.  The prefetch thread can then read up to readahead
+    // bytes more while they are handled.
+    if (g_queue_is_empty (lr->ready_queue)) {
+        g_mutex_lock (lr->prefetch_mutex);
+        while (g_queue_is_empty (lr->prefetch_queue) && !lr->prefetch_done)
+            g_cond_wait (lr->prefetch_cond, lr->prefetch_mutex);
+        GQueue *ready = lr->prefetch_queue;
+        lr->prefetch_queue = lr->ready_queue;
+        lr->ready_queue = ready;
+        lr->prefetch_bytes = 0;
+        g_cond_broadcast (lr->prefetch_cond);
+        g_mutex_unlock (lr->prefetch_mutex);
+    }
+    prefetched_event_t * pe =
+        (prefetched_event_t *) g_queue_pop_head (lr->ready_queue);
+
+    if (!pe)
+        return -1;
+    lr->event = pe->event;
+    lr->stdio_event = pe->stdio_event;
+    free (pe);
+    lr->have_event = 1;
     return 0;
 }
 
@@ -183,8 +405,8 @@ lcm_logprov_create (lcm_t * parent, const char *target, const GHashTable *args)
     dbg (DBG_LCM, "Initializing LCM log provider context...\n");
     dbg (DBG_LCM, "Filename %s\n", lr->filename);
 
-    if(lcm_internal_pipe_create(lr->notify_pipe) != 0) {
-        perror(__FILE__ " - pipe (notify)");
+    if(lcm_notify_init(&lr->notify) != 0) {
+        perror(__FILE__ " - notify");
         lcm_logprov_destroy (lr);
         return NULL;
     }
@@ -193,11 +415,15 @@ lcm_logprov_create (lcm_t * parent, const char *target, const GHashTable *args)
         lcm_logprov_destroy (lr);
         return NULL;
     }
-    //fcntl (lcm->notify_pipe[1], F_SETFL, O_NONBLOCK);
 
     switch (lr->log_mode) {
         case LCM_LOGPROV_READ_MODE:
-            lr->log = lcm_eventlog_create(lr->filename, "r");
+            lr->reader = lcm_eventlog_reader_create(lr->filename);
+            if (!lr->reader) {
+                dbg (DBG_LCM, "Can't map %s, reading it with stdio\n",
+                        lr->filename);
+                lr->log = lcm_eventlog_create(lr->filename, "r");
+            }
             break;
         case LCM_LOGPROV_WRITE_MODE:
             lr->log = lcm_eventlog_create(lr->filename, "w");
@@ -211,37 +437,45 @@ lcm_logprov_create (lcm_t * parent, const char *target, const GHashTable *args)
             return NULL;
     }
 
-    if (!lr->log) {
+    if (!lr->log && !lr->reader) {
         fprintf (stderr, "Error: Failed to open %s: %s\n", lr->filename,
                 strerror (errno));
         lcm_logprov_destroy (lr);
         return NULL;
     }
 
-    // only start the reader thread if we're in read mode
+    // only start the reader thread if we're in read mode.  When skipping
+    // events without subscribers, the first event is only read by
+    // lcm_logprov_handle(), once the application has subscribed.
     if (lr->log_mode == LCM_LOGPROV_READ_MODE){
-        if (load_next_event (lr) < 0) {
+        if (!lr->skip_unsubscribed && load_next_event (lr) < 0) {
             fprintf (stderr, "Error: Failed to read first event from log\n");
             lcm_logprov_destroy (lr);
             return NULL;
         }
 
-        /* Start the reader thread */
-        lr->timer_thread = g_thread_create (timer_thread, lr, TRUE, NULL);
-        if (!lr->timer_thread) {
-            fprintf (stderr, "Error: LCM failed to start timer thread\n");
-            lcm_logprov_destroy (lr);
-            return NULL;
+        /* Start the timer thread, unless playing back as fast as possible.
+         * Then every event is due right away, so the notifier just stays
+         * signaled. */
+        if (lr->speed > 0) {
+            lr->timer_thread = g_thread_create (timer_thread, lr, TRUE, NULL);
+            if (!lr->timer_thread) {
+                fprintf (stderr, "Error: LCM failed to start timer thread\n");
+                lcm_logprov_destroy (lr);
+                return NULL;
+            }
+            lr->thread_created = 1;
         }
-        lr->thread_created = 1;
 
-        if(lcm_internal_pipe_write(lr->notify_pipe[1], "+", 1) < 0) {
-            perror(__FILE__ " - write (reader create)");
-        }
+        lcm_notify_signal(&lr->notify);
 
         if(lr->start_timestamp > 0){
             dbg (DBG_LCM, "Seeking to timestamp: %lld\n", (long long)lr->start_timestamp);
-            lcm_eventlog_seek_to_timestamp(lr->log, lr->start_timestamp);
+            if (lr->reader)
+                lcm_eventlog_reader_seek_to_timestamp(lr->reader,
+                        lr->start_timestamp);
+            else
+                lcm_eventlog_seek_to_timestamp(lr->log, lr->start_timestamp);
         }
     }
 
@@ -251,75 +485,133 @@ lcm_logprov_create (lcm_t * parent, const char *target, const GHashTable *args)
 static int
 lcm_logprov_get_fileno (lcm_logprov_t *lr)
 {
-    return lr->notify_pipe[0];
+    return lcm_notify_fileno(&lr->notify);
 }
 
+// Gets ready to handle the current event.  Returns -1 if there is none.
 static int
-lcm_logprov_handle (lcm_logprov_t * lr)
+prepare_handle (lcm_logprov_t * lr)
 {
-    lcm_recv_buf_t rbuf;
-
-    if (!lr->event)
+    // Start reading ahead once playback starts, after the application had a
+    // chance to subscribe and the log provider has seeked to the start
+    // timestamp.
+    if (lr->readahead > 0 && !lr->prefetch_thread &&
+            lr->log_mode == LCM_LOGPROV_READ_MODE &&
+            0 != start_prefetch_thread (lr))
         return -1;
 
-    char ch;
-    int status = lcm_internal_pipe_read(lr->notify_pipe[0], &ch, 1);
-    if (status == 0) {
-        fprintf (stderr, "Error: lcm_handle read 0 bytes from notify_pipe\n");
-        return -1;
+    if (!lr->have_event) {
+        if (!lr->skip_unsubscribed || lr->next_clock_time >= 0 ||
+                load_next_event (lr) < 0)
+            return -1;
     }
-    else if (status < 0) {
-        fprintf (stderr, "Error: lcm_handle read: %s\n", strerror (errno));
+
+    /* Wait until the current event is due.  The notifier stays signaled
+     * while events are due back to back, so this doesn't need a system call
+     * when playing back faster than real time. */
+    if (lcm_notify_wait(&lr->notify) != 0) {
+        fprintf (stderr, "Error: lcm_handle wait: %s\n", strerror (errno));
         return -1;
     }
 
-    int64_t now = timestamp_now ();
     /* Initialize the wall clock if this is the first time through */
     if (lr->next_clock_time < 0)
-        lr->next_clock_time = now;
+        lr->next_clock_time = timestamp_now ();
+    return 0;
+}
 
-//    rbuf.channel = lr->event->channel,
-    rbuf.data = (uint8_t*) lr->event->data;
-    rbuf.data_size = lr->event->datalen;
+// Dispatches the current event, which is due at time now, and loads the next
+// one.  Returns 1 if the next event is due as well, and 0 otherwise.
+static int
+dispatch_event (lcm_logprov_t * lr, int64_t now)
+{
+    lcm_recv_buf_t rbuf;
+
+    rbuf.data = (uint8_t*) lr->event.data;
+    rbuf.data_size = lr->event.datalen;
     rbuf.recv_utime = lr->next_clock_time;
     rbuf.lcm = lr->lcm;
 
-    if(lcm_try_enqueue_message(lr->lcm, lr->event->channel))
-        lcm_dispatch_handlers (lr->lcm, &rbuf, lr->event->channel);
+    // mapped channel names aren't NUL-terminated
+    memcpy (lr->channel, lr->event.channel, lr->event.channellen);
+    lr->channel[lr->event.channellen] = 0;
+
+    lcm_channel_t *chan = lcm_get_channel (lr->lcm, lr->channel);
+    if(lcm_try_enqueue_channel_message(lr->lcm, chan))
+        lcm_dispatch_channel_handlers (lr->lcm, &rbuf, chan);
+    lr->events_read++;
+    lr->bytes_read += lr->event.datalen;
 
-    int64_t prev_log_time = lr->event->timestamp;
+    int64_t prev_log_time = lr->event.timestamp;
     if (load_next_event (lr) < 0) {
         /* end-of-file reached.  This call succeeds, but next call to
-         * _handle will fail */
-        lr->event = NULL;
-        if(lcm_internal_pipe_write(lr->notify_pipe[1], "+", 1) < 0) {
-            perror(__FILE__ " - write(notify)");
-        }
+         * _handle will fail.  Leave the notifier signaled so that it does
+         * so right away. */
         return 0;
     }
 
     /* Compute the wall time for the next event */
     if (lr->speed > 0)
         lr->next_clock_time +=
-            (lr->event->timestamp - prev_log_time) / lr->speed;
+            (lr->event.timestamp - prev_log_time) / lr->speed;
     else
         lr->next_clock_time = now;
 
+    /* If the next event is already due, just leave the notifier signaled.
+     * Otherwise, clear it and let the timer thread signal it again. */
     if (lr->next_clock_time > now) {
+        lcm_notify_clear(&lr->notify);
         int wstatus = lcm_internal_pipe_write(lr->timer_pipe[1], &lr->next_clock_time, 8);
         if(wstatus < 0) {
             perror(__FILE__ " - write(timer_pipe)");
         }
-    } else {
-        int wstatus = lcm_internal_pipe_write(lr->notify_pipe[1], "+", 1);
-        if(wstatus < 0) {
-            perror(__FILE__ " - write(notify_pipe)");
-        }
+        return 0;
     }
 
+    return 1;
+}
+
+static int
+lcm_logprov_handle (lcm_logprov_t * lr)
+{
+    if (prepare_handle (lr) != 0)
+        return -1;
+
+    dispatch_event (lr, timestamp_now ());
     return 0;
 }
 
+static int
+lcm_logprov_handle_batch (lcm_logprov_t * lr, int max_msgs)
+{
+    if (prepare_handle (lr) != 0)
+        return -1;
+
+    // Dispatch events for as long as they are due.  When playing back as
+    // fast as possible, they always are, and are all stamped with the time
+    // the batch started.
+    int64_t now = timestamp_now ();
+    int nhandled = 0;
+    while (nhandled < max_msgs) {
+        int next_due = dispatch_event (lr, now);
+        nhandled++;
+        if (!next_due)
+            break;
+        if (lr->speed > 0)
+            now = timestamp_now ();
+    }
+    return nhandled;
+}
+
+static int
+lcm_logprov_get_stats (lcm_logprov_t * lr, lcm_stats_t * stats)
+{
+    // The counters are updated by lcm_handle() without any locking, so this
+    // is only a snapshot.
+    stats->packets_received = lr->events_read;
+    stats->bytes_received = lr->bytes_read;
+    return 0;
+}
 
 static int
 lcm_logprov_publish (lcm_logprov_t *lcm, const char *channel, const void *data,
@@ -365,7 +657,9 @@ static lcm_provider_vtable_t logprov_vtable = {
     .unsubscribe = NULL,
     .publish     = lcm_logprov_publish,
     .handle      = lcm_logprov_handle,
-    .get_fileno  = lcm_logprov_get_fileno
+    .get_fileno  = lcm_logprov_get_fileno,
+    .handle_batch = lcm_logprov_handle_batch,
+    .get_stats   = lcm_logprov_get_stats
 };
 #endif
 
@@ -383,6 +677,8 @@ lcm_logprov_provider_init (GPtrArray * providers)
     logprov_vtable.publish     = lcm_logprov_publish;
     logprov_vtable.handle      = lcm_logprov_handle;
     logprov_vtable.get_fileno  = lcm_logprov_get_fileno;
+    logprov_vtable.handle_batch = lcm_logprov_handle_batch;
+    logprov_vtable.get_stats   = lcm_logprov_get_stats;
 #endif
 
     logprov_info.name = "file";
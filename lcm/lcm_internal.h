@@ -42,12 +42,36 @@ struct _lcm_provider_vtable_t {
             unsigned int);
     int (*handle)(lcm_provider_t *);
     int (*get_fileno)(lcm_provider_t *);
+    // optional.  Dispatches up to max_msgs messages that are already
+    // available, without blocking, and returns how many were dispatched.
+    int (*handle_batch)(lcm_provider_t *, int max_msgs);
+    // optional.  Fills in the provider's counters in stats, which is
+    // otherwise zeroed.
+    int (*get_stats)(lcm_provider_t *, lcm_stats_t *stats);
 };
 
 int
 lcm_parse_url (const char * url, char ** provider, char ** target,
         GHashTable * args);
 
+/**
+ * A channel name that has been seen by this LCM instance, together with the
+ * subscriptions matching it.
+ */
+typedef struct _lcm_channel_t lcm_channel_t;
+
+/**
+ * Returns the channel record for a channel name, creating it the first time
+ * the name is seen.  Records stay valid until the lcm_t is destroyed, so a
+ * provider can look up the channel of a received message once, and then use
+ * the record to enqueue and dispatch it without any further lookups.
+ */
+lcm_channel_t *
+lcm_get_channel (lcm_t * lcm, const char * channel);
+
+const char *
+lcm_channel_name (const lcm_channel_t * chan);
+
 /**
  * Try to enqueue a message.  This may fail if there are no subscribers, or if
  * all the subscribers' queues are full.  The actual message contents are not
@@ -62,4 +86,67 @@ lcm_has_handlers (lcm_t * lcm, const char * channel);
 int
 lcm_dispatch_handlers (lcm_t * lcm, lcm_recv_buf_t * buf, const char *channel);
 
+/**
+ * Same as lcm_try_enqueue_message(), lcm_has_handlers() and
+ * lcm_dispatch_handlers(), for a channel that was already looked up.
+ */
+int
+lcm_try_enqueue_channel_message (lcm_t * lcm, lcm_channel_t * chan);
+
+int
+lcm_channel_has_handlers (lcm_t * lcm, lcm_channel_t * chan);
+
+int
+lcm_dispatch_channel_handlers (lcm_t * lcm, lcm_recv_buf_t * buf,
+        lcm_channel_t * chan);
+
+/**
+ * Wakeup primitive used by providers to tell lcm_handle() that messages are
+ * available.  The file descriptor returned by lcm_notify_fileno() is readable
+ * for as long as the notifier is signaled, so providers can hand it out from
+ * their get_fileno() method.
+ *
+ * Wakeups are coalesced: lcm_notify_signal() only touches the descriptor if
+ * the notifier is not signaled yet, and lcm_notify_clear() only if it is.
+ * Providers should signal every time they queue a message and clear once the
+ * queue is empty, with the lock protecting the queue held for both.  Then
+ * lcm_handle() can drain a backlog of messages without any system calls.
+ *
+ * On Linux, an eventfd counter is used.  Other platforms use a pipe.
+ */
+typedef struct _lcm_notify_t lcm_notify_t;
+struct _lcm_notify_t {
+    int fds[2];     // read and write ends.  Both are the same eventfd on Linux
+    volatile int signaled;
+};
+
+int
+lcm_notify_init (lcm_notify_t * notify);
+
+void
+lcm_notify_destroy (lcm_notify_t * notify);
+
+int
+lcm_notify_fileno (const lcm_notify_t * notify);
+
+/**
+ * Marks the notifier as signaled, making its file descriptor readable.
+ */
+int
+lcm_notify_signal (lcm_notify_t * notify);
+
+/**
+ * Clears a signaled notifier, so that its file descriptor is no longer
+ * readable.
+ */
+int
+lcm_notify_clear (lcm_notify_t * notify);
+
+/**
+ * Blocks until the notifier is signaled.  Returns immediately, without a
+ * system call, if it already is.
+ */
+int
+lcm_notify_wait (lcm_notify_t * notify);
+
 #endif
@@ -17,31 +17,30 @@ struct _lcm_provider_t {
     lcm_t* lcm;
     GQueue* queue;
     GMutex* mutex;
-    int notify_pipe[2];
+    lcm_notify_t notify;
 };
 
 typedef struct _memq_msg memq_msg_t;
 struct _memq_msg {
-    char* channel;
+    lcm_channel_t* channel;
     lcm_recv_buf_t rbuf;
 };
 
 static memq_msg_t*
-memq_msg_new(lcm_t* lcm, const char* channel, const void* data, int data_size, int64_t utime) {
+memq_msg_new(lcm_t* lcm, lcm_channel_t* channel, const void* data, int data_size, int64_t utime) {
     memq_msg_t* msg = (memq_msg_t*)malloc(sizeof(memq_msg_t));
     msg->rbuf.data = malloc(data_size);
     msg->rbuf.data_size = data_size;
     memcpy(msg->rbuf.data, data, data_size);
     msg->rbuf.recv_utime = utime;
     msg->rbuf.lcm = lcm;
-    msg->channel = g_strdup(channel);
+    msg->channel = channel;
     return msg;
 }
 
 static void
 memq_msg_destroy(memq_msg_t* msg) {
     free(msg->rbuf.data);
-    g_free(msg->channel);
     memset(msg, 0, sizeof(memq_msg_t));
     free(msg);
 }
@@ -50,8 +49,7 @@ static void
 lcm_memq_destroy (lcm_memq_t *self)
 {
     dbg(DBG_LCM, "destroying LCM memq provider context\n");
-    if(self->notify_pipe[0] >= 0) lcm_internal_pipe_close(self->notify_pipe[0]);
-    if(self->notify_pipe[1] >= 0) lcm_internal_pipe_close(self->notify_pipe[1]);
+    lcm_notify_destroy(&self->notify);
 
     while (!g_queue_is_empty(self->queue)) {
         memq_msg_t* msg = (memq_msg_t*) g_queue_pop_head(self->queue);
@@ -81,8 +79,8 @@ lcm_memq_create (lcm_t* parent, const char* target, const GHashTable* args)
 
     dbg(DBG_LCM, "Initializing LCM memq provider context...\n");
 
-    if(lcm_internal_pipe_create(self->notify_pipe) != 0) {
-        perror(__FILE__ " - pipe (notify)");
+    if(lcm_notify_init(&self->notify) != 0) {
+        perror(__FILE__ " - notify");
         lcm_memq_destroy (self);
         return NULL;
     }
@@ -92,38 +90,63 @@ lcm_memq_create (lcm_t* parent, const char* target, const GHashTable* args)
 static int
 lcm_memq_get_fileno(lcm_memq_t* self)
 {
-    return self->notify_pipe[0];
+    return lcm_notify_fileno(&self->notify);
 }
 
-static int
-lcm_memq_handle(lcm_memq_t* self)
+static void
+memq_dispatch(lcm_memq_t* self, memq_msg_t* msg)
 {
-    char ch;
-    int status = lcm_internal_pipe_read(self->notify_pipe[0], &ch, 1);
-    if (status == 0) {
-        fprintf(stderr,
-            "Error: lcm_memq_handle read 0 bytes from notify_pipe\n");
-        return -1;
+    dbg(DBG_LCM, "Dispatching message on channel [%s], size [%d]\n",
+        lcm_channel_name(msg->channel), msg->rbuf.data_size);
+
+    if (lcm_try_enqueue_channel_message(self->lcm, msg->channel)) {
+      lcm_dispatch_channel_handlers(self->lcm, &msg->rbuf, msg->channel);
     }
 
+    memq_msg_destroy(msg);
+}
+
+static int
+lcm_memq_handle(lcm_memq_t* self)
+{
     g_mutex_lock(self->mutex);
-    memq_msg_t* msg = (memq_msg_t*)g_queue_pop_head(self->queue);
-    if (!g_queue_is_empty(self->queue)) {
-        if(lcm_internal_pipe_write(self->notify_pipe[1], "+", 1) < 0) {
-            perror(__FILE__ " - write to notify pipe (lcm_memq_handle)");
+    while (g_queue_is_empty(self->queue)) {
+        g_mutex_unlock(self->mutex);
+        if (lcm_notify_wait(&self->notify) != 0) {
+            perror(__FILE__ " - wait (lcm_memq_handle)");
+            return -1;
         }
+        g_mutex_lock(self->mutex);
+    }
+    memq_msg_t* msg = (memq_msg_t*)g_queue_pop_head(self->queue);
+    if (g_queue_is_empty(self->queue)) {
+        lcm_notify_clear(&self->notify);
     }
     g_mutex_unlock(self->mutex);
 
-    dbg(DBG_LCM, "Dispatching message on channel [%s], size [%d]\n",
-        msg->channel, msg->rbuf.data_size);
+    memq_dispatch(self, msg);
+    return 0;
+}
 
-    if (lcm_try_enqueue_message(self->lcm, msg->channel)) {
-      lcm_dispatch_handlers(self->lcm, &msg->rbuf, msg->channel);
+static int
+lcm_memq_handle_batch(lcm_memq_t* self, int max_msgs)
+{
+    GQueue batch = G_QUEUE_INIT;
+
+    g_mutex_lock(self->mutex);
+    while ((int) batch.length < max_msgs && !g_queue_is_empty(self->queue)) {
+        g_queue_push_tail(&batch, g_queue_pop_head(self->queue));
     }
+    if (g_queue_is_empty(self->queue)) {
+        lcm_notify_clear(&self->notify);
+    }
+    g_mutex_unlock(self->mutex);
 
-    memq_msg_destroy(msg);
-    return 0;
+    int nhandled = batch.length;
+    while (!g_queue_is_empty(&batch)) {
+        memq_dispatch(self, (memq_msg_t*)g_queue_pop_head(&batch));
+    }
+    return nhandled;
 }
 
 
@@ -131,7 +154,8 @@ static int
 lcm_memq_publish (lcm_memq_t *self, const char *channel, const void *data,
         unsigned int datalen)
 {
-    if(!lcm_has_handlers(self->lcm, channel)) {
+    lcm_channel_t* chan = lcm_get_channel(self->lcm, channel);
+    if(!lcm_channel_has_handlers(self->lcm, chan)) {
       dbg(DBG_LCM,
           "Publishing [%s] size [%d] - dropping (no subscribers)\n",
           channel, datalen);
@@ -139,16 +163,11 @@ lcm_memq_publish (lcm_memq_t *self, const char *channel, const void *data,
     }
     dbg(DBG_LCM, "Publishing to [%s] message size [%d]\n", channel, datalen);
     memq_msg_t* msg =
-      memq_msg_new(self->lcm, channel, data, datalen, timestamp_now());
+      memq_msg_new(self->lcm, chan, data, datalen, timestamp_now());
 
     g_mutex_lock(self->mutex);
-    int was_empty = g_queue_is_empty(self->queue);
     g_queue_push_tail(self->queue, msg);
-    if (was_empty) {
-        if(lcm_internal_pipe_write(self->notify_pipe[1], "+", 1) < 0) {
-            perror(__FILE__ " - write to notify pipe (lcm_memq_publish)");
-        }
-    }
+    lcm_notify_signal(&self->notify);
     g_mutex_unlock(self->mutex);
     return 0;
 }
@@ -163,7 +182,8 @@ static lcm_provider_vtable_t memq_vtable = {
     .unsubscribe = NULL,
     .publish     = lcm_memq_publish,
     .handle      = lcm_memq_handle,
-    .get_fileno  = lcm_memq_get_fileno
+    .get_fileno  = lcm_memq_get_fileno,
+    .handle_batch = lcm_memq_handle_batch
 };
 #endif
 static lcm_provider_info_t memq_info;
@@ -179,6 +199,7 @@ lcm_memq_provider_init (GPtrArray * providers)
     memq_vtable.publish     = lcm_memq_publish;
     memq_vtable.handle      = lcm_memq_handle;
     memq_vtable.get_fileno  = lcm_memq_get_fileno;
+    memq_vtable.handle_batch = lcm_memq_handle_batch;
 #endif
     memq_info.name = "memq";
     memq_info.vtable = &memq_vtable;
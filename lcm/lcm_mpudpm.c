@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // for recvmmsg()
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +21,14 @@
 #include <sys/select.h>
 #endif
 
+// On Linux, the read thread waits on all of its receive sockets with a single
+// epoll instance, and drains the ready ones with recvmmsg().  Elsewhere, it
+// falls back to select(), which is limited to FD_SETSIZE sockets.
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <glib.h>
 
 #include "lcm.h"
@@ -26,25 +38,98 @@
 #include "udpm_util.h"
 
 #include "lcmtypes/channel_port_map_update_t.h"
+#include "lcmtypes/channel_port_loads_t.h"
+#include "lcmtypes/channel_port_map_delta_t.h"
 
 // Lets reserve channels starting with #! for internal use
 #define RESERVED_CHANNEL_PREFIX "#!"
 // The number of LCM channels that we use internally for stuff.
 // Updating the channel to port map efficiently depends on this number
 // being correct
-#define NUM_INTERNAL_CHANNELS 3
+#define NUM_INTERNAL_CHANNELS 6
 #define SELF_TEST_CHANNEL RESERVED_CHANNEL_PREFIX "mpudpm_SELF_TEST"
+// full channel to port maps.  Older releases use the UPD channel, newer ones
+// the MAP channel, so that they can tell whether an older process is around.
 #define CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL \
     RESERVED_CHANNEL_PREFIX "mpudpm_CH2PRT_UPD"
+#define CHANNEL_TO_PORT_MAP_CHANNEL \
+    RESERVED_CHANNEL_PREFIX "mpudpm_CH2PRT_MAP"
 #define CHANNEL_TO_PORT_MAP_REQUEST_CHANNEL \
     RESERVED_CHANNEL_PREFIX "mpudpm_CH2PRT_REQ"
+#define CHANNEL_TO_PORT_MAP_DELTA_CHANNEL \
+    RESERVED_CHANNEL_PREFIX "mpudpm_CH2PRT_DELTA"
+#define CHANNEL_PORT_LOADS_CHANNEL \
+    RESERVED_CHANNEL_PREFIX "mpudpm_CH2PRT_LOAD"
 
 // regex to check with the channel is a string literal
 #define REGEX_FINDER_RE "[^\\\\][\\.\\[\\{\\(\\)\\\\\\*\\+\\?\\|\\^\\$]"
 
-// broadcast channel to port mapping this frequently
+// broadcast the channel to port map digest this frequently
 #define CHANNEL_TO_PORT_MAP_UPDATE_NOMINAL_PERIOD 5e6
+// wait up to this long before sending the full map to a process whose map
+// differs, in case another process sends one first
+#define FULL_MAPPING_REPLY_MAX_DELAY 5e4
+
+// with port_mapping=balanced, publishers measure and report their channel
+// loads this often
+#define CHANNEL_LOAD_REPORT_PERIOD 1e6
+// forget the rate reported for a channel after this long
+#define CHANNEL_LOAD_MAX_AGE (3 * CHANNEL_LOAD_REPORT_PERIOD)
+// after moving a channel, keep publishing on the old port for this long, so
+// that subscribers have time to join the new one
+#define CHANNEL_MOVE_GRACE_PERIOD 1e5
+// subscribers keep receiving on the port a channel moved away from for this
+// long, until its publishers no longer use it
+#define CHANNEL_MOVE_RELEASE_DELAY (2 * CHANNEL_MOVE_GRACE_PERIOD)
+// publish rate (bytes/s) above which a channel gets a port of its own
+#define DEFAULT_HEAVY_CHANNEL_RATE 1000000
+
+// maximum number of datagrams read from a socket with one recvmmsg() call
+#define RECV_BATCH_SIZE 16
+// maximum number of ready sockets reported by one epoll_wait() call
+#define MAX_EPOLL_EVENTS 64
+// upper bound on the recv_threads provider argument
+#define MAX_RECV_THREADS 64
 
+typedef struct _lcm_provider_t lcm_mpudpm_t;
+
+/**
+ * mpudpm_reader_t:
+ * @lcm                 the provider this reader belongs to
+ * @thread              receive thread reading the reader's sockets
+ * @thread_msg_pipe     pipe to notify the thread when to cancel a select or
+ *                      terminate
+ * @epoll_fd            the reader's sockets and the thread_msg_pipe read end,
+ *                      when USE_EPOLL is defined
+ * @recv_sockets_changed  whether a socket of this reader was added or removed
+ *                      since the thread last looked.  Guarded by the
+ *                      receive_lock.
+ * @ringbuf             memory for received small packets.  Guarded by the
+ *                      receive_lock.
+ * @ringbuf_high_water  most bytes ever used in the ringbuffer
+ * @frag_bufs           messages being reassembled.  Only used by the thread.
+ * @udp_rx              packets received and processed
+ * @udp_discarded_bad   packets discarded because they were bad somehow
+ *
+ * Each receive socket is read by exactly one reader, picked by its port.
+ * A channel is normally published on a single port, so the messages of a
+ * channel are queued in the order they were received.  The exception is a
+ * channel that was just moved with port_mapping=balanced: when its old and
+ * new port are read by different readers, the last messages sent on the old
+ * port may be queued after the first ones sent on the new port.
+ */
+typedef struct _mpudpm_reader_t {
+    lcm_mpudpm_t *lcm;
+    GThread *thread;
+    int thread_msg_pipe[2];
+    int epoll_fd;
+    int8_t recv_sockets_changed;
+    lcm_ringbuf_t *ringbuf;
+    uint32_t ringbuf_high_water;
+    lcm_frag_buf_store *frag_bufs;
+    uint64_t udp_rx;
+    uint64_t udp_discarded_bad;
+} mpudpm_reader_t;
 
 /**
  * mpudpm_socket_t:
@@ -52,11 +137,13 @@
  * @port                multicast port
  * @num_subscribers     the number of subscribers to enable closing this socket
  *                             when it's no longer in use
+ * @reader              the reader whose thread receives on this socket
  */
 typedef struct _mpudpm_socket_t {
     SOCKET fd;
     uint16_t port;
     int num_subscribers;
+    mpudpm_reader_t *reader;
 } mpudpm_socket_t;
 
 
@@ -65,15 +152,56 @@ typedef struct _mpudpm_socket_t {
  * @channel_string  The channel string this subscriber is subscribed to
  * @regex           Compiled regex to match explicit channels to this subscriber
  * @sockets         The list of sockets that are used for this subscription
- * @channel_set     Set of active channels that the channel_regex matches
+ * @channel_set     Active channels that the subscriber listens to, and the
+ *                  port each one is received on
+ * @old_ports       Ports that channels of the subscriber moved away from,
+ *                  whose sockets are kept until the publishers stopped using
+ *                  them
  */
 typedef struct _mpudpm_subscriber_t {
     char * channel_string;
     GRegex * regex;   // compiled regex for the channel_string (if it's a regex)
     GSList* sockets;  //type: mpudpm_socket_t
-    GHashTable* channel_set; //GHashTable used as a set (value points to key)
+    GHashTable* channel_set; //type: char* -> uint16_t (via GUINT_TO_POINTER)
+    GSList* old_ports; //type: mpudpm_old_port_t
 } mpudpm_subscriber_t;
 
+/**
+ * mpudpm_old_port_t:
+ * @port            port that a channel of the subscriber moved away from
+ * @release_utime   when the subscriber lets go of the port
+ */
+typedef struct _mpudpm_old_port_t {
+    uint16_t port;
+    int64_t release_utime;
+} mpudpm_old_port_t;
+
+/**
+ * mpudpm_channel_load_t:
+ * @version         number of times the channel was moved to another port.
+ *                  Processes adopt the mapping with the highest version.
+ * @bytes           bytes this process published on the channel since its last
+ *                  load report
+ * @local_rate      bytes/s this process published in the last report period
+ * @rate            highest rate recently reported for the channel by any
+ *                  process, including this one
+ * @rate_utime      when @rate was reported
+ * @prev_port       port this process keeps publishing on until @switch_utime
+ *                  after moving the channel itself
+ * @switch_utime
+ *
+ * Only used with port_mapping=balanced.
+ */
+typedef struct _mpudpm_channel_load_t {
+    int32_t version;
+    int64_t bytes;
+    int64_t local_rate;
+    int64_t rate;
+    int64_t rate_utime;
+    uint16_t prev_port;
+    int64_t switch_utime;
+} mpudpm_channel_load_t;
+
 /**
  * mpudpm_params_t:
  * @mc_addr:              multicast address
@@ -85,6 +213,14 @@ typedef struct _mpudpm_subscriber_t {
  *                        don't use > 1.  that's just rude.
  * @recv_buf_size:        requested size of the kernel receive buffer, set with
  *                        SO_RCVBUF.  0 indicates to use the default settings.
+ * @recv_threads:         number of threads that receive packets and reassemble
+ *                        messages, each reading a share of the ports
+ *                        (defaults to 1)
+ * @balance_ports:        if true (port_mapping=balanced), channels published
+ *                        at more than @heavy_channel_rate bytes/s are moved
+ *                        off the hashed port onto a port no other channel
+ *                        uses.  All processes must use the same setting.
+ * @heavy_channel_rate:   see @balance_ports
  *
  */
 typedef struct _mpudpm_params_t mpudpm_params_t;
@@ -94,9 +230,11 @@ struct _mpudpm_params_t {
     uint16_t num_mc_ports;
     uint8_t mc_ttl; 
     int recv_buf_size;
+    int recv_threads;
+    int balance_ports;
+    int64_t heavy_channel_rate;
 };
 
-typedef struct _lcm_provider_t lcm_mpudpm_t;
 struct _lcm_provider_t {
     lcm_t * lcm;
     mpudpm_params_t params;
@@ -114,9 +252,6 @@ struct _lcm_provider_t {
 
     /* list of mpudpm_socket_t structs */
     GSList* recv_sockets;
-    /* flag for whether the subscriptions have changed since they were last
-     * accessed. must be protected by the receive_lock.*/
-    int8_t recv_sockets_changed;
 
     /* list of mpudpm_subscriber_t structs */
     GSList* subscribers;
@@ -124,14 +259,11 @@ struct _lcm_provider_t {
     /* Packet structures available for sending or receiving use are
      * stored in the *_empty queues. */
     lcm_buf_queue_t * inbufs_empty;
-    /* Received packets that are filled with data are queued here. */
+    /* Received packets that are filled with data are queued here, by all
+     * of the readers. */
     lcm_buf_queue_t * inbufs_filled;
 
-    /* Memory for received small packets is taken from a fixed-size ring buffer
-     * so we don't have to do any mallocs */
-    lcm_ringbuf_t * ringbuf;
-
-    /* Indicates whether the receive thread was successfully created */
+    /* Indicates whether the receive threads were successfully created */
     int8_t recv_thread_created;
 
     /* END VARIABLES GUARDED BY receive_lock
@@ -153,21 +285,48 @@ struct _lcm_provider_t {
      * type: char* -> uint16_t (via GUINT_TO_POINTER macro)*/
     GHashTable* channel_to_port_map;
 
-    /* Last time the channel_to_port mapping was broadcast by someone */
+    /* Last time the channel_to_port mapping digest was broadcast by someone */
     int64_t last_mapping_update_utime;
+    /* Last time this process broadcast its full channel_to_port mapping */
+    int64_t last_full_mapping_utime;
+    /* When this process is due to broadcast its full mapping to a process
+     * whose map differs, or 0.  Dropped if another process sends a full
+     * mapping that has all of this process's channels first. */
+    int64_t full_mapping_reply_utime;
+    /* Set once a full mapping arrived on CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL,
+     * which means that a process of an older release is around.  It only
+     * learns about new channels from full mappings. */
+    int8_t old_format_peers;
+
+    /* Number of non-reserved channels in channel_to_port_map, and the sum of
+     * their mpudpm_digest_hash() values */
+    int32_t num_mapped_channels;
+    uint64_t map_digest;
 
     /* rolling counter of how many messages transmitted */
     uint32_t     msg_seqno;
 
     /* Use a separate variable for publishers to ease contention */
     int8_t recv_thread_created_tx;
+
+    /* Load of each channel, with port_mapping=balanced
+     * type: char* -> mpudpm_channel_load_t */
+    GHashTable* channel_loads;
+    /* Last time this process measured and reported its channel loads */
+    int64_t last_load_report_utime;
+    /* Last time this process published a channel_port_loads_t */
+    int64_t last_loads_publish_utime;
+    /* Set when this process moved one of its channels, so that its own
+     * subscriptions follow once the report comes back */
+    int8_t moved_channels;
     /* END VARIABLES GUARDED BY transmit_lock
      **************************************************************/
 
-    GThread *read_thread;
-    int notify_pipe[2];         // pipe to notify application when messages arrive
-    int thread_msg_pipe[2];     // pipe to notify read thread when to cancel a
-    // select or terminate
+    lcm_notify_t notify;        // notifies application when messages arrive
+
+    /* receive threads, and the state private to each of them */
+    mpudpm_reader_t *readers;
+    int num_readers;
 
     /* synchronization variables used only while allocating receive resources
      */
@@ -177,13 +336,6 @@ struct _lcm_provider_t {
 
 
     /* other variables */
-    lcm_frag_buf_store  *frag_bufs;
-
-    uint32_t     udp_rx;            // packets received and processed
-    uint32_t     udp_discarded_bad; // packets discarded because they were bad 
-    // somehow
-    double       udp_low_watermark; // least buffer available
-    int32_t      udp_last_report_secs;
 
     // regex to check whether a passed in channel is a regex :-)
     GRegex* regex_finder_re;
@@ -193,15 +345,29 @@ struct _lcm_provider_t {
 static int setup_recv_parts(lcm_mpudpm_t *lcm);
 static mpudpm_socket_t* add_recv_socket(lcm_mpudpm_t *lcm, uint16_t port);
 static void remove_recv_socket(lcm_mpudpm_t *lcm, mpudpm_socket_t* sock);
+static void release_recv_socket(lcm_mpudpm_t *lcm, mpudpm_socket_t* sock);
 int lcm_mpudpm_unsubscribe(lcm_mpudpm_t *lcm, const char *channel);
 static int publish_message_internal(lcm_mpudpm_t *lcm, const char *channel,
         const void *data, unsigned int datalen);
 static void publish_channel_mapping_update(lcm_mpudpm_t *lcm);
 static void channel_port_mapping_update_handler(lcm_mpudpm_t *lcm,
-        const channel_port_map_update_t *msg, int64_t recv_time);
+        const channel_port_map_update_t *msg, int64_t recv_time,
+        int old_format);
+static int mapping_reply_timeout(mpudpm_reader_t *reader);
+static void publish_due_mapping_update(lcm_mpudpm_t *lcm);
+static void set_channel_port(lcm_mpudpm_t *lcm, const char *channel,
+        uint16_t port);
+static void publish_channel_mapping_delta(lcm_mpudpm_t *lcm,
+        const char *channel);
+static void channel_port_mapping_delta_handler(lcm_mpudpm_t *lcm,
+        const channel_port_map_delta_t *msg, int64_t recv_time);
+static void publish_channel_loads(lcm_mpudpm_t *lcm);
+static void channel_port_loads_handler(lcm_mpudpm_t *lcm,
+        const channel_port_loads_t *msg);
 static void update_subscription_ports(lcm_mpudpm_t* lcm);
 static void add_channel_to_subscriber(lcm_mpudpm_t* lcm,
         mpudpm_subscriber_t * sub, const char * channel, uint16_t port);
+static void release_old_ports(lcm_mpudpm_t* lcm);
 
 
 static GStaticPrivate CREATE_READ_THREAD_PKEY = G_STATIC_PRIVATE_INIT;
@@ -221,6 +387,9 @@ mpudpm_subscriber_t_destroy (mpudpm_subscriber_t *sub)
     }
     if (sub->channel_set!=NULL)
         g_hash_table_destroy(sub->channel_set);
+    for (GSList* it = sub->old_ports; it != NULL; it = it->next)
+        free(it->data);
+    g_slist_free(sub->old_ports);
     free(sub);
 }
 
@@ -231,26 +400,49 @@ mpudpm_socket_t_destroy (mpudpm_socket_t *sock)
     free(sock);
 }
 
+/* Frees the data of a received packet.  A reader whose ringbuffer fills up
+ * replaces it with a larger one, and the old ringbuffer is freed along with
+ * its last packet.  The caller must hold the receive_lock. */
+static void
+free_recv_buf_data (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb)
+{
+    lcm_ringbuf_t *current = NULL;
+    for (int i = 0; i < lcm->num_readers; i++) {
+        if (lcmb->ringbuf && lcmb->ringbuf == lcm->readers[i].ringbuf)
+            current = lcmb->ringbuf;
+    }
+    lcm_buf_free_data(lcmb, current);
+}
+
+static void
+free_recv_buf_queue (lcm_mpudpm_t *lcm, lcm_buf_queue_t *q)
+{
+    lcm_buf_t *lcmb;
+    while ((lcmb = lcm_buf_dequeue(q))) {
+        free_recv_buf_data(lcm, lcmb);
+        free(lcmb);
+    }
+    lcm_buf_queue_free(q, NULL);
+}
+
 static void
 destroy_recv_parts (lcm_mpudpm_t *lcm)
 {
-    if (lcm->recv_thread_created) {
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+        if (!reader->thread)
+            continue;
         // send the read thread an exit command
-        int wstatus = lcm_internal_pipe_write(lcm->thread_msg_pipe[1], "\0", 1);
+        int wstatus = lcm_internal_pipe_write(reader->thread_msg_pipe[1],
+                "\0", 1);
         if(wstatus < 0) {
             perror(__FILE__ " thread_msg_pipe write: terminate");
         } else {
-            g_thread_join (lcm->read_thread);
+            g_thread_join (reader->thread);
         }
-        lcm->read_thread = NULL;
-        lcm->recv_thread_created = 0;
-    }
-
-    if (lcm->thread_msg_pipe[0] >= 0) {
-        lcm_internal_pipe_close(lcm->thread_msg_pipe[0]);
-        lcm_internal_pipe_close(lcm->thread_msg_pipe[1]);
-        lcm->thread_msg_pipe[0] = lcm->thread_msg_pipe[1] = -1;
+        reader->thread = NULL;
     }
+    lcm->recv_thread_created = 0;
 
     if (lcm->subscribers) {
         for (GSList* it = lcm->subscribers; it != NULL ; it = it->next) {
@@ -258,23 +450,40 @@ destroy_recv_parts (lcm_mpudpm_t *lcm)
             lcm_mpudpm_unsubscribe(lcm, sub->channel_string);
         }
         g_slist_free(lcm->subscribers);
+        lcm->subscribers = NULL;
     }
 
-    if (lcm->frag_bufs) {
-        lcm_frag_buf_store_destroy(lcm->frag_bufs);
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+        if (reader->thread_msg_pipe[0] >= 0) {
+            lcm_internal_pipe_close(reader->thread_msg_pipe[0]);
+            lcm_internal_pipe_close(reader->thread_msg_pipe[1]);
+            reader->thread_msg_pipe[0] = reader->thread_msg_pipe[1] = -1;
+        }
+        if (reader->epoll_fd >= 0) {
+            close(reader->epoll_fd);
+            reader->epoll_fd = -1;
+        }
+        if (reader->frag_bufs) {
+            lcm_frag_buf_store_destroy(reader->frag_bufs);
+            reader->frag_bufs = NULL;
+        }
     }
 
     if (lcm->inbufs_empty) {
-        lcm_buf_queue_free (lcm->inbufs_empty, lcm->ringbuf);
+        free_recv_buf_queue (lcm, lcm->inbufs_empty);
         lcm->inbufs_empty = NULL;
     }
     if (lcm->inbufs_filled) {
-        lcm_buf_queue_free (lcm->inbufs_filled, lcm->ringbuf);
+        free_recv_buf_queue (lcm, lcm->inbufs_filled);
         lcm->inbufs_filled = NULL;
     }
-    if (lcm->ringbuf) {
-        lcm_ringbuf_free (lcm->ringbuf);
-        lcm->ringbuf = NULL;
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+        if (reader->ringbuf) {
+            lcm_ringbuf_free (reader->ringbuf);
+            reader->ringbuf = NULL;
+        }
     }
 }
 
@@ -290,9 +499,11 @@ lcm_mpudpm_destroy (lcm_mpudpm_t *lcm)
     if (lcm->channel_to_port_map != NULL) {
         g_hash_table_destroy(lcm->channel_to_port_map);
     }
+    if (lcm->channel_loads != NULL) {
+        g_hash_table_destroy(lcm->channel_loads);
+    }
 
-    lcm_internal_pipe_close(lcm->notify_pipe[0]);
-    lcm_internal_pipe_close(lcm->notify_pipe[1]);
+    lcm_notify_destroy(&lcm->notify);
 
     g_static_mutex_free (&lcm->receive_lock);
     g_static_mutex_free (&lcm->transmit_lock);
@@ -305,6 +516,7 @@ lcm_mpudpm_destroy (lcm_mpudpm_t *lcm)
         g_regex_unref(lcm->regex_finder_re);
     }
 
+    free (lcm->readers);
     free (lcm);
 }
 
@@ -320,6 +532,20 @@ static uint32_t mpudpm_str_hash(const char* str) {
     return hash;
 }
 
+/* _digest_hash:
+ * 64 bit FNV-1a hash function, for the channel to port map digest.  The
+ * digest is the sum of the hashes of all the channels in the map, so it does
+ * not depend on the order in which they were added.
+ */
+static uint64_t mpudpm_digest_hash(const char* str) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* p = str; *p != '\0'; p++) {
+        hash ^= (uint8_t) *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 static uint16_t
 map_channel_to_port(lcm_mpudpm_t* lcm, const char * channel) {
     uint32_t channel_hash = mpudpm_str_hash(channel);
@@ -386,6 +612,39 @@ new_argument (gpointer key, gpointer value, gpointer user)
             params->num_mc_ports = 1;
         }
     }
+    else if (!strcmp ((char *) key, "recv_threads")) {
+        char *endptr = NULL;
+        params->recv_threads = strtol ((char *) value, &endptr, 0);
+        if (endptr == value || params->recv_threads < 1) {
+            fprintf(stderr, "Warning: Invalid value (%s) for recv_threads\n",
+                    (char*) value);
+            params->recv_threads = 1;
+        } else if (params->recv_threads > MAX_RECV_THREADS) {
+            fprintf(stderr, "Warning: recv_threads limited to %d\n",
+                    MAX_RECV_THREADS);
+            params->recv_threads = MAX_RECV_THREADS;
+        }
+    }
+    else if (!strcmp ((char *) key, "port_mapping")) {
+        if (!strcmp ((char *) value, "hash"))
+            params->balance_ports = 0;
+        else if (!strcmp ((char *) value, "balanced"))
+            params->balance_ports = 1;
+        else
+            fprintf(stderr, "Warning: Invalid value (%s) for port_mapping\n",
+                    (char*) value);
+    }
+    else if (!strcmp ((char *) key, "heavy_channel_rate")) {
+        char *endptr = NULL;
+        int64_t rate = strtoll ((char *) value, &endptr, 0);
+        if (endptr == value || rate <= 0) {
+            fprintf(stderr,
+                    "Warning: Invalid value (%s) for heavy_channel_rate\n",
+                    (char*) value);
+        } else {
+            params->heavy_channel_rate = rate;
+        }
+    }
     else {
         fprintf(stderr, "%s:%d -- unknown provider argument %s\n",
                 __FILE__, __LINE__, (char *)key);
@@ -399,15 +658,17 @@ is_reserved_channel(const char * channel){
 }
 
 static int 
-recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
+recv_message_fragment (mpudpm_reader_t *reader, lcm_buf_t *lcmb, uint32_t sz)
 {
+    lcm_mpudpm_t *lcm = reader->lcm;
     lcm2_header_long_t *hdr = (lcm2_header_long_t*) lcmb->buf;
 
-    // any existing fragment buffer for this message source?
-    lcm_frag_buf_t *fbuf = lcm_frag_buf_store_lookup(lcm->frag_bufs,
-            &lcmb->from);
-
     uint32_t msg_seqno = ntohl (hdr->msg_seqno);
+
+    // any existing fragment buffer for this message?
+    lcm_frag_buf_t *fbuf = lcm_frag_buf_store_lookup(reader->frag_bufs,
+            &lcmb->from, msg_seqno);
+
     uint32_t data_size = ntohl (hdr->msg_size);
     uint32_t fragment_offset = ntohl (hdr->fragment_offset);
     //    uint16_t fragment_no = ntohs (hdr->fragment_no);
@@ -415,12 +676,12 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
     uint32_t frag_size = sz - sizeof (lcm2_header_long_t);
     char *data_start = (char*) (hdr + 1);
 
-    // discard any stale fragments from previous messages
-    if (fbuf && ((fbuf->msg_seqno != msg_seqno) ||
-            (fbuf->data_size != data_size))) {
-        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
+    // discard any stale fragments from a previous message with the same
+    // sequence number
+    if (fbuf && fbuf->data_size != data_size) {
         dbg(DBG_LCM, "Dropping message (missing %d fragments)\n",
             fbuf->fragments_remaining);
+        lcm_frag_buf_store_remove (reader->frag_bufs, fbuf);
         fbuf = NULL;
     }
 
@@ -436,19 +697,21 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
         int channel_sz = strlen (channel);
         if (channel_sz > LCM_MAX_CHANNEL_NAME_LENGTH) {
             dbg (DBG_LCM, "bad channel name length\n");
-            lcm->udp_discarded_bad++;
+            reader->udp_discarded_bad++;
             return 0;
         }
 
         // if the packet has no subscribers, drop the message now.
-        if (!lcm_has_handlers(lcm->lcm, channel)
+        lcm_channel_t *chan = lcm_get_channel(lcm->lcm, channel);
+        if (!lcm_channel_has_handlers(lcm->lcm, chan)
                 && !is_reserved_channel(channel))
             return 0;
 
-        fbuf = lcm_frag_buf_new (*((struct sockaddr_in*) &lcmb->from),
+        fbuf = lcm_frag_buf_new (NULL, *((struct sockaddr_in*) &lcmb->from),
                 channel, msg_seqno, data_size, fragments_in_msg,
                 lcmb->recv_utime);
-        lcm_frag_buf_store_add (lcm->frag_bufs, fbuf);
+        fbuf->chan = chan;
+        lcm_frag_buf_store_add (reader->frag_bufs, fbuf);
         data_start += channel_sz + 1;
         frag_size -= (channel_sz + 1);
     }
@@ -479,13 +742,13 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
     if (fragment_offset + frag_size > fbuf->data_size) {
         dbg (DBG_LCM, "dropping invalid fragment (off: %d, %d / %d)\n",
                 fragment_offset, frag_size, fbuf->data_size);
-        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
+        lcm_frag_buf_store_remove (reader->frag_bufs, fbuf);
         return 0;
     }
 
     // copy data
     memcpy (fbuf->data + fragment_offset, data_start, frag_size);
-    fbuf->last_packet_utime = lcmb->recv_utime;
+    lcm_frag_buf_store_touch (reader->frag_bufs, fbuf, lcmb->recv_utime);
 
     fbuf->fragments_remaining --;
 
@@ -495,18 +758,21 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
         // WARNING: lcm_try_enqueue_message increments the number of queued
         // messages, so we must check whether it is a reserved channel FIRST
         if (!is_reserved_channel(fbuf->channel)
-                && !lcm_try_enqueue_message(lcm->lcm, fbuf->channel)) {
+                && !lcm_try_enqueue_channel_message(lcm->lcm, fbuf->chan)) {
             // no... sad... free the fragment buffer and return
-            lcm_frag_buf_store_remove(lcm->frag_bufs, fbuf);
+            lcm_frag_buf_store_remove(reader->frag_bufs, fbuf);
             return 0;
         }
 
         // yes, transfer the message into the lcm_buf_t
 
-        // deallocate the ringbuffer-allocated buffer
-        g_static_mutex_lock(&lcm->receive_lock);
-        lcm_buf_free_data(lcmb, lcm->ringbuf);
-        g_static_mutex_unlock(&lcm->receive_lock);
+        // deallocate the ringbuffer-allocated buffer.  Packets received in
+        // a batch live in a receive slot instead, which is reused as is.
+        if (lcmb->ringbuf) {
+            g_static_mutex_lock(&lcm->receive_lock);
+            free_recv_buf_data(lcm, lcmb);
+            g_static_mutex_unlock(&lcm->receive_lock);
+        }
 
         // transfer ownership of the message's payload buffer
         lcmb->buf = fbuf->data;
@@ -514,12 +780,13 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
 
         strcpy (lcmb->channel_name, fbuf->channel);
         lcmb->channel_size = strlen (lcmb->channel_name);
+        lcmb->chan = fbuf->chan;
         lcmb->data_offset = 0;
         lcmb->data_size = fbuf->data_size;
         lcmb->recv_utime = fbuf->last_packet_utime;
 
         // don't need the fragment buffer anymore
-        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
+        lcm_frag_buf_store_remove (reader->frag_bufs, fbuf);
 
         return 1;
     }
@@ -528,8 +795,9 @@ recv_message_fragment (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
 }
 
 static int
-recv_short_message (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, int sz)
+recv_short_message (mpudpm_reader_t *reader, lcm_buf_t *lcmb, int sz)
 {
+    lcm_mpudpm_t *lcm = reader->lcm;
     lcm2_header_short_t *hdr2 = (lcm2_header_short_t*) lcmb->buf;
 
     // shouldn't have to worry about buffer overflow here because we
@@ -540,18 +808,19 @@ recv_short_message (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, int sz)
 
     if (lcmb->channel_size > LCM_MAX_CHANNEL_NAME_LENGTH) {
         dbg (DBG_LCM, "bad channel name length\n");
-        lcm->udp_discarded_bad++;
+        reader->udp_discarded_bad++;
         return 0;
     }
 
-    lcm->udp_rx++;
+    reader->udp_rx++;
 
     // if the packet has no subscribers, drop the message now.
     // WARNING: lcm_try_enqueue_message increments the number of queued
     // messages, so we must check whether it is a reserved channel FIRST
+    lcmb->chan = lcm_get_channel(lcm->lcm, pkt_channel_str);
     if (!is_reserved_channel(pkt_channel_str)
             || strcmp(pkt_channel_str, SELF_TEST_CHANNEL) == 0) {
-        if (!lcm_try_enqueue_message(lcm->lcm, pkt_channel_str)) {
+        if (!lcm_try_enqueue_channel_message(lcm->lcm, lcmb->chan)) {
             return 0;
         }
     }
@@ -566,16 +835,20 @@ recv_short_message (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb, int sz)
 }
 
 // this function will aquire locks if needed
-static void dispatch_complete_message(lcm_mpudpm_t * lcm, lcm_buf_t * lcmb,
-        int actual_size) {
+static void dispatch_complete_message(mpudpm_reader_t * reader,
+        lcm_buf_t * lcmb, int actual_size) {
+    lcm_mpudpm_t *lcm = reader->lcm;
     int handled_internal_message = 0;
     if (strcmp(lcmb->channel_name, CHANNEL_TO_PORT_MAP_REQUEST_CHANNEL) == 0) {
         g_static_mutex_lock(&lcm->transmit_lock);
         publish_channel_mapping_update(lcm);
+        if (lcm->params.balance_ports)
+            publish_channel_loads(lcm);
         g_static_mutex_unlock(&lcm->transmit_lock);
         // discard the received message
         handled_internal_message = 1;
     } else if (strcmp(lcmb->channel_name, CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL)
+            == 0 || strcmp(lcmb->channel_name, CHANNEL_TO_PORT_MAP_CHANNEL)
             == 0) {
         channel_port_map_update_t upd_msg;
         int status = channel_port_map_update_t_decode(lcmb->buf,
@@ -585,17 +858,46 @@ static void dispatch_complete_message(lcm_mpudpm_t * lcm, lcm_buf_t * lcmb,
                     status);
         } else {
             channel_port_mapping_update_handler(lcm, &upd_msg,
-                    lcmb->recv_utime);
+                    lcmb->recv_utime, strcmp(lcmb->channel_name,
+                            CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL) == 0);
             channel_port_map_update_t_decode_cleanup(&upd_msg);
         }
         // discard the received message
         handled_internal_message = 1;
+    } else if (strcmp(lcmb->channel_name, CHANNEL_TO_PORT_MAP_DELTA_CHANNEL)
+            == 0) {
+        channel_port_map_delta_t delta_msg;
+        int status = channel_port_map_delta_t_decode(lcmb->buf,
+                lcmb->data_offset, lcmb->data_size, &delta_msg);
+        if (status < 0) {
+            fprintf(stderr, "error %d decoding channel_port_map_delta_t!!!\n",
+                    status);
+        } else {
+            channel_port_mapping_delta_handler(lcm, &delta_msg,
+                    lcmb->recv_utime);
+            channel_port_map_delta_t_decode_cleanup(&delta_msg);
+        }
+        // discard the received message
+        handled_internal_message = 1;
+    } else if (strcmp(lcmb->channel_name, CHANNEL_PORT_LOADS_CHANNEL) == 0) {
+        channel_port_loads_t loads_msg;
+        int status = channel_port_loads_t_decode(lcmb->buf,
+                lcmb->data_offset, lcmb->data_size, &loads_msg);
+        if (status < 0) {
+            fprintf(stderr, "error %d decoding channel_port_loads_t!!!\n",
+                    status);
+        } else {
+            channel_port_loads_handler(lcm, &loads_msg);
+            channel_port_loads_t_decode_cleanup(&loads_msg);
+        }
+        // discard the received message
+        handled_internal_message = 1;
     }
 
     if (handled_internal_message) {
         // one of the handlers above took it, so discard lcmb
         g_static_mutex_lock(&lcm->receive_lock);
-        lcm_buf_free_data(lcmb, lcm->ringbuf);
+        free_recv_buf_data(lcm, lcmb);
         lcm_buf_enqueue(lcm->inbufs_empty, lcmb);
         g_static_mutex_unlock(&lcm->receive_lock);
     } else {
@@ -608,24 +910,287 @@ static void dispatch_complete_message(lcm_mpudpm_t * lcm, lcm_buf_t * lcmb,
         // incoming message.
         if (lcmb->ringbuf) {
             lcm_ringbuf_shrink_last(lcmb->ringbuf, lcmb->buf, actual_size);
+            uint32_t used = lcm_ringbuf_used(reader->ringbuf);
+            if (used > reader->ringbuf_high_water)
+                reader->ringbuf_high_water = used;
+        }
+        /* Queue the packet for future retrieval by lcm_handle (), and wake up
+         * the reading thread if it isn't already. */
+        lcm_buf_enqueue(lcm->inbufs_filled, lcmb);
+        lcm_notify_signal(&lcm->notify);
+        g_static_mutex_unlock(&lcm->receive_lock);
+    }
+}
+
+#ifdef USE_EPOLL
+/* Receive slots for one recvmmsg() call.  Packets are copied onto the
+ * ringbuffer only once they complete a message, since the ringbuffer can only
+ * release its oldest or newest chunk, and any packet in a batch may be
+ * dropped. */
+typedef struct _mpudpm_recv_batch mpudpm_recv_batch_t;
+struct _mpudpm_recv_batch {
+    int size;
+    char *slots;                // size * LCM_MAX_UNFRAGMENTED_PACKET_SIZE
+    struct mmsghdr *msgs;
+    struct iovec *vecs;
+    char *controlbufs;          // 64 bytes per slot, for SO_TIMESTAMP
+    lcm_buf_t *pkts;            // metadata of the packet in each slot
+};
+
+static mpudpm_recv_batch_t *
+mpudpm_recv_batch_new (int size)
+{
+    mpudpm_recv_batch_t *batch =
+        (mpudpm_recv_batch_t *) calloc (1, sizeof (mpudpm_recv_batch_t));
+    batch->size = size;
+    batch->slots = (char *) malloc (size * LCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+    batch->msgs = (struct mmsghdr *) calloc (size, sizeof (struct mmsghdr));
+    batch->vecs = (struct iovec *) calloc (size, sizeof (struct iovec));
+    batch->controlbufs = (char *) calloc (size, 64);
+    batch->pkts = (lcm_buf_t *) calloc (size, sizeof (lcm_buf_t));
+
+    int i;
+    for (i = 0; i < size; i++) {
+        char *slot = batch->slots + i * LCM_MAX_UNFRAGMENTED_PACKET_SIZE;
+        // zero the last byte of each slot so that strlen never segfaults
+        slot[LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1] = 0;
+        batch->pkts[i].buf = slot;
+
+        batch->vecs[i].iov_base = slot;
+        batch->vecs[i].iov_len = LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1;
+
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        msg->msg_name = &batch->pkts[i].from;
+        msg->msg_iov = &batch->vecs[i];
+        msg->msg_iovlen = 1;
+    }
+    return batch;
+}
+
+static void
+mpudpm_recv_batch_free (mpudpm_recv_batch_t *batch)
+{
+    free (batch->slots);
+    free (batch->msgs);
+    free (batch->vecs);
+    free (batch->controlbufs);
+    free (batch->pkts);
+    free (batch);
+}
+
+/* Reads up to batch->size datagrams from sock.  The caller must hold the
+ * receive_lock, so that sock can't be closed underneath the call.  Returns the
+ * number of datagrams read. */
+static int
+recv_batch_from_socket (mpudpm_reader_t *reader, mpudpm_recv_batch_t *batch,
+        mpudpm_socket_t *sock)
+{
+    int i;
+    for (i = 0; i < batch->size; i++) {
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        msg->msg_namelen = sizeof (struct sockaddr);
+#ifdef MSG_EXT_HDR
+        msg->msg_control = batch->controlbufs + i * 64;
+        msg->msg_controllen = 64;
+#endif
+        msg->msg_flags = 0;
+    }
+
+    int npackets = recvmmsg (sock->fd, batch->msgs, batch->size,
+            MSG_DONTWAIT, NULL);
+    if (npackets < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror ("recv_batch_from_socket -- recvmmsg");
+            reader->udp_discarded_bad++;
+        }
+        return 0;
+    }
+    return npackets;
+}
+
+/* Parses the datagrams of a batch received on recv_port, and queues every
+ * message they complete for lcm_handle (). */
+static void
+process_recv_batch (mpudpm_reader_t *reader, mpudpm_recv_batch_t *batch,
+        int npackets, uint16_t recv_port)
+{
+    lcm_mpudpm_t *lcm = reader->lcm;
+    int64_t now = 0;
+    int i;
+    for (i = 0; i < npackets; i++) {
+        lcm_buf_t *pkt = &batch->pkts[i];
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        int sz = batch->msgs[i].msg_len;
+
+        if (sz < sizeof(lcm2_header_short_t)) {
+            // packet too short to be LCM
+            reader->udp_discarded_bad++;
+            continue;
         }
-        // If necessary, notify the reading thread by writing to a pipe.  We
-        // only want one character in the pipe at a time to avoid blocking
-        // writes, so we only do this when the queue transitions from empty to
-        // non-empty.
-        if (lcm_buf_queue_is_empty(lcm->inbufs_filled)) {
-            if (lcm_internal_pipe_write(lcm->notify_pipe[1], "+", 1) < 0) {
-                perror("write to notify");
+
+        pkt->fromlen = msg->msg_namelen;
+        // see the comment in the select() based recv_thread below
+        struct sockaddr_in *from_addr = (struct sockaddr_in*) &pkt->from;
+        from_addr->sin_addr.s_addr &= 0xFFFF0000;
+        from_addr->sin_addr.s_addr |= htons(recv_port);
+
+        pkt->recv_utime = 0;
+#ifdef SO_TIMESTAMP
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR (msg);
+        // Get the receive timestamp out of the packet headers (if possible)
+        while (cmsg) {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_TIMESTAMP) {
+                struct timeval * t = (struct timeval*) CMSG_DATA (cmsg);
+                pkt->recv_utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
+                break;
             }
+            cmsg = CMSG_NXTHDR (msg, cmsg);
         }
-        /* Queue the packet for future retrieval by lcm_handle (). */
-        lcm_buf_enqueue(lcm->inbufs_filled, lcmb);
+#endif
+        if (!pkt->recv_utime) {
+            if (!now)
+                now = lcm_timestamp_now ();
+            pkt->recv_utime = now;
+        }
+
+        lcm2_header_short_t *hdr2 = (lcm2_header_short_t*) pkt->buf;
+        uint32_t rcvd_magic = ntohl(hdr2->magic);
+        lcm_buf_t *lcmb;
+        if (rcvd_magic == LCM2_MAGIC_SHORT) {
+            if (!recv_short_message (reader, pkt, sz))
+                continue;
+            // copy the whole packet onto the ringbuffer
+            g_static_mutex_lock(&lcm->receive_lock);
+            lcmb = lcm_buf_allocate_data_len (lcm->inbufs_empty,
+                    &reader->ringbuf, sz);
+            g_static_mutex_unlock(&lcm->receive_lock);
+            memcpy (lcmb->buf, pkt->buf, sz);
+        } else if (rcvd_magic == LCM2_MAGIC_LONG) {
+            if (!recv_message_fragment (reader, pkt, sz))
+                continue;
+            // take over the reassembled message from the slot's packet
+            g_static_mutex_lock(&lcm->receive_lock);
+            lcmb = lcm_buf_dequeue (lcm->inbufs_empty);
+            g_static_mutex_unlock(&lcm->receive_lock);
+            if (!lcmb)
+                lcmb = (lcm_buf_t *) calloc (1, sizeof (lcm_buf_t));
+            lcmb->buf = pkt->buf;
+            pkt->buf = batch->slots + i * LCM_MAX_UNFRAGMENTED_PACKET_SIZE;
+        } else {
+            dbg(DBG_LCM, "LCM: bad magic\n");
+            reader->udp_discarded_bad++;
+            continue;
+        }
+
+        strcpy (lcmb->channel_name, pkt->channel_name);
+        lcmb->channel_size = pkt->channel_size;
+        lcmb->chan = pkt->chan;
+        lcmb->recv_utime = pkt->recv_utime;
+        lcmb->data_offset = pkt->data_offset;
+        lcmb->data_size = pkt->data_size;
+        lcmb->from = pkt->from;
+        lcmb->fromlen = pkt->fromlen;
+
+        dispatch_complete_message(reader, lcmb, sz);
+    }
+}
+
+/* This is the receiver thread that runs continuously to retrieve any incoming
+ * LCM packets from the network and queues them locally.
+ *
+ * Each reader runs its own thread.  Its sockets are registered with its
+ * epoll_fd when they are created, so waking up
+ * costs the same no matter how many ports are open.  The ready sockets are
+ * then drained round robin, one batch at a time, until none has data left. */
+static void *
+recv_thread(void * user) {
+#ifdef G_OS_UNIX
+    // Mask out all signals on this thread.
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+#endif
+
+    mpudpm_reader_t * reader = (mpudpm_reader_t *) user;
+    lcm_mpudpm_t * lcm = reader->lcm;
+
+    mpudpm_recv_batch_t *batch = mpudpm_recv_batch_new (RECV_BATCH_SIZE);
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    mpudpm_socket_t *ready[MAX_EPOLL_EVENTS];
+
+    // loop until we get an exit message on the thread_msg_pipe
+    while (1) {
+        // sockets removed from here on are caught by recv_sockets_changed
+        g_static_mutex_lock(&lcm->receive_lock);
+        reader->recv_sockets_changed = 0;
         g_static_mutex_unlock(&lcm->receive_lock);
+
+        int nevents = epoll_wait(reader->epoll_fd, events, MAX_EPOLL_EVENTS,
+                mapping_reply_timeout(reader));
+        if (nevents < 0) {
+            if (errno != EINTR)
+                perror("recv_thread -- epoll_wait");
+            continue;
+        }
+        publish_due_mapping_update(lcm);
+
+        int nready = 0;
+        int exiting = 0;
+        for (int i = 0; i < nevents; i++) {
+            if (events[i].data.ptr) {
+                ready[nready++] = (mpudpm_socket_t *) events[i].data.ptr;
+                continue;
+            }
+            // the only message sent on the pipe is an exit command
+            char ch;
+            if (lcm_internal_pipe_read(reader->thread_msg_pipe[0], &ch, 1) <= 0)
+                fprintf(stderr,
+                        "Error: Problem reading from thread_msg_pipe\n");
+            else
+                dbg(DBG_LCM, "read thread received exit command\n");
+            exiting = 1;
+        }
+        if (exiting)
+            break;
+
+        while (nready > 0) {
+            int nleft = 0;
+            for (int i = 0; i < nready; i++) {
+                g_static_mutex_lock(&lcm->receive_lock);
+                if (reader->recv_sockets_changed) {
+                    // a socket may have been closed, so the pointers in ready
+                    // can't be trusted anymore.  Wait again instead, epoll
+                    // still reports the sockets that have data left.
+                    g_static_mutex_unlock(&lcm->receive_lock);
+                    nleft = 0;
+                    break;
+                }
+                mpudpm_socket_t *sock = ready[i];
+                uint16_t recv_port = sock->port;
+                int npackets = recv_batch_from_socket(reader, batch, sock);
+                g_static_mutex_unlock(&lcm->receive_lock);
+
+                process_recv_batch(reader, batch, npackets, recv_port);
+
+                // a full batch means the socket may have more data queued
+                if (npackets == batch->size)
+                    ready[nleft++] = sock;
+            }
+            nready = nleft;
+        }
     }
+
+    mpudpm_recv_batch_free (batch);
+    dbg(DBG_LCM, "read thread exiting\n");
+    return NULL ;
 }
 
+#else
+
 /* This is the receiver thread that runs continuously to retrieve any incoming
- * LCM packets from the network and queues them locally. */
+ * LCM packets from the network and queues them locally.  Each reader runs its
+ * own thread, which only reads the reader's sockets. */
 static void *
 recv_thread(void * user) {
 #ifdef G_OS_UNIX
@@ -635,7 +1200,8 @@ recv_thread(void * user) {
     pthread_sigmask(SIG_SETMASK, &mask, NULL);
 #endif
 
-    lcm_mpudpm_t * lcm = (lcm_mpudpm_t *) user;
+    mpudpm_reader_t * reader = (mpudpm_reader_t *) user;
+    lcm_mpudpm_t * lcm = reader->lcm;
 
     lcm_buf_t *lcmb = NULL;
     // loop until we get an exit message on the thread_msg_pipe
@@ -649,30 +1215,37 @@ recv_thread(void * user) {
         FD_ZERO(&fds);
 
         // thread_msg_pipe fd
-        FD_SET(lcm->thread_msg_pipe[0], &fds);
-        SOCKET maxfd = lcm->thread_msg_pipe[0];
+        FD_SET(reader->thread_msg_pipe[0], &fds);
+        SOCKET maxfd = reader->thread_msg_pipe[0];
 
         for (GSList* it = lcm->recv_sockets; it != NULL ; it = it->next) {
           mpudpm_socket_t * sub_socket = (mpudpm_socket_t *) it->data;
+          if (sub_socket->reader != reader)
+            continue;
           FD_SET(sub_socket->fd, &fds);
           if (sub_socket->fd > maxfd) {
             maxfd = sub_socket->fd;
           }
         }
-        lcm->recv_sockets_changed = 0;
+        reader->recv_sockets_changed = 0;
 
         // unlock receive_lock while we wait for a message
         g_static_mutex_unlock(&lcm->receive_lock);
 
-        if (select(maxfd + 1, &fds, NULL, NULL, NULL) < 0) {
+        int timeout_ms = mapping_reply_timeout(reader);
+        struct timeval timeout = { timeout_ms / 1000,
+            (timeout_ms % 1000) * 1000 };
+        if (select(maxfd + 1, &fds, NULL, NULL,
+                    timeout_ms < 0 ? NULL : &timeout) < 0) {
             perror("udp_read_packet -- select() failed:");
             continue;
         }
+        publish_due_mapping_update(lcm);
 
         // check for a signaling message
-        if (FD_ISSET(lcm->thread_msg_pipe[0], &fds)) {
+        if (FD_ISSET(reader->thread_msg_pipe[0], &fds)) {
             char ch;
-            int status = lcm_internal_pipe_read(lcm->thread_msg_pipe[0], &ch,
+            int status = lcm_internal_pipe_read(reader->thread_msg_pipe[0], &ch,
                     1);
             if (status <= 0) {
                 fprintf(stderr,
@@ -699,7 +1272,7 @@ recv_thread(void * user) {
             }
         }
         g_static_mutex_lock(&lcm->receive_lock);
-        if (lcm->recv_sockets_changed) {
+        if (reader->recv_sockets_changed) {
             // the set of receive sockets has changed, so we need to start
             // over
             g_static_mutex_unlock(&lcm->receive_lock);
@@ -715,7 +1288,8 @@ recv_thread(void * user) {
                 it = it->next, ++poll_i) {
             // We should be holding receive_lock at the start of this loop
             mpudpm_socket_t * sub_socket = (mpudpm_socket_t *) it->data;
-            if (!FD_ISSET(sub_socket->fd, &fds)) {
+            if (sub_socket->reader != reader ||
+                    !FD_ISSET(sub_socket->fd, &fds)) {
                 continue;
             } else {
                 recv_fd = sub_socket->fd;
@@ -728,7 +1302,7 @@ recv_thread(void * user) {
                 // We should be holding receive_lock at the start of this loop
                 if (lcmb == NULL ) {
                     lcmb = lcm_buf_allocate_data(lcm->inbufs_empty,
-                            &lcm->ringbuf);
+                            &reader->ringbuf);
                 }
 
                 // unlock while we actually receive the incoming message
@@ -760,14 +1334,14 @@ recv_thread(void * user) {
                     if (WSAGetLastError() != WSAEWOULDBLOCK) {
 #endif
                         perror("udp_read_packet -- recvmsg");
-                        lcm->udp_discarded_bad++;
+                        reader->udp_discarded_bad++;
                     }
                     break;
                 }
 
                 if (sz < sizeof(lcm2_header_short_t)) {
                     // packet too short to be LCM
-                    lcm->udp_discarded_bad++;
+                    reader->udp_discarded_bad++;
                     continue;
                 }
 
@@ -809,18 +1383,18 @@ recv_thread(void * user) {
                 uint32_t rcvd_magic = ntohl(hdr2->magic);
                 int got_complete_message = 0;
                 if (rcvd_magic == LCM2_MAGIC_SHORT)
-                    got_complete_message = recv_short_message(lcm, lcmb, sz);
+                    got_complete_message = recv_short_message(reader, lcmb, sz);
                 else if (rcvd_magic == LCM2_MAGIC_LONG)
-                    got_complete_message = recv_message_fragment(lcm, lcmb, sz);
+                    got_complete_message = recv_message_fragment(reader, lcmb, sz);
                 else {
                     dbg(DBG_LCM, "LCM: bad magic\n");
-                    lcm->udp_discarded_bad++;
+                    reader->udp_discarded_bad++;
                     continue;
                 }
 
                 // dispatch internal messages
                 if (got_complete_message) {
-                    dispatch_complete_message(lcm, lcmb, sz);
+                    dispatch_complete_message(reader, lcmb, sz);
                     lcmb = NULL;
                 }
                 // lock to go back around the while loop
@@ -831,7 +1405,7 @@ recv_thread(void * user) {
             // lock the receive lock to check whether the receive sockets have
             // changed and go back around the loop
             g_static_mutex_lock(&lcm->receive_lock);
-            if (lcm->recv_sockets_changed) {
+            if (reader->recv_sockets_changed) {
                 // the set of receive sockets may have changed, so we need to
                 // break and wait again on the appropriate set of sockets
                 break;
@@ -843,6 +1417,7 @@ recv_thread(void * user) {
     dbg(DBG_LCM, "read thread exiting\n");
     return NULL ;
 }
+#endif
 
 int
 lcm_mpudpm_get_fileno (lcm_mpudpm_t *lcm)
@@ -850,7 +1425,7 @@ lcm_mpudpm_get_fileno (lcm_mpudpm_t *lcm)
     if (setup_recv_parts(lcm) < 0) {
         return -1;
     }
-    return lcm->notify_pipe[0];
+    return lcm_notify_fileno (&lcm->notify);
 }
 
 int
@@ -901,15 +1476,20 @@ lcm_mpudpm_subscribe (lcm_mpudpm_t *lcm, const char *channel)
         if (lookup_value == NULL ) {
             // insert the new destination into the hash table
             port = map_channel_to_port(lcm, channel);
-            g_hash_table_insert(lcm->channel_to_port_map, strdup(channel),
-                    GUINT_TO_POINTER(port));
-            // broadcast the updated channel map...
-            lcm->last_mapping_update_utime = 0;
-            publish_channel_mapping_update(lcm);
+            set_channel_port(lcm, channel, port);
+            // broadcast the new entry
+            publish_channel_mapping_delta(lcm, channel);
         }
         else{
             port = GPOINTER_TO_UINT(lookup_value);
         }
+        if (lcm->params.balance_ports) {
+            // the channel may have been moved off its hashed port.  Ask the
+            // publishers where it is.
+            char *msg = "r";
+            publish_message_internal(lcm, CHANNEL_TO_PORT_MAP_REQUEST_CHANNEL,
+                    (uint8_t*) msg, strlen(msg));
+        }
         g_static_mutex_unlock(&lcm->transmit_lock);
 
         g_static_mutex_lock(&lcm->receive_lock);
@@ -953,15 +1533,8 @@ lcm_mpudpm_unsubscribe (lcm_mpudpm_t *lcm, const char *channel)
     dbg(DBG_LCM, "Unsubscribing from %s\n", channel);
     // cleanup sockets
     for (GSList* it = chan_sub->sockets; it != NULL ; it = it->next) {
-        mpudpm_socket_t * sock = (mpudpm_socket_t *) it->data;
         // decrement the reference count for all of the used sockets
-        sock->num_subscribers--;
-        if (sock->num_subscribers==0){
-            // destroy socket if we're last one using it
-            dbg(DBG_LCM, "No more subscribers using port %d, closing it\n",
-                    sock->port);
-            remove_recv_socket(lcm,sock);
-        }
+        release_recv_socket(lcm, (mpudpm_socket_t *) it->data);
     }
     lcm->subscribers = g_slist_delete_link (lcm->subscribers, chan_it);
     mpudpm_subscriber_t_destroy(chan_sub);
@@ -969,18 +1542,72 @@ lcm_mpudpm_unsubscribe (lcm_mpudpm_t *lcm, const char *channel)
     return 0;
 }
 
+// Adds a channel to the channel to port map, or changes its port, and keeps
+// the map digest up to date.
+// This function assumes that the caller is holding the transmit_lock
+static void
+set_channel_port(lcm_mpudpm_t *lcm, const char *channel, uint16_t port)
+{
+    if (g_hash_table_lookup(lcm->channel_to_port_map, channel) == NULL &&
+            !is_reserved_channel(channel)) {
+        lcm->num_mapped_channels++;
+        lcm->map_digest += mpudpm_digest_hash(channel);
+    }
+    g_hash_table_insert(lcm->channel_to_port_map, strdup(channel),
+            GUINT_TO_POINTER(port));
+}
+
+// Publishes the mapping of a channel that was just added to the map, along
+// with the map digest.  If channel is NULL, only the digest is published.
+// This function assumes that the caller is holding the transmit_lock
+static void
+publish_channel_mapping_delta(lcm_mpudpm_t *lcm, const char *channel){
+    lcm->last_mapping_update_utime = lcm_timestamp_now();
+
+    channel_to_port_t mapping;
+    channel_port_map_delta_t msg;
+    msg.num_ports = lcm->params.num_mc_ports;
+    msg.map_size = lcm->num_mapped_channels;
+    msg.map_digest = (int64_t) lcm->map_digest;
+    msg.num_channels = 0;
+    msg.mapping = &mapping;
+    if (channel != NULL) {
+        mapping.channel = (char *) channel;
+        // cast to int16_t for LCM
+        mapping.port = (int16_t) GPOINTER_TO_UINT(
+                g_hash_table_lookup(lcm->channel_to_port_map, channel));
+        msg.num_channels = 1;
+    }
+
+    int msg_sz = channel_port_map_delta_t_encoded_size(&msg);
+    void* buf = malloc(msg_sz);
+    channel_port_map_delta_t_encode(buf, 0, msg_sz, &msg);
+    dbg(DBG_LCM, "Publishing a %dB channel_port_map_delta with %d mappings\n",
+            msg_sz, msg.num_channels);
+    publish_message_internal(lcm, CHANNEL_TO_PORT_MAP_DELTA_CHANNEL, buf,
+            msg_sz);
+    free(buf);
+
+    // processes of older releases don't know about deltas
+    if (channel != NULL && lcm->old_format_peers)
+        publish_channel_mapping_update(lcm);
+}
+
+// Publishes the whole channel to port map.  This is only needed when a new
+// process asks for it, when the map digests of two processes differ, or when
+// a process of an older release is around.
 // This function assumes that the caller is holding the transmit_lock
 static void
 publish_channel_mapping_update(lcm_mpudpm_t *lcm){
     int64_t now = lcm_timestamp_now();
-    if (now - lcm->last_mapping_update_utime < 1e4) {
+    // this also answers any process whose map differs
+    lcm->full_mapping_reply_utime = 0;
+    if (now - lcm->last_full_mapping_utime < 1e4) {
         // lets not publish updates too often.
-        // if we actually have new information (ie a new channel),
-        // last_mapping_update_utime will have been set to 0, so this check
-        // is bypassed
         return;
     }
-    lcm->last_mapping_update_utime = lcm_timestamp_now();
+    lcm->last_full_mapping_utime = now;
+    lcm->last_mapping_update_utime = now;
 
     channel_port_map_update_t* msg = (channel_port_map_update_t*) calloc(1,
             sizeof(channel_port_map_update_t));
@@ -1005,6 +1632,7 @@ publish_channel_mapping_update(lcm_mpudpm_t *lcm){
     }
     msg->num_channels = ind;
     assert(msg->num_channels == table_size - NUM_INTERNAL_CHANNELS);
+    assert(msg->num_channels == lcm->num_mapped_channels);
 
     if (msg->num_channels > 0) {
         // publish the message
@@ -1014,16 +1642,59 @@ publish_channel_mapping_update(lcm_mpudpm_t *lcm){
         dbg(DBG_LCM,
                 "Publishing a %dB channel_port_map with %d mappings\n",
                 msg_sz, msg->num_channels);
-        publish_message_internal(lcm, CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL, buf,
-                msg_sz);
+        publish_message_internal(lcm, lcm->old_format_peers ?
+                CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL : CHANNEL_TO_PORT_MAP_CHANNEL,
+                buf, msg_sz);
         free(buf);
     }
     channel_port_map_update_t_destroy(msg);
 }
 
+// Publishes the full map a random time from now, unless that is already
+// planned.  All processes that notice a difference would otherwise answer at
+// once, while usually the first answer makes the others unnecessary.
+// This function assumes that the caller is holding the transmit_lock
+static void
+schedule_channel_mapping_update(lcm_mpudpm_t *lcm)
+{
+    if (lcm->full_mapping_reply_utime)
+        return;
+    lcm->full_mapping_reply_utime = lcm_timestamp_now()
+            + g_random_int_range(0, FULL_MAPPING_REPLY_MAX_DELAY);
+}
+
+// Returns how many ms a reader may wait for packets, -1 meaning forever.  The
+// internal channels are received by the first reader, so that one wakes up
+// when the full map is due.
+static int
+mapping_reply_timeout(mpudpm_reader_t *reader)
+{
+    lcm_mpudpm_t *lcm = reader->lcm;
+    if (reader != &lcm->readers[0])
+        return -1;
+    g_static_mutex_lock(&lcm->transmit_lock);
+    int64_t reply_utime = lcm->full_mapping_reply_utime;
+    g_static_mutex_unlock(&lcm->transmit_lock);
+    if (!reply_utime)
+        return -1;
+    int64_t wait = reply_utime - lcm_timestamp_now();
+    return wait > 0 ? (int) ((wait + 999) / 1000) : 0;
+}
+
+static void
+publish_due_mapping_update(lcm_mpudpm_t *lcm)
+{
+    g_static_mutex_lock(&lcm->transmit_lock);
+    if (lcm->full_mapping_reply_utime &&
+            lcm_timestamp_now() >= lcm->full_mapping_reply_utime)
+        publish_channel_mapping_update(lcm);
+    g_static_mutex_unlock(&lcm->transmit_lock);
+}
+
 static void
 channel_port_mapping_update_handler(lcm_mpudpm_t *lcm,
-        const channel_port_map_update_t *msg, int64_t recv_utime) {
+        const channel_port_map_update_t *msg, int64_t recv_utime,
+        int old_format) {
     if (msg->num_ports != lcm->params.num_mc_ports) {
         fprintf(stderr, "WARNING: received a channel to port mapping "
                 "update from a process with \n"
@@ -1032,6 +1703,11 @@ channel_port_mapping_update_handler(lcm_mpudpm_t *lcm,
         return;
     }
     g_static_mutex_lock(&lcm->transmit_lock);
+    if (old_format && !lcm->old_format_peers) {
+        dbg(DBG_LCM, "A process of an older release is around, "
+                "publishing full channel to port maps from now on\n");
+        lcm->old_format_peers = 1;
+    }
     int8_t updated_channel_to_port_map = FALSE;
     for (int i = 0; i < msg->num_channels; i++) {
         void* lookup_value = g_hash_table_lookup(lcm->channel_to_port_map,
@@ -1044,20 +1720,70 @@ channel_port_mapping_update_handler(lcm_mpudpm_t *lcm,
                     port);
 
             // insert the new destination into the hash table
-            g_hash_table_insert(lcm->channel_to_port_map,
-                    strdup(msg->mapping[i].channel),
-                    GUINT_TO_POINTER(port));
+            set_channel_port(lcm, msg->mapping[i].channel, port);
             updated_channel_to_port_map = TRUE;
         }
     }
-    int channel_to_port_map_size = g_hash_table_size(lcm->channel_to_port_map);
-    if (!updated_channel_to_port_map
-            && channel_to_port_map_size
-            - NUM_INTERNAL_CHANNELS == msg->num_channels) {
-        // the broadcast message is identical to mine...
-        // treat it as if I just published an update :-)
+    if (lcm->num_mapped_channels == msg->num_channels) {
+        // the sender has all of my channels, so everyone who got this has
+        // them too
+        lcm->full_mapping_reply_utime = 0;
+        if (!updated_channel_to_port_map) {
+            // the broadcast message is identical to mine...
+            // treat it as if I just published an update :-)
+            dbg(DBG_LCM, "Channel to port map is up to date\n");
+            lcm->last_mapping_update_utime = recv_utime;
+        }
+    } else if (lcm->num_mapped_channels > msg->num_channels) {
+        // the sender is missing some of my channels
+        schedule_channel_mapping_update(lcm);
+    }
+    g_static_mutex_unlock(&lcm->transmit_lock);
+
+    if (updated_channel_to_port_map){
+        update_subscription_ports(lcm);
+    }
+}
+
+static void
+channel_port_mapping_delta_handler(lcm_mpudpm_t *lcm,
+        const channel_port_map_delta_t *msg, int64_t recv_utime) {
+    if (msg->num_ports != lcm->params.num_mc_ports) {
+        fprintf(stderr, "WARNING: received a channel to port mapping "
+                "update from a process with \n"
+                "nports=%d instead of %d\n", msg->num_ports,
+                lcm->params.num_mc_ports);
+        return;
+    }
+    g_static_mutex_lock(&lcm->transmit_lock);
+    int8_t updated_channel_to_port_map = FALSE;
+    for (int i = 0; i < msg->num_channels; i++) {
+        void* lookup_value = g_hash_table_lookup(lcm->channel_to_port_map,
+                msg->mapping[i].channel);
+        if (lookup_value == NULL ) {
+            // cast back to uint16_t for LCM
+            uint16_t port = (uint16_t)msg->mapping[i].port;
+            dbg(DBG_LCM, "Received mapping for new channel %s on port %d\n",
+                    msg->mapping[i].channel,
+                    port);
+            set_channel_port(lcm, msg->mapping[i].channel, port);
+            updated_channel_to_port_map = TRUE;
+        }
+    }
+    if (msg->map_size == lcm->num_mapped_channels
+            && (uint64_t) msg->map_digest == lcm->map_digest) {
+        // treat it as if I just published the digest
         dbg(DBG_LCM, "Channel to port map is up to date\n");
         lcm->last_mapping_update_utime = recv_utime;
+    } else if (msg->num_channels == 0) {
+        // Someone is missing channels.  Deltas that cross each other also
+        // disagree for a moment, so only periodic digests trigger a full
+        // sync.  Send my whole map, unless another process sends one with
+        // all of my channels first; if the sender has channels that are not
+        // in it, it answers with its own.
+        dbg(DBG_LCM, "Channel to port map digest differs (%d vs %d channels)\n",
+                msg->map_size, lcm->num_mapped_channels);
+        schedule_channel_mapping_update(lcm);
     }
     g_static_mutex_unlock(&lcm->transmit_lock);
 
@@ -1066,6 +1792,275 @@ channel_port_mapping_update_handler(lcm_mpudpm_t *lcm,
     }
 }
 
+// This function assumes that the caller is holding the transmit_lock
+static mpudpm_channel_load_t *
+get_channel_load(lcm_mpudpm_t *lcm, const char *channel)
+{
+    mpudpm_channel_load_t *load = (mpudpm_channel_load_t *)
+            g_hash_table_lookup(lcm->channel_loads, channel);
+    if (load == NULL) {
+        load = (mpudpm_channel_load_t *) calloc(1,
+                sizeof(mpudpm_channel_load_t));
+        g_hash_table_insert(lcm->channel_loads, strdup(channel), load);
+    }
+    return load;
+}
+
+static int64_t
+channel_rate(const mpudpm_channel_load_t *load, int64_t now)
+{
+    if (load == NULL || now - load->rate_utime > CHANNEL_LOAD_MAX_AGE)
+        return 0;
+    return load->rate;
+}
+
+// Of two heavy channels sharing a port, the one that ranks higher stays.  The
+// same order is used by all processes, so only one of them moves.
+static int
+channel_outranks(const char *a, int64_t rate_a, const char *b, int64_t rate_b)
+{
+    if (rate_a != rate_b)
+        return rate_a > rate_b;
+    return strcmp(a, b) < 0;
+}
+
+// Moves the heavy channels that this process publishes off ports they share
+// with other channels, onto ports that no channel uses yet.  This function
+// assumes that the caller is holding the transmit_lock
+static void
+rebalance_channels(lcm_mpudpm_t *lcm, int64_t now)
+{
+    int num_ports = lcm->params.num_mc_ports;
+    uint16_t port_start = lcm->params.mc_port_range_start;
+    int *num_channels = (int *) calloc(num_ports, sizeof(int));
+    int *num_heavy = (int *) calloc(num_ports, sizeof(int));
+    const char **top_channel = (const char **) calloc(num_ports,
+            sizeof(const char *));
+    int64_t *top_rate = (int64_t *) calloc(num_ports, sizeof(int64_t));
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, lcm->channel_to_port_map);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const char *channel = (const char *) key;
+        int ind = (uint16_t) (GPOINTER_TO_UINT(value) - port_start);
+        if (ind >= num_ports)
+            continue;
+        num_channels[ind]++;
+        int64_t rate = channel_rate((mpudpm_channel_load_t *)
+                g_hash_table_lookup(lcm->channel_loads, channel), now);
+        if (rate < lcm->params.heavy_channel_rate)
+            continue;
+        num_heavy[ind]++;
+        if (!top_channel[ind] ||
+                channel_outranks(channel, rate, top_channel[ind], top_rate[ind])) {
+            top_channel[ind] = channel;
+            top_rate[ind] = rate;
+        }
+    }
+
+    g_hash_table_iter_init(&iter, lcm->channel_loads);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const char *channel = (const char *) key;
+        mpudpm_channel_load_t *load = (mpudpm_channel_load_t *) value;
+        if (load->local_rate < lcm->params.heavy_channel_rate)
+            continue;
+        uint16_t port = GPOINTER_TO_UINT(
+                g_hash_table_lookup(lcm->channel_to_port_map, channel));
+        int ind = (uint16_t) (port - port_start);
+        if (ind >= num_ports || num_channels[ind] <= 1)
+            continue;
+        // if another heavy channel shares the port, the lower ranked one
+        // moves
+        if (num_heavy[ind] > 1 && top_channel[ind] != NULL &&
+                !strcmp(top_channel[ind], channel))
+            continue;
+
+        // probe for an unused port, starting at a different place for each
+        // channel.  The first port is left to the internal channels.
+        int new_ind = -1;
+        uint32_t start = mpudpm_str_hash(channel);
+        for (int i = 0; i < num_ports; i++) {
+            int candidate = (start + i) % num_ports;
+            if (candidate != 0 && num_channels[candidate] == 0) {
+                new_ind = candidate;
+                break;
+            }
+        }
+        if (new_ind < 0) {
+            dbg(DBG_LCM, "No unused port left for heavy channel %s\n", channel);
+            continue;
+        }
+
+        uint16_t new_port = port_start + new_ind;
+        dbg(DBG_LCM, "Moving channel %s (%lld B/s) from port %d to %d\n",
+                channel, (long long) load->local_rate, port, new_port);
+        num_channels[ind]--;
+        num_heavy[ind]--;
+        num_channels[new_ind]++;
+        num_heavy[new_ind]++;
+        set_channel_port(lcm, channel, new_port);
+        load->version++;
+        load->prev_port = port;
+        load->switch_utime = now + CHANNEL_MOVE_GRACE_PERIOD;
+        lcm->moved_channels = 1;
+    }
+
+    free(num_channels);
+    free(num_heavy);
+    free(top_channel);
+    free(top_rate);
+}
+
+// Publishes the channels that this process publishes, with their rates, and
+// every channel that was moved off its hashed port.  This function assumes
+// that the caller is holding the transmit_lock
+static void
+publish_channel_loads(lcm_mpudpm_t *lcm)
+{
+    int64_t now = lcm_timestamp_now();
+    if (now - lcm->last_loads_publish_utime < 1e4) {
+        // lets not publish updates too often.
+        return;
+    }
+    lcm->last_loads_publish_utime = now;
+
+    channel_port_loads_t msg;
+    msg.num_ports = lcm->params.num_mc_ports;
+    msg.num_channels = 0;
+    msg.loads = (channel_port_load_t *) calloc(
+            g_hash_table_size(lcm->channel_loads) + 1,
+            sizeof(channel_port_load_t));
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, lcm->channel_loads);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        char *channel = (char *) key;
+        mpudpm_channel_load_t *load = (mpudpm_channel_load_t *) value;
+        void *lookup_value = g_hash_table_lookup(lcm->channel_to_port_map,
+                channel);
+        if (lookup_value == NULL || (!load->local_rate && !load->version))
+            continue;
+        channel_port_load_t *entry = &msg.loads[msg.num_channels++];
+        entry->channel = channel;
+        entry->port = (int16_t) GPOINTER_TO_UINT(lookup_value);
+        entry->version = load->version;
+        entry->bytes_per_sec = load->local_rate;
+    }
+
+    if (msg.num_channels > 0) {
+        int msg_sz = channel_port_loads_t_encoded_size(&msg);
+        void* buf = malloc(msg_sz);
+        channel_port_loads_t_encode(buf, 0, msg_sz, &msg);
+        dbg(DBG_LCM, "Publishing a %dB channel_port_loads with %d channels\n",
+                msg_sz, msg.num_channels);
+        publish_message_internal(lcm, CHANNEL_PORT_LOADS_CHANNEL, buf, msg_sz);
+        free(buf);
+    }
+    // the channel names are owned by channel_loads
+    free(msg.loads);
+}
+
+// Measures how much this process published on each channel since the last
+// report, moves heavy channels if needed, and publishes the result.  This
+// function assumes that the caller is holding the transmit_lock
+static void
+report_channel_loads(lcm_mpudpm_t *lcm, int64_t now)
+{
+    int64_t elapsed = now - lcm->last_load_report_utime;
+    lcm->last_load_report_utime = now;
+    if (elapsed <= 0)
+        return;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, lcm->channel_loads);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        mpudpm_channel_load_t *load = (mpudpm_channel_load_t *) value;
+        load->local_rate = load->bytes * 1000000 / elapsed;
+        load->bytes = 0;
+        if (load->local_rate && load->local_rate >= channel_rate(load, now)) {
+            load->rate = load->local_rate;
+            load->rate_utime = now;
+        }
+    }
+
+    rebalance_channels(lcm, now);
+    publish_channel_loads(lcm);
+}
+
+static void
+channel_port_loads_handler(lcm_mpudpm_t *lcm, const channel_port_loads_t *msg)
+{
+    if (!lcm->params.balance_ports ||
+            msg->num_ports != lcm->params.num_mc_ports) {
+        // a mismatched nports is already reported for the mapping updates
+        return;
+    }
+    int64_t now = lcm_timestamp_now();
+    uint16_t port_start = lcm->params.mc_port_range_start;
+
+    g_static_mutex_lock(&lcm->transmit_lock);
+    int8_t updated_channel_to_port_map = lcm->moved_channels;
+    lcm->moved_channels = 0;
+    for (int i = 0; i < msg->num_channels; i++) {
+        const channel_port_load_t *entry = &msg->loads[i];
+        // cast back to uint16_t for LCM
+        uint16_t port = (uint16_t) entry->port;
+        if (is_reserved_channel(entry->channel) ||
+                (uint16_t) (port - port_start) >= msg->num_ports)
+            continue;
+
+        mpudpm_channel_load_t *load = get_channel_load(lcm, entry->channel);
+        if (entry->bytes_per_sec >= channel_rate(load, now)) {
+            load->rate = entry->bytes_per_sec;
+            load->rate_utime = now;
+        }
+
+        void* lookup_value = g_hash_table_lookup(lcm->channel_to_port_map,
+                entry->channel);
+        uint16_t cur_port = GPOINTER_TO_UINT(lookup_value);
+        if (lookup_value != NULL && entry->version < load->version)
+            continue;
+        if (lookup_value != NULL && entry->version == load->version &&
+                port >= cur_port)
+            continue;
+        // newer mapping.  When two processes moved the channel at the same
+        // time, the lower port wins.
+        load->version = entry->version;
+        if (port != cur_port) {
+            dbg(DBG_LCM, "Channel %s moved to port %d\n", entry->channel, port);
+            set_channel_port(lcm, entry->channel, port);
+            // someone else moved it, so follow right away
+            load->switch_utime = 0;
+            updated_channel_to_port_map = TRUE;
+        }
+    }
+    g_static_mutex_unlock(&lcm->transmit_lock);
+
+    if (updated_channel_to_port_map){
+        update_subscription_ports(lcm);
+    }
+    // publishers report their loads regularly, so this is also a good time
+    // to stop receiving on ports that channels moved away from
+    release_old_ports(lcm);
+}
+
+// Returns true if a channel of the subscriber is received on port
+static int
+subscriber_uses_port(mpudpm_subscriber_t * sub, uint16_t port)
+{
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, sub->channel_set);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (GPOINTER_TO_UINT(value) == port)
+            return 1;
+    }
+    return 0;
+}
+
 // This function assumes that the caller is holding the receive_lock
 static void
 add_channel_to_subscriber(lcm_mpudpm_t* lcm, mpudpm_subscriber_t * sub,
@@ -1089,12 +2084,81 @@ add_channel_to_subscriber(lcm_mpudpm_t* lcm, mpudpm_subscriber_t * sub,
                 port, channel);
         subscription_socket = add_recv_socket(lcm, port);
     }
-    // increment socket reference counter
-    subscription_socket->num_subscribers++;
-    sub->sockets = g_slist_prepend(sub->sockets,
-            subscription_socket);
-    char* key = strdup(channel);
-    g_hash_table_replace(sub->channel_set, key, key);
+    // increment socket reference counter, once per subscriber
+    if (g_slist_find(sub->sockets, subscription_socket) == NULL) {
+        subscription_socket->num_subscribers++;
+        sub->sockets = g_slist_prepend(sub->sockets,
+                subscription_socket);
+    }
+
+    void* lookup_value = g_hash_table_lookup(sub->channel_set, channel);
+    uint16_t old_port = GPOINTER_TO_UINT(lookup_value);
+    g_hash_table_replace(sub->channel_set, strdup(channel),
+            GUINT_TO_POINTER(port));
+    if (lookup_value == NULL || old_port == port)
+        return;
+
+    // The channel moved.  The process that moved it goes on publishing on
+    // the old port for a little while, so keep receiving there until then.
+    int64_t release_utime = lcm_timestamp_now() + CHANNEL_MOVE_RELEASE_DELAY;
+    for (GSList* it = sub->old_ports; it != NULL; it = it->next) {
+        mpudpm_old_port_t* old = (mpudpm_old_port_t*) it->data;
+        if (old->port == old_port) {
+            old->release_utime = release_utime;
+            return;
+        }
+    }
+    mpudpm_old_port_t* old = (mpudpm_old_port_t*) malloc(
+            sizeof(mpudpm_old_port_t));
+    old->port = old_port;
+    old->release_utime = release_utime;
+    sub->old_ports = g_slist_prepend(sub->old_ports, old);
+}
+
+// This function assumes that the caller is holding the receive_lock
+static void
+release_subscriber_port(lcm_mpudpm_t* lcm, mpudpm_subscriber_t * sub,
+        uint16_t port)
+{
+    for (GSList* sock_it = sub->sockets; sock_it != NULL ;
+            sock_it = sock_it->next) {
+        mpudpm_socket_t* sock = (mpudpm_socket_t*) sock_it->data;
+        if (sock->port == port) {
+            dbg(DBG_LCM, "Subscriber (%s) no longer using port %d\n",
+                    sub->channel_string, port);
+            sub->sockets = g_slist_delete_link(sub->sockets, sock_it);
+            release_recv_socket(lcm, sock);
+            return;
+        }
+    }
+}
+
+// Lets go of the ports that channels moved away from once their publishers
+// stopped using them, unless another channel of the subscriber is still
+// received there.
+static void
+release_old_ports(lcm_mpudpm_t* lcm)
+{
+    int64_t now = lcm_timestamp_now();
+    g_static_mutex_lock(&lcm->receive_lock);
+    for (GSList* it = lcm->subscribers; it != NULL ; it = it->next) {
+        mpudpm_subscriber_t * sub = (mpudpm_subscriber_t *) it->data;
+        GSList* old_it = sub->old_ports;
+        while (old_it != NULL) {
+            mpudpm_old_port_t* old = (mpudpm_old_port_t*) old_it->data;
+            GSList* next = old_it->next;
+            if (now < old->release_utime) {
+                old_it = next;
+                continue;
+            }
+            if (!subscriber_uses_port(sub, old->port))
+                release_subscriber_port(lcm, sub, old->port);
+            sub->old_ports = g_slist_delete_link(sub->old_ports, old_it);
+            free(old);
+            old_it = next;
+        }
+    }
+    g_static_mutex_unlock(&lcm->receive_lock);
 }
 
 static void
@@ -1106,8 +2170,15 @@ update_subscription_ports(lcm_mpudpm_t* lcm){
     for (GSList* it = lcm->subscribers; it != NULL ; it = it->next) {
         mpudpm_subscriber_t * sub = (mpudpm_subscriber_t *) it->data;
         if (sub->regex==NULL){
-            // Subscriber is looking for a single channel
-            // We should have already subscribed
+            // Subscriber is looking for a single channel.  We already
+            // subscribed, but the channel may have moved to another port
+            // since.
+            void* lookup_value = g_hash_table_lookup(lcm->channel_to_port_map,
+                    sub->channel_string);
+            uint16_t port = GPOINTER_TO_UINT(lookup_value);
+            if (lookup_value != NULL && port != GPOINTER_TO_UINT(
+                    g_hash_table_lookup(sub->channel_set, sub->channel_string)))
+                add_channel_to_subscriber(lcm, sub, sub->channel_string, port);
             continue;
         }
         else {
@@ -1120,8 +2191,8 @@ update_subscription_ports(lcm_mpudpm_t* lcm){
                 uint16_t port = GPOINTER_TO_UINT(value);
                 if (g_regex_match(sub->regex, channel, (GRegexMatchFlags) 0,
                         NULL ) && !is_reserved_channel(channel)) {
-                    if (g_hash_table_lookup_extended(sub->channel_set, channel,
-                            NULL, NULL )) {
+                    if (port == GPOINTER_TO_UINT(
+                            g_hash_table_lookup(sub->channel_set, channel))) {
                         dbg(DBG_LCM,
                                 "Subscriber (%s) already listening for [%s] "
                                 "on port %d\n", sub->channel_string, channel, port);
@@ -1137,7 +2208,6 @@ update_subscription_ports(lcm_mpudpm_t* lcm){
     g_static_mutex_unlock(&lcm->receive_lock);
 }
 
-
 // This function assumes that the caller is holding the transmit_lock
 // The transmit lock is held so that all fragments are transmitted
 // together, and so that no other message uses the same sequence number
@@ -1176,15 +2246,27 @@ publish_message_internal (lcm_mpudpm_t *lcm, const char *channel, const void *da
                 channel, chan_port);
 
         // insert the new destination into the hash table
-        g_hash_table_insert(lcm->channel_to_port_map, strdup(channel),
-                GUINT_TO_POINTER(chan_port));
-        // force an update to get sent
-        lcm->last_mapping_update_utime =0; 
+        set_channel_port(lcm, channel, chan_port);
+        // and let everyone else know about it
+        publish_channel_mapping_delta(lcm, channel);
     }
     if (lcm_timestamp_now() - lcm->last_mapping_update_utime>
         lcm->channel_to_port_map_update_period) {
-        // publish the mapping if no one has broadcast in a while
-        publish_channel_mapping_update(lcm);
+        // publish the map digest if no one has broadcast in a while
+        publish_channel_mapping_delta(lcm, NULL);
+    }
+    if (lcm->params.balance_ports && !is_reserved_channel(channel)) {
+        int64_t now = lcm_timestamp_now();
+        mpudpm_channel_load_t *load = get_channel_load(lcm, channel);
+        load->bytes += datalen;
+        if (now - lcm->last_load_report_utime >= CHANNEL_LOAD_REPORT_PERIOD) {
+            report_channel_loads(lcm, now);
+            // the channel may have just been moved
+            chan_port = GPOINTER_TO_UINT(
+                    g_hash_table_lookup(lcm->channel_to_port_map, channel));
+        }
+        if (now < load->switch_utime)
+            chan_port = load->prev_port;
     }
     // set the destination port
     lcm->dest_addr.sin_port = htons(chan_port);
@@ -1316,65 +2398,119 @@ lcm_mpudpm_publish(lcm_mpudpm_t *lcm, const char *channel,
     return status;
 }
 
+static void
+dispatch_packet (lcm_mpudpm_t *lcm, lcm_buf_t *lcmb)
+{
+    lcm_recv_buf_t rbuf;
+    rbuf.data = (uint8_t*) lcmb->buf + lcmb->data_offset;
+    rbuf.data_size = lcmb->data_size;
+    rbuf.recv_utime = lcmb->recv_utime;
+    rbuf.lcm = lcm->lcm;
+
+    if(lcm->creating_read_thread) {
+        // special case:  If we're creating the read thread and are in
+        // self-test mode, then only dispatch the self-test message.
+        if(!strcmp(lcmb->channel_name, SELF_TEST_CHANNEL))
+            lcm_dispatch_channel_handlers (lcm->lcm, &rbuf, lcmb->chan);
+    } else {
+        lcm_dispatch_channel_handlers (lcm->lcm, &rbuf, lcmb->chan);
+    }
+}
+
 int
 lcm_mpudpm_handle (lcm_mpudpm_t *lcm)
 {
-    int status;
-    char ch;
     if(0 != setup_recv_parts (lcm)){
         return -1;
     }
 
-    /* Read one byte from the notify pipe.  This will block if no packets are
-     * available yet and wake up when they are. */
-    status = lcm_internal_pipe_read(lcm->notify_pipe[0], &ch, 1);
-    if (status == 0) {
-        fprintf (stderr, "Error: lcm_handle read 0 bytes from notify_pipe\n");
-        return -1;
-    }
-    else if (status < 0) {
-        fprintf (stderr, "Error: lcm_handle read: %s\n", strerror (errno));
-        return -1;
+    /* Wait for a packet.  This only blocks if none are queued yet. */
+    g_static_mutex_lock (&lcm->receive_lock);
+    while (lcm_buf_queue_is_empty (lcm->inbufs_filled)) {
+        g_static_mutex_unlock (&lcm->receive_lock);
+        if (0 != lcm_notify_wait (&lcm->notify)) {
+            fprintf (stderr, "Error: lcm_handle wait: %s\n", strerror (errno));
+            return -1;
+        }
+        g_static_mutex_lock (&lcm->receive_lock);
     }
 
     /* Dequeue the next received packet */
-    g_static_mutex_lock (&lcm->receive_lock);
     lcm_buf_t * lcmb = lcm_buf_dequeue (lcm->inbufs_filled);
 
-    if (!lcmb) {
-        fprintf (stderr, 
-                "Error: no packet available despite getting notification.\n");
-        g_static_mutex_unlock (&lcm->receive_lock);
+    /* Once the queue is drained, stop reporting the file descriptor as
+     * readable. */
+    if (lcm_buf_queue_is_empty (lcm->inbufs_filled))
+        lcm_notify_clear (&lcm->notify);
+    g_static_mutex_unlock (&lcm->receive_lock);
+
+    dispatch_packet (lcm, lcmb);
+
+    g_static_mutex_lock (&lcm->receive_lock);
+    free_recv_buf_data(lcm, lcmb);
+    lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
+    g_static_mutex_unlock (&lcm->receive_lock);
+
+    return 0;
+}
+
+static int
+lcm_mpudpm_handle_batch (lcm_mpudpm_t *lcm, int max_msgs)
+{
+    if(0 != setup_recv_parts (lcm)){
         return -1;
     }
 
-    /* If there are still packets in the queue, put something back in the pipe
-     * so that future invocations will get called. */
-    if (!lcm_buf_queue_is_empty (lcm->inbufs_filled))
-        if (lcm_internal_pipe_write(lcm->notify_pipe[1], "+", 1) < 0)
-            perror ("write to notify");
+    lcm_buf_queue_t batch;
+    batch.head = NULL;
+    batch.tail = &batch.head;
+    batch.count = 0;
+
+    /* Dequeue everything that's already available, up to max_msgs */
+    g_static_mutex_lock (&lcm->receive_lock);
+    while (batch.count < max_msgs &&
+            !lcm_buf_queue_is_empty (lcm->inbufs_filled))
+        lcm_buf_enqueue (&batch, lcm_buf_dequeue (lcm->inbufs_filled));
+    if (lcm_buf_queue_is_empty (lcm->inbufs_filled))
+        lcm_notify_clear (&lcm->notify);
     g_static_mutex_unlock (&lcm->receive_lock);
 
-    lcm_recv_buf_t rbuf;
-    rbuf.data = (uint8_t*) lcmb->buf + lcmb->data_offset;
-    rbuf.data_size = lcmb->data_size;
-    rbuf.recv_utime = lcmb->recv_utime;
-    rbuf.lcm = lcm->lcm;
+    lcm_buf_t *lcmb;
+    for (lcmb = batch.head; lcmb; lcmb = lcmb->next)
+        dispatch_packet (lcm, lcmb);
 
-    if(lcm->creating_read_thread) {
-        // special case:  If we're creating the read thread and are in
-        // self-test mode, then only dispatch the self-test message.
-        if(!strcmp(lcmb->channel_name, SELF_TEST_CHANNEL))
-            lcm_dispatch_handlers (lcm->lcm, &rbuf, lcmb->channel_name);
-    } else {
-        lcm_dispatch_handlers (lcm->lcm, &rbuf, lcmb->channel_name);
+    /* Release the packets in the order they were received, since their data
+     * may live on a reader's ringbuffer */
+    int nhandled = batch.count;
+    g_static_mutex_lock (&lcm->receive_lock);
+    while ((lcmb = lcm_buf_dequeue (&batch))) {
+        free_recv_buf_data(lcm, lcmb);
+        lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
     }
+    g_static_mutex_unlock (&lcm->receive_lock);
+
+    return nhandled;
+}
 
+static int
+lcm_mpudpm_get_stats (lcm_mpudpm_t *lcm, lcm_stats_t *stats)
+{
     g_static_mutex_lock (&lcm->receive_lock);
-    lcm_buf_free_data(lcmb, lcm->ringbuf);
-    lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
+    // totals over all of the readers
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+        stats->packets_received += reader->udp_rx;
+        stats->packets_bad += reader->udp_discarded_bad;
+        if (reader->frag_bufs) {
+            stats->reassembly_evictions += reader->frag_bufs->n_evicted;
+            stats->reassembly_expirations += reader->frag_bufs->n_expired;
+        }
+        if (reader->ringbuf) {
+            stats->recv_buf_high_water += reader->ringbuf_high_water;
+            stats->recv_buf_capacity += lcm_ringbuf_capacity (reader->ringbuf);
+        }
+    }
     g_static_mutex_unlock (&lcm->receive_lock);
-
     return 0;
 }
 
@@ -1412,7 +2548,7 @@ mpudpm_self_test (lcm_mpudpm_t *lcm)
     GTimeVal next_retransmit;
     lcm_timeval_add (&now, &retransmit_interval, &next_retransmit);
 
-    int recvfd = lcm->notify_pipe[0];
+    int recvfd = lcm_notify_fileno (&lcm->notify);
 
     do {
         GTimeVal selectto;
@@ -1553,14 +2689,31 @@ add_recv_socket(lcm_mpudpm_t *lcm, uint16_t port){
     subscriber_socket->fd = recv_fd;
     subscriber_socket->port = port;
     subscriber_socket->num_subscribers =0;
-    lcm->recv_sockets = g_slist_prepend(lcm->recv_sockets, subscriber_socket);
-    lcm->recv_sockets_changed = 1;
-
+    // spread the ports over the readers
+    subscriber_socket->reader = &lcm->readers[
+        (uint16_t) (port - lcm->params.mc_port_range_start) % lcm->num_readers];
+    mpudpm_reader_t *reader = subscriber_socket->reader;
+
+#ifdef USE_EPOLL
+    // the read thread picks the socket up on its next epoll_wait()
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = subscriber_socket;
+    if (epoll_ctl(reader->epoll_fd, EPOLL_CTL_ADD, recv_fd, &ev) < 0) {
+        perror("epoll_ctl (EPOLL_CTL_ADD)");
+        free(subscriber_socket);
+        goto add_recv_socket_fail;
+    }
+#else
     // Tell read thread that a select should be canceled
-    int wstatus = lcm_internal_pipe_write(lcm->thread_msg_pipe[1], "c", 1);
+    int wstatus = lcm_internal_pipe_write(reader->thread_msg_pipe[1], "c", 1);
     if (wstatus < 0) {
         perror(__FILE__ " thread_msg_pipe write: cancel_select");
     }
+#endif
+    lcm->recv_sockets = g_slist_prepend(lcm->recv_sockets, subscriber_socket);
+    reader->recv_sockets_changed = 1;
     return subscriber_socket;
 
     add_recv_socket_fail:
@@ -1571,17 +2724,44 @@ add_recv_socket(lcm_mpudpm_t *lcm, uint16_t port){
 // This function assumes that the caller is holding the lcm->receive_lock
 static void
 remove_recv_socket(lcm_mpudpm_t *lcm, mpudpm_socket_t* sock){
+    mpudpm_reader_t *reader = sock->reader;
+#ifdef USE_EPOLL
+    // The read thread may still hold a pointer to sock from an earlier
+    // epoll_wait().  It checks recv_sockets_changed before using it.
+    if (reader->epoll_fd >= 0 &&
+            epoll_ctl(reader->epoll_fd, EPOLL_CTL_DEL, sock->fd, NULL) < 0) {
+        perror("epoll_ctl (EPOLL_CTL_DEL)");
+    }
+#else
     // Tell read thread that a select should be canceled
-    int wstatus = lcm_internal_pipe_write(lcm->thread_msg_pipe[1], "c", 1);
-    if (wstatus < 0) {
-        perror(__FILE__ " thread_msg_pipe write: cancel_select");
+    if (reader->thread_msg_pipe[1] >= 0) {
+        int wstatus = lcm_internal_pipe_write(reader->thread_msg_pipe[1], "c",
+                1);
+        if (wstatus < 0) {
+            perror(__FILE__ " thread_msg_pipe write: cancel_select");
+        }
     }
-    lcm->recv_sockets_changed = 1;
+#endif
+    reader->recv_sockets_changed = 1;
 
     lcm->recv_sockets = g_slist_remove(lcm->recv_sockets, sock);
     mpudpm_socket_t_destroy(sock);
 }
 
+// Drops a subscriber's reference to sock, and closes it if that was the last
+// one.  This function assumes that the caller is holding the
+// lcm->receive_lock
+static void
+release_recv_socket(lcm_mpudpm_t *lcm, mpudpm_socket_t* sock){
+    sock->num_subscribers--;
+    if (sock->num_subscribers==0){
+        // destroy socket if we're last one using it
+        dbg(DBG_LCM, "No more subscribers using port %d, closing it\n",
+                sock->port);
+        remove_recv_socket(lcm,sock);
+    }
+}
+
 static int
 setup_recv_parts (lcm_mpudpm_t *lcm)
 {
@@ -1630,13 +2810,8 @@ setup_recv_parts (lcm_mpudpm_t *lcm)
 
     dbg (DBG_LCM, "allocating resources for receiving messages\n");
 
-    // allocate the fragment buffer hashtable
-    lcm->frag_bufs = lcm_frag_buf_store_new(MAX_FRAG_BUF_TOTAL_SIZE,
-            MAX_NUM_FRAG_BUFS);
-
     lcm->inbufs_empty = lcm_buf_queue_new ();
     lcm->inbufs_filled = lcm_buf_queue_new ();
-    lcm->ringbuf = lcm_ringbuf_new (LCM_RINGBUF_SIZE);
 
     for (int i = 0; i < LCM_DEFAULT_RECV_BUFS; i++) {
         /* We don't set the receive buffer's data pointer yet because it
@@ -1645,18 +2820,46 @@ setup_recv_parts (lcm_mpudpm_t *lcm)
         lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
     }
 
-    // setup a pipe for notifying the reader thread when to quit
-    if(0 != lcm_internal_pipe_create(lcm->thread_msg_pipe)) {
-        perror(__FILE__ " pipe(setup)");
-        goto setup_recv_thread_fail;
-    }
-    fcntl (lcm->thread_msg_pipe[1], F_SETFL, O_NONBLOCK);
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+
+        // allocate the fragment buffer hashtable
+        reader->frag_bufs = lcm_frag_buf_store_new(MAX_FRAG_BUF_TOTAL_SIZE,
+                MAX_NUM_FRAG_BUFS, MAX_FRAG_BUFS_PER_SOURCE,
+                MAX_FRAG_BUF_AGE_USEC);
+        reader->ringbuf = lcm_ringbuf_new (LCM_RINGBUF_SIZE);
 
-    /* Start the reader thread */
-    lcm->read_thread = g_thread_create (recv_thread, lcm, TRUE, NULL);
-    if (!lcm->read_thread) {
-        fprintf (stderr, "Error: LCM failed to start reader thread\n");
-        goto setup_recv_thread_fail;
+        // setup a pipe for notifying the reader thread when to quit
+        if(0 != lcm_internal_pipe_create(reader->thread_msg_pipe)) {
+            perror(__FILE__ " pipe(setup)");
+            goto setup_recv_thread_fail;
+        }
+        fcntl (reader->thread_msg_pipe[1], F_SETFL, O_NONBLOCK);
+
+#ifdef USE_EPOLL
+        reader->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (reader->epoll_fd < 0) {
+            perror(__FILE__ " epoll_create1(setup)");
+            goto setup_recv_thread_fail;
+        }
+        // the pipe is the only registered descriptor without a socket struct
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(reader->epoll_fd, EPOLL_CTL_ADD,
+                reader->thread_msg_pipe[0], &ev) < 0) {
+            perror(__FILE__ " epoll_ctl(setup)");
+            goto setup_recv_thread_fail;
+        }
+#endif
+
+        /* Start the reader thread */
+        reader->thread = g_thread_create (recv_thread, reader, TRUE, NULL);
+        if (!reader->thread) {
+            fprintf (stderr, "Error: LCM failed to start reader thread\n");
+            goto setup_recv_thread_fail;
+        }
     }
     lcm->recv_thread_created = 1;
 
@@ -1718,6 +2921,8 @@ lcm_mpudpm_create (lcm_t * parent, const char *network, const GHashTable *args)
     mpudpm_params_t params;
     memset (&params, 0, sizeof (mpudpm_params_t));
     params.num_mc_ports = 500;
+    params.recv_threads = 1;
+    params.heavy_channel_rate = DEFAULT_HEAVY_CHANNEL_RATE;
 
     g_hash_table_foreach ((GHashTable*) args, new_argument, &params);
 
@@ -1731,29 +2936,34 @@ lcm_mpudpm_create (lcm_t * parent, const char *network, const GHashTable *args)
     lcm->params = params;
     lcm->recv_sockets = NULL;
     lcm->send_fd = -1;
-    lcm->thread_msg_pipe[0] = lcm->thread_msg_pipe[1] = -1;
-    lcm->udp_low_watermark = 1.0;
+
+    lcm->num_readers = params.recv_threads;
+    lcm->readers = (mpudpm_reader_t *) calloc (lcm->num_readers,
+            sizeof (mpudpm_reader_t));
+    for (int i = 0; i < lcm->num_readers; i++) {
+        mpudpm_reader_t *reader = &lcm->readers[i];
+        reader->lcm = lcm;
+        reader->thread_msg_pipe[0] = reader->thread_msg_pipe[1] = -1;
+        reader->epoll_fd = -1;
+    }
 
     lcm->kernel_rbuf_sz = 0;
     lcm->warned_about_small_kernel_buf = 0;
 
-    lcm->frag_bufs = NULL;
-
     // synchronization variables used when allocating receive resources
     lcm->creating_read_thread = 0;
     lcm->create_read_thread_mutex = NULL;
     lcm->create_read_thread_cond = NULL;
 
-    // internal notification pipe
-    if(0 != lcm_internal_pipe_create(lcm->notify_pipe)) {
-        perror(__FILE__ " pipe(create)");
+    g_static_mutex_init (&lcm->receive_lock);
+    g_static_mutex_init (&lcm->transmit_lock);
+
+    // internal notification
+    if(0 != lcm_notify_init(&lcm->notify)) {
+        perror(__FILE__ " notify(create)");
         lcm_mpudpm_destroy (lcm);
         return NULL;
     }
-    fcntl (lcm->notify_pipe[1], F_SETFL, O_NONBLOCK);
-
-    g_static_mutex_init (&lcm->receive_lock);
-    g_static_mutex_init (&lcm->transmit_lock);
 
     dbg (DBG_LCM, "Initializing Multi-Port LCM UDP Multicast context...\n");
     dbg(DBG_LCM,"Multicast to %s on ports %d:%d\n", inet_ntoa(params.mc_addr),
@@ -1765,6 +2975,9 @@ lcm_mpudpm_create (lcm_t * parent, const char *network, const GHashTable *args)
     // but store shorts as pointers so no destroy function for values
     lcm->channel_to_port_map = g_hash_table_new_full(g_str_hash, g_str_equal,
             free, NULL );
+    lcm->channel_loads = g_hash_table_new_full(g_str_hash, g_str_equal,
+            free, free);
+    lcm->last_load_report_utime = lcm_timestamp_now();
 
     // Create a regex to find whether subscribers use a regex to get a set of
     // channels instead of just listening to a single channel.
@@ -1783,9 +2996,18 @@ lcm_mpudpm_create (lcm_t * parent, const char *network, const GHashTable *args)
     g_hash_table_insert(lcm->channel_to_port_map,
             strdup(CHANNEL_TO_PORT_MAP_UPDATE_CHANNEL),
             GUINT_TO_POINTER(lcm->params.mc_port_range_start));
+    g_hash_table_insert(lcm->channel_to_port_map,
+            strdup(CHANNEL_TO_PORT_MAP_CHANNEL),
+            GUINT_TO_POINTER(lcm->params.mc_port_range_start));
     g_hash_table_insert(lcm->channel_to_port_map,
             strdup(CHANNEL_TO_PORT_MAP_REQUEST_CHANNEL),
             GUINT_TO_POINTER(lcm->params.mc_port_range_start));
+    g_hash_table_insert(lcm->channel_to_port_map,
+            strdup(CHANNEL_TO_PORT_MAP_DELTA_CHANNEL),
+            GUINT_TO_POINTER(lcm->params.mc_port_range_start));
+    g_hash_table_insert(lcm->channel_to_port_map,
+            strdup(CHANNEL_PORT_LOADS_CHANNEL),
+            GUINT_TO_POINTER(lcm->params.mc_port_range_start));
     g_hash_table_insert(lcm->channel_to_port_map, strdup(SELF_TEST_CHANNEL),
             GUINT_TO_POINTER(map_channel_to_port(lcm, SELF_TEST_CHANNEL)));
 
@@ -1889,7 +3111,9 @@ static lcm_provider_vtable_t mpudpm_vtable = {
     .unsubscribe = lcm_mpudpm_unsubscribe,
     .publish     = lcm_mpudpm_publish,
     .handle      = lcm_mpudpm_handle,
-    .get_fileno  = lcm_mpudpm_get_fileno
+    .get_fileno  = lcm_mpudpm_get_fileno,
+    .handle_batch = lcm_mpudpm_handle_batch,
+    .get_stats   = lcm_mpudpm_get_stats
 };
 #endif
 static lcm_provider_info_t mpudpm_info;
@@ -1907,6 +3131,8 @@ lcm_mpudpm_provider_init (GPtrArray * providers)
     mpudpm_vtable.publish     = lcm_mpudpm_publish;
     mpudpm_vtable.handle      = lcm_mpudpm_handle;
     mpudpm_vtable.get_fileno  = lcm_mpudpm_get_fileno;
+    mpudpm_vtable.handle_batch = lcm_mpudpm_handle_batch;
+    mpudpm_vtable.get_stats   = lcm_mpudpm_get_stats;
 #endif
     mpudpm_info.name = "mpudpm";
     mpudpm_info.vtable = &mpudpm_vtable;
@@ -381,8 +381,9 @@ lcm_tcpq_handle(lcm_tcpq_t * self)
     rbuf.recv_utime = timestamp_now();
     rbuf.lcm = self->lcm;
 
-    if(lcm_try_enqueue_message(self->lcm, self->recv_channel_buf))
-        lcm_dispatch_handlers(self->lcm, &rbuf, self->recv_channel_buf);
+    lcm_channel_t *chan = lcm_get_channel(self->lcm, self->recv_channel_buf);
+    if(lcm_try_enqueue_channel_message(self->lcm, chan))
+        lcm_dispatch_channel_handlers(self->lcm, &rbuf, chan);
     return 0;
 
 disconnected:
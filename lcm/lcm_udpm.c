@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // for recvmmsg() and sendmmsg()
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +26,24 @@
 #define MSG_EXT_HDR
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_RECVMMSG
+#define HAVE_SENDMMSG
+#endif
+
+// receiving fragments in place relies on MSG_TRUNC reporting the full size
+// of a datagram that is only peeked at partially, which is Linux specific.
+#if defined(__linux__) && defined(MSG_TRUNC)
+#define HAVE_ZERO_COPY_FRAGS
+#endif
+
+// dropping unsubscribed channels in the kernel needs classic BPF socket
+// filters
+#ifdef __linux__
+#include <linux/filter.h>
+#define HAVE_SOCKET_FILTER
+#endif
+
 #ifdef WIN32
 #include "windows/WinPorting.h"
 #include <winsock2.h>
@@ -41,6 +63,13 @@
 
 #define SELF_TEST_CHANNEL "LCM_SELF_TEST"
 
+// upper bound on the recv_batch provider argument.  Each datagram in a batch
+// needs its own LCM_MAX_UNFRAGMENTED_PACKET_SIZE receive slot.
+#define MAX_RECV_BATCH 64
+
+// maximum number of fragments passed to a single sendmmsg() call
+#define MAX_SEND_BATCH 256
+
 /**
  * udpm_params_t:
  * @mc_addr:        multicast address
@@ -51,6 +80,16 @@
  *                  don't use > 1.  that's just rude. 
  * @recv_buf_size:  requested size of the kernel receive buffer, set with
  *                  SO_RCVBUF.  0 indicates to use the default settings.
+ * @recv_batch:     maximum number of datagrams the read thread drains from
+ *                  the socket per system call.  1 disables batching.
+ * @zero_copy_frags: if set, fragment payloads are received directly into
+ *                  their reassembly buffer.
+ * @interleave_frags: if set, large messages published from different threads
+ *                  are transmitted concurrently, and their fragments may be
+ *                  interleaved.
+ * @channel_filter: if set, a socket filter drops messages on channels that
+ *                  nobody subscribed to before they are copied out of the
+ *                  kernel.
  *
  */
 typedef struct _udpm_params_t udpm_params_t;
@@ -59,6 +98,10 @@ struct _udpm_params_t {
     uint16_t mc_port;
     uint8_t mc_ttl; 
     int recv_buf_size;
+    int recv_batch;
+    int zero_copy_frags;
+    int interleave_frags;
+    int channel_filter;
 };
 
 typedef struct _lcm_provider_t lcm_udpm_t;
@@ -75,22 +118,29 @@ struct _lcm_provider_t {
     int kernel_rbuf_sz;
     int warned_about_small_kernel_buf;
 
-    /* Packet structures available for sending or receiving use are
-     * stored in the *_empty queues. */
+    /* Packet structures available for receiving are stored in the _empty
+     * queue.  Only the read thread uses it. */
     lcm_buf_queue_t * inbufs_empty;
-    /* Received packets that are filled with data are queued here. */
-    lcm_buf_queue_t * inbufs_filled;
+    /* Received packets that are filled with data are passed from the read
+     * thread to lcm_handle () through this queue. */
+    lcm_buf_spsc_t * inbufs_filled;
+    /* lcm_handle () passes dispatched packets back to the read thread through
+     * this queue, with their data still allocated. */
+    lcm_buf_spsc_t * inbufs_done;
 
     /* Memory for received small packets is taken from a fixed-size ring buffer
-     * so we don't have to do any mallocs */
+     * so we don't have to do any mallocs.  Only the read thread uses it. */
     lcm_ringbuf_t * ringbuf;
 
-    GStaticRecMutex mutex; /* Must be locked when reading/writing to the
-                              above three queues */
+    GStaticRecMutex mutex; /* Must be locked when setting up or tearing down
+                              the receive resources */
+    GStaticMutex notify_lock; /* Serializes signaling and clearing notify */
 
     int thread_created;
     GThread *read_thread;
-    int notify_pipe[2];         // pipe to notify application when messages arrive
+    lcm_notify_t notify;        // notifies application when messages arrive
+    GStaticMutex done_lock; /* Serializes signaling and clearing done_notify */
+    lcm_notify_t done_notify;   // notifies read thread when packets are handled
     int thread_msg_pipe[2];     // pipe to notify read thread when to quit
 
     GStaticMutex transmit_lock; // so that only thread at a time can transmit
@@ -104,20 +154,43 @@ struct _lcm_provider_t {
 
     /* other variables */
     lcm_frag_buf_store * frag_bufs;
+    /* Reassembly buffers for fragmented messages.  Only the read thread uses
+     * it. */
+    lcm_frag_pool_t * frag_pool;
 
-    uint32_t     udp_rx;            // packets received and processed
-    uint32_t     udp_discarded_bad; // packets discarded because they were bad 
+    /* receive statistics.  Only the read thread updates them. */
+    uint64_t     udp_rx;            // packets received and processed
+    uint64_t     udp_discarded_bad; // packets discarded because they were bad 
                                     // somehow
-    double       udp_low_watermark; // least buffer available
-    int32_t      udp_last_report_secs;
+    uint64_t     udp_discarded_frags; // fragments of messages that are not
+                                    // being reassembled
+    uint32_t     ringbuf_high_water; // most bytes ever used in the ringbuf
+    uint32_t     ringbuf_capacity;
 
     uint32_t     msg_seqno; // rolling counter of how many messages transmitted
+
+    /* Number of subscriptions to each channel pattern, used to build the
+     * socket filter.  NULL unless channel_filter is set.  Must be accessed
+     * with mutex locked.
+     * type: char* -> count (via GUINT_TO_POINTER) */
+    GHashTable * subscribed_channels;
 };
 
 static int _setup_recv_parts (lcm_udpm_t *lcm);
 
 static GStaticPrivate CREATE_READ_THREAD_PKEY = G_STATIC_PRIVATE_INIT;
 
+static void
+_buf_spsc_free (lcm_buf_spsc_t *q, lcm_ringbuf_t *ringbuf)
+{
+    lcm_buf_t *lcmb;
+    while ((lcmb = lcm_buf_spsc_pop (q))) {
+        lcm_buf_free_data (lcmb, ringbuf);
+        free (lcmb);
+    }
+    lcm_buf_spsc_free (q);
+}
+
 static void
 _destroy_recv_parts (lcm_udpm_t *lcm)
 {
@@ -153,14 +226,24 @@ _destroy_recv_parts (lcm_udpm_t *lcm)
         lcm_buf_queue_free (lcm->inbufs_empty, lcm->ringbuf);
         lcm->inbufs_empty = NULL;
     }
+    // release the oldest packets first, since their data may live on the
+    // ringbuffer
+    if (lcm->inbufs_done) {
+        _buf_spsc_free (lcm->inbufs_done, lcm->ringbuf);
+        lcm->inbufs_done = NULL;
+    }
     if (lcm->inbufs_filled) {
-        lcm_buf_queue_free (lcm->inbufs_filled, lcm->ringbuf);
+        _buf_spsc_free (lcm->inbufs_filled, lcm->ringbuf);
         lcm->inbufs_filled = NULL;
     }
     if (lcm->ringbuf) {
         lcm_ringbuf_free (lcm->ringbuf);
         lcm->ringbuf = NULL;
     }
+    if (lcm->frag_pool) {
+        lcm_frag_pool_destroy (lcm->frag_pool);
+        lcm->frag_pool = NULL;
+    }
 }
 
 void
@@ -172,10 +255,15 @@ lcm_udpm_destroy (lcm_udpm_t *lcm)
     if (lcm->sendfd >= 0)
         lcm_close_socket(lcm->sendfd);
 
-    lcm_internal_pipe_close(lcm->notify_pipe[0]);
-    lcm_internal_pipe_close(lcm->notify_pipe[1]);
+    lcm_notify_destroy(&lcm->notify);
+    lcm_notify_destroy(&lcm->done_notify);
+
+    if (lcm->subscribed_channels)
+        g_hash_table_destroy (lcm->subscribed_channels);
 
     g_static_rec_mutex_free (&lcm->mutex);
+    g_static_mutex_free (&lcm->notify_lock);
+    g_static_mutex_free (&lcm->done_lock);
     g_static_mutex_free (&lcm->transmit_lock);
     if(lcm->create_read_thread_mutex) {
         g_mutex_free(lcm->create_read_thread_mutex);
@@ -228,6 +316,45 @@ new_argument (gpointer key, gpointer value, gpointer user)
         if (endptr == value)
             fprintf (stderr, "Warning: Invalid value for ttl\n");
     }
+    else if (!strcmp ((char *) key, "recv_batch")) {
+        char *endptr = NULL;
+        params->recv_batch = strtol ((char *) value, &endptr, 0);
+        if (endptr == value || params->recv_batch < 1) {
+            fprintf (stderr, "Warning: Invalid value for recv_batch\n");
+            params->recv_batch = 1;
+        } else if (params->recv_batch > MAX_RECV_BATCH) {
+            fprintf (stderr, "Warning: recv_batch limited to %d\n",
+                    MAX_RECV_BATCH);
+            params->recv_batch = MAX_RECV_BATCH;
+        }
+    }
+    else if (!strcmp ((char *) key, "zero_copy_frags")) {
+        if (!strcmp ((char *) value, "true") || !strcmp ((char *) value, "1"))
+            params->zero_copy_frags = 1;
+        else if (!strcmp ((char *) value, "false") ||
+                !strcmp ((char *) value, "0"))
+            params->zero_copy_frags = 0;
+        else
+            fprintf (stderr, "Warning: Invalid value for zero_copy_frags\n");
+    }
+    else if (!strcmp ((char *) key, "interleave_frags")) {
+        if (!strcmp ((char *) value, "true") || !strcmp ((char *) value, "1"))
+            params->interleave_frags = 1;
+        else if (!strcmp ((char *) value, "false") ||
+                !strcmp ((char *) value, "0"))
+            params->interleave_frags = 0;
+        else
+            fprintf (stderr, "Warning: Invalid value for interleave_frags\n");
+    }
+    else if (!strcmp ((char *) key, "channel_filter")) {
+        if (!strcmp ((char *) value, "true") || !strcmp ((char *) value, "1"))
+            params->channel_filter = 1;
+        else if (!strcmp ((char *) value, "false") ||
+                !strcmp ((char *) value, "0"))
+            params->channel_filter = 0;
+        else
+            fprintf (stderr, "Warning: Invalid value for channel_filter\n");
+    }
     else if (!strcmp ((char *) key, "transmit_only")) {
         fprintf (stderr, "%s:%d -- transmit_only option is now obsolete\n",
                 __FILE__, __LINE__);
@@ -238,29 +365,38 @@ new_argument (gpointer key, gpointer value, gpointer user)
     }
 }
 
-static int 
-_recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
+/* Finds the fragment buffer that the fragment in lcmb belongs to, creating a
+ * new one for the first fragment of a message.  sz is the size of the whole
+ * datagram, but only its header needs to be in lcmb->buf.  On success, sets
+ * *payload_offset to the offset of the fragment's payload in the datagram.
+ * Returns NULL if the fragment should be dropped. */
+static lcm_frag_buf_t *
+_lookup_frag_buf (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz,
+        uint32_t *payload_offset)
 {
     lcm2_header_long_t *hdr = (lcm2_header_long_t*) lcmb->buf;
 
-    // any existing fragment buffer for this message source?
+    uint32_t msg_seqno = ntohl (hdr->msg_seqno);
+
+    // any existing fragment buffer for this message?
     lcm_frag_buf_t *fbuf = lcm_frag_buf_store_lookup(lcm->frag_bufs,
-            &lcmb->from);
+            &lcmb->from, msg_seqno);
 
-    uint32_t msg_seqno = ntohl (hdr->msg_seqno);
     uint32_t data_size = ntohl (hdr->msg_size);
     uint32_t fragment_offset = ntohl (hdr->fragment_offset);
 //    uint16_t fragment_no = ntohs (hdr->fragment_no);
     uint16_t fragments_in_msg = ntohs (hdr->fragments_in_msg);
     uint32_t frag_size = sz - sizeof (lcm2_header_long_t);
-    char *data_start = (char*) (hdr + 1);
+    *payload_offset = sizeof (lcm2_header_long_t);
 
-    // discard any stale fragments from previous messages
-    if (fbuf && ((fbuf->msg_seqno != msg_seqno) ||
-                 (fbuf->data_size != data_size))) {
-        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
+    lcm->udp_rx++;
+
+    // discard any stale fragments from a previous message with the same
+    // sequence number
+    if (fbuf && fbuf->data_size != data_size) {
         dbg(DBG_LCM, "Dropping message (missing %d fragments)\n",
             fbuf->fragments_remaining);
+        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
         fbuf = NULL;
     }
 
@@ -270,32 +406,40 @@ _recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
 
     if (data_size > LCM_MAX_MESSAGE_SIZE) {
         dbg (DBG_LCM, "rejecting huge message (%d bytes)\n", data_size);
-        return 0;
+        lcm->udp_discarded_bad++;
+        return NULL;
     }
 
     // create a new fragment buffer if necessary
     if (!fbuf && hdr->fragment_no == 0) {
         char *channel = (char*) (hdr + 1);
-        int channel_sz = strlen (channel);
-        if (channel_sz > LCM_MAX_CHANNEL_NAME_LENGTH) {
+        int channel_sz = strnlen (channel, LCM_MAX_CHANNEL_NAME_LENGTH + 1);
+        if (channel_sz > LCM_MAX_CHANNEL_NAME_LENGTH ||
+                channel_sz + 1 > frag_size) {
             dbg (DBG_LCM, "bad channel name length\n");
             lcm->udp_discarded_bad++;
-            return 0;
+            return NULL;
         }
 
         // if the packet has no subscribers, drop the message now.
-        if(!lcm_has_handlers(lcm->lcm, channel))
-            return 0;
+        lcm_channel_t *chan = lcm_get_channel(lcm->lcm, channel);
+        if(!lcm_channel_has_handlers(lcm->lcm, chan))
+            return NULL;
 
-        fbuf = lcm_frag_buf_new (*((struct sockaddr_in*) &lcmb->from),
+        fbuf = lcm_frag_buf_new (lcm->frag_pool,
+                *((struct sockaddr_in*) &lcmb->from),
                 channel, msg_seqno, data_size, fragments_in_msg,
                 lcmb->recv_utime);
+        fbuf->chan = chan;
         lcm_frag_buf_store_add (lcm->frag_bufs, fbuf);
-        data_start += channel_sz + 1;
+        *payload_offset += channel_sz + 1;
         frag_size -= (channel_sz + 1);
     }
 
-    if (!fbuf) return 0;
+    if (!fbuf) {
+        lcm->udp_discarded_frags++;
+        return NULL;
+    }
 
 #ifdef __linux__
     if(lcm->kernel_rbuf_sz < 262145 && 
@@ -317,19 +461,27 @@ _recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
         dbg (DBG_LCM, "dropping invalid fragment (off: %d, %d / %d)\n",
                 fragment_offset, frag_size, fbuf->data_size);
         lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
-        return 0;
+        lcm->udp_discarded_bad++;
+        return NULL;
     }
 
-    // copy data
-    memcpy (fbuf->data + fragment_offset, data_start, frag_size);
-    fbuf->last_packet_utime = lcmb->recv_utime;
+    return fbuf;
+}
+
+/* Accounts for a fragment whose payload has been stored in fbuf.  If that
+ * completes the message, hands the reassembled message over to lcmb and
+ * returns 1.  Otherwise returns 0. */
+static int
+_frag_buf_received (lcm_udpm_t *lcm, lcm_buf_t *lcmb, lcm_frag_buf_t *fbuf)
+{
+    lcm_frag_buf_store_touch (lcm->frag_bufs, fbuf, lcmb->recv_utime);
 
     fbuf->fragments_remaining --;
 
     if (0 == fbuf->fragments_remaining) {
         // complete message received.  Is there a subscriber that still
         // wants it?  (i.e., does any subscriber have space in its queue?)
-        if(!lcm_try_enqueue_message(lcm->lcm, fbuf->channel)) {
+        if(!lcm_try_enqueue_channel_message(lcm->lcm, fbuf->chan)) {
             // no... sad... free the fragment buffer and return
             lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
             return 0;
@@ -337,17 +489,20 @@ _recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
 
         // yes, transfer the message into the lcm_buf_t
 
-        // deallocate the ringbuffer-allocated buffer
-        g_static_rec_mutex_lock (&lcm->mutex);
-        lcm_buf_free_data(lcmb, lcm->ringbuf);
-        g_static_rec_mutex_unlock (&lcm->mutex);
+        // deallocate the ringbuffer-allocated buffer.  Packets received in
+        // batches live in the read thread's receive slots instead, and are
+        // left alone.
+        if (lcmb->ringbuf)
+            lcm_buf_free_data(lcmb, lcm->ringbuf);
 
         // transfer ownership of the message's payload buffer
         lcmb->buf = fbuf->data;
+        lcmb->frag_pool = fbuf->pool;
         fbuf->data = NULL;
 
         strcpy (lcmb->channel_name, fbuf->channel);
         lcmb->channel_size = strlen (lcmb->channel_name);
+        lcmb->chan = fbuf->chan;
         lcmb->data_offset = 0;
         lcmb->data_size = fbuf->data_size;
         lcmb->recv_utime = fbuf->last_packet_utime;
@@ -361,6 +516,22 @@ _recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
     return 0;
 }
 
+static int 
+_recv_message_fragment (lcm_udpm_t *lcm, lcm_buf_t *lcmb, uint32_t sz)
+{
+    uint32_t payload_offset;
+    lcm_frag_buf_t *fbuf = _lookup_frag_buf (lcm, lcmb, sz, &payload_offset);
+    if (!fbuf)
+        return 0;
+
+    // copy data
+    lcm2_header_long_t *hdr = (lcm2_header_long_t*) lcmb->buf;
+    memcpy (fbuf->data + ntohl (hdr->fragment_offset),
+            lcmb->buf + payload_offset, sz - payload_offset);
+
+    return _frag_buf_received (lcm, lcmb, fbuf);
+}
+
 static int
 _recv_short_message (lcm_udpm_t *lcm, lcm_buf_t *lcmb, int sz)
 {
@@ -381,7 +552,8 @@ _recv_short_message (lcm_udpm_t *lcm, lcm_buf_t *lcmb, int sz)
     lcm->udp_rx++;
 
     // if the packet has no subscribers, drop the message now.
-    if(!lcm_try_enqueue_message(lcm->lcm, pkt_channel_str))
+    lcmb->chan = lcm_get_channel(lcm->lcm, pkt_channel_str);
+    if(!lcm_try_enqueue_channel_message(lcm->lcm, lcmb->chan))
         return 0;
 
     strcpy (lcmb->channel_name, pkt_channel_str);
@@ -393,6 +565,214 @@ _recv_short_message (lcm_udpm_t *lcm, lcm_buf_t *lcmb, int sz)
     return 1;
 }
 
+/* Returns the packets that lcm_handle () is done with to the pool of empty
+ * packets, and releases their data.  Only the read thread may call this,
+ * since it owns the ringbuffer. */
+static void
+_reclaim_bufs (lcm_udpm_t *lcm)
+{
+    lcm_buf_t *lcmb;
+    while ((lcmb = lcm_buf_spsc_pop (lcm->inbufs_done))) {
+        lcm_buf_free_data (lcmb, lcm->ringbuf);
+        lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
+    }
+}
+
+/* Wakes up the read thread after lcm_handle () handed packets back to it.
+ * done_notify stays signaled until the read thread runs out of packets and
+ * clears it, so this is only a flag check while the read thread keeps up. */
+static void
+_signal_done (lcm_udpm_t *lcm)
+{
+    if (g_atomic_int_get (&lcm->done_notify.signaled))
+        return;
+
+    g_static_mutex_lock (&lcm->done_lock);
+    lcm_notify_signal (&lcm->done_notify);
+    g_static_mutex_unlock (&lcm->done_lock);
+}
+
+/* Makes sure that there is a packet available on inbufs_empty.  The number of
+ * packets is fixed, so that the queues to and from lcm_handle () can never
+ * overflow.  If they're all still waiting to be handled, this waits for
+ * lcm_handle () to catch up and leaves incoming datagrams in the kernel's
+ * receive buffer meanwhile.  Returns -1 if the read thread was told to exit
+ * while waiting, and 0 otherwise. */
+static int
+_wait_for_empty_buf (lcm_udpm_t *lcm)
+{
+    _reclaim_bufs (lcm);
+    while (lcm_buf_queue_is_empty (lcm->inbufs_empty)) {
+        // Clear the notifier before looking at the queue again, so that
+        // packets handed back after that are sure to signal it.
+        g_static_mutex_lock (&lcm->done_lock);
+        lcm_notify_clear (&lcm->done_notify);
+        g_static_mutex_unlock (&lcm->done_lock);
+        _reclaim_bufs (lcm);
+        if (!lcm_buf_queue_is_empty (lcm->inbufs_empty))
+            break;
+
+        fd_set fds;
+        FD_ZERO (&fds);
+        FD_SET (lcm->thread_msg_pipe[0], &fds);
+        int done_fd = lcm_notify_fileno (&lcm->done_notify);
+        FD_SET (done_fd, &fds);
+        SOCKET maxfd = MAX(done_fd, lcm->thread_msg_pipe[0]);
+        if (select (maxfd + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("udpm wait for empty buffer");
+            return -1;
+        }
+        if (FD_ISSET (lcm->thread_msg_pipe[0], &fds)) {
+            dbg (DBG_LCM, "read thread received exit command\n");
+            return -1;
+        }
+        _reclaim_bufs (lcm);
+    }
+    return 0;
+}
+
+/* Wakes up lcm_handle () after the read thread queued packets, unless it has
+ * already been woken up.  The lock is only taken when the application has
+ * caught up with the read thread. */
+static void
+_signal_filled (lcm_udpm_t *lcm)
+{
+    if (g_atomic_int_get (&lcm->notify.signaled))
+        return;
+
+    g_static_mutex_lock (&lcm->notify_lock);
+    // lcm_handle () may have already taken the packets in the meantime
+    if (!lcm_buf_spsc_is_empty (lcm->inbufs_filled))
+        lcm_notify_signal (&lcm->notify);
+    g_static_mutex_unlock (&lcm->notify_lock);
+}
+
+/* Stops reporting the file descriptor as readable once lcm_handle () has
+ * drained the queue of received packets. */
+static void
+_clear_filled (lcm_udpm_t *lcm)
+{
+    if (!g_atomic_int_get (&lcm->notify.signaled))
+        return;
+
+    g_static_mutex_lock (&lcm->notify_lock);
+    if (lcm_buf_spsc_is_empty (lcm->inbufs_filled)) {
+        lcm_notify_clear (&lcm->notify);
+        // The read thread skips _signal_filled () when it sees the notifier
+        // still signaled, so check for packets queued just before clearing.
+        if (!lcm_buf_spsc_is_empty (lcm->inbufs_filled))
+            lcm_notify_signal (&lcm->notify);
+    }
+    g_static_mutex_unlock (&lcm->notify_lock);
+}
+
+/* Receives a datagram into the given buffers, and records its sender and
+ * receive time in lcmb.  Returns the size of the datagram, or -1 if it isn't
+ * a valid LCM packet. */
+static int
+_recv_datagram (lcm_udpm_t *lcm, lcm_buf_t *lcmb, struct iovec *vecs,
+        int nvecs, int flags)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_name = &lcmb->from;
+    msg.msg_namelen = sizeof (struct sockaddr);
+    msg.msg_iov = vecs;
+    msg.msg_iovlen = nvecs;
+#ifdef MSG_EXT_HDR
+    // operating systems that provide SO_TIMESTAMP allow us to obtain more
+    // accurate timestamps by having the kernel produce timestamps as soon
+    // as packets are received.
+    char controlbuf[64];
+    msg.msg_control = controlbuf;
+    msg.msg_controllen = sizeof (controlbuf);
+    msg.msg_flags = 0;
+#endif
+    int sz = recvmsg (lcm->recvfd, &msg, flags);
+
+    if (sz < 0) {
+        perror ("udp_read_packet -- recvmsg");
+        lcm->udp_discarded_bad++;
+        return -1;
+    }
+
+    if (sz < sizeof(lcm2_header_short_t)) { 
+        // packet too short to be LCM
+        lcm->udp_discarded_bad++;
+        return -1;
+    }
+
+    lcmb->fromlen = msg.msg_namelen;
+
+    int got_utime = 0;
+#ifdef SO_TIMESTAMP
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR (&msg);
+    /* Get the receive timestamp out of the packet headers if possible */
+    while (!lcmb->recv_utime && cmsg) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval * t = (struct timeval*) CMSG_DATA (cmsg);
+            lcmb->recv_utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
+            got_utime = 1;
+            break;
+        }
+        cmsg = CMSG_NXTHDR (&msg, cmsg);
+    }
+#endif
+    if (!got_utime)
+        lcmb->recv_utime = lcm_timestamp_now ();
+
+    return sz;
+}
+
+#ifdef HAVE_ZERO_COPY_FRAGS
+/* Receives a fragment whose header has already been peeked at into lcmb.  The
+ * header goes to lcmb, and the payload straight to its place in the
+ * reassembly buffer.  sz is the size of the whole datagram.  Returns 1 if the
+ * fragment completed a message, and 0 otherwise. */
+static int
+_recv_fragment_in_place (lcm_udpm_t *lcm, lcm_buf_t *lcmb, int sz)
+{
+    uint32_t payload_offset;
+    lcm_frag_buf_t *fbuf = _lookup_frag_buf (lcm, lcmb, sz, &payload_offset);
+
+    // Fragments that are dropped are truncated to their header, which
+    // discards the rest of the datagram.
+    struct iovec vecs[2];
+    int nvecs = 1;
+    vecs[0].iov_base = lcmb->buf;
+    vecs[0].iov_len = payload_offset;
+    if (fbuf) {
+        lcm2_header_long_t *hdr = (lcm2_header_long_t*) lcmb->buf;
+        vecs[1].iov_base = fbuf->data + ntohl (hdr->fragment_offset);
+        vecs[1].iov_len = sz - payload_offset;
+        nvecs = 2;
+    }
+
+    int rsz = _recv_datagram (lcm, lcmb, vecs, nvecs, 0);
+    if (!fbuf)
+        return 0;
+    if (rsz != sz) {
+        dbg (DBG_LCM, "fragment changed size (%d / %d)\n", rsz, sz);
+        lcm_frag_buf_store_remove (lcm->frag_bufs, fbuf);
+        lcm->udp_discarded_bad++;
+        return 0;
+    }
+    return _frag_buf_received (lcm, lcmb, fbuf);
+}
+#endif
+
+static void
+_update_ringbuf_stats (lcm_udpm_t *lcm)
+{
+    uint32_t used = lcm_ringbuf_used (lcm->ringbuf);
+    if (used > lcm->ringbuf_high_water)
+        lcm->ringbuf_high_water = used;
+    lcm->ringbuf_capacity = lcm_ringbuf_capacity (lcm->ringbuf);
+}
+
 // read continuously until a complete message arrives
 static lcm_buf_t *
 udp_read_packet (lcm_udpm_t *lcm)
@@ -401,37 +781,6 @@ udp_read_packet (lcm_udpm_t *lcm)
 
     int sz = 0;
 
-    // TODO warn about message loss somewhere else.
-
-//    g_static_rec_mutex_lock (&lcm->mutex);
-//    unsigned int ring_capacity = lcm_ringbuf_capacity(lcm->ringbuf);
-//    unsigned int ring_used = lcm_ringbuf_used(lcm->ringbuf);
-//    double buf_avail = ((double)(ring_capacity - ring_used)) / ring_capacity;
-//    g_static_rec_mutex_unlock (&lcm->mutex);
-//    if (buf_avail < lcm->udp_low_watermark)
-//        lcm->udp_low_watermark = buf_avail;
-//
-//    GTimeVal tv;
-//    g_get_current_time(&tv);
-//    int elapsedsecs = tv.tv_sec - lcm->udp_last_report_secs;
-//    if (elapsedsecs > 2) {
-//        uint32_t total_bad = lcm->udp_discarded_bad;
-//        if (total_bad > 0 || lcm->udp_low_watermark < 0.5) {
-//            fprintf(stderr, 
-//                    "%d.%03d LCM loss %4.1f%% : %5d err, "
-//                    "buf avail %4.1f%%\n", 
-//                   (int) tv.tv_sec, (int) tv.tv_usec/1000,
-//                   total_bad * 100.0 / (lcm->udp_rx + total_bad),
-//                   lcm->udp_discarded_bad,
-//                   100.0 * lcm->udp_low_watermark);
-//            
-//            lcm->udp_rx = 0;
-//            lcm->udp_discarded_bad = 0;
-//            lcm->udp_last_report_secs = tv.tv_sec;
-//            lcm->udp_low_watermark = HUGE;
-//        }
-//    }
-    
     int got_complete_message = 0;
 
     while (!got_complete_message) {
@@ -467,88 +816,282 @@ udp_read_packet (lcm_udpm_t *lcm)
         assert (FD_ISSET (lcm->recvfd, &fds));
 
         if (!lcmb) {
-            g_static_rec_mutex_lock (&lcm->mutex);
+            if (0 != _wait_for_empty_buf (lcm))
+                return NULL;
             lcmb = lcm_buf_allocate_data(lcm->inbufs_empty, &lcm->ringbuf);
-            g_static_rec_mutex_unlock (&lcm->mutex);
         }
         struct iovec        vec;
         vec.iov_base = lcmb->buf;
-        vec.iov_len = 65535;
+        vec.iov_len = LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1;
+
+#ifdef HAVE_ZERO_COPY_FRAGS
+        if (lcm->params.zero_copy_frags) {
+            // peek at the packet header first, to find out where the payload
+            // of a fragment needs to go.
+            struct iovec peek_vec;
+            peek_vec.iov_base = lcmb->buf;
+            peek_vec.iov_len = sizeof (lcm2_header_long_t) +
+                LCM_MAX_CHANNEL_NAME_LENGTH + 1;
+            sz = _recv_datagram (lcm, lcmb, &peek_vec, 1, MSG_PEEK | MSG_TRUNC);
+            if (sz >= (int) sizeof (lcm2_header_long_t) &&
+                    sz < LCM_MAX_UNFRAGMENTED_PACKET_SIZE &&
+                    ntohl (((lcm2_header_long_t*) lcmb->buf)->magic) ==
+                    LCM2_MAGIC_LONG) {
+                got_complete_message = _recv_fragment_in_place (lcm, lcmb, sz);
+                continue;
+            }
+            // anything else is received as usual
+        }
+#endif
 
-        struct msghdr msg;
-        memset(&msg, 0, sizeof(struct msghdr));
-        msg.msg_name = &lcmb->from;
-        msg.msg_namelen = sizeof (struct sockaddr);
-        msg.msg_iov = &vec;
-        msg.msg_iovlen = 1;
+        sz = _recv_datagram (lcm, lcmb, &vec, 1, 0);
+        if (sz < 0)
+            continue;
+
+        lcm2_header_short_t *hdr2 = (lcm2_header_short_t*) lcmb->buf;
+        uint32_t rcvd_magic = ntohl(hdr2->magic);
+        if (rcvd_magic == LCM2_MAGIC_SHORT)
+            got_complete_message = _recv_short_message (lcm, lcmb, sz);
+        else if (rcvd_magic == LCM2_MAGIC_LONG)
+            got_complete_message = _recv_message_fragment (lcm, lcmb, sz);
+        else {
+            dbg (DBG_LCM, "LCM: bad magic\n");
+            lcm->udp_discarded_bad++;
+            continue;
+        }
+    }
+
+    // if the newly received packet is a short packet, then resize the space
+    // allocated to it on the ringbuffer to exactly match the amount of space
+    // required.  That way, we do not use 64k of the ringbuffer for every
+    // incoming message.
+    if (lcmb->ringbuf) {
+        lcm_ringbuf_shrink_last(lcmb->ringbuf, lcmb->buf, sz);
+        _update_ringbuf_stats (lcm);
+    }
+
+    return lcmb;
+}
+
+#ifdef HAVE_RECVMMSG
+/* Receive slots used by the read thread when recv_batch > 1.  Datagrams are
+ * drained into these with a single recvmmsg() call, and only the completed
+ * messages are then copied onto the ringbuffer.  Receiving straight into the
+ * ringbuffer is not an option here, because the ringbuffer can only release
+ * its oldest or newest chunk, and any packet in a batch may be dropped. */
+typedef struct _udpm_recv_batch udpm_recv_batch_t;
+struct _udpm_recv_batch {
+    int size;
+    char *slots;                // size * LCM_MAX_UNFRAGMENTED_PACKET_SIZE
+    struct mmsghdr *msgs;
+    struct iovec *vecs;
+    char *controlbufs;          // 64 bytes per slot, for SO_TIMESTAMP
+    lcm_buf_t *pkts;            // metadata of the packet in each slot
+    lcm_buf_t **complete;       // packets that completed a message
+};
+
+static udpm_recv_batch_t *
+udpm_recv_batch_new (int size)
+{
+    udpm_recv_batch_t *batch =
+        (udpm_recv_batch_t *) calloc (1, sizeof (udpm_recv_batch_t));
+    batch->size = size;
+    batch->slots = (char *) malloc (size * LCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+    batch->msgs = (struct mmsghdr *) calloc (size, sizeof (struct mmsghdr));
+    batch->vecs = (struct iovec *) calloc (size, sizeof (struct iovec));
+    batch->controlbufs = (char *) calloc (size, 64);
+    batch->pkts = (lcm_buf_t *) calloc (size, sizeof (lcm_buf_t));
+    batch->complete = (lcm_buf_t **) calloc (size, sizeof (lcm_buf_t *));
+
+    int i;
+    for (i = 0; i < size; i++) {
+        char *slot = batch->slots + i * LCM_MAX_UNFRAGMENTED_PACKET_SIZE;
+        // zero the last byte of each slot so that strlen never segfaults
+        slot[LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1] = 0;
+        batch->pkts[i].buf = slot;
+
+        batch->vecs[i].iov_base = slot;
+        batch->vecs[i].iov_len = LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1;
+
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        msg->msg_name = &batch->pkts[i].from;
+        msg->msg_iov = &batch->vecs[i];
+        msg->msg_iovlen = 1;
+    }
+    return batch;
+}
+
+static void
+udpm_recv_batch_free (udpm_recv_batch_t *batch)
+{
+    free (batch->slots);
+    free (batch->msgs);
+    free (batch->vecs);
+    free (batch->controlbufs);
+    free (batch->pkts);
+    free (batch->complete);
+    free (batch);
+}
+
+/* Drains up to batch->size datagrams from the socket and queues every message
+ * they complete for lcm_handle ().  Returns -1 when the read thread has been
+ * told to exit, and 0 otherwise. */
+static int
+udp_read_packet_batch (lcm_udpm_t *lcm, udpm_recv_batch_t *batch)
+{
+    // wait for either incoming UDP data, or for an abort message
+    fd_set fds;
+    FD_ZERO (&fds);
+    FD_SET (lcm->recvfd, &fds);
+    FD_SET (lcm->thread_msg_pipe[0], &fds);
+    SOCKET maxfd = MAX(lcm->recvfd, lcm->thread_msg_pipe[0]);
+
+    if (select (maxfd + 1, &fds, NULL, NULL, NULL) <= 0) {
+        perror ("udp_read_packet_batch -- select:");
+        return 0;
+    }
+
+    if (FD_ISSET (lcm->thread_msg_pipe[0], &fds)) {
+        // received an exit command.
+        dbg (DBG_LCM, "read thread received exit command\n");
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < batch->size; i++) {
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        msg->msg_namelen = sizeof (struct sockaddr);
 #ifdef MSG_EXT_HDR
-        // operating systems that provide SO_TIMESTAMP allow us to obtain more
-        // accurate timestamps by having the kernel produce timestamps as soon
-        // as packets are received.
-        char controlbuf[64];
-        msg.msg_control = controlbuf;
-        msg.msg_controllen = sizeof (controlbuf);
-        msg.msg_flags = 0;
+        msg->msg_control = batch->controlbufs + i * 64;
+        msg->msg_controllen = 64;
 #endif
-        sz = recvmsg (lcm->recvfd, &msg, 0);
+        msg->msg_flags = 0;
+    }
 
-        if (sz < 0) {
-            perror ("udp_read_packet -- recvmsg");
+    int npackets = recvmmsg (lcm->recvfd, batch->msgs, batch->size,
+            MSG_DONTWAIT, NULL);
+    if (npackets < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror ("udp_read_packet_batch -- recvmmsg");
             lcm->udp_discarded_bad++;
-            continue;
         }
+        return 0;
+    }
+
+    int64_t now = 0;
+    int ncomplete = 0;
+    for (i = 0; i < npackets; i++) {
+        lcm_buf_t *pkt = &batch->pkts[i];
+        struct msghdr *msg = &batch->msgs[i].msg_hdr;
+        int sz = batch->msgs[i].msg_len;
 
-        if (sz < sizeof(lcm2_header_short_t)) { 
+        if (sz < sizeof(lcm2_header_short_t)) {
             // packet too short to be LCM
             lcm->udp_discarded_bad++;
             continue;
         }
 
-        lcmb->fromlen = msg.msg_namelen;
-
-        int got_utime = 0;
+        pkt->fromlen = msg->msg_namelen;
+        pkt->packet_size = sz;
+        pkt->recv_utime = 0;
 #ifdef SO_TIMESTAMP
-        struct cmsghdr * cmsg = CMSG_FIRSTHDR (&msg);
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR (msg);
         /* Get the receive timestamp out of the packet headers if possible */
-        while (!lcmb->recv_utime && cmsg) {
+        while (cmsg) {
             if (cmsg->cmsg_level == SOL_SOCKET &&
                     cmsg->cmsg_type == SCM_TIMESTAMP) {
                 struct timeval * t = (struct timeval*) CMSG_DATA (cmsg);
-                lcmb->recv_utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
-                got_utime = 1;
+                pkt->recv_utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
                 break;
             }
-            cmsg = CMSG_NXTHDR (&msg, cmsg);
+            cmsg = CMSG_NXTHDR (msg, cmsg);
         }
 #endif
-        if (!got_utime)
-            lcmb->recv_utime = lcm_timestamp_now ();
+        if (!pkt->recv_utime) {
+            if (!now)
+                now = lcm_timestamp_now ();
+            pkt->recv_utime = now;
+        }
 
-        lcm2_header_short_t *hdr2 = (lcm2_header_short_t*) lcmb->buf;
+        int got_complete_message = 0;
+        lcm2_header_short_t *hdr2 = (lcm2_header_short_t*) pkt->buf;
         uint32_t rcvd_magic = ntohl(hdr2->magic);
         if (rcvd_magic == LCM2_MAGIC_SHORT)
-            got_complete_message = _recv_short_message (lcm, lcmb, sz);
+            got_complete_message = _recv_short_message (lcm, pkt, sz);
         else if (rcvd_magic == LCM2_MAGIC_LONG)
-            got_complete_message = _recv_message_fragment (lcm, lcmb, sz);
+            got_complete_message = _recv_message_fragment (lcm, pkt, sz);
         else {
             dbg (DBG_LCM, "LCM: bad magic\n");
             lcm->udp_discarded_bad++;
-            continue;
         }
+
+        if (got_complete_message)
+            batch->complete[ncomplete++] = pkt;
     }
 
-    // if the newly received packet is a short packet, then resize the space
-    // allocated to it on the ringbuffer to exactly match the amount of space
-    // required.  That way, we do not use 64k of the ringbuffer for every
-    // incoming message.
-    if (lcmb->ringbuf) {
-        g_static_rec_mutex_lock (&lcm->mutex);
-        lcm_ringbuf_shrink_last(lcmb->ringbuf, lcmb->buf, sz);
-        g_static_rec_mutex_unlock (&lcm->mutex);
+    if (!ncomplete)
+        return 0;
+
+    /* Move all completed messages onto the filled queue. */
+    for (i = 0; i < ncomplete; i++) {
+        lcm_buf_t *pkt = batch->complete[i];
+        char *slot = batch->slots +
+            (pkt - batch->pkts) * LCM_MAX_UNFRAGMENTED_PACKET_SIZE;
+        lcm_buf_t *lcmb;
+
+        if (0 != _wait_for_empty_buf (lcm)) {
+            // exiting.  drop the reassembled messages that weren't queued.
+            for (; i < ncomplete; i++) {
+                pkt = batch->complete[i];
+                slot = batch->slots +
+                    (pkt - batch->pkts) * LCM_MAX_UNFRAGMENTED_PACKET_SIZE;
+                if (pkt->buf != slot) {
+                    lcm_frag_pool_release (pkt->frag_pool, pkt->buf);
+                    pkt->buf = slot;
+                    pkt->frag_pool = NULL;
+                }
+            }
+            return -1;
+        }
+
+        if (pkt->buf == slot) {
+            // short message.  copy its payload onto the ringbuffer.
+            lcmb = lcm_buf_allocate_data_len (lcm->inbufs_empty, &lcm->ringbuf,
+                    pkt->data_size);
+            memcpy (lcmb->buf, pkt->buf + pkt->data_offset, pkt->data_size);
+            lcmb->data_offset = 0;
+            _update_ringbuf_stats (lcm);
+        } else {
+            // reassembled message.  take ownership of the fragment buffer's
+            // payload, and give the packet its receive slot back.
+            lcmb = lcm_buf_dequeue (lcm->inbufs_empty);
+            lcmb->buf = pkt->buf;
+            lcmb->ringbuf = NULL;
+            lcmb->frag_pool = pkt->frag_pool;
+            pkt->frag_pool = NULL;
+            lcmb->data_offset = pkt->data_offset;
+            pkt->buf = slot;
+        }
+
+        strcpy (lcmb->channel_name, pkt->channel_name);
+        lcmb->channel_size = pkt->channel_size;
+        lcmb->chan = pkt->chan;
+        lcmb->data_size = pkt->data_size;
+        lcmb->recv_utime = pkt->recv_utime;
+        lcmb->packet_size = pkt->packet_size;
+        lcmb->from = pkt->from;
+        lcmb->fromlen = pkt->fromlen;
+
+        /* Queue the packet for future retrieval by lcm_handle ().  This
+         * can't fail, since the queue has room for every packet. */
+        lcm_buf_spsc_push (lcm->inbufs_filled, lcmb);
     }
 
-    return lcmb;
+    /* Wake up the reading thread once for the whole batch. */
+    _signal_filled (lcm);
+    return 0;
 }
+#endif
 
 /* This is the receiver thread that runs continuously to retrieve any incoming
  * LCM packets from the network and queues them locally. */
@@ -564,25 +1107,26 @@ recv_thread (void * user)
 
     lcm_udpm_t * lcm = (lcm_udpm_t *) user;
 
+#ifdef HAVE_RECVMMSG
+    if (lcm->params.recv_batch > 1) {
+        udpm_recv_batch_t *batch = udpm_recv_batch_new (lcm->params.recv_batch);
+        while (0 == udp_read_packet_batch (lcm, batch));
+        udpm_recv_batch_free (batch);
+        dbg (DBG_LCM, "read thread exiting\n");
+        return NULL;
+    }
+#endif
+
     while (1) {
 
         lcm_buf_t *lcmb = udp_read_packet(lcm);
         if (!lcmb) break;
 
-        /* If necessary, notify the reading thread by writing to a pipe.  We
-         * only want one character in the pipe at a time to avoid blocking
-         * writes, so we only do this when the queue transitions from empty to
-         * non-empty. */
-        g_static_rec_mutex_lock (&lcm->mutex);
-
-        if (lcm_buf_queue_is_empty (lcm->inbufs_filled))
-            if (lcm_internal_pipe_write(lcm->notify_pipe[1], "+", 1) < 0)
-                perror ("write to notify");
-
-        /* Queue the packet for future retrieval by lcm_handle (). */
-        lcm_buf_enqueue (lcm->inbufs_filled, lcmb);
-        
-        g_static_rec_mutex_unlock (&lcm->mutex);
+        /* Queue the packet for future retrieval by lcm_handle (), and wake up
+         * the reading thread if it isn't already.  The push can't fail,
+         * since the queue has room for every packet. */
+        lcm_buf_spsc_push (lcm->inbufs_filled, lcmb);
+        _signal_filled (lcm);
     }
     dbg (DBG_LCM, "read thread exiting\n");
     return NULL;
@@ -594,13 +1138,319 @@ lcm_udpm_get_fileno (lcm_udpm_t *lcm)
     if (_setup_recv_parts (lcm) < 0) {
         return -1;
     }
-    return lcm->notify_pipe[0];
+    return lcm_notify_fileno (&lcm->notify);
+}
+
+#ifdef HAVE_SOCKET_FILTER
+// Socket filters on UDP sockets see the UDP header before the LCM header
+#define FILTER_LCM_HEADER_OFFSET 8
+#define FILTER_ACCEPT 0xffffffff
+
+typedef struct _udpm_filter_prog {
+    struct sock_filter insns[BPF_MAXINSNS];
+    int len;
+    int ok;     // cleared if the filter can't pass all subscribed channels
+} udpm_filter_prog_t;
+
+static void
+_filter_add (udpm_filter_prog_t *prog, uint16_t code, uint8_t jt, uint8_t jf,
+        uint32_t k)
+{
+    if (prog->len >= BPF_MAXINSNS) {
+        prog->ok = 0;
+        return;
+    }
+    struct sock_filter insn = { code, jt, jf, k };
+    prog->insns[prog->len++] = insn;
+}
+
+/* Adds the instructions that accept a message if its channel name starts
+ * with the first n bytes of pattern.  On entry, X holds the offset of the
+ * channel name in the packet, and M[0] the number of bytes from there to the
+ * end of the packet. */
+static void
+_filter_add_channel (udpm_filter_prog_t *prog, const char *pattern, int n)
+{
+    // compare 4, then 2, then 1 bytes at a time
+    int nloads = n / 4 + (n % 4) / 2 + n % 2;
+    int block_len = 2 + 2 * nloads + 1;
+    int start = prog->len;
+
+    _filter_add (prog, BPF_LD | BPF_MEM, 0, 0, 0);
+    _filter_add (prog, BPF_JMP | BPF_JGE | BPF_K, 0,
+            block_len - (prog->len - start + 1), n);
+    const uint8_t *p = (const uint8_t *) pattern;
+    for (int off = 0; off < n; ) {
+        int size = n - off >= 4 ? 4 : n - off >= 2 ? 2 : 1;
+        uint32_t val = 0;
+        for (int i = 0; i < size; i++)
+            val = (val << 8) | p[off + i];
+        _filter_add (prog, BPF_LD | BPF_IND |
+                (size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B), 0, 0, off);
+        _filter_add (prog, BPF_JMP | BPF_JEQ | BPF_K, 0,
+                block_len - (prog->len - start + 1), val);
+        off += size;
+    }
+    _filter_add (prog, BPF_RET | BPF_K, 0, 0, FILTER_ACCEPT);
+}
+
+/* Builds a classic BPF program that accepts short messages and first
+ * fragments whose channel is subscribed to.  The other fragments of a large
+ * message don't carry its channel name, so they are all accepted, and dropped
+ * later if their first fragment was.  Only literal channel names and
+ * "prefix.*" patterns can be matched; any other regex disables the filter. */
+static void
+_build_channel_filter (lcm_udpm_t *lcm, udpm_filter_prog_t *prog)
+{
+    const uint32_t magic_off = FILTER_LCM_HEADER_OFFSET;
+    const uint32_t frag_no_off = FILTER_LCM_HEADER_OFFSET +
+        offsetof (lcm2_header_long_t, fragment_no);
+    prog->len = 0;
+    prog->ok = 1;
+
+    _filter_add (prog, BPF_LD | BPF_W | BPF_ABS, 0, 0, magic_off);       // 0
+    _filter_add (prog, BPF_JMP | BPF_JEQ | BPF_K, 4, 0, LCM2_MAGIC_SHORT);// 1
+    _filter_add (prog, BPF_JMP | BPF_JEQ | BPF_K, 0, 2, LCM2_MAGIC_LONG); // 2
+    _filter_add (prog, BPF_LD | BPF_H | BPF_ABS, 0, 0, frag_no_off);     // 3
+    _filter_add (prog, BPF_JMP | BPF_JEQ | BPF_K, 3, 0, 0);              // 4
+    // unknown packets, and fragments other than the first
+    _filter_add (prog, BPF_RET | BPF_K, 0, 0, FILTER_ACCEPT);            // 5
+    _filter_add (prog, BPF_LDX | BPF_IMM, 0, 0,                          // 6
+            FILTER_LCM_HEADER_OFFSET + sizeof (lcm2_header_short_t));
+    _filter_add (prog, BPF_JMP | BPF_JA, 0, 0, 1);                       // 7
+    _filter_add (prog, BPF_LDX | BPF_IMM, 0, 0,                          // 8
+            FILTER_LCM_HEADER_OFFSET + sizeof (lcm2_header_long_t));
+    // M[0] = number of bytes from the channel name to the end of the packet
+    _filter_add (prog, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+    _filter_add (prog, BPF_ALU | BPF_SUB | BPF_X, 0, 0, 0);
+    _filter_add (prog, BPF_ST, 0, 0, 0);
+
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init (&iter, lcm->subscribed_channels);
+    while (prog->ok && g_hash_table_iter_next (&iter, &key, NULL)) {
+        const char *pattern = (const char *) key;
+        // same classification of patterns as lcm_subscribe()
+        size_t len = strcspn (pattern, "\\^$.|?*+()[]{}");
+        if (len > LCM_MAX_CHANNEL_NAME_LENGTH)
+            continue;   // no message can be on this channel
+        if (!pattern[len])
+            _filter_add_channel (prog, pattern, len + 1);
+        else if (len > 0 && !strcmp (pattern + len, ".*"))
+            _filter_add_channel (prog, pattern, len);
+        else
+            prog->ok = 0;
+    }
+    _filter_add (prog, BPF_RET | BPF_K, 0, 0, 0);
+}
+#endif
+
+/* Replaces the socket filter after the set of subscribed channels changed.
+ * Must be called with mutex locked. */
+static void
+_update_channel_filter (lcm_udpm_t *lcm)
+{
+#ifdef HAVE_SOCKET_FILTER
+    if (!lcm->subscribed_channels || lcm->recvfd < 0)
+        return;
+
+    udpm_filter_prog_t *prog =
+        (udpm_filter_prog_t *) malloc (sizeof (udpm_filter_prog_t));
+    _build_channel_filter (lcm, prog);
+    // The receive socket is created by the first subscription before its
+    // channel is added to the set, and the set may become empty again after
+    // unsubscribing.  A filter built from an empty set would reject every
+    // packet, including any a subscription made next would want, so pass
+    // everything instead until there is at least one channel to match.
+    if (!g_hash_table_size (lcm->subscribed_channels))
+        prog->ok = 0;
+    if (prog->ok) {
+        struct sock_fprog fprog;
+        fprog.len = prog->len;
+        fprog.filter = prog->insns;
+        dbg (DBG_LCM, "LCM: attaching a %d instruction channel filter\n",
+                prog->len);
+        if (setsockopt (lcm->recvfd, SOL_SOCKET, SO_ATTACH_FILTER,
+                &fprog, sizeof (fprog)) < 0) {
+            perror ("setsockopt (SOL_SOCKET, SO_ATTACH_FILTER)");
+            prog->ok = 0;
+        }
+    }
+    if (!prog->ok) {
+        // receive everything, and filter in userspace only
+        dbg (DBG_LCM, "LCM: not filtering channels in the kernel\n");
+        int opt = 0;
+        setsockopt (lcm->recvfd, SOL_SOCKET, SO_DETACH_FILTER,
+                &opt, sizeof (opt));
+    }
+    free (prog);
+#endif
 }
 
 static int
 lcm_udpm_subscribe (lcm_udpm_t *lcm, const char *channel)
 {
-    return _setup_recv_parts (lcm);
+    int status = _setup_recv_parts (lcm);
+    if (status == 0 && lcm->subscribed_channels) {
+        g_static_rec_mutex_lock (&lcm->mutex);
+        guint count = GPOINTER_TO_UINT (
+                g_hash_table_lookup (lcm->subscribed_channels, channel));
+        g_hash_table_insert (lcm->subscribed_channels, strdup (channel),
+                GUINT_TO_POINTER (count + 1));
+        _update_channel_filter (lcm);
+        g_static_rec_mutex_unlock (&lcm->mutex);
+    }
+    return status;
+}
+
+static int
+lcm_udpm_unsubscribe (lcm_udpm_t *lcm, const char *channel)
+{
+    if (!lcm->subscribed_channels)
+        return 0;
+
+    g_static_rec_mutex_lock (&lcm->mutex);
+    guint count = GPOINTER_TO_UINT (
+            g_hash_table_lookup (lcm->subscribed_channels, channel));
+    if (count > 1)
+        g_hash_table_insert (lcm->subscribed_channels, strdup (channel),
+                GUINT_TO_POINTER (count - 1));
+    else
+        g_hash_table_remove (lcm->subscribed_channels, channel);
+    _update_channel_filter (lcm);
+    g_static_rec_mutex_unlock (&lcm->mutex);
+    return 0;
+}
+
+/* Transmits a large message as a sequence of fragments.
+ *
+ * The headers and scatter/gather lists for every fragment are built before
+ * the transmit lock is acquired.  While holding the lock, only the sequence
+ * number is filled in, and the fragments are handed to the kernel in batches
+ * with sendmmsg() where available. */
+static int
+_publish_fragments (lcm_udpm_t *lcm, const char *channel, int channel_size,
+        const void *data, unsigned int datalen, int nfragments)
+{
+    int fragment_size = LCM_FRAGMENT_MAX_PAYLOAD;
+
+    lcm2_header_long_t *hdrs = (lcm2_header_long_t *)
+        malloc (nfragments * sizeof (lcm2_header_long_t));
+    // the first fragment has 3 iovecs, the others have 2
+    struct iovec *vecs = (struct iovec *)
+        malloc ((2 * nfragments + 1) * sizeof (struct iovec));
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr *msgs = (struct mmsghdr *)
+        calloc (nfragments, sizeof (struct mmsghdr));
+#else
+    struct msghdr *msgs = (struct msghdr *)
+        calloc (nfragments, sizeof (struct msghdr));
+#endif
+    int *packet_sizes = (int *) malloc (nfragments * sizeof (int));
+
+    // first fragment is special.  insert channel before data
+    int firstfrag_datasize = fragment_size - (channel_size + 1);
+    assert (firstfrag_datasize <= datalen);
+
+    uint32_t fragment_offset = 0;
+    struct iovec *vec = vecs;
+    int frag_no;
+    for (frag_no = 0; frag_no < nfragments; frag_no++) {
+        lcm2_header_long_t *hdr = &hdrs[frag_no];
+        hdr->magic = htonl (LCM2_MAGIC_LONG);
+        hdr->msg_size = htonl (datalen);
+        hdr->fragment_offset = htonl (fragment_offset);
+        hdr->fragment_no = htons (frag_no);
+        hdr->fragments_in_msg = htons (nfragments);
+
+#ifdef HAVE_SENDMMSG
+        struct msghdr *msg = &msgs[frag_no].msg_hdr;
+#else
+        struct msghdr *msg = &msgs[frag_no];
+#endif
+        msg->msg_name = (struct sockaddr*) &lcm->dest_addr;
+        msg->msg_namelen = sizeof(lcm->dest_addr);
+        msg->msg_iov = vec;
+
+        vec->iov_base = (char *) hdr;
+        vec->iov_len = sizeof (lcm2_header_long_t);
+        vec++;
+
+        int fraglen;
+        if (frag_no == 0) {
+            fraglen = firstfrag_datasize;
+            vec->iov_base = (char *) channel;
+            vec->iov_len = channel_size + 1;
+            vec++;
+            packet_sizes[frag_no] = sizeof (lcm2_header_long_t) +
+                channel_size + 1 + fraglen;
+        } else {
+            fraglen = MIN (fragment_size, datalen - fragment_offset);
+            packet_sizes[frag_no] = sizeof (lcm2_header_long_t) + fraglen;
+        }
+        vec->iov_base = (char *) data + fragment_offset;
+        vec->iov_len = fraglen;
+        vec++;
+
+        msg->msg_iovlen = vec - msg->msg_iov;
+        fragment_offset += fraglen;
+    }
+    assert (fragment_offset == datalen);
+
+    // acquire transmit lock so that no other message uses the same sequence
+    // number (at least until the sequence # rolls over).  Unless fragments
+    // may be interleaved, also hold it so that all fragments are transmitted
+    // together.
+    int interleave = lcm->params.interleave_frags;
+    g_static_mutex_lock (&lcm->transmit_lock);
+    dbg (DBG_LCM_MSG, "transmitting %d byte [%s] payload in %d fragments\n",
+            datalen, channel, nfragments);
+
+    uint32_t msg_seqno = htonl (lcm->msg_seqno);
+    lcm->msg_seqno ++;
+    if (interleave)
+        g_static_mutex_unlock (&lcm->transmit_lock);
+
+    for (frag_no = 0; frag_no < nfragments; frag_no++)
+        hdrs[frag_no].msg_seqno = msg_seqno;
+
+    int nsent = 0;
+#ifdef HAVE_SENDMMSG
+    while (nsent < nfragments) {
+        int status = sendmmsg (lcm->sendfd, msgs + nsent,
+                MIN (nfragments - nsent, MAX_SEND_BATCH), 0);
+        if (status <= 0)
+            break;
+        // stop at the first fragment that was not sent in full, like the
+        // sendmsg () loop below
+        int i;
+        for (i = nsent; i < nsent + status; i++) {
+            if (msgs[i].msg_len != (unsigned int) packet_sizes[i])
+                break;
+        }
+        if (i < nsent + status) {
+            nsent = i;
+            break;
+        }
+        nsent += status;
+    }
+#else
+    for (; nsent < nfragments; nsent++) {
+        int status = sendmsg (lcm->sendfd, &msgs[nsent], 0);
+        if (status != packet_sizes[nsent])
+            break;
+    }
+#endif
+
+    if (!interleave)
+        g_static_mutex_unlock (&lcm->transmit_lock);
+
+    free (packet_sizes);
+    free (msgs);
+    free (vecs);
+    free (hdrs);
+
+    return (nsent == nfragments) ? 0 : -1;
 }
 
 static int 
@@ -665,143 +1515,101 @@ lcm_udpm_publish (lcm_udpm_t *lcm, const char *channel, const void *data,
             return -1;
         }
 
-        // acquire transmit lock so that all fragments are transmitted
-        // together, and so that no other message uses the same sequence number
-        // (at least until the sequence # rolls over)
-        g_static_mutex_lock (&lcm->transmit_lock);
-        dbg (DBG_LCM_MSG, "transmitting %d byte [%s] payload in %d fragments\n",
-                payload_size, channel, nfragments);
-
-        uint32_t fragment_offset = 0;
-
-        lcm2_header_long_t hdr;
-        hdr.magic = htonl (LCM2_MAGIC_LONG);
-        hdr.msg_seqno = htonl (lcm->msg_seqno);
-        hdr.msg_size = htonl (datalen);
-        hdr.fragment_offset = 0;
-        hdr.fragment_no = 0;
-        hdr.fragments_in_msg = htons (nfragments);
-
-        // first fragment is special.  insert channel before data
-        int firstfrag_datasize = fragment_size - (channel_size + 1);
-        assert (firstfrag_datasize <= datalen);
-
-        struct iovec    first_sendbufs[3];
-        first_sendbufs[0].iov_base = (char *) &hdr;
-        first_sendbufs[0].iov_len = sizeof (hdr);
-        first_sendbufs[1].iov_base = (char *) channel;
-        first_sendbufs[1].iov_len = channel_size + 1;
-        first_sendbufs[2].iov_base = (char *) data;
-        first_sendbufs[2].iov_len = firstfrag_datasize;
-
-        int packet_size = sizeof (hdr) + channel_size + 1 + firstfrag_datasize;
-        fragment_offset += firstfrag_datasize;
-//        int status = writev (lcm->sendfd, first_sendbufs, 3);
-        struct msghdr msg;
-        msg.msg_name = (struct sockaddr*) &lcm->dest_addr;
-        msg.msg_namelen = sizeof(lcm->dest_addr);
-        msg.msg_iov = first_sendbufs;
-        msg.msg_iovlen = 3;
-        msg.msg_control = NULL;
-        msg.msg_controllen = 0;
-        msg.msg_flags = 0;
-        int status = sendmsg(lcm->sendfd, &msg, 0);
-
-        // transmit the rest of the fragments
-        for (uint16_t frag_no=1; 
-                packet_size == status && frag_no<nfragments; 
-                frag_no++) {
-            hdr.fragment_offset = htonl (fragment_offset);
-            hdr.fragment_no = htons (frag_no);
-
-            int fraglen = MIN (fragment_size,
-                    datalen - fragment_offset);
-
-            struct iovec sendbufs[2];
-            sendbufs[0].iov_base = (char *) &hdr;
-            sendbufs[0].iov_len = sizeof (hdr);
-            sendbufs[1].iov_base = (char *) ((char *)data + fragment_offset);
-            sendbufs[1].iov_len = fraglen;
-
-//            status = writev (lcm->sendfd, sendbufs, 2);
-            msg.msg_iov = sendbufs;
-            msg.msg_iovlen = 2;
-            status = sendmsg(lcm->sendfd, &msg, 0);
-
-            fragment_offset += fraglen;
-            packet_size = sizeof (hdr) + fraglen;
-        }
+        return _publish_fragments (lcm, channel, channel_size, data, datalen,
+                nfragments);
+    }
+}
 
-        // sanity check
-        if (0 == status) {
-            assert (fragment_offset == datalen);
-        }
+static void
+_dispatch_packet (lcm_udpm_t *lcm, lcm_buf_t *lcmb)
+{
+    lcm_recv_buf_t rbuf;
+    rbuf.data = (uint8_t*) lcmb->buf + lcmb->data_offset;
+    rbuf.data_size = lcmb->data_size;
+    rbuf.recv_utime = lcmb->recv_utime;
+    rbuf.lcm = lcm->lcm;
 
-        lcm->msg_seqno ++;
-        g_static_mutex_unlock (&lcm->transmit_lock);
+    if(lcm->creating_read_thread) {
+        // special case:  If we're creating the read thread and are in
+        // self-test mode, then only dispatch the self-test message.
+        if(!strcmp(lcmb->channel_name, SELF_TEST_CHANNEL))
+            lcm_dispatch_channel_handlers (lcm->lcm, &rbuf, lcmb->chan);
+    } else {
+        lcm_dispatch_channel_handlers (lcm->lcm, &rbuf, lcmb->chan);
     }
-
-    return 0;
 }
 
 static int 
 lcm_udpm_handle (lcm_udpm_t *lcm)
 {
-    int status;
-    char ch;
     if(0 != _setup_recv_parts (lcm))
         return -1;
 
-    /* Read one byte from the notify pipe.  This will block if no packets are
-     * available yet and wake up when they are. */
-    status = lcm_internal_pipe_read(lcm->notify_pipe[0], &ch, 1);
-    if (status == 0) {
-        fprintf (stderr, "Error: lcm_handle read 0 bytes from notify_pipe\n");
-        return -1;
-    }
-    else if (status < 0) {
-        fprintf (stderr, "Error: lcm_handle read: %s\n", strerror (errno));
-        return -1;
+    /* Wait for a packet.  This only blocks if none are queued yet. */
+    lcm_buf_t * lcmb;
+    while (!(lcmb = lcm_buf_spsc_pop (lcm->inbufs_filled))) {
+        _clear_filled (lcm);
+        if (0 != lcm_notify_wait (&lcm->notify)) {
+            fprintf (stderr, "Error: lcm_handle wait: %s\n", strerror (errno));
+            return -1;
+        }
     }
 
-    /* Dequeue the next received packet */
-    g_static_rec_mutex_lock (&lcm->mutex);
-    lcm_buf_t * lcmb = lcm_buf_dequeue (lcm->inbufs_filled);
+    /* Once the queue is drained, stop reporting the file descriptor as
+     * readable. */
+    if (lcm_buf_spsc_is_empty (lcm->inbufs_filled))
+        _clear_filled (lcm);
 
-    if (!lcmb) {
-        fprintf (stderr, 
-                "Error: no packet available despite getting notification.\n");
-        g_static_rec_mutex_unlock (&lcm->mutex);
-        return -1;
-    }
+    _dispatch_packet (lcm, lcmb);
 
-    /* If there are still packets in the queue, put something back in the pipe
-     * so that future invocations will get called. */
-    if (!lcm_buf_queue_is_empty (lcm->inbufs_filled))
-        if (lcm_internal_pipe_write(lcm->notify_pipe[1], "+", 1) < 0)
-            perror ("write to notify");
-    g_static_rec_mutex_unlock (&lcm->mutex);
+    /* Hand the packet back to the read thread, which releases its data.  This
+     * can't fail, since the queue has room for every packet. */
+    lcm_buf_spsc_push (lcm->inbufs_done, lcmb);
+    _signal_done (lcm);
 
-    lcm_recv_buf_t rbuf;
-    rbuf.data = (uint8_t*) lcmb->buf + lcmb->data_offset;
-    rbuf.data_size = lcmb->data_size;
-    rbuf.recv_utime = lcmb->recv_utime;
-    rbuf.lcm = lcm->lcm;
+    return 0;
+}
 
-    if(lcm->creating_read_thread) {
-        // special case:  If we're creating the read thread and are in
-        // self-test mode, then only dispatch the self-test message.
-        if(!strcmp(lcmb->channel_name, SELF_TEST_CHANNEL))
-            lcm_dispatch_handlers (lcm->lcm, &rbuf, lcmb->channel_name);
-    } else {
-        lcm_dispatch_handlers (lcm->lcm, &rbuf, lcmb->channel_name);
+static int
+lcm_udpm_handle_batch (lcm_udpm_t *lcm, int max_msgs)
+{
+    if(0 != _setup_recv_parts (lcm))
+        return -1;
+
+    int nhandled = 0;
+    lcm_buf_t *lcmb;
+    while (nhandled < max_msgs &&
+            (lcmb = lcm_buf_spsc_pop (lcm->inbufs_filled))) {
+        _dispatch_packet (lcm, lcmb);
+        lcm_buf_spsc_push (lcm->inbufs_done, lcmb);
+        nhandled++;
     }
+    if (nhandled)
+        _signal_done (lcm);
+
+    if (lcm_buf_spsc_is_empty (lcm->inbufs_filled))
+        _clear_filled (lcm);
+
+    return nhandled;
+}
 
+static int
+lcm_udpm_get_stats (lcm_udpm_t *lcm, lcm_stats_t *stats)
+{
+    // The counters are updated by the read thread without any locking, so
+    // this is only a snapshot.  The fragment buffer store only exists once
+    // the receive resources are set up.
     g_static_rec_mutex_lock (&lcm->mutex);
-    lcm_buf_free_data(lcmb, lcm->ringbuf);
-    lcm_buf_enqueue (lcm->inbufs_empty, lcmb);
+    stats->packets_received = lcm->udp_rx;
+    stats->packets_bad = lcm->udp_discarded_bad;
+    stats->fragments_dropped = lcm->udp_discarded_frags;
+    if (lcm->frag_bufs) {
+        stats->reassembly_evictions = lcm->frag_bufs->n_evicted;
+        stats->reassembly_expirations = lcm->frag_bufs->n_expired;
+    }
+    stats->recv_buf_high_water = lcm->ringbuf_high_water;
+    stats->recv_buf_capacity = lcm->ringbuf_capacity;
     g_static_rec_mutex_unlock (&lcm->mutex);
-
     return 0;
 }
 
@@ -836,7 +1644,7 @@ udpm_self_test (lcm_udpm_t *lcm)
     GTimeVal next_retransmit;
     lcm_timeval_add (&now, &retransmit_interval, &next_retransmit);
 
-    int recvfd = lcm->notify_pipe[0];
+    int recvfd = lcm_notify_fileno (&lcm->notify);
 
     do {
         GTimeVal selectto;
@@ -918,7 +1726,9 @@ _setup_recv_parts (lcm_udpm_t *lcm)
 
     // allocate the fragment buffer hashtable
     lcm->frag_bufs = lcm_frag_buf_store_new(MAX_FRAG_BUF_TOTAL_SIZE,
-            MAX_NUM_FRAG_BUFS);
+            MAX_NUM_FRAG_BUFS, MAX_FRAG_BUFS_PER_SOURCE,
+            MAX_FRAG_BUF_AGE_USEC);
+    lcm->frag_pool = lcm_frag_pool_new(MAX_FRAG_BUF_TOTAL_SIZE);
 
     // allocate multicast socket
     lcm->recvfd = socket (AF_INET, SOCK_DGRAM, 0);
@@ -926,6 +1736,7 @@ _setup_recv_parts (lcm_udpm_t *lcm)
         perror ("allocating LCM recv socket");
         goto setup_recv_thread_fail;
     }
+    _update_channel_filter (lcm);
 
     struct sockaddr_in addr;
     memset (&addr, 0, sizeof (addr));
@@ -1024,7 +1835,8 @@ _setup_recv_parts (lcm_udpm_t *lcm)
     }
 
     lcm->inbufs_empty = lcm_buf_queue_new ();
-    lcm->inbufs_filled = lcm_buf_queue_new ();
+    lcm->inbufs_filled = lcm_buf_spsc_new (LCM_DEFAULT_RECV_BUFS);
+    lcm->inbufs_done = lcm_buf_spsc_new (LCM_DEFAULT_RECV_BUFS);
     lcm->ringbuf = lcm_ringbuf_new (LCM_RINGBUF_SIZE);
 
     int i;
@@ -1088,6 +1900,33 @@ lcm_udpm_create (lcm_t * parent, const char *network, const GHashTable *args)
 
     g_hash_table_foreach ((GHashTable*) args, new_argument, &params);
 
+#ifndef HAVE_RECVMMSG
+    if (params.recv_batch > 1) {
+        fprintf (stderr, "Warning: recv_batch is not supported on this "
+                "platform\n");
+        params.recv_batch = 1;
+    }
+#endif
+#ifndef HAVE_ZERO_COPY_FRAGS
+    if (params.zero_copy_frags) {
+        fprintf (stderr, "Warning: zero_copy_frags is not supported on this "
+                "platform\n");
+        params.zero_copy_frags = 0;
+    }
+#endif
+#ifndef HAVE_SOCKET_FILTER
+    if (params.channel_filter) {
+        fprintf (stderr, "Warning: channel_filter is not supported on this "
+                "platform\n");
+        params.channel_filter = 0;
+    }
+#endif
+    if (params.zero_copy_frags && params.recv_batch > 1) {
+        fprintf (stderr, "Warning: zero_copy_frags can't be combined with "
+                "recv_batch, ignoring it\n");
+        params.zero_copy_frags = 0;
+    }
+
     if (parse_mc_addr_and_port (network, &params) < 0) {
         return NULL;
     }
@@ -1099,28 +1938,38 @@ lcm_udpm_create (lcm_t * parent, const char *network, const GHashTable *args)
     lcm->recvfd = -1;
     lcm->sendfd = -1;
     lcm->thread_msg_pipe[0] = lcm->thread_msg_pipe[1] = -1;
-    lcm->udp_low_watermark = 1.0;
 
     lcm->kernel_rbuf_sz = 0;
     lcm->warned_about_small_kernel_buf = 0;
 
     lcm->frag_bufs = NULL;
 
+    if (params.channel_filter)
+        lcm->subscribed_channels = g_hash_table_new_full (g_str_hash,
+                g_str_equal, free, NULL);
+
     // synchronization variables used when allocating receive resources
     lcm->creating_read_thread = 0;
     lcm->create_read_thread_mutex = NULL;
     lcm->create_read_thread_cond = NULL;
 
-    // internal notification pipe
-    if(0 != lcm_internal_pipe_create(lcm->notify_pipe)) {
-        perror(__FILE__ " pipe(create)");
+    g_static_rec_mutex_init (&lcm->mutex);
+    g_static_mutex_init (&lcm->notify_lock);
+    g_static_mutex_init (&lcm->done_lock);
+    g_static_mutex_init (&lcm->transmit_lock);
+
+    // internal notification
+    lcm->done_notify.fds[0] = lcm->done_notify.fds[1] = -1;
+    if(0 != lcm_notify_init(&lcm->notify)) {
+        perror(__FILE__ " notify(create)");
+        lcm_udpm_destroy (lcm);
+        return NULL;
+    }
+    if(0 != lcm_notify_init(&lcm->done_notify)) {
+        perror(__FILE__ " notify(create)");
         lcm_udpm_destroy (lcm);
         return NULL;
     }
-    fcntl (lcm->notify_pipe[1], F_SETFL, O_NONBLOCK);
-
-    g_static_rec_mutex_init (&lcm->mutex);
-    g_static_mutex_init (&lcm->transmit_lock);
 
     dbg (DBG_LCM, "Initializing LCM UDPM context...\n");
     dbg (DBG_LCM, "Multicast %s:%d\n", inet_ntoa(params.mc_addr), ntohs (params.mc_port));
@@ -1221,10 +2070,12 @@ static lcm_provider_vtable_t udpm_vtable = {
     .create      = lcm_udpm_create,
     .destroy     = lcm_udpm_destroy,
     .subscribe   = lcm_udpm_subscribe,
-    .unsubscribe = NULL,
+    .unsubscribe = lcm_udpm_unsubscribe,
     .publish     = lcm_udpm_publish,
     .handle      = lcm_udpm_handle,
     .get_fileno  = lcm_udpm_get_fileno,
+    .handle_batch = lcm_udpm_handle_batch,
+    .get_stats   = lcm_udpm_get_stats,
 };
 #endif
 
@@ -1239,10 +2090,12 @@ lcm_udpm_provider_init (GPtrArray * providers)
     udpm_vtable.create      = lcm_udpm_create;
     udpm_vtable.destroy     = lcm_udpm_destroy;
     udpm_vtable.subscribe   = lcm_udpm_subscribe;
-    udpm_vtable.unsubscribe = NULL;
+    udpm_vtable.unsubscribe = lcm_udpm_unsubscribe;
     udpm_vtable.publish     = lcm_udpm_publish;
     udpm_vtable.handle      = lcm_udpm_handle;
     udpm_vtable.get_fileno  = lcm_udpm_get_fileno;
+    udpm_vtable.handle_batch = lcm_udpm_handle_batch;
+    udpm_vtable.get_stats   = lcm_udpm_get_stats;
 #endif
     udpm_info.name = "udpm";
     udpm_info.vtable = &udpm_vtable;
@@ -1,35 +1,136 @@
 #include "udpm_util.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
 
 #include "dbg.h"
 
-#define LCM_MAX_UNFRAGMENTED_PACKET_SIZE 65536
+/******************** reassembly buffer pool **********************/
+
+// buffers smaller than this are rounded up to it
+#define FRAG_POOL_MIN_CLASS 10
+// LCM_MAX_MESSAGE_SIZE is 1 << 28
+#define FRAG_POOL_NUM_CLASSES (28 - FRAG_POOL_MIN_CLASS + 1)
+
+typedef struct _lcm_frag_pool_chunk lcm_frag_pool_chunk_t;
+struct _lcm_frag_pool_chunk {
+    lcm_frag_pool_chunk_t *next;    // next free chunk of the same size class
+    unsigned int size_class;
+    char data[];
+};
+
+struct _lcm_frag_pool {
+    lcm_frag_pool_chunk_t *free_chunks[FRAG_POOL_NUM_CLASSES];
+    uint32_t free_size;             // bytes held on the free lists
+    uint32_t max_free_size;
+};
+
+static unsigned int
+_frag_pool_size_class (uint32_t size)
+{
+    unsigned int size_class = 0;
+    while (((uint32_t) 1 << (size_class + FRAG_POOL_MIN_CLASS)) < size)
+        size_class++;
+    return size_class;
+}
+
+lcm_frag_pool_t *
+lcm_frag_pool_new (uint32_t max_free_size)
+{
+    lcm_frag_pool_t *pool =
+        (lcm_frag_pool_t *) calloc (1, sizeof (lcm_frag_pool_t));
+    pool->max_free_size = max_free_size;
+    return pool;
+}
+
+void
+lcm_frag_pool_destroy (lcm_frag_pool_t *pool)
+{
+    int i;
+    for (i = 0; i < FRAG_POOL_NUM_CLASSES; i++) {
+        while (pool->free_chunks[i]) {
+            lcm_frag_pool_chunk_t *chunk = pool->free_chunks[i];
+            pool->free_chunks[i] = chunk->next;
+            free (chunk);
+        }
+    }
+    free (pool);
+}
+
+char *
+lcm_frag_pool_alloc (lcm_frag_pool_t *pool, uint32_t size)
+{
+    unsigned int size_class = _frag_pool_size_class (size);
+    assert (size_class < FRAG_POOL_NUM_CLASSES);
+    uint32_t chunk_size = (uint32_t) 1 << (size_class + FRAG_POOL_MIN_CLASS);
+
+    lcm_frag_pool_chunk_t *chunk = pool->free_chunks[size_class];
+    if (chunk) {
+        pool->free_chunks[size_class] = chunk->next;
+        pool->free_size -= chunk_size;
+    } else {
+        chunk = (lcm_frag_pool_chunk_t *) malloc (
+                sizeof (lcm_frag_pool_chunk_t) + chunk_size);
+        chunk->size_class = size_class;
+    }
+    chunk->next = NULL;
+    return chunk->data;
+}
+
+void
+lcm_frag_pool_release (lcm_frag_pool_t *pool, char *data)
+{
+    lcm_frag_pool_chunk_t *chunk = (lcm_frag_pool_chunk_t *)
+        (data - offsetof (lcm_frag_pool_chunk_t, data));
+    uint32_t chunk_size =
+        (uint32_t) 1 << (chunk->size_class + FRAG_POOL_MIN_CLASS);
+
+    if (pool->free_size + chunk_size > pool->max_free_size) {
+        free (chunk);
+        return;
+    }
+    chunk->next = pool->free_chunks[chunk->size_class];
+    pool->free_chunks[chunk->size_class] = chunk;
+    pool->free_size += chunk_size;
+}
+
 
 /******************** fragment buffer **********************/
 lcm_frag_buf_t *
-lcm_frag_buf_new (struct sockaddr_in from, const char *channel, 
-        uint32_t msg_seqno, uint32_t data_size, uint16_t nfragments,
-        int64_t first_packet_utime)
+lcm_frag_buf_new (lcm_frag_pool_t *pool, struct sockaddr_in from,
+        const char *channel, uint32_t msg_seqno, uint32_t data_size,
+        uint16_t nfragments, int64_t first_packet_utime)
 {
     lcm_frag_buf_t *fbuf = (lcm_frag_buf_t*) malloc (sizeof (lcm_frag_buf_t));
     strncpy (fbuf->channel, channel, sizeof (fbuf->channel));
-    fbuf->from = from;
-    fbuf->msg_seqno = msg_seqno;
-    fbuf->data = (char*)malloc (data_size);
+    fbuf->chan = NULL;
+    memset (&fbuf->key, 0, sizeof (fbuf->key));
+    fbuf->key.from = from;
+    fbuf->key.msg_seqno = msg_seqno;
+    fbuf->pool = pool;
+    if (pool)
+        fbuf->data = lcm_frag_pool_alloc (pool, data_size);
+    else
+        fbuf->data = (char*)malloc (data_size);
     fbuf->data_size = data_size;
     fbuf->fragments_remaining = nfragments;
     fbuf->last_packet_utime = first_packet_utime;
+    fbuf->lru_prev = fbuf->lru_next = NULL;
+    fbuf->source = NULL;
+    fbuf->src_prev = fbuf->src_next = NULL;
     return fbuf;
 }
 
 void
 lcm_frag_buf_destroy (lcm_frag_buf_t *fbuf)
 {
-    free (fbuf->data);
+    if (fbuf->data && fbuf->pool)
+        lcm_frag_pool_release (fbuf->pool, fbuf->data);
+    else
+        free (fbuf->data);
     free (fbuf);
 }
 
@@ -56,62 +157,192 @@ _sockaddr_in_equal (const void * a, const void *b)
            a_addr->sin_family      == b_addr->sin_family;
 }
 
+// a sender that has messages in the store
+struct _lcm_frag_source {
+    struct sockaddr_in from;
+    uint32_t n_frag_bufs;
+    lcm_frag_buf_t *oldest;
+    lcm_frag_buf_t *newest;
+};
+
+static guint
+_frag_key_hash (const void * key)
+{
+    const lcm_frag_key_t *k = (const lcm_frag_key_t*) key;
+    return _sockaddr_in_hash (&k->from) ^ (k->msg_seqno * 2654435761U);
+}
+
+static gboolean
+_frag_key_equal (const void * a, const void *b)
+{
+    const lcm_frag_key_t *a_key = (const lcm_frag_key_t*) a;
+    const lcm_frag_key_t *b_key = (const lcm_frag_key_t*) b;
+
+    return a_key->msg_seqno == b_key->msg_seqno &&
+           _sockaddr_in_equal (&a_key->from, &b_key->from);
+}
+
+static void
+_lru_unlink (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
+{
+    if (fbuf->lru_prev)
+        fbuf->lru_prev->lru_next = fbuf->lru_next;
+    else
+        store->lru_head = fbuf->lru_next;
+    if (fbuf->lru_next)
+        fbuf->lru_next->lru_prev = fbuf->lru_prev;
+    else
+        store->lru_tail = fbuf->lru_prev;
+    fbuf->lru_prev = fbuf->lru_next = NULL;
+}
+
 static void
-_find_lru_frag_buf (gpointer key, gpointer value, void *user_data)
+_lru_append (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
 {
-    lcm_frag_buf_t **lru_fbuf = (lcm_frag_buf_t**) user_data;
-    lcm_frag_buf_t *c_fbuf = (lcm_frag_buf_t*) value;
-    if (! *lru_fbuf ||
-        (c_fbuf->last_packet_utime < (*lru_fbuf)->last_packet_utime)) {
-        *lru_fbuf = c_fbuf;
+    fbuf->lru_prev = store->lru_tail;
+    fbuf->lru_next = NULL;
+    if (store->lru_tail)
+        store->lru_tail->lru_next = fbuf;
+    else
+        store->lru_head = fbuf;
+    store->lru_tail = fbuf;
+}
+
+static void
+_source_append (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
+{
+    lcm_frag_source_t *src = (lcm_frag_source_t *) g_hash_table_lookup (
+            store->sources, &fbuf->key.from);
+    if (!src) {
+        src = (lcm_frag_source_t *) calloc (1, sizeof (lcm_frag_source_t));
+        src->from = fbuf->key.from;
+        g_hash_table_insert (store->sources, &src->from, src);
     }
+
+    fbuf->source = src;
+    fbuf->src_prev = src->newest;
+    fbuf->src_next = NULL;
+    if (src->newest)
+        src->newest->src_next = fbuf;
+    else
+        src->oldest = fbuf;
+    src->newest = fbuf;
+    src->n_frag_bufs++;
+}
+
+static void
+_source_unlink (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
+{
+    lcm_frag_source_t *src = fbuf->source;
+    if (fbuf->src_prev)
+        fbuf->src_prev->src_next = fbuf->src_next;
+    else
+        src->oldest = fbuf->src_next;
+    if (fbuf->src_next)
+        fbuf->src_next->src_prev = fbuf->src_prev;
+    else
+        src->newest = fbuf->src_prev;
+    fbuf->src_prev = fbuf->src_next = NULL;
+    fbuf->source = NULL;
+
+    if (--src->n_frag_bufs == 0)
+        g_hash_table_remove (store->sources, &src->from);
 }
 
 lcm_frag_buf_store * lcm_frag_buf_store_new(uint32_t max_total_size,
-        uint32_t max_n_frag_bufs) {
+        uint32_t max_n_frag_bufs, uint32_t max_n_frag_bufs_per_source,
+        int64_t max_age_usec) {
     lcm_frag_buf_store * store = (lcm_frag_buf_store *) calloc(1,
             sizeof(lcm_frag_buf_store));
     store->total_size = 0;
     store->max_total_size = max_total_size;
     store->max_n_frag_bufs = max_n_frag_bufs;
+    store->max_n_frag_bufs_per_source = MAX (max_n_frag_bufs_per_source, 1);
+    store->max_age_usec = max_age_usec;
 
-    store->frag_bufs = g_hash_table_new_full(_sockaddr_in_hash,
-                                       _sockaddr_in_equal, NULL,
+    store->frag_bufs = g_hash_table_new_full(_frag_key_hash,
+                                       _frag_key_equal, NULL,
                                        (GDestroyNotify) lcm_frag_buf_destroy);
+    store->sources = g_hash_table_new_full(_sockaddr_in_hash,
+                                       _sockaddr_in_equal, NULL, free);
     return store;
 }
 
 void lcm_frag_buf_store_destroy(lcm_frag_buf_store * store){
     g_hash_table_destroy (store->frag_bufs);
+    g_hash_table_destroy (store->sources);
     free(store);
 }
 
 lcm_frag_buf_t * lcm_frag_buf_store_lookup(lcm_frag_buf_store * store,
-        struct sockaddr* key) {
-    return (lcm_frag_buf_t *) g_hash_table_lookup(store->frag_bufs, key);
+        const struct sockaddr* from, uint32_t msg_seqno) {
+    lcm_frag_key_t key;
+    memset (&key, 0, sizeof (key));
+    memcpy (&key.from, from, sizeof (key.from));
+    key.msg_seqno = msg_seqno;
+    return (lcm_frag_buf_t *) g_hash_table_lookup(store->frag_bufs, &key);
 }
 
 void
 lcm_frag_buf_store_add (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
 {
-    while (store->total_size > store->max_total_size ||
-            g_hash_table_size (store->frag_bufs) > store->max_n_frag_bufs) {
-        // find and remove the least recently updated fragment buffer
-        lcm_frag_buf_t *lru_fbuf = NULL;
-        g_hash_table_foreach (store->frag_bufs, _find_lru_frag_buf, &lru_fbuf);
-        if (lru_fbuf){
-            lcm_frag_buf_store_remove (store, lru_fbuf);
-        }
+    lcm_frag_buf_store_expire (store, fbuf->last_packet_utime);
+
+    // limit how many messages a single sender can have in flight
+    lcm_frag_source_t *src = (lcm_frag_source_t *) g_hash_table_lookup (
+            store->sources, &fbuf->key.from);
+    if (src && src->n_frag_bufs >= store->max_n_frag_bufs_per_source) {
+        dbg (DBG_LCM, "Evicting incomplete message from sender "
+                "(missing %d fragments)\n", src->oldest->fragments_remaining);
+        store->n_evicted++;
+        lcm_frag_buf_store_remove (store, src->oldest);
+    }
+
+    // evict the least recently updated fragment buffers until there's room
+    while (store->lru_head &&
+            (store->total_size + fbuf->data_size > store->max_total_size ||
+             g_hash_table_size (store->frag_bufs) >= store->max_n_frag_bufs)) {
+        dbg (DBG_LCM, "Evicting incomplete message (missing %d fragments)\n",
+                store->lru_head->fragments_remaining);
+        store->n_evicted++;
+        lcm_frag_buf_store_remove (store, store->lru_head);
     }
-    g_hash_table_insert (store->frag_bufs, &fbuf->from, fbuf);
+    g_hash_table_insert (store->frag_bufs, &fbuf->key, fbuf);
     store->total_size += fbuf->data_size;
+    _lru_append (store, fbuf);
+    _source_append (store, fbuf);
+}
+
+void
+lcm_frag_buf_store_touch (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf,
+        int64_t utime)
+{
+    fbuf->last_packet_utime = utime;
+    if (fbuf != store->lru_tail) {
+        _lru_unlink (store, fbuf);
+        _lru_append (store, fbuf);
+    }
+}
+
+void
+lcm_frag_buf_store_expire (lcm_frag_buf_store *store, int64_t now)
+{
+    while (store->lru_head &&
+            now - store->lru_head->last_packet_utime > store->max_age_usec) {
+        dbg (DBG_LCM, "Expiring incomplete message (missing %d fragments)\n",
+                store->lru_head->fragments_remaining);
+        store->n_expired++;
+        lcm_frag_buf_store_remove (store, store->lru_head);
+    }
 }
 
 void
 lcm_frag_buf_store_remove (lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf)
 {
     store->total_size -= fbuf->data_size;
-    g_hash_table_remove (store->frag_bufs, &fbuf->from);
+    _lru_unlink (store, fbuf);
+    _source_unlink (store, fbuf);
+    g_hash_table_remove (store->frag_bufs, &fbuf->key);
 }
 
 
@@ -169,16 +400,20 @@ lcm_buf_free_data(lcm_buf_t *lcmb, lcm_ringbuf_t *ringbuf)
             dbg(DBG_LCM, "Destroying unused orphan ringbuffer %p\n",
                     lcmb->ringbuf);
         }
+    } else if (lcmb->frag_pool) {
+        lcm_frag_pool_release (lcmb->frag_pool, lcmb->buf);
     } else {
         free (lcmb->buf);
     }
     lcmb->buf = NULL;
     lcmb->buf_size = 0;
     lcmb->ringbuf = NULL;
+    lcmb->frag_pool = NULL;
 }
 
 lcm_buf_t *
-lcm_buf_allocate_data(lcm_buf_queue_t * inbufs_empty, lcm_ringbuf_t **ringbuf) {
+lcm_buf_allocate_data_len(lcm_buf_queue_t * inbufs_empty,
+        lcm_ringbuf_t **ringbuf, unsigned int len) {
      lcm_buf_t * lcmb = NULL;
      // first allocate a buffer struct for the packet metadata
      if (lcm_buf_queue_is_empty(inbufs_empty)) {
@@ -194,8 +429,7 @@ lcm_buf_allocate_data(lcm_buf_queue_t * inbufs_empty, lcm_ringbuf_t **ringbuf) {
      assert(lcmb);
 
     // allocate space on the ringbuffer for the packet data.
-    // give it the maximum possible size for an unfragmented packet
-    lcmb->buf = lcm_ringbuf_alloc(*ringbuf, LCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+    lcmb->buf = lcm_ringbuf_alloc(*ringbuf, len);
     if (lcmb->buf == NULL) {
          // ringbuffer is full.  allocate a larger ringbuffer
 
@@ -208,18 +442,26 @@ lcm_buf_allocate_data(lcm_buf_queue_t * inbufs_empty, lcm_ringbuf_t **ringbuf) {
          unsigned int new_capacity = (unsigned int) (old_capacity * 1.5);
          // replace the passed in ringbuf with the new one
          *ringbuf = lcm_ringbuf_new(new_capacity);
-         lcmb->buf = lcm_ringbuf_alloc(*ringbuf, 65536);
+         lcmb->buf = lcm_ringbuf_alloc(*ringbuf, len);
          assert(lcmb->buf);
          dbg(DBG_LCM, "Allocated new ringbuffer size %u\n", new_capacity);
      }
      // save a pointer to the ringbuf, in case it gets replaced by another call
      lcmb->ringbuf = *ringbuf;
-
-     // zero the last byte so that strlen never segfaults
-     lcmb->buf[65535] = 0;
      return lcmb;
  }
 
+lcm_buf_t *
+lcm_buf_allocate_data(lcm_buf_queue_t * inbufs_empty, lcm_ringbuf_t **ringbuf) {
+    // give it the maximum possible size for an unfragmented packet
+    lcm_buf_t * lcmb = lcm_buf_allocate_data_len(inbufs_empty, ringbuf,
+            LCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+
+    // zero the last byte so that strlen never segfaults
+    lcmb->buf[LCM_MAX_UNFRAGMENTED_PACKET_SIZE - 1] = 0;
+    return lcmb;
+}
+
  void
 lcm_buf_queue_free (lcm_buf_queue_t * q, lcm_ringbuf_t *ringbuf)
 {
@@ -239,6 +481,64 @@ lcm_buf_queue_is_empty (lcm_buf_queue_t * q)
 
 
 
+/*** Lock-free single-producer / single-consumer buffer queue ***/
+lcm_buf_spsc_t *
+lcm_buf_spsc_new (unsigned int capacity)
+{
+    // one slot always stays unused, to tell a full queue from an empty one
+    unsigned int nslots = 2;
+    while (nslots < capacity + 1)
+        nslots <<= 1;
+
+    lcm_buf_spsc_t * q = (lcm_buf_spsc_t *) calloc (1, sizeof (lcm_buf_spsc_t));
+    q->slots = (lcm_buf_t **) calloc (nslots, sizeof (lcm_buf_t *));
+    q->mask = nslots - 1;
+    q->head = 0;
+    q->tail = 0;
+    return q;
+}
+
+void
+lcm_buf_spsc_free (lcm_buf_spsc_t * q)
+{
+    free (q->slots);
+    free (q);
+}
+
+int
+lcm_buf_spsc_push (lcm_buf_spsc_t * q, lcm_buf_t * el)
+{
+    int tail = q->tail;
+    int next = (tail + 1) & q->mask;
+    if (next == g_atomic_int_get (&q->head))
+        return -1;
+
+    q->slots[tail] = el;
+    // publish the slot contents before the new tail
+    g_atomic_int_set (&q->tail, next);
+    return 0;
+}
+
+lcm_buf_t *
+lcm_buf_spsc_pop (lcm_buf_spsc_t * q)
+{
+    int head = q->head;
+    if (head == g_atomic_int_get (&q->tail))
+        return NULL;
+
+    lcm_buf_t * el = q->slots[head];
+    // only give the slot back to the producer once it has been read
+    g_atomic_int_set (&q->head, (head + 1) & q->mask);
+    return el;
+}
+
+int
+lcm_buf_spsc_is_empty (lcm_buf_spsc_t * q)
+{
+    return g_atomic_int_get (&q->head) == g_atomic_int_get (&q->tail);
+}
+
+
 #ifdef __linux__
 static inline int _parse_inaddr(const char *addr_str, struct in_addr *addr)
 {
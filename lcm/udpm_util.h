@@ -30,6 +30,7 @@ typedef int SOCKET;
 #include <glib.h>
 
 #include "lcm.h"
+#include "lcm_internal.h"
 #include "ringbuffer.h"
 
 /************************* Important Defines *******************/
@@ -44,12 +45,20 @@ typedef int SOCKET;
 #define LCM_FRAGMENT_MAX_PAYLOAD 65487
 #endif
 
+#define LCM_MAX_UNFRAGMENTED_PACKET_SIZE 65536
+
 #define LCM_RINGBUF_SIZE (200*1024)
 
 #define LCM_DEFAULT_RECV_BUFS 2000
 
 #define MAX_FRAG_BUF_TOTAL_SIZE (1 << 24)// 16 megabytes
 #define MAX_NUM_FRAG_BUFS 1000
+// maximum number of messages that a single sender can have partially received
+// at once
+#define MAX_FRAG_BUFS_PER_SOURCE 8
+// partially received messages are dropped once no fragment has arrived for
+// them in this many microseconds
+#define MAX_FRAG_BUF_AGE_USEC 2000000
 
 // HUGE is not defined on cygwin as of 2008-03-05
 #ifndef HUGE
@@ -135,10 +144,24 @@ lcm_timestamp_now()
 }
 
 
+/******************** reassembly buffer pool **********************/
+// Recycles the buffers that fragmented messages are reassembled into, instead
+// of allocating one per message.  Sizes are rounded up to a power of two, and
+// released buffers are kept on a free list for their size class until
+// max_free_size bytes are cached.  Not thread safe.
+typedef struct _lcm_frag_pool lcm_frag_pool_t;
+
+lcm_frag_pool_t * lcm_frag_pool_new(uint32_t max_free_size);
+void lcm_frag_pool_destroy(lcm_frag_pool_t * pool);
+char * lcm_frag_pool_alloc(lcm_frag_pool_t * pool, uint32_t size);
+void lcm_frag_pool_release(lcm_frag_pool_t * pool, char * data);
+
+
 /******************** message buffer **********************/
 typedef struct _lcm_buf {
     char  channel_name[LCM_MAX_CHANNEL_NAME_LENGTH+1];
     int   channel_size;      // length of channel name
+    lcm_channel_t *chan;     // channel record, looked up once per message
 
     int64_t recv_utime;      // timestamp of first datagram receipt
     char *buf;               // pointer to beginning of message.  This includes
@@ -149,6 +172,7 @@ typedef struct _lcm_buf {
     int   data_size;         // size of payload
     lcm_ringbuf_t *ringbuf;  // the ringbuffer used to allocate buf.  NULL if
                              // not allocated from ringbuf
+    lcm_frag_pool_t *frag_pool; // the pool used to allocate buf, if any
 
     int   packet_size;       // total bytes received
     int   buf_size;          // bytes allocated
@@ -180,41 +204,117 @@ int lcm_buf_queue_is_empty(lcm_buf_queue_t * q);
 lcm_buf_t *
 lcm_buf_allocate_data(lcm_buf_queue_t * inbufs_empty, lcm_ringbuf_t **ringbuf);
 
+// same as lcm_buf_allocate_data(), but only allocates len bytes from the
+// ringbuf.  Used when the packet size is already known, e.g., for packets
+// received in batches outside of the ringbuf.
+lcm_buf_t *
+lcm_buf_allocate_data_len(lcm_buf_queue_t * inbufs_empty,
+        lcm_ringbuf_t **ringbuf, unsigned int len);
+
 void lcm_buf_free_data(lcm_buf_t *lcmb, lcm_ringbuf_t *ringbuf);
 
+/******* Lock-free queue of message buffers *******/
+// Bounded queue for handing lcm_buf_t structs from exactly one producer thread
+// to exactly one consumer thread without any locks.  Each side only ever
+// writes its own index, so the two threads don't contend for a cache line
+// unless the queue is empty or full.
+typedef struct _lcm_buf_spsc {
+    lcm_buf_t ** slots;
+    unsigned int mask;       // number of slots - 1.  A power of two.
+    char pad0[64];
+    volatile int head;       // next slot to read.  Written by consumer only.
+    char pad1[64];
+    volatile int tail;       // next slot to write.  Written by producer only.
+    char pad2[64];
+} lcm_buf_spsc_t;
+
+// creates a queue that can hold at least capacity elements
+lcm_buf_spsc_t * lcm_buf_spsc_new(unsigned int capacity);
+// frees the queue, but not the buffers remaining in it
+void lcm_buf_spsc_free(lcm_buf_spsc_t * q);
+// returns 0 on success, or -1 if the queue is full.  Producer only.
+int lcm_buf_spsc_push(lcm_buf_spsc_t * q, lcm_buf_t * el);
+// returns NULL if the queue is empty.  Consumer only.
+lcm_buf_t * lcm_buf_spsc_pop(lcm_buf_spsc_t * q);
+int lcm_buf_spsc_is_empty(lcm_buf_spsc_t * q);
+
 /******************** fragment buffer **********************/
+// identifies a fragmented message: its sender and sequence number
+typedef struct _lcm_frag_key {
+    struct    sockaddr_in from;
+    uint32_t  msg_seqno;
+} lcm_frag_key_t;
+
+typedef struct _lcm_frag_source lcm_frag_source_t;
+
 typedef struct _lcm_frag_buf {
     char      channel[LCM_MAX_CHANNEL_NAME_LENGTH+1];
-    struct    sockaddr_in from;
+    lcm_channel_t *chan;
+    lcm_frag_key_t key;
     char      *data;
+    lcm_frag_pool_t *pool;   // the pool used to allocate data, if any
     uint32_t  data_size;
     uint16_t  fragments_remaining;
-    uint32_t  msg_seqno;
     int64_t   last_packet_utime;
+
+    // neighbors in the store's list of fragment buffers, ordered from least
+    // to most recently updated
+    struct _lcm_frag_buf *lru_prev;
+    struct _lcm_frag_buf *lru_next;
+
+    // the sender, and neighbors in its list of fragment buffers, ordered from
+    // oldest to newest message
+    lcm_frag_source_t *source;
+    struct _lcm_frag_buf *src_prev;
+    struct _lcm_frag_buf *src_next;
 } lcm_frag_buf_t;
 
-lcm_frag_buf_t * lcm_frag_buf_new(struct sockaddr_in from, const char *channel,
+// allocates data from pool, or with malloc() if pool is NULL
+lcm_frag_buf_t * lcm_frag_buf_new(lcm_frag_pool_t *pool,
+        struct sockaddr_in from, const char *channel,
         uint32_t msg_seqno, uint32_t data_size, uint16_t nfragments,
         int64_t first_packet_utime);
 void lcm_frag_buf_destroy(lcm_frag_buf_t *fbuf);
 
 
 /******************** fragment buffer store **********************/
+// Fragment buffers are looked up by sender and sequence number, so a sender
+// can have several messages in flight at once, e.g., when it publishes large
+// messages from more than one thread.
 typedef struct _lcm_frag_buf_store {
     uint32_t total_size;
     uint32_t max_total_size;
     uint32_t max_n_frag_bufs;
-    GHashTable *frag_bufs;
+    uint32_t max_n_frag_bufs_per_source;
+    int64_t max_age_usec;
+    GHashTable *frag_bufs;   // lcm_frag_key_t -> lcm_frag_buf_t
+    GHashTable *sources;     // struct sockaddr_in -> lcm_frag_source_t
+
+    lcm_frag_buf_t *lru_head;   // least recently updated
+    lcm_frag_buf_t *lru_tail;   // most recently updated
+
+    uint64_t n_evicted;  // incomplete messages dropped to make room
+    uint64_t n_expired;  // incomplete messages dropped after max_age_usec
 } lcm_frag_buf_store;
 
 lcm_frag_buf_store * lcm_frag_buf_store_new(uint32_t max_total_size,
-        uint32_t max_n_frag_bufs);
+        uint32_t max_n_frag_bufs, uint32_t max_n_frag_bufs_per_source,
+        int64_t max_age_usec);
 void lcm_frag_buf_store_destroy(lcm_frag_buf_store * store);
 lcm_frag_buf_t * lcm_frag_buf_store_lookup(lcm_frag_buf_store * store,
-        struct sockaddr* key);
+        const struct sockaddr* from, uint32_t msg_seqno);
 
 void lcm_frag_buf_store_remove(lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf);
+// adds a fragment buffer, making room for it first by evicting the least
+// recently updated ones, and expiring the stale ones.  If its sender already
+// has max_n_frag_bufs_per_source messages in flight, the oldest of those is
+// evicted too.
 void lcm_frag_buf_store_add(lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf);
+// records that a fragment was received for fbuf at utime
+void lcm_frag_buf_store_touch(lcm_frag_buf_store *store, lcm_frag_buf_t *fbuf,
+        int64_t utime);
+// drops the fragment buffers that haven't been updated in max_age_usec
+void lcm_frag_buf_store_expire(lcm_frag_buf_store *store, int64_t now);
 
 
 /************************* Linux Specific Functions *******************/
@@ -0,0 +1,231 @@
+// Measures udpm receive throughput and CPU cost per packet with and without
+// recvmmsg() batching (the recv_batch provider argument).
+//
+// For each batch size, a child process publishes a burst of small messages
+// on a private multicast port while this process receives them.  CPU time is
+// taken from getrusage() of the receiving process only, so it covers the LCM
+// read thread plus the lcm_handle() loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <lcm/lcm.h>
+
+#define BENCH_CHANNEL "UDPM_BENCH"
+#define BENCH_DONE_CHANNEL "UDPM_BENCH_DONE"
+
+typedef struct {
+    int num_received;
+    int done;
+} bench_state_t;
+
+static double
+timeval_to_sec(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static double
+now_sec(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return timeval_to_sec(&tv);
+}
+
+static double
+cpu_sec(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return timeval_to_sec(&ru.ru_utime) + timeval_to_sec(&ru.ru_stime);
+}
+
+static void
+on_msg(const lcm_recv_buf_t *rbuf, const char *channel, void *user)
+{
+    bench_state_t *state = (bench_state_t *) user;
+    state->num_received++;
+}
+
+static void
+on_done(const lcm_recv_buf_t *rbuf, const char *channel, void *user)
+{
+    bench_state_t *state = (bench_state_t *) user;
+    state->done = 1;
+}
+
+static void
+run_sender(const char *addr, int go_fd, int num_msgs, int msg_size)
+{
+    // wait for the receiver to get ready
+    char go;
+    if (read(go_fd, &go, 1) != 1)
+        _exit(1);
+
+    char url[256];
+    snprintf(url, sizeof(url), "udpm://%s?ttl=0", addr);
+    lcm_t *lcm = lcm_create(url);
+    if (!lcm)
+        _exit(1);
+
+    char *data = (char *) calloc(1, msg_size);
+    int i;
+    for (i = 0; i < num_msgs; i++) {
+        lcm_publish(lcm, BENCH_CHANNEL, data, msg_size);
+    }
+    // the done message may itself be dropped, so send it a few times
+    for (i = 0; i < 10; i++) {
+        lcm_publish(lcm, BENCH_DONE_CHANNEL, data, 0);
+        usleep(10000);
+    }
+    free(data);
+    lcm_destroy(lcm);
+    _exit(0);
+}
+
+static int
+run_trial(const char *addr, int recv_batch, int num_msgs, int msg_size)
+{
+    char url[256];
+    snprintf(url, sizeof(url),
+            "udpm://%s?ttl=0&recv_buf_size=8388608&recv_batch=%d",
+            addr, recv_batch);
+
+    // fork the sender before the receiver starts any threads
+    int go_pipe[2];
+    if (pipe(go_pipe) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        close(go_pipe[1]);
+        run_sender(addr, go_pipe[0], num_msgs, msg_size);
+    }
+    close(go_pipe[0]);
+
+    lcm_t *lcm = lcm_create(url);
+    if (!lcm) {
+        fprintf(stderr, "couldn't create LCM instance for %s\n", url);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    bench_state_t state;
+    memset(&state, 0, sizeof(state));
+    lcm_subscription_t *sub = lcm_subscribe(lcm, BENCH_CHANNEL, on_msg, &state);
+    lcm_subscription_set_queue_capacity(sub, 0);
+    lcm_subscribe(lcm, BENCH_DONE_CHANNEL, on_done, &state);
+
+    // make sure the receive thread is running before the sender starts
+    lcm_get_fileno(lcm);
+
+    double cpu_start = cpu_sec();
+    double wall_start = now_sec();
+
+    if (write(go_pipe[1], "+", 1) != 1)
+        perror("write");
+    close(go_pipe[1]);
+
+    while (!state.done) {
+        if (lcm_handle_timeout(lcm, 2000) <= 0)
+            break;
+    }
+
+    double wall = now_sec() - wall_start;
+    double cpu = cpu_sec() - cpu_start;
+    waitpid(pid, NULL, 0);
+
+    int n = state.num_received;
+    printf("%10d %10d %9.1f%% %12.0f %12.3f\n",
+            recv_batch, n, 100.0 * (num_msgs - n) / num_msgs,
+            n / wall, n ? cpu * 1e6 / n : 0.0);
+
+    lcm_destroy(lcm);
+    return 0;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "\n"
+            "Compares udpm receive throughput and CPU time per packet for\n"
+            "several recv_batch settings.\n"
+            "\n"
+            "  -a, --addr ADDR:PORT   multicast group (default 239.255.76.67:7671)\n"
+            "  -n, --count N          messages per trial (default 200000)\n"
+            "  -s, --size N           message payload size (default 64)\n"
+            "  -b, --batch N          recv_batch setting to compare (default 16)\n"
+            "  -h, --help             show this help text and exit\n",
+            progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *addr = "239.255.76.67:7671";
+    int num_msgs = 200000;
+    int msg_size = 64;
+    int batch = 16;
+
+    struct option long_opts[] = {
+        { "addr", required_argument, 0, 'a' },
+        { "count", required_argument, 0, 'n' },
+        { "size", required_argument, 0, 's' },
+        { "batch", required_argument, 0, 'b' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "a:n:s:b:h", long_opts, 0)) >= 0) {
+        switch (c) {
+            case 'a':
+                addr = optarg;
+                break;
+            case 'n':
+                num_msgs = atoi(optarg);
+                break;
+            case 's':
+                msg_size = atoi(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (num_msgs <= 0 || msg_size < 0 || batch < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%d messages of %d bytes per trial\n\n", num_msgs, msg_size);
+    printf("%10s %10s %10s %12s %12s\n",
+            "recv_batch", "received", "lost", "msgs/s", "cpu us/msg");
+
+    if (run_trial(addr, 1, num_msgs, msg_size) < 0)
+        return 1;
+    if (batch > 1 && run_trial(addr, batch, num_msgs, msg_size) < 0)
+        return 1;
+
+    return 0;
+}
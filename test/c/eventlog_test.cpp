@@ -1,5 +1,11 @@
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+#include <string>
 #include <gtest/gtest.h>
 
 #include <lcm/lcm.h>
@@ -128,3 +134,854 @@ TEST(LCM_C, EventLogCorrupt) {
     lcm_eventlog_destroy(rlog);
     free_tmpnam(fname);
 }
+
+#ifndef WIN32
+TEST(LCM_C, EventLogReader) {
+    // Write some events to a log, then read them back through a memory
+    // mapping.
+    char* fname = make_tmpnam();
+
+    lcm_eventlog_t* wlog = lcm_eventlog_create(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    const char* channel = "CHANNEL_TEST";
+    const int channellen = strlen(channel);
+    char data[300];
+
+    lcm_eventlog_event_t event;
+    event.channellen = channellen;
+    event.channel = const_cast<char*>(channel);
+    event.data = data;
+
+    const int num_events = 100;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        event.timestamp = event_num * 1000;
+        event.datalen = event_num * 3;
+        memset(data, event_num, event.datalen);
+        EXPECT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+    lcm_eventlog_destroy(wlog);
+
+    lcm_eventlog_reader_t* reader = lcm_eventlog_reader_create(fname);
+    ASSERT_NE((void*)NULL, reader);
+
+    lcm_eventlog_view_t view;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        ASSERT_EQ(0, lcm_eventlog_reader_next(reader, &view));
+        EXPECT_EQ(event_num, view.eventnum);
+        EXPECT_EQ(event_num * 1000, view.timestamp);
+        ASSERT_EQ(channellen, view.channellen);
+        EXPECT_EQ(0, memcmp(channel, view.channel, channellen));
+        ASSERT_EQ(event_num * 3, view.datalen);
+
+        bool bytes_match = true;
+        for (int byte_num = 0; byte_num < view.datalen; ++byte_num) {
+            bytes_match &= ((const char*)view.data)[byte_num] == event_num;
+        }
+        EXPECT_TRUE(bytes_match);
+    }
+    EXPECT_EQ(-1, lcm_eventlog_reader_next(reader, &view));
+
+    // Seeking lands on an event near the requested time.
+    EXPECT_EQ(0, lcm_eventlog_reader_seek_to_timestamp(reader, 50000));
+    ASSERT_EQ(0, lcm_eventlog_reader_next(reader, &view));
+    EXPECT_NEAR(50000, view.timestamp, 2000);
+    EXPECT_EQ(view.timestamp / 1000, view.eventnum);
+
+    lcm_eventlog_reader_destroy(reader);
+    free_tmpnam(fname);
+}
+#endif
+
+#ifndef WIN32
+TEST(LCM_C, EventLogIndex) {
+    // Write a log with an index, with timestamps out of order, then seek in
+    // it by time, event number and channel.
+    char* fname = make_tmpnam();
+
+    lcm_eventlog_t* wlog = lcm_eventlog_create_with_index(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    const char* channels[] = { "CHANNEL_A", "CHANNEL_B", "CHANNEL_C" };
+    char data[100];
+    memset(data, 0, sizeof(data));
+
+    lcm_eventlog_event_t event;
+    event.data = data;
+
+    // Timestamps go 0, 1000, ..., 49000, then back to 500, 1500, ...
+    const int num_events = 100;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        event.timestamp = (event_num % 50) * 1000 + (event_num / 50) * 500;
+        event.channel = const_cast<char*>(channels[event_num % 3]);
+        event.channellen = strlen(event.channel);
+        event.datalen = event_num;
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+    lcm_eventlog_destroy(wlog);
+
+    lcm_eventlog_index_t* index = lcm_eventlog_index_open(fname);
+    ASSERT_NE((void*)NULL, index);
+    EXPECT_EQ(num_events, lcm_eventlog_index_size(index));
+    int64_t count = 0;
+    const int64_t* offsets =
+        lcm_eventlog_index_channel_offsets(index, "CHANNEL_B", &count);
+    EXPECT_EQ(33, count);
+    for (int i = 1; i < count; ++i) {
+        EXPECT_LT(offsets[i - 1], offsets[i]);
+    }
+    EXPECT_EQ((void*)NULL,
+              lcm_eventlog_index_channel_offsets(index, "NONE", &count));
+    EXPECT_EQ(0, count);
+    lcm_eventlog_index_close(index);
+
+    lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+
+    // Seeking by time is exact, even though timestamps aren't in order.
+    EXPECT_EQ(0, lcm_eventlog_seek_to_timestamp(rlog, 20100));
+    lcm_eventlog_event_t* revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(20500, revent->timestamp);
+    EXPECT_EQ(70, revent->eventnum);
+    lcm_eventlog_free_event(revent);
+
+    EXPECT_EQ(0, lcm_eventlog_seek_to_eventnum(rlog, 42));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(42, revent->eventnum);
+    lcm_eventlog_free_event(revent);
+    EXPECT_EQ(-1, lcm_eventlog_seek_to_eventnum(rlog, num_events));
+
+    // The next event on a channel after event 42 is event 44.
+    EXPECT_EQ(0, lcm_eventlog_seek_to_channel(rlog, "CHANNEL_C"));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(44, revent->eventnum);
+    EXPECT_STREQ("CHANNEL_C", revent->channel);
+    lcm_eventlog_free_event(revent);
+    lcm_eventlog_destroy(rlog);
+
+    // Appending extends the index.
+    wlog = lcm_eventlog_create_with_index(fname, "a");
+    ASSERT_NE((void*)NULL, wlog);
+    event.timestamp = 100000;
+    EXPECT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    lcm_eventlog_destroy(wlog);
+
+    index = lcm_eventlog_index_open(fname);
+    ASSERT_NE((void*)NULL, index);
+    EXPECT_EQ(num_events + 1, lcm_eventlog_index_size(index));
+    int64_t last = lcm_eventlog_index_find_timestamp(index, 100000);
+    EXPECT_GT(last, 0);
+    EXPECT_EQ(-1, lcm_eventlog_index_find_timestamp(index, 100001));
+    lcm_eventlog_index_close(index);
+
+    // A rebuilt index is the same as the one written along with the log.
+    char* index_fname = (char*)malloc(strlen(fname) + 5);
+    sprintf(index_fname, "%s.idx", fname);
+    FILE* f = fopen(index_fname, "rb");
+    ASSERT_NE((void*)NULL, f);
+    char written[8192];
+    size_t written_size = fread(written, 1, sizeof(written), f);
+    fclose(f);
+
+    EXPECT_EQ(num_events + 1, lcm_eventlog_index_build(fname));
+    f = fopen(index_fname, "rb");
+    ASSERT_NE((void*)NULL, f);
+    char rebuilt[8192];
+    size_t rebuilt_size = fread(rebuilt, 1, sizeof(rebuilt), f);
+    fclose(f);
+    ASSERT_EQ(written_size, rebuilt_size);
+    EXPECT_EQ(0, memcmp(written, rebuilt, written_size));
+
+    // Overwriting the log removes its index.
+    wlog = lcm_eventlog_create(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+    lcm_eventlog_destroy(wlog);
+    EXPECT_EQ((void*)NULL, fopen(index_fname, "rb"));
+
+    free(index_fname);
+    free_tmpnam(fname);
+}
+
+TEST(LCM_C, EventLogIndexFlushAndVerify) {
+    char* fname = make_tmpnam();
+    lcm_eventlog_t* wlog = lcm_eventlog_create_with_index(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+    EXPECT_LE(0, lcm_eventlog_index_fileno(wlog));
+
+    const char* channels[] = { "CHANNEL_A", "CHANNEL_B" };
+    lcm_eventlog_event_t event;
+    event.data = NULL;
+    event.datalen = 0;
+    const int num_events = 10;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        event.timestamp = event_num;
+        event.channel = const_cast<char*>(channels[event_num % 2]);
+        event.channellen = strlen(event.channel);
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+
+    // Flushing the log flushes its index too, so that readers of a log that
+    // is still being written see the index of the events written so far.
+    ASSERT_EQ(0, lcm_eventlog_flush(wlog));
+    lcm_eventlog_index_t* index = lcm_eventlog_index_open(fname);
+    ASSERT_NE((void*)NULL, index);
+    EXPECT_EQ(num_events, lcm_eventlog_index_size(index));
+    int64_t count = 0;
+    int64_t offset =
+        lcm_eventlog_index_channel_offsets(index, "CHANNEL_B", &count)[0];
+    lcm_eventlog_index_close(index);
+    lcm_eventlog_destroy(wlog);
+
+    // Rename the channel of event 1, as if its name had the same hash as
+    // CHANNEL_B.  Seeking to the channel skips it.
+    FILE* f = fopen(fname, "r+b");
+    ASSERT_NE((void*)NULL, f);
+    fseek(f, offset + 28 + strlen("CHANNEL_"), SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+
+    lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    EXPECT_EQ(0, lcm_eventlog_seek_to_channel(rlog, "CHANNEL_B"));
+    lcm_eventlog_event_t* revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(3, revent->eventnum);
+    EXPECT_STREQ("CHANNEL_B", revent->channel);
+    lcm_eventlog_free_event(revent);
+    lcm_eventlog_destroy(rlog);
+
+    free_tmpnam(fname);
+}
+#endif
+
+#ifndef WIN32
+static int
+is_channel_b(const char* channel, void* user)
+{
+    ++*(int*)user;
+    return !strcmp(channel, "CHANNEL_B");
+}
+
+static void
+count_handler(const lcm_recv_buf_t* rbuf, const char* channel, void* user)
+{
+    ++*(int*)user;
+}
+
+TEST(LCM_C, EventLogFiltered) {
+    // Read only the events on one channel, with and without an index.
+    char* fname = make_tmpnam();
+    const char* channels[] = { "CHANNEL_A", "CHANNEL_B", "CHANNEL_C" };
+    char data[100];
+    memset(data, 0, sizeof(data));
+    const int num_events = 99;
+
+    for (int with_index = 0; with_index < 2; ++with_index) {
+        lcm_eventlog_t* wlog = with_index ?
+            lcm_eventlog_create_with_index(fname, "w") :
+            lcm_eventlog_create(fname, "w");
+        ASSERT_NE((void*)NULL, wlog);
+        lcm_eventlog_event_t event;
+        event.data = data;
+        for (int event_num = 0; event_num < num_events; ++event_num) {
+            event.timestamp = event_num;
+            event.channel = const_cast<char*>(channels[event_num % 3]);
+            event.channellen = strlen(event.channel);
+            event.datalen = event_num;
+            ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+        }
+        lcm_eventlog_destroy(wlog);
+
+        // stdio
+        lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+        ASSERT_NE((void*)NULL, rlog);
+        int filter_calls = 0;
+        for (int event_num = 1; event_num < num_events; event_num += 3) {
+            lcm_eventlog_event_t* revent = lcm_eventlog_read_next_event_filtered(
+                    rlog, is_channel_b, &filter_calls);
+            ASSERT_NE((void*)NULL, revent);
+            EXPECT_EQ(event_num, revent->eventnum);
+            EXPECT_EQ(event_num, revent->datalen);
+            EXPECT_STREQ("CHANNEL_B", revent->channel);
+            lcm_eventlog_free_event(revent);
+        }
+        EXPECT_EQ((void*)NULL, lcm_eventlog_read_next_event_filtered(
+                    rlog, is_channel_b, &filter_calls));
+        EXPECT_LE(num_events, filter_calls);
+        lcm_eventlog_destroy(rlog);
+
+        // memory mapped
+        lcm_eventlog_reader_t* reader = lcm_eventlog_reader_create(fname);
+        ASSERT_NE((void*)NULL, reader);
+        lcm_eventlog_view_t view;
+        for (int event_num = 1; event_num < num_events; event_num += 3) {
+            ASSERT_EQ(0, lcm_eventlog_reader_next_filtered(reader, &view,
+                        is_channel_b, &filter_calls));
+            EXPECT_EQ(event_num, view.eventnum);
+            EXPECT_EQ(event_num, view.datalen);
+            EXPECT_EQ(0, memcmp("CHANNEL_B", view.channel, view.channellen));
+        }
+        EXPECT_EQ(-1, lcm_eventlog_reader_next_filtered(reader, &view,
+                    is_channel_b, &filter_calls));
+        lcm_eventlog_reader_destroy(reader);
+
+        // The log provider only hands out events that have subscribers.
+        char url[1024];
+        snprintf(url, sizeof(url), "file://%s?speed=0&skip_unsubscribed=true",
+                 fname);
+        lcm_t* lcm = lcm_create(url);
+        ASSERT_NE((void*)NULL, lcm);
+        int handled = 0;
+        lcm_subscribe(lcm, "CHANNEL_C", count_handler, &handled);
+        int handle_calls = 0;
+        while (0 == lcm_handle(lcm))
+            ++handle_calls;
+        EXPECT_EQ(num_events / 3, handled);
+        EXPECT_EQ(num_events / 3, handle_calls);
+        lcm_destroy(lcm);
+    }
+
+    lcm_eventlog_destroy(lcm_eventlog_create(fname, "w"));
+    free_tmpnam(fname);
+}
+#endif
+
+typedef struct {
+    int num_handled;
+    int in_order;
+} readahead_state_t;
+
+static void
+readahead_handler(const lcm_recv_buf_t* rbuf, const char* channel, void* user)
+{
+    readahead_state_t* state = (readahead_state_t*)user;
+    // each message holds its own sequence number, repeated
+    bool ok = rbuf->data_size == state->num_handled % 300;
+    for (uint32_t i = 0; ok && i < rbuf->data_size; ++i) {
+        ok = ((const uint8_t*)rbuf->data)[i] == (uint8_t)state->num_handled;
+    }
+    state->in_order &= ok;
+    state->num_handled++;
+}
+
+TEST(LCM_C, LogProviderReadahead) {
+    // Play back a log with a read-ahead buffer much smaller than the log.
+    char* fname = make_tmpnam();
+    lcm_eventlog_t* wlog = lcm_eventlog_create(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    const int num_events = 2000;
+    char data[300];
+    lcm_eventlog_event_t event;
+    event.channel = const_cast<char*>("READAHEAD");
+    event.channellen = strlen(event.channel);
+    event.data = data;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        event.timestamp = event_num;
+        event.datalen = event_num % 300;
+        memset(data, (uint8_t)event_num, event.datalen);
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+    lcm_eventlog_destroy(wlog);
+
+    for (int skip = 0; skip < 2; ++skip) {
+        char url[1024];
+        snprintf(url, sizeof(url),
+                 "file://%s?speed=0&readahead_mb=0.01&skip_unsubscribed=%d",
+                 fname, skip);
+        lcm_t* lcm = lcm_create(url);
+        ASSERT_NE((void*)NULL, lcm);
+        readahead_state_t state = { 0, 1 };
+        lcm_subscribe(lcm, "READAHEAD", readahead_handler, &state);
+        while (0 == lcm_handle(lcm)) {
+        }
+        EXPECT_EQ(num_events, state.num_handled);
+        EXPECT_TRUE(state.in_order);
+        lcm_destroy(lcm);
+    }
+
+    free_tmpnam(fname);
+}
+
+TEST(LCM_C, LogProviderFastReplay) {
+    // Play back a log as fast as possible, in batches, with and without
+    // reading ahead.
+    char* fname = make_tmpnam();
+    lcm_eventlog_t* wlog = lcm_eventlog_create(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    const int num_events = 1000;
+    char data[300];
+    lcm_eventlog_event_t event;
+    event.channel = const_cast<char*>("READAHEAD");
+    event.channellen = strlen(event.channel);
+    event.data = data;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        // timestamps an hour apart would take forever in real time
+        event.timestamp = (int64_t)event_num * 3600000000LL;
+        event.datalen = event_num % 300;
+        memset(data, (uint8_t)event_num, event.datalen);
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+    lcm_eventlog_destroy(wlog);
+
+    for (int readahead = 0; readahead < 2; ++readahead) {
+        char url[1024];
+        snprintf(url, sizeof(url), "file://%s?speed=0&readahead_mb=%d",
+                 fname, readahead);
+        lcm_t* lcm = lcm_create(url);
+        ASSERT_NE((void*)NULL, lcm);
+        readahead_state_t state = { 0, 1 };
+        lcm_subscribe(lcm, "READAHEAD", readahead_handler, &state);
+        int num_batches = 0;
+        int status;
+        while ((status = lcm_handle_batch(lcm, 100, 1000)) > 0) {
+            EXPECT_GE(100, status);
+            num_batches++;
+        }
+        EXPECT_EQ(-1, status);
+        EXPECT_EQ(num_events, state.num_handled);
+        EXPECT_TRUE(state.in_order);
+        EXPECT_GE(num_events / 100 + 1, num_batches);
+
+        lcm_stats_t stats;
+        stats.size = sizeof(stats);
+        ASSERT_EQ(0, lcm_get_stats(lcm, &stats));
+        EXPECT_EQ(num_events, stats.packets_received);
+        EXPECT_EQ(num_events, stats.messages_dispatched);
+        uint64_t num_bytes = 0;
+        for (int event_num = 0; event_num < num_events; ++event_num) {
+            num_bytes += event_num % 300;
+        }
+        EXPECT_EQ(num_bytes, stats.bytes_received);
+        lcm_destroy(lcm);
+    }
+
+    free_tmpnam(fname);
+}
+
+#if defined(LCM_HAVE_ZLIB) && !defined(WIN32)
+TEST(LCM_C, EventLogCompressed) {
+    // Write a compressed log that spans several blocks, then read it back,
+    // seek in it and append to it.
+    char* fname = make_tmpnam();
+    lcm_eventlog_t* wlog = lcm_eventlog_create_compressed(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    const char* channels[] = { "CHANNEL_A", "CHANNEL_B", "CHANNEL_C" };
+    const int num_events = 3000;
+    char data[1000];
+    lcm_eventlog_event_t event;
+    event.data = data;
+    for (int event_num = 0; event_num < num_events; ++event_num) {
+        event.timestamp = event_num * 1000;
+        event.channel = const_cast<char*>(channels[event_num % 3]);
+        event.channellen = strlen(event.channel);
+        event.datalen = event_num % 1000;
+        memset(data, (uint8_t)event_num, event.datalen);
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+        EXPECT_EQ(event_num, event.eventnum);
+    }
+    lcm_eventlog_destroy(wlog);
+
+    FILE* f = fopen(fname, "rb");
+    ASSERT_NE((void*)NULL, f);
+    fseek(f, 0, SEEK_END);
+    long compressed_size = ftell(f);
+    fclose(f);
+    EXPECT_GT(num_events * 500, compressed_size);
+    EXPECT_EQ((void*)NULL, lcm_eventlog_reader_create(fname));
+
+    lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    lcm_eventlog_event_t* revent;
+    int num_read = 0;
+    while ((revent = lcm_eventlog_read_next_event(rlog))) {
+        EXPECT_EQ(num_read, revent->eventnum);
+        EXPECT_EQ(num_read * 1000, revent->timestamp);
+        EXPECT_STREQ(channels[num_read % 3], revent->channel);
+        ASSERT_EQ(num_read % 1000, revent->datalen);
+        for (int i = 0; i < revent->datalen; ++i) {
+            ASSERT_EQ((uint8_t)num_read, ((uint8_t*)revent->data)[i]);
+        }
+        lcm_eventlog_free_event(revent);
+        num_read++;
+    }
+    EXPECT_EQ(num_events, num_read);
+
+    EXPECT_EQ(0, lcm_eventlog_seek_to_timestamp(rlog, 2500500));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(2501, revent->eventnum);
+    lcm_eventlog_free_event(revent);
+
+    EXPECT_EQ(0, lcm_eventlog_seek_to_eventnum(rlog, 1234));
+    EXPECT_EQ(-1, lcm_eventlog_seek_to_eventnum(rlog, num_events));
+    EXPECT_EQ(-1, lcm_eventlog_seek_to_channel(rlog, "NONE"));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(1234, revent->eventnum);
+    lcm_eventlog_free_event(revent);
+
+    EXPECT_EQ(0, lcm_eventlog_seek_to_channel(rlog, "CHANNEL_A"));
+    int filter_calls = 0;
+    revent = lcm_eventlog_read_next_event_filtered(rlog, is_channel_b,
+                                                   &filter_calls);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(1237, revent->eventnum);
+    EXPECT_EQ(2, filter_calls);
+    lcm_eventlog_free_event(revent);
+    lcm_eventlog_destroy(rlog);
+
+    // Appending keeps the log compressed, and carries on numbering events.
+    wlog = lcm_eventlog_create(fname, "a");
+    ASSERT_NE((void*)NULL, wlog);
+    event.timestamp = num_events * 1000;
+    ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    EXPECT_EQ(num_events, event.eventnum);
+    lcm_eventlog_destroy(wlog);
+
+    // A log that wasn't closed has no block index, but is still readable.
+    f = fopen(fname, "rb");
+    ASSERT_NE((void*)NULL, f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* contents = (char*)malloc(size);
+    ASSERT_EQ(1, fread(contents, size, 1, f));
+    fclose(f);
+    f = fopen(fname, "wb");
+    ASSERT_NE((void*)NULL, f);
+    ASSERT_EQ(1, fwrite(contents, size - 30, 1, f));
+    fclose(f);
+    free(contents);
+
+    rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    EXPECT_EQ(0, lcm_eventlog_seek_to_eventnum(rlog, num_events));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(num_events, revent->eventnum);
+    lcm_eventlog_free_event(revent);
+    EXPECT_EQ((void*)NULL, lcm_eventlog_read_next_event(rlog));
+    lcm_eventlog_destroy(rlog);
+
+    // Log playback reads compressed logs too.
+    char url[1024];
+    snprintf(url, sizeof(url), "file://%s?speed=0", fname);
+    lcm_t* lcm = lcm_create(url);
+    ASSERT_NE((void*)NULL, lcm);
+    readahead_state_t state = { 0, 1 };
+    lcm_subscribe(lcm, ".*", readahead_handler, &state);
+    while (0 == lcm_handle(lcm)) {
+    }
+    EXPECT_EQ(num_events + 1, state.num_handled);
+    lcm_destroy(lcm);
+
+    free_tmpnam(fname);
+
+    // Flushing writes out a partial block, so that the log can be read while
+    // it is still being written.
+    fname = make_tmpnam();
+    wlog = lcm_eventlog_create_compressed(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+    event.timestamp = 42;
+    event.channel = const_cast<char*>("FLUSHED");
+    event.channellen = strlen(event.channel);
+    event.datalen = 10;
+    memset(data, 7, event.datalen);
+    ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    ASSERT_EQ(0, lcm_eventlog_flush(wlog));
+
+    rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(0, revent->eventnum);
+    EXPECT_EQ(42, revent->timestamp);
+    EXPECT_STREQ("FLUSHED", revent->channel);
+    EXPECT_EQ(10, revent->datalen);
+    lcm_eventlog_free_event(revent);
+    EXPECT_EQ((void*)NULL, lcm_eventlog_read_next_event(rlog));
+    lcm_eventlog_destroy(rlog);
+
+    // the next event goes into a new block
+    event.timestamp = 43;
+    ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    lcm_eventlog_destroy(wlog);
+
+    rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    int num_flushed = 0;
+    while ((revent = lcm_eventlog_read_next_event(rlog))) {
+        EXPECT_EQ(num_flushed, revent->eventnum);
+        EXPECT_EQ(42 + num_flushed, revent->timestamp);
+        lcm_eventlog_free_event(revent);
+        num_flushed++;
+    }
+    EXPECT_EQ(2, num_flushed);
+    lcm_eventlog_destroy(rlog);
+
+    free_tmpnam(fname);
+}
+#endif
+
+#ifndef WIN32
+static char batch_data[5000 + 256];
+
+static void
+write_batch_log(const char* fname, const char* mode, int direct_io,
+                int first_event, int num_events)
+{
+    lcm_eventlog_t* wlog = lcm_eventlog_create_with_index(fname, mode);
+    ASSERT_NE((void*)NULL, wlog);
+    if (direct_io && 0 != lcm_eventlog_enable_direct_io(wlog)) {
+        // not supported by the file system of the temporary directory
+        printf("Direct I/O is not available\n");
+    }
+
+    lcm_eventlog_event_t events[100];
+    lcm_eventlog_event_t* batch[100];
+    int event_num = first_event;
+    while (event_num < first_event + num_events) {
+        // batches of varying sizes, and a single event in between
+        int n = event_num % 100 + 1;
+        if (n > first_event + num_events - event_num) {
+            n = first_event + num_events - event_num;
+        }
+        for (int i = 0; i < n; ++i, ++event_num) {
+            events[i].timestamp = event_num;
+            events[i].channel = const_cast<char*>("BATCH");
+            events[i].channellen = 5;
+            events[i].datalen = event_num * 7 % 5000;
+            events[i].data = batch_data + event_num % 256;
+            batch[i] = &events[i];
+        }
+        ASSERT_EQ(n, lcm_eventlog_write_events(wlog, batch, n));
+        EXPECT_EQ(event_num - 1, events[n - 1].eventnum + first_event);
+        if (event_num < first_event + num_events) {
+            events[0].timestamp = event_num;
+            events[0].datalen = event_num * 7 % 5000;
+            events[0].data = batch_data + event_num % 256;
+            ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &events[0]));
+            event_num++;
+        }
+        ASSERT_EQ(0, lcm_eventlog_flush(wlog));
+    }
+    lcm_eventlog_destroy(wlog);
+}
+
+TEST(LCM_C, EventLogWriteEvents) {
+    // Write a log in batches, with and without direct I/O, and append to it.
+    for (int i = 0; i < (int)sizeof(batch_data); ++i) {
+        batch_data[i] = (char)(i * 31);
+    }
+
+    for (int direct_io = 0; direct_io < 2; ++direct_io) {
+        char* fname = make_tmpnam();
+        write_batch_log(fname, "w", direct_io, 0, 1500);
+        write_batch_log(fname, "a", direct_io, 1500, 500);
+
+        lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+        ASSERT_NE((void*)NULL, rlog);
+        lcm_eventlog_event_t* revent;
+        int num_read = 0;
+        while ((revent = lcm_eventlog_read_next_event(rlog))) {
+            EXPECT_EQ(num_read, revent->timestamp);
+            EXPECT_STREQ("BATCH", revent->channel);
+            ASSERT_EQ(num_read * 7 % 5000, revent->datalen);
+            EXPECT_EQ(0, memcmp(revent->data, batch_data + num_read % 256,
+                                revent->datalen));
+            lcm_eventlog_free_event(revent);
+            num_read++;
+        }
+        EXPECT_EQ(2000, num_read);
+        lcm_eventlog_destroy(rlog);
+
+        // The index written along with the log matches the log.
+        lcm_eventlog_index_t* index = lcm_eventlog_index_open(fname);
+        ASSERT_NE((void*)NULL, index);
+        EXPECT_EQ(2000, lcm_eventlog_index_size(index));
+        lcm_eventlog_index_close(index);
+
+        free_tmpnam(fname);
+    }
+}
+
+TEST(LCM_C, EventLogWriteEventsShort) {
+    // A batch that only partly fits below the file size limit leaves no
+    // torn event behind.
+    char data[300];
+    memset(data, 'x', sizeof(data));
+    lcm_eventlog_event_t events[10];
+    lcm_eventlog_event_t* batch[10];
+    for (int i = 0; i < 10; ++i) {
+        events[i].timestamp = i;
+        events[i].channel = const_cast<char*>("SHORT");
+        events[i].channellen = 5;
+        events[i].datalen = sizeof(data);
+        events[i].data = data;
+        batch[i] = &events[i];
+    }
+    const long event_size = 4 + 8 + 8 + 4 + 5 + 4 + sizeof(data);
+
+    char* fname = make_tmpnam();
+    lcm_eventlog_t* wlog = lcm_eventlog_create(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+
+    struct rlimit saved;
+    ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &saved));
+    struct rlimit limit = saved;
+    limit.rlim_cur = 3 * event_size + event_size / 2;
+    void (*saved_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+    int written = lcm_eventlog_write_events(wlog, batch, 10);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, saved_handler);
+    EXPECT_EQ(3, written);
+
+    // The rest goes on after the last complete event.
+    EXPECT_EQ(7, lcm_eventlog_write_events(wlog, batch + 3, 7));
+    lcm_eventlog_destroy(wlog);
+
+    struct stat st;
+    ASSERT_EQ(0, stat(fname, &st));
+    EXPECT_EQ(10 * event_size, (long)st.st_size);
+    lcm_eventlog_t* rlog = lcm_eventlog_create(fname, "r");
+    ASSERT_NE((void*)NULL, rlog);
+    lcm_eventlog_event_t* revent;
+    int num_read = 0;
+    while ((revent = lcm_eventlog_read_next_event(rlog))) {
+        EXPECT_EQ(num_read, revent->timestamp);
+        EXPECT_EQ(num_read, revent->eventnum);
+        lcm_eventlog_free_event(revent);
+        num_read++;
+    }
+    EXPECT_EQ(10, num_read);
+    lcm_eventlog_destroy(rlog);
+    free_tmpnam(fname);
+}
+#endif
+
+#ifndef WIN32
+static void
+write_shard(const char* fname, const char* channel, int num_events,
+            int64_t interval, int64_t offset)
+{
+    lcm_eventlog_t* wlog = lcm_eventlog_create_with_index(fname, "w");
+    ASSERT_NE((void*)NULL, wlog);
+    for (int i = 0; i < num_events; ++i) {
+        int64_t timestamp = i * interval + offset;
+        lcm_eventlog_event_t event;
+        event.timestamp = timestamp;
+        event.channel = const_cast<char*>(channel);
+        event.channellen = strlen(channel);
+        event.datalen = sizeof(timestamp);
+        event.data = &timestamp;
+        ASSERT_EQ(0, lcm_eventlog_write_event(wlog, &event));
+    }
+    lcm_eventlog_destroy(wlog);
+}
+
+static int
+is_slow(const char* channel, void* user)
+{
+    return !strcmp(channel, "SLOW");
+}
+
+TEST(LCM_C, EventLogSharded) {
+    // Two shards, listed in a manifest, are read back merged by timestamp.
+    std::string fname = make_tmpnam();
+    std::string fast_name = fname + ".fast";
+    std::string slow_name = fname + ".slow";
+    write_shard(fast_name.c_str(), "FAST", 200, 2, 0);
+    write_shard(slow_name.c_str(), "SLOW", 60, 6, 1);
+
+    // one shard relative to the manifest, and one absolute
+    std::string fast_entry = fast_name.substr(fast_name.rfind('/') + 1);
+    const char* shards[] = { fast_entry.c_str(), slow_name.c_str() };
+    ASSERT_EQ(0, lcm_eventlog_write_manifest(fname.c_str(), shards, 2));
+
+    lcm_eventlog_t* rlog = lcm_eventlog_create(fname.c_str(), "r");
+    ASSERT_NE((void*)NULL, rlog);
+    lcm_eventlog_event_t* revent;
+    int num_read = 0;
+    int64_t last_timestamp = -1;
+    while ((revent = lcm_eventlog_read_next_event(rlog))) {
+        EXPECT_LT(last_timestamp, revent->timestamp);
+        EXPECT_STREQ(revent->timestamp % 2 ? "SLOW" : "FAST", revent->channel);
+        ASSERT_EQ((int)sizeof(int64_t), revent->datalen);
+        EXPECT_EQ(0, memcmp(revent->data, &revent->timestamp, sizeof(int64_t)));
+        last_timestamp = revent->timestamp;
+        lcm_eventlog_free_event(revent);
+        num_read++;
+    }
+    EXPECT_EQ(260, num_read);
+
+    // Seeking moves every shard.
+    ASSERT_EQ(0, lcm_eventlog_seek_to_timestamp(rlog, 101));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(102, revent->timestamp);
+    lcm_eventlog_free_event(revent);
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(103, revent->timestamp);
+    lcm_eventlog_free_event(revent);
+
+    // Seeking to a channel skips the events before it, and no others.
+    ASSERT_EQ(0, lcm_eventlog_seek_to_timestamp(rlog, 0));
+    ASSERT_EQ(0, lcm_eventlog_seek_to_channel(rlog, "SLOW"));
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(1, revent->timestamp);
+    lcm_eventlog_free_event(revent);
+    revent = lcm_eventlog_read_next_event(rlog);
+    ASSERT_NE((void*)NULL, revent);
+    EXPECT_EQ(2, revent->timestamp);
+    lcm_eventlog_free_event(revent);
+
+    // Filtered reads skip events in all shards.
+    num_read = 0;
+    while ((revent = lcm_eventlog_read_next_event_filtered(rlog, is_slow,
+                                                           NULL))) {
+        EXPECT_STREQ("SLOW", revent->channel);
+        lcm_eventlog_free_event(revent);
+        num_read++;
+    }
+    EXPECT_EQ(59, num_read);
+
+    // Event numbers aren't unique across shards.
+    EXPECT_EQ(-1, lcm_eventlog_seek_to_eventnum(rlog, 0));
+    lcm_eventlog_destroy(rlog);
+
+    // The manifest itself can't be mapped, indexed or appended to.
+    EXPECT_EQ((void*)NULL, lcm_eventlog_reader_create(fname.c_str()));
+    EXPECT_EQ(-1, lcm_eventlog_index_build(fname.c_str()));
+    EXPECT_EQ((void*)NULL, lcm_eventlog_create(fname.c_str(), "a"));
+
+    // Log playback merges the shards too.
+    char url[1024];
+    snprintf(url, sizeof(url), "file://%s?speed=0", fname.c_str());
+    lcm_t* lcm = lcm_create(url);
+    ASSERT_NE((void*)NULL, lcm);
+    int num_handled = 0;
+    lcm_subscribe(lcm, ".*", count_handler, &num_handled);
+    while (0 == lcm_handle(lcm)) {
+    }
+    EXPECT_EQ(260, num_handled);
+    lcm_destroy(lcm);
+
+    // A missing shard is an error.
+    remove(slow_name.c_str());
+    EXPECT_EQ((void*)NULL, lcm_eventlog_create(fname.c_str(), "r"));
+
+    remove(fast_name.c_str());
+    remove((fast_name + ".idx").c_str());
+    remove((slow_name + ".idx").c_str());
+    remove(fname.c_str());
+}
+#endif
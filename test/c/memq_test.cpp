@@ -1,3 +1,5 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <gtest/gtest.h>
@@ -113,3 +115,123 @@ TEST(LCM_C, MemqTimeout) {
 
   lcm_destroy(lcm);
 }
+
+TEST(LCM_C, MemqHandleBatch) {
+    // Publish several messages, then dispatch them in batches.
+    lcm_t* lcm = lcm_create("memq://");
+    std::vector<std::vector<uint8_t> > received_buffers;
+
+    // No messages available.  Call should timeout immediately.
+    EXPECT_EQ(0, lcm_handle_batch(lcm, 10, 0));
+
+    // A batch size of zero is an error.
+    EXPECT_GT(0, lcm_handle_batch(lcm, 0, 0));
+
+    lcm_subscription_t* subs =
+        lcm_subscribe(lcm, "channel", MemqBufferedHandler, &received_buffers);
+    lcm_subscription_set_queue_capacity(subs, 0);
+
+    int num_bufs = 25;
+    std::vector<std::vector<uint8_t> > buffers(num_bufs);
+    for (int buf_num = 0; buf_num < num_bufs; ++buf_num) {
+        std::vector<uint8_t>& buf = buffers[buf_num];
+        buf.resize(10, buf_num);
+        lcm_publish(lcm, "channel", &buf[0], buf.size());
+    }
+
+    EXPECT_EQ(10, lcm_handle_batch(lcm, 10, 0));
+    EXPECT_EQ(10, lcm_handle_batch(lcm, 10, 100));
+    EXPECT_EQ(5, lcm_handle_batch(lcm, 10, -1));
+    EXPECT_EQ(0, lcm_handle_batch(lcm, 10, 10));
+
+    EXPECT_EQ(buffers, received_buffers);
+
+    lcm_destroy(lcm);
+}
+
+static uint64_t SumLatencies(const uint64_t* buckets) {
+    uint64_t total = 0;
+    for (int i = 0; i < LCM_STATS_LATENCY_BUCKETS; ++i) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+TEST(LCM_C, MemqStats) {
+    lcm_t* lcm = lcm_create("memq://");
+    std::vector<std::vector<uint8_t> > received_buffers;
+    lcm_subscription_t* subs =
+        lcm_subscribe(lcm, "channel", MemqBufferedHandler, &received_buffers);
+    lcm_subscription_set_queue_capacity(subs, 7);
+
+    for (int buf_num = 0; buf_num < 4; ++buf_num) {
+        std::vector<uint8_t> buf(10, buf_num);
+        lcm_publish(lcm, "channel", &buf[0], buf.size());
+    }
+    EXPECT_EQ(4, lcm_handle_batch(lcm, 10, 0));
+
+    lcm_stats_t stats;
+    stats.size = sizeof(stats);
+    EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+    EXPECT_EQ(4, stats.messages_dispatched);
+    EXPECT_EQ(0, stats.messages_dropped);
+    EXPECT_EQ(4, SumLatencies(stats.latency_usec));
+
+    lcm_subscription_stats_t subs_stats;
+    subs_stats.size = sizeof(subs_stats);
+    EXPECT_EQ(0, lcm_subscription_get_stats(subs, &subs_stats));
+    EXPECT_EQ(4, subs_stats.messages_handled);
+    EXPECT_EQ(0, subs_stats.messages_dropped);
+    EXPECT_EQ(0, subs_stats.queue_size);
+    EXPECT_EQ(1, subs_stats.queue_size_high_water);
+    EXPECT_EQ(7, subs_stats.queue_capacity);
+    EXPECT_EQ(4, SumLatencies(subs_stats.latency_usec));
+
+    // a caller built against a smaller struct only gets the fields it knows
+    memset(&stats, 0xff, sizeof(stats));
+    stats.size = offsetof(lcm_stats_t, messages_dispatched);
+    EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+    EXPECT_EQ(0, stats.messages_dropped);
+    EXPECT_EQ(UINT64_MAX, stats.messages_dispatched);
+    EXPECT_EQ(offsetof(lcm_stats_t, messages_dispatched), stats.size);
+    stats.size = 0;
+    EXPECT_EQ(-1, lcm_get_stats(lcm, &stats));
+
+    lcm_destroy(lcm);
+}
+
+void MemqChannelsHandler(const lcm_recv_buf_t* rbuf, const char* channel,
+        void* user_data) {
+    std::vector<std::string>* channels = (std::vector<std::string>*)user_data;
+    channels->push_back(channel);
+}
+
+TEST(LCM_C, MemqSubscribePatterns) {
+    // Literal, prefix and regular expression subscriptions all have to match
+    // exactly the channels that the equivalent regular expression would.
+    lcm_t* lcm = lcm_create("memq://");
+    std::vector<std::string> literal, prefix, regex, regex_plus, all;
+
+    lcm_subscribe(lcm, "FOO", MemqChannelsHandler, &literal);
+    lcm_subscribe(lcm, "FOO.*", MemqChannelsHandler, &prefix);
+    lcm_subscribe(lcm, "F.O", MemqChannelsHandler, &regex);
+    lcm_subscribe(lcm, "BAR[0-9]+", MemqChannelsHandler, &regex_plus);
+    lcm_subscribe(lcm, ".*", MemqChannelsHandler, &all);
+
+    const char* channels[] = { "FOO", "FOOBAR", "FO", "XFOO", "FXO", "BAR12",
+        "BAR" };
+    const int num_channels = sizeof(channels) / sizeof(channels[0]);
+    for (int i = 0; i < num_channels; ++i) {
+        lcm_publish(lcm, channels[i], "", 0);
+    }
+    while (lcm_handle_timeout(lcm, 0) > 0) {
+    }
+
+    EXPECT_EQ(std::vector<std::string>({ "FOO" }), literal);
+    EXPECT_EQ(std::vector<std::string>({ "FOO", "FOOBAR" }), prefix);
+    EXPECT_EQ(std::vector<std::string>({ "FOO", "FXO" }), regex);
+    EXPECT_EQ(std::vector<std::string>({ "BAR12" }), regex_plus);
+    EXPECT_EQ(num_channels, (int) all.size());
+
+    lcm_destroy(lcm);
+}
@@ -0,0 +1,456 @@
+#ifndef WIN32
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#endif
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <lcm/lcm.h>
+
+#ifndef WIN32
+static void
+sleep_ms(int ms)
+{
+  struct timespec sleeptime;
+  sleeptime.tv_sec = ms / 1000;
+  sleeptime.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&sleeptime, NULL);
+}
+
+// Same hash as the provider uses to map a channel to a port.
+static int
+port_index(const char* channel, int nports)
+{
+  uint32_t hash = 5381;
+  for (const char* p = channel; *p != '\0'; p++)
+    hash += (hash << 5) + *p;
+  return hash % nports;
+}
+
+// Returns a channel name starting with prefix that is hashed to the port at
+// index ind of the range.
+static std::string
+channel_on_port(const char* prefix, int ind, int nports)
+{
+  for (int i = 0; ; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%d", prefix, i);
+    if (port_index(name, nports) == ind)
+      return name;
+  }
+}
+
+// Returns a bit mask of the ports in [start, start + nports) that a socket of
+// this process is bound to.
+static int
+bound_ports(int start, int nports)
+{
+  int mask = 0;
+  for (int fd = 0; fd < 1024; fd++) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*) &addr, &len) < 0 ||
+        addr.sin_family != AF_INET)
+      continue;
+    int port = ntohs(addr.sin_port);
+    if (port >= start && port < start + nports)
+      mask |= 1 << (port - start);
+  }
+  return mask;
+}
+
+static void
+count_handler(const lcm_recv_buf_t* /* unused */, const char* /* unused */, void *user)
+{
+  (*(int*) user)++;
+}
+
+#define NUM_MSGS 50
+
+struct channel_msgs {
+  int counts[NUM_MSGS];
+  int total;
+  int bad;
+};
+
+static void
+channel_msgs_handler(const lcm_recv_buf_t* rbuf, const char* /* unused */, void *user)
+{
+  channel_msgs* msgs = (channel_msgs*) user;
+  int32_t ind = -1;
+  if (rbuf->data_size == sizeof(ind))
+    memcpy(&ind, rbuf->data, sizeof(ind));
+  if (ind < 0 || ind >= NUM_MSGS) {
+    msgs->bad++;
+    return;
+  }
+  msgs->counts[ind]++;
+  msgs->total++;
+}
+
+// Publishes NUM_MSGS numbered messages on each channel, interleaved, and
+// checks that each of them is handled exactly once.
+static void
+check_delivered_once(lcm_t* lcm, const std::string* channels, int nchannels)
+{
+  channel_msgs* msgs = new channel_msgs[nchannels]();
+  for (int c = 0; c < nchannels; c++) {
+    lcm_subscription_t* subs = lcm_subscribe(lcm, channels[c].c_str(),
+        channel_msgs_handler, &msgs[c]);
+    lcm_subscription_set_queue_capacity(subs, NUM_MSGS);
+  }
+
+  for (int32_t i = 0; i < NUM_MSGS; i++) {
+    for (int c = 0; c < nchannels; c++) {
+      lcm_publish(lcm, channels[c].c_str(), &i, sizeof(i));
+    }
+  }
+
+  int total = 0;
+  while (total < nchannels * NUM_MSGS && lcm_handle_timeout(lcm, 500) > 0) {
+    total = 0;
+    for (int c = 0; c < nchannels; c++) {
+      total += msgs[c].total;
+    }
+  }
+  // anything that was received twice is handled by now too
+  while (lcm_handle_timeout(lcm, 100) > 0) {
+  }
+
+  for (int c = 0; c < nchannels; c++) {
+    EXPECT_EQ(0, msgs[c].bad) << channels[c];
+    EXPECT_EQ(NUM_MSGS, msgs[c].total) << channels[c];
+    for (int i = 0; i < NUM_MSGS; i++) {
+      EXPECT_EQ(1, msgs[c].counts[i]) << channels[c] << " message " << i;
+    }
+  }
+  delete[] msgs;
+}
+
+// Several channels share each port, and more packets are queued on a socket
+// than one recvmmsg() call reads.
+TEST(LCM_C, MpudpmDeliveredOnce) {
+  lcm_t* lcm = lcm_create("mpudpm://239.255.76.67:7710?ttl=0&nports=2");
+  ASSERT_NE((void*)NULL, lcm);
+
+  std::string channels[4] = {
+    channel_on_port("ONCE", 0, 2), channel_on_port("ONCE_A", 0, 2),
+    channel_on_port("ONCE", 1, 2), channel_on_port("ONCE_A", 1, 2),
+  };
+  check_delivered_once(lcm, channels, 4);
+
+  lcm_destroy(lcm);
+}
+
+// Returns the number of threads of this process.
+static int
+count_threads()
+{
+  int n = 0;
+  DIR* dir = opendir("/proc/self/task");
+  if (!dir)
+    return -1;
+  while (struct dirent* ent = readdir(dir)) {
+    if (ent->d_name[0] != '.')
+      n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+// With several receive threads, channels on ports read by different threads
+// should all be delivered, and every thread should exit on lcm_destroy().
+TEST(LCM_C, MpudpmRecvThreads) {
+  int threads_before = count_threads();
+  ASSERT_LT(0, threads_before);
+  lcm_t* lcm = lcm_create(
+      "mpudpm://239.255.76.67:7720?ttl=0&nports=4&recv_threads=2");
+  ASSERT_NE((void*)NULL, lcm);
+
+  // ports are dealt out to the threads round robin
+  std::string channels[3] = {
+    channel_on_port("THREADS", 1, 4), channel_on_port("THREADS", 2, 4),
+    channel_on_port("THREADS", 3, 4),
+  };
+  check_delivered_once(lcm, channels, 3);
+  EXPECT_LE(threads_before + 2, count_threads());
+
+  lcm_destroy(lcm);
+  // a thread that was joined may take a moment to disappear from /proc
+  int threads_after = count_threads();
+  for (int i = 0; i < 100 && threads_after != threads_before; i++) {
+    sleep_ms(10);
+    threads_after = count_threads();
+  }
+  EXPECT_EQ(threads_before, threads_after);
+}
+
+// Records the sequence numbers of the messages received, in order.
+static void
+seqno_handler(const lcm_recv_buf_t* rbuf, const char* /* unused */, void *user)
+{
+  int seqno;
+  memcpy(&seqno, rbuf->data, sizeof(seqno));
+  ((std::vector<int>*) user)->push_back(seqno);
+}
+
+// With port_mapping=balanced, a subscriber should follow a heavy channel to
+// its new port without missing a message, and close the socket of the port it
+// left once the publisher no longer uses it.
+TEST(LCM_C, MpudpmBalancedMove) {
+  const int start = 7730;
+  const int nports = 4;
+  lcm_t* lcm = lcm_create("mpudpm://239.255.76.67:7730?ttl=0&nports=4"
+      "&port_mapping=balanced&heavy_channel_rate=1000");
+  ASSERT_NE((void*)NULL, lcm);
+
+  // a heavy channel that shares its port with another one gets moved
+  std::string heavy = channel_on_port("HEAVY", 1, nports);
+  std::string light = channel_on_port("LIGHT", 1, nports);
+  std::vector<int> received;
+  lcm_subscribe(lcm, heavy.c_str(), seqno_handler, &received);
+  lcm_publish(lcm, light.c_str(), "", 0);
+  EXPECT_EQ(0x3, bound_ports(start, nports));
+
+  static char buf[200];
+  int num_sent = 0;
+  int ports = 0;
+  for (int i = 0; i < 500; i++) {
+    memcpy(buf, &num_sent, sizeof(num_sent));
+    lcm_publish(lcm, heavy.c_str(), buf, sizeof(buf));
+    num_sent++;
+    sleep_ms(10);
+    while (lcm_handle_timeout(lcm, 0) > 0) {
+    }
+    ports = bound_ports(start, nports);
+    if (ports != 0x3)
+      break;
+  }
+  // the channel's new port is joined, and its old port is still received
+  EXPECT_EQ(0x3, ports & 0x3);
+  EXPECT_EQ(1, __builtin_popcount(ports & ~0x3));
+
+  // until the next load report, after which only the first port stays open
+  // for the internal channels
+  for (int i = 0; i < 150; i++) {
+    memcpy(buf, &num_sent, sizeof(num_sent));
+    lcm_publish(lcm, heavy.c_str(), buf, sizeof(buf));
+    num_sent++;
+    sleep_ms(10);
+    while (lcm_handle_timeout(lcm, 0) > 0) {
+    }
+  }
+  EXPECT_EQ(0x1 | (ports & ~0x3), bound_ports(start, nports));
+
+  // and nothing was lost or reordered on the way
+  ASSERT_EQ(num_sent, (int) received.size());
+  for (int i = 0; i < num_sent; i++)
+    EXPECT_EQ(i, received[i]);
+
+  lcm_destroy(lcm);
+}
+// Opens a socket that receives the packets sent to port on the test group.
+static int
+open_observer(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return -1;
+  int opt = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  unsigned char ttl = 0;
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+  struct ip_mreq mreq;
+  inet_aton("239.255.76.67", &mreq.imr_multiaddr);
+  mreq.imr_interface.s_addr = INADDR_ANY;
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Sends an LCM message in the short packet format.
+static void
+send_short_message(int fd, uint16_t port, const char* channel,
+    const void* data, int size)
+{
+  uint8_t pkt[1024];
+  uint32_t words[2] = { htonl(0x4c433032), htonl(0) };
+  memcpy(pkt, words, sizeof(words));
+  int len = sizeof(words);
+  strcpy((char*) pkt + len, channel);
+  len += strlen(channel) + 1;
+  memcpy(pkt + len, data, size);
+  len += size;
+  struct sockaddr_in dest;
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(port);
+  inet_aton("239.255.76.67", &dest.sin_addr);
+  sendto(fd, pkt, len, 0, (const struct sockaddr*) &dest, sizeof(dest));
+}
+
+static uint32_t
+get_be(const uint8_t* p, int size)
+{
+  uint32_t val = 0;
+  for (int i = 0; i < size; i++)
+    val = (val << 8) | p[i];
+  return val;
+}
+
+// Full channel to port maps are sent on the first channel, or on the second
+// one when a process of an older release is around.
+static const char kMapChannel[] = "#!mpudpm_CH2PRT_MAP";
+static const char kOldMapChannel[] = "#!mpudpm_CH2PRT_UPD";
+
+// Receives for timeout_ms, and returns the channels listed by each full
+// channel to port map (channel_port_map_update_t) that was broadcast on
+// map_channel.  If payload is not NULL, the last encoded map is stored there.
+static std::vector<std::set<std::string> >
+receive_map_updates(int fd, const char* map_channel, int timeout_ms,
+    std::string* payload = NULL)
+{
+  std::vector<std::set<std::string> > updates;
+  int channel_size = strlen(map_channel) + 1;
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  while (poll(&pfd, 1, timeout_ms) > 0) {
+    uint8_t pkt[65536];
+    int len = recv(fd, pkt, sizeof(pkt), 0);
+    // short header, channel, then the fingerprint, num_ports and
+    // num_channels of the message
+    int off = 8 + channel_size;
+    if (len < off + 12 || get_be(pkt, 4) != 0x4c433032 ||
+        memcmp(pkt + 8, map_channel, channel_size))
+      continue;
+    if (payload)
+      payload->assign((const char*) pkt + off, len - off);
+    int num_channels = (int16_t) get_be(pkt + off + 10, 2);
+    off += 12;
+    std::set<std::string> channels;
+    for (int i = 0; i < num_channels && off + 4 <= len; i++) {
+      int size = get_be(pkt + off, 4);
+      off += 4;
+      if (size < 1 || off + size + 2 > len)
+        break;
+      channels.insert(std::string((const char*) pkt + off, size - 1));
+      off += size + 2;
+    }
+    updates.push_back(channels);
+  }
+  return updates;
+}
+
+// A process that joins late should get the channels that were mapped before
+// it started through the digest mismatch resync, and the later ones through
+// deltas, until its map agrees with the other processes'.
+TEST(LCM_C, MpudpmLateJoiner) {
+  int observer = open_observer(7740);
+  ASSERT_GE(observer, 0);
+  const char* url = "mpudpm://239.255.76.67:7740?ttl=0&nports=8";
+
+  lcm_t* early = lcm_create(url);
+  ASSERT_NE((void*)NULL, early);
+  for (int i = 0; i < 3; i++) {
+    char channel[16];
+    snprintf(channel, sizeof(channel), "EARLY_%d", i);
+    lcm_publish(early, channel, "", 0);
+  }
+  // nobody disagrees with the map yet
+  EXPECT_EQ(0u, receive_map_updates(observer, kMapChannel, 200).size());
+
+  // a second process catches up
+  lcm_t* early2 = lcm_create(url);
+  ASSERT_NE((void*)NULL, early2);
+  int early_received = 0;
+  lcm_subscribe(early2, "EARLY_0", count_handler, &early_received);
+  EXPECT_EQ(1u, receive_map_updates(observer, kMapChannel, 200).size());
+
+  lcm_t* late = lcm_create(url);
+  ASSERT_NE((void*)NULL, late);
+  int received = 0;
+  lcm_subscribe(late, "JOINER", count_handler, &received);
+  // the first digest of the late process doesn't match, so one of the early
+  // processes sends its whole map.  The other one leaves it at that.
+  std::vector<std::set<std::string> > updates =
+      receive_map_updates(observer, kMapChannel, 200);
+  ASSERT_EQ(1u, updates.size());
+  EXPECT_EQ(1u, updates[0].count("EARLY_0"));
+  EXPECT_EQ(1u, updates[0].count("EARLY_2"));
+  EXPECT_EQ(1u, updates[0].count("JOINER"));
+
+  // a channel that is added now only goes out in a delta
+  lcm_publish(early, "LATE_0", "", 0);
+  lcm_publish(early, "JOINER", "", 0);
+  while (received < 1 && lcm_handle_timeout(late, 500) > 0) {
+  }
+  EXPECT_EQ(1, received);
+  EXPECT_EQ(0u, receive_map_updates(observer, kMapChannel, 200).size());
+
+  // ask all processes for their maps
+  send_short_message(observer, 7740, "#!mpudpm_CH2PRT_REQ", "r", 1);
+  updates = receive_map_updates(observer, kMapChannel, 200);
+  std::set<std::string> expected;
+  expected.insert("EARLY_0");
+  expected.insert("EARLY_1");
+  expected.insert("EARLY_2");
+  expected.insert("JOINER");
+  expected.insert("LATE_0");
+  ASSERT_EQ(3u, updates.size());
+  for (size_t i = 0; i < updates.size(); i++)
+    EXPECT_TRUE(expected == updates[i]);
+
+  lcm_destroy(late);
+  lcm_destroy(early2);
+  lcm_destroy(early);
+  close(observer);
+}
+
+// Once a full map shows up on the channel that older releases use, new
+// channels should go out in full maps on that channel too.
+TEST(LCM_C, MpudpmOlderPeer) {
+  int observer = open_observer(7750);
+  ASSERT_GE(observer, 0);
+  lcm_t* lcm = lcm_create("mpudpm://239.255.76.67:7750?ttl=0&nports=8");
+  ASSERT_NE((void*)NULL, lcm);
+  lcm_publish(lcm, "NEW_0", "", 0);
+  EXPECT_EQ(0u, receive_map_updates(observer, kOldMapChannel, 200).size());
+
+  // an older process would send a map like the one this process sends
+  send_short_message(observer, 7750, "#!mpudpm_CH2PRT_REQ", "r", 1);
+  std::string payload;
+  ASSERT_EQ(1u, receive_map_updates(observer, kMapChannel, 200,
+                                    &payload).size());
+  send_short_message(observer, 7750, kOldMapChannel, payload.data(),
+                     payload.size());
+  receive_map_updates(observer, kOldMapChannel, 200);
+
+  lcm_publish(lcm, "NEW_1", "", 0);
+  std::vector<std::set<std::string> > updates =
+      receive_map_updates(observer, kOldMapChannel, 200);
+  ASSERT_EQ(1u, updates.size());
+  EXPECT_EQ(1u, updates[0].count("NEW_0"));
+  EXPECT_EQ(1u, updates[0].count("NEW_1"));
+
+  lcm_destroy(lcm);
+  close(observer);
+}
+#endif
@@ -1,5 +1,10 @@
 #ifndef WIN32
 #include <time.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #endif
 
 #include <gtest/gtest.h>
@@ -55,3 +60,201 @@ TEST(LCM_C, QueueSize) {
   lcm_destroy(lcm);
 }
 #endif
+
+#ifndef WIN32
+TEST(LCM_C, UdpmStats) {
+  lcm_t* lcm = lcm_create("udpm://239.255.76.67:7682?ttl=0");
+  ASSERT_NE((void*)NULL, lcm);
+
+  lcm_subscription_t* subs = lcm_subscribe(lcm, "channel", empty_handler, NULL);
+  lcm_subscription_set_queue_capacity(subs, 5);
+
+  for (int i = 0; i < 10; i++) {
+    lcm_publish(lcm, "channel", "", 0);
+  }
+
+  // wait until the queue is full
+  struct timespec sleeptime;
+  sleeptime.tv_sec = 0;
+  sleeptime.tv_nsec = 100000000;
+  nanosleep(&sleeptime, NULL);
+
+  lcm_subscription_stats_t subs_stats;
+  subs_stats.size = sizeof(subs_stats);
+  EXPECT_EQ(0, lcm_subscription_get_stats(subs, &subs_stats));
+  EXPECT_EQ(5, subs_stats.queue_size);
+  EXPECT_EQ(5, subs_stats.queue_size_high_water);
+  EXPECT_EQ(5, subs_stats.messages_dropped);
+
+  while (lcm_handle_timeout(lcm, 0) > 0) {
+  }
+
+  lcm_stats_t stats;
+  stats.size = sizeof(stats);
+  EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+  // the self test message is received too
+  EXPECT_LE(10, stats.packets_received);
+  EXPECT_EQ(0, stats.packets_bad);
+  EXPECT_EQ(5, stats.messages_dropped);
+  EXPECT_LE(5, stats.messages_dispatched);
+  EXPECT_LT(0, stats.recv_buf_high_water);
+  EXPECT_LE(stats.recv_buf_high_water, stats.recv_buf_capacity);
+
+  EXPECT_EQ(0, lcm_subscription_get_stats(subs, &subs_stats));
+  EXPECT_EQ(5, subs_stats.messages_handled);
+  EXPECT_EQ(0, subs_stats.queue_size);
+
+  lcm_destroy(lcm);
+}
+
+#ifdef __linux__
+static void
+count_handler(const lcm_recv_buf_t* /* unused */, const char* /* unused */, void *user)
+{
+  (*(int*) user)++;
+}
+
+// With channel_filter set, messages on channels that nobody subscribed to
+// should be dropped before they are received.
+TEST(LCM_C, UdpmChannelFilter) {
+  lcm_t* lcm = lcm_create("udpm://239.255.76.67:7683?ttl=0&channel_filter=true");
+  ASSERT_NE((void*)NULL, lcm);
+
+  int literal = 0;
+  int prefixed = 0;
+  int large = 0;
+  lcm_subscription_t* subs =
+      lcm_subscribe(lcm, "FILTERED", count_handler, &literal);
+  lcm_subscription_t* prefixed_subs =
+      lcm_subscribe(lcm, "PRE.*", count_handler, &prefixed);
+
+  for (int i = 0; i < 10; i++) {
+    lcm_publish(lcm, "FILTERED", "", 0);
+    lcm_publish(lcm, "FILTERED_NOT", "", 0);
+    lcm_publish(lcm, "PREFIX", "abc", 3);
+    lcm_publish(lcm, "OTHER", "abc", 3);
+  }
+
+  struct timespec sleeptime;
+  sleeptime.tv_sec = 0;
+  sleeptime.tv_nsec = 100000000;
+  nanosleep(&sleeptime, NULL);
+  while (lcm_handle_timeout(lcm, 0) > 0) {
+  }
+  EXPECT_EQ(10, literal);
+  EXPECT_EQ(10, prefixed);
+
+  lcm_stats_t stats;
+  stats.size = sizeof(stats);
+  EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+  // at most the self test message is received besides the subscribed ones
+  EXPECT_GE(21, stats.packets_received);
+
+  // large messages still get through
+  lcm_subscription_t* large_subs =
+      lcm_subscribe(lcm, "LARGE", count_handler, &large);
+  static char buf[100000];
+  lcm_publish(lcm, "LARGE", buf, sizeof(buf));
+  lcm_publish(lcm, "OTHER", buf, sizeof(buf));
+  while (large < 1 && lcm_handle_timeout(lcm, 500) > 0) {
+  }
+  EXPECT_EQ(1, large);
+
+  // and the filter follows unsubscriptions
+  lcm_unsubscribe(lcm, subs);
+  lcm_unsubscribe(lcm, large_subs);
+  lcm_publish(lcm, "FILTERED", "", 0);
+  lcm_publish(lcm, "PREFIX", "abc", 3);
+  while (prefixed < 11 && lcm_handle_timeout(lcm, 500) > 0) {
+  }
+  EXPECT_EQ(11, prefixed);
+  EXPECT_EQ(10, literal);
+
+  // with no subscriptions left, everything is received again
+  lcm_unsubscribe(lcm, prefixed_subs);
+  EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+  uint64_t received = stats.packets_received;
+  lcm_publish(lcm, "OTHER", "abc", 3);
+  nanosleep(&sleeptime, NULL);
+  EXPECT_EQ(0, lcm_get_stats(lcm, &stats));
+  EXPECT_EQ(received + 1, stats.packets_received);
+
+  lcm_destroy(lcm);
+}
+#endif
+
+struct frag_test_msgs {
+  int count;
+  int ok;
+};
+
+static void
+frag_test_handler(const lcm_recv_buf_t* rbuf, const char* /* unused */, void *user)
+{
+  frag_test_msgs* msgs = (frag_test_msgs*) user;
+  const uint8_t* data = (const uint8_t*) rbuf->data;
+  bool ok = rbuf->data_size == 3000;
+  for (int i = 0; ok && i < rbuf->data_size; i++) {
+    ok = data[i] == data[0];
+  }
+  msgs->count++;
+  msgs->ok += ok;
+}
+
+// Sends one fragment of an LCM message in the long packet format.
+static void
+send_fragment(int fd, const struct sockaddr_in* dest, uint32_t seqno,
+    const char* channel, uint8_t fill, int frag_no, int nfrags, int size)
+{
+  int frag_size = size / nfrags;
+  uint8_t pkt[2048];
+  uint32_t words[4] = { htonl(0x4c433033), htonl(seqno), htonl(size),
+      htonl(frag_no * frag_size) };
+  uint16_t counts[2] = { htons(frag_no), htons(nfrags) };
+  memcpy(pkt, words, sizeof(words));
+  memcpy(pkt + sizeof(words), counts, sizeof(counts));
+  int len = sizeof(words) + sizeof(counts);
+  if (frag_no == 0) {
+    strcpy((char*) pkt + len, channel);
+    len += strlen(channel) + 1;
+  }
+  memset(pkt + len, fill, frag_size);
+  len += frag_size;
+  sendto(fd, pkt, len, 0, (const struct sockaddr*) dest, sizeof(*dest));
+}
+
+// Fragments of two messages from the same sender that arrive interleaved
+// should both be reassembled.
+TEST(LCM_C, InterleavedFragments) {
+  lcm_t* lcm = lcm_create("udpm://239.255.76.67:7681?ttl=0");
+  ASSERT_NE((void*)NULL, lcm);
+
+  frag_test_msgs msgs = { 0, 0 };
+  lcm_subscribe(lcm, "FRAGS", frag_test_handler, &msgs);
+  // start the read thread
+  lcm_get_fileno(lcm);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(fd, 0);
+  unsigned char ttl = 0;
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  struct sockaddr_in dest;
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(7681);
+  inet_aton("239.255.76.67", &dest.sin_addr);
+
+  for (int frag_no = 0; frag_no < 3; frag_no++) {
+    send_fragment(fd, &dest, 10, "FRAGS", 'a', frag_no, 3, 3000);
+    send_fragment(fd, &dest, 11, "FRAGS", 'b', frag_no, 3, 3000);
+  }
+  close(fd);
+
+  while (msgs.count < 2 && lcm_handle_timeout(lcm, 500) > 0) {
+  }
+  EXPECT_EQ(2, msgs.count);
+  EXPECT_EQ(2, msgs.ok);
+
+  lcm_destroy(lcm);
+}
+#endif
@@ -104,3 +104,19 @@ TEST(LCM_CPP, MemqTimeout) {
     EXPECT_LT(0, lcm.handleTimeout(10000));
     EXPECT_TRUE(msg_handled);
 }
+
+TEST(LCM_CPP, MemqHandleBatch) {
+    // Publish several messages, then dispatch them in batches.
+    lcm::LCM lcm("memq://");
+
+    // No messages available.  Call should timeout immediately.
+    EXPECT_EQ(0, lcm.handleBatch(10, 0));
+
+    bool msg_handled = false;
+    lcm.subscribeFunction("channel", MemqTimeoutHandler, &msg_handled);
+    for (int i = 0; i < 3; ++i) {
+        lcm.publish("channel", "", 0);
+    }
+    EXPECT_EQ(3, lcm.handleBatch(10, 10000));
+    EXPECT_TRUE(msg_handled);
+}